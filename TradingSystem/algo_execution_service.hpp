@@ -9,40 +9,60 @@
 #define algo_execution_service_hpp
 
 #include "soa.hpp"
+#include "static_listeners.hpp"
+#include "latency.hpp"
 #include <string>
 #include "market_data_service.hpp"
 #include "execution_order.hpp"
+#include "object_pool.hpp"
+#include "product_registry.hpp"
 
 // Wrapper for ExecutionOrder for use by AlgoExecutionService
 // Specifies the ExecutionOrder and the market on which the ExecutionOrder is executed.
+// The ExecutionOrder comes from an ObjectPool and is owned by exactly one AlgoExecutionOrder:
+// moving hands it over, copying takes a copy from the same pool.
 template <typename T>
 class AlgoExecutionOrder {
 private:
-    ExecutionOrder<T>* order_;
-    Market market_;
+    PooledPtr<ExecutionOrder<T>> order_;
+    Market market_ = BROKERTEC;
     
 public:
     AlgoExecutionOrder() = default;
-    AlgoExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder, Market market);
-    AlgoExecutionOrder(ExecutionOrder<T>& order, Market market);
-    ~AlgoExecutionOrder();
+    AlgoExecutionOrder(ObjectPool<ExecutionOrder<T>>& pool, const T &_product, PricingSide _side, string _orderId, OrderType _orderType, PriceTick _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder, Market market);
+    AlgoExecutionOrder(PooledPtr<ExecutionOrder<T>> order, Market market);
     
-    // Fetch the order
+    AlgoExecutionOrder(const AlgoExecutionOrder& other);
+    AlgoExecutionOrder& operator = (const AlgoExecutionOrder& other);
+    AlgoExecutionOrder(AlgoExecutionOrder&& other) = default;
+    AlgoExecutionOrder& operator = (AlgoExecutionOrder&& other) = default;
+    ~AlgoExecutionOrder() = default;
+    
+    // Fetch the order (nullptr for a default constructed wrapper)
     ExecutionOrder<T>* GetExecutionOrder() const;
     
     // Fetch the market
     Market GetMarket() const;
 };
 
-template <typename T>
+template <typename T, typename Static = StaticListeners<AlgoExecutionOrder<T>>>
+class AlgoExecutionService;
+template <typename T, typename S = AlgoExecutionService<T>>
 class MarketDataToAlgoExecutionListener;
 
-template <typename T>
-class AlgoExecutionService : public Service<string, AlgoExecutionOrder<T>> {
+template <typename T, typename Static>
+class AlgoExecutionService final : public Service<string, AlgoExecutionOrder<T>>
+{
+public:
+    // Concrete types of the objects attached to this service, for static wiring
+    typedef MarketDataToAlgoExecutionListener<T, AlgoExecutionService> InListener;
+    
 private:
-    unordered_map<string, AlgoExecutionOrder<T>> algo_execution_orders_;
-    MarketDataToAlgoExecutionListener<T>* in_listener_;
-    double spread_;
+    ObjectPool<ExecutionOrder<T>> order_pool_;     // Declared first: outlives every order handed out
+    ProductStore<AlgoExecutionOrder<T>> algo_execution_orders_;     // Indexed by product index
+    InListener* in_listener_;
+    Static static_listeners_;
+    PriceTick spread_;
     long execution_count_;
     
 public:
@@ -64,19 +84,26 @@ public:
     virtual const vector<ServiceListener<AlgoExecutionOrder<T>>*>& GetListeners() const override;
     // MARK: SERVICE CLASS OVERRIDE ABOVE
     
-    MarketDataToAlgoExecutionListener<T>* GetInListener();
+    InListener* GetInListener();
+    
+    // Get the listeners wired at compile time (notified ahead of the dynamic listeners)
+    Static& GetStaticListeners();
     
     // Execute an order on a market
     void AlgoExecute(OrderBook<T>& order_book, Market market = BROKERTEC);
+    
+    // Number of executions so far, which picks the side of the next one (e.g. to snapshot and restore it)
+    long GetExecutionCount() const;
+    void SetExecutionCount(long count);
 };
 
-template <typename T>
-class MarketDataToAlgoExecutionListener : public ServiceListener<OrderBook<T>> {
+template <typename T, typename S>
+class MarketDataToAlgoExecutionListener final : public ServiceListener<OrderBook<T>> {
 private:
-    AlgoExecutionService<T>* service_;
+    S* service_;
     
 public:
-    MarketDataToAlgoExecutionListener(AlgoExecutionService<T>* service);
+    MarketDataToAlgoExecutionListener(S* service);
     ~MarketDataToAlgoExecutionListener() = default;
     
     // MARK: SERVICELISTENER CLASS OVERRIDE BELOW
@@ -92,21 +119,39 @@ public:
 };
 
 template <typename T>
-AlgoExecutionOrder<T>::AlgoExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder, Market market) : market_(market) {
-    order_ = new ExecutionOrder<T>(_product, _side, _orderId, _orderType, _price, _visibleQuantity, _hiddenQuantity, _parentOrderId, _isChildOrder);
-}
+AlgoExecutionOrder<T>::AlgoExecutionOrder(ObjectPool<ExecutionOrder<T>>& pool, const T &_product, PricingSide _side, string _orderId, OrderType _orderType, PriceTick _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder, Market market) :
+  order_(pool.Acquire(_product, _side, move(_orderId), _orderType, _price, _visibleQuantity, _hiddenQuantity, move(_parentOrderId), _isChildOrder)), market_(market) {}
+
+template <typename T>
+AlgoExecutionOrder<T>::AlgoExecutionOrder(PooledPtr<ExecutionOrder<T>> order, Market market) : order_(move(order)), market_(market) {}
 
 template <typename T>
-AlgoExecutionOrder<T>::AlgoExecutionOrder(ExecutionOrder<T>& order, Market market) : order_(&order), market_(market) {}
+AlgoExecutionOrder<T>::AlgoExecutionOrder(const AlgoExecutionOrder& other) : market_(other.market_) {
+    if (other.order_) {
+        order_ = other.order_.GetPool()->Acquire(*other.order_);
+    }
+}
 
 template <typename T>
-AlgoExecutionOrder<T>::~AlgoExecutionOrder() {
-    delete order_;
+AlgoExecutionOrder<T>& AlgoExecutionOrder<T>::operator = (const AlgoExecutionOrder& other) {
+    if (this == &other) {
+        return *this;
+    }
+    if (order_ && other.order_) {
+        // Reuse the order we already hold
+        *order_ = *other.order_;
+    } else if (other.order_) {
+        order_ = other.order_.GetPool()->Acquire(*other.order_);
+    } else {
+        order_.Reset();
+    }
+    market_ = other.market_;
+    return *this;
 }
 
 template <typename T>
 ExecutionOrder<T>* AlgoExecutionOrder<T>::GetExecutionOrder() const {
-    return order_;
+    return order_.Get();
 }
 
 template <typename T>
@@ -114,26 +159,26 @@ Market AlgoExecutionOrder<T>::GetMarket() const {
     return market_;
 }
 
-template <typename T>
-AlgoExecutionService<T>::AlgoExecutionService() : spread_(1. / 128.), execution_count_(0) {
-    in_listener_ = new MarketDataToAlgoExecutionListener<T>(this);
+template <typename T, typename Static>
+AlgoExecutionService<T, Static>::AlgoExecutionService() : algo_execution_orders_(ProductRegistry<T>::Instance().Size()), spread_(PriceTick::kTicksPerPoint / 128), execution_count_(0) {
+    in_listener_ = new InListener(this);
 }
 
-template <typename T>
-AlgoExecutionService<T>::~AlgoExecutionService() {
+template <typename T, typename Static>
+AlgoExecutionService<T, Static>::~AlgoExecutionService() {
     delete in_listener_;
 }
 
-template <typename T>
-AlgoExecutionOrder<T>& AlgoExecutionService<T>::GetData(string product_id) {
-    return algo_execution_orders_[product_id];
+template <typename T, typename Static>
+AlgoExecutionOrder<T>& AlgoExecutionService<T, Static>::GetData(string product_id) {
+    return algo_execution_orders_[ProductRegistry<T>::Instance().GetIndex(product_id)];
 }
 
-template <typename T>
-void AlgoExecutionService<T>::OnMessage(AlgoExecutionOrder<T>& data) {
-    string product_id = data.GetExecutionOrder()->GetProduct().GetProductId();
+template <typename T, typename Static>
+void AlgoExecutionService<T, Static>::OnMessage(AlgoExecutionOrder<T>& data) {
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(data.GetExecutionOrder()->GetProduct());
     
-    algo_execution_orders_.insert_or_assign(product_id, data);
+    algo_execution_orders_.InsertOrAssign(index, data);
     
 //    // Also notify listeners
 //    for (auto& listener : Service<string, AlgoExecutionOrder<T>>::listeners_) {
@@ -141,38 +186,56 @@ void AlgoExecutionService<T>::OnMessage(AlgoExecutionOrder<T>& data) {
 //    }
 }
 
-template <typename T>
-void AlgoExecutionService<T>::AddListener(ServiceListener<AlgoExecutionOrder<T>>* listener) {
+template <typename T, typename Static>
+void AlgoExecutionService<T, Static>::AddListener(ServiceListener<AlgoExecutionOrder<T>>* listener) {
     this->Service<string, AlgoExecutionOrder<T>>::AddListener(listener);
 }
 
-template <typename T>
-const vector<ServiceListener<AlgoExecutionOrder<T>>*>& AlgoExecutionService<T>::GetListeners() const {
+template <typename T, typename Static>
+const vector<ServiceListener<AlgoExecutionOrder<T>>*>& AlgoExecutionService<T, Static>::GetListeners() const {
     return this->Service<string, AlgoExecutionOrder<T>>::GetListeners();
 }
 
-template <typename T>
-MarketDataToAlgoExecutionListener<T>* AlgoExecutionService<T>::GetInListener() {
+template <typename T, typename Static>
+typename AlgoExecutionService<T, Static>::InListener* AlgoExecutionService<T, Static>::GetInListener() {
     return in_listener_;
 }
 
-template <typename T>
-void AlgoExecutionService<T>::AlgoExecute(OrderBook<T>& order_book, Market market) {
-    T product = order_book.GetProduct();
-    string product_id = product.GetProductId();
+template <typename T, typename Static>
+Static& AlgoExecutionService<T, Static>::GetStaticListeners() {
+    return static_listeners_;
+}
+
+template <typename T, typename Static>
+long AlgoExecutionService<T, Static>::GetExecutionCount() const {
+    return execution_count_;
+}
+
+template <typename T, typename Static>
+void AlgoExecutionService<T, Static>::SetExecutionCount(long count) {
+    execution_count_ = count;
+}
+
+template <typename T, typename Static>
+void AlgoExecutionService<T, Static>::AlgoExecute(OrderBook<T>& order_book, Market market) {
+    LATENCY_RECORD(ALGO_EXECUTE, order_book);
+    // Incremental deletes can empty a side, which leaves no spread to cross
+    if (order_book.GetBidStack().empty() || order_book.GetOfferStack().empty()) {
+        return;
+    }
+    const T& product = order_book.GetProduct();
     PricingSide side;
     // TODO: Generate order id
     string order_id = "";
-    double price;
+    PriceTick price;
     long quantity;
     
-    // Get the current best bid/offer
-    BidOffer bid_offer = order_book.GetBidOffer();
-    Order bid_order = bid_offer.GetBidOrder();
-    double bid_price = bid_order.GetPrice();
+    // Read the current best bid/offer straight from the top of book
+    const Order& bid_order = order_book.GetBestBid();
+    PriceTick bid_price = bid_order.GetPrice();
     long bid_quantity = bid_order.GetQuantity();
-    Order offer_order = bid_offer.GetOfferOrder();
-    double offer_price = offer_order.GetPrice();
+    const Order& offer_order = order_book.GetBestOffer();
+    PriceTick offer_price = offer_order.GetPrice();
     long offer_quantity = offer_order.GetQuantity();
     
     // If the spread is no more than the designated threshold, cross the spread alternatingly
@@ -188,32 +251,34 @@ void AlgoExecutionService<T>::AlgoExecute(OrderBook<T>& order_book, Market marke
         }
         execution_count_++;
         
-        AlgoExecutionOrder<T> algo_execution_order(product, side, order_id, MARKET, price, quantity, 0, "", false, market);
+        AlgoExecutionOrder<T> algo_execution_order(order_pool_, product, side, order_id, MARKET, price, quantity, 0, "", false, market);
+        LATENCY_CARRY(*algo_execution_order.GetExecutionOrder(), order_book);
         
         // Notify listeners
+        static_listeners_.ProcessAdd(algo_execution_order);
         for (auto& l : Service<string, AlgoExecutionOrder<T>>::listeners_) {
             l->ProcessAdd(algo_execution_order);
         }
     }
 }
 
-template<typename T>
-MarketDataToAlgoExecutionListener<T>::MarketDataToAlgoExecutionListener(AlgoExecutionService<T>* service) : service_(service) {}
+template <typename T, typename S>
+MarketDataToAlgoExecutionListener<T, S>::MarketDataToAlgoExecutionListener(S* service) : service_(service) {}
 
-template<typename T>
-void MarketDataToAlgoExecutionListener<T>::ProcessAdd(OrderBook<T>& data)
+template <typename T, typename S>
+void MarketDataToAlgoExecutionListener<T, S>::ProcessAdd(OrderBook<T>& data)
 {
     // Request execution of the order
     service_->AlgoExecute(data);
 }
 
-template<typename T>
-void MarketDataToAlgoExecutionListener<T>::ProcessRemove(OrderBook<T>& data) {
+template <typename T, typename S>
+void MarketDataToAlgoExecutionListener<T, S>::ProcessRemove(OrderBook<T>& data) {
     // Do nothing
 }
 
-template<typename T>
-void MarketDataToAlgoExecutionListener<T>::ProcessUpdate(OrderBook<T>& data) {
+template <typename T, typename S>
+void MarketDataToAlgoExecutionListener<T, S>::ProcessUpdate(OrderBook<T>& data) {
     // Do nothing
 }
 
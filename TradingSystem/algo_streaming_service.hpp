@@ -11,35 +11,35 @@
 #include "price_stream.hpp"
 #include "soa.hpp"
 #include <unordered_map>
+#include "product_registry.hpp"
 
 // Wrapper for price stream for AlgoStreamingService,
 //   just like AlgoExecutionOrder for AlgoExecutionService
+// The stream is held by value, so the service updates its stored stream in place on every price
 template<typename T>
 class AlgoStream {
 private:
-    PriceStream<T>* price_stream_;
+    PriceStream<T> price_stream_;
 
 public:
     AlgoStream() = default;
     AlgoStream(const T& product, const PriceStreamOrder& bid_order, const PriceStreamOrder& offer_order);
-    ~AlgoStream();
-
     
-    PriceStream<T>* GetPriceStream() const;
+    const PriceStream<T>& GetPriceStream() const;
+    PriceStream<T>& GetPriceStream();
 };
 
 template<typename T>
-AlgoStream<T>::AlgoStream(const T& product, const PriceStreamOrder& bid_order, const PriceStreamOrder& offer_order) {
-    price_stream_ = new PriceStream<T>(product, bid_order, offer_order);
-}
+AlgoStream<T>::AlgoStream(const T& product, const PriceStreamOrder& bid_order, const PriceStreamOrder& offer_order) :
+  price_stream_(product, bid_order, offer_order) {}
 
 template<typename T>
-AlgoStream<T>::~AlgoStream() {
-    // delete price_stream_;
+const PriceStream<T>& AlgoStream<T>::GetPriceStream() const {
+    return price_stream_;
 }
 
 template<typename T>
-PriceStream<T>* AlgoStream<T>::GetPriceStream() const {
+PriceStream<T>& AlgoStream<T>::GetPriceStream() {
     return price_stream_;
 }
 
@@ -49,9 +49,14 @@ class PricingToAlgoStreamingListener;
 template<typename T>
 class AlgoStreamingService : public Service<string, AlgoStream<T>> {
 private:
-    unordered_map<string, AlgoStream<T>> algo_streams_;
+    ProductStore<AlgoStream<T>> algo_streams_;     // Indexed by product index
     ServiceListener<Price<T>>* in_listener_;
     long count_;
+    bool suppress_unchanged_;
+    long suppressed_count_;
+    
+    // Update the stored stream of a price in place; returns it, or nullptr if it was suppressed
+    AlgoStream<T>* UpdateStream(Price<T>& price);
     
 public:
     AlgoStreamingService();
@@ -76,6 +81,17 @@ public:
     ServiceListener<Price<T>>* GetInListener();
     
     void AlgoPublishPrice(Price<T>& price);
+    
+    // Skip prices whose two-way quote (bid and offer price) is the one already streamed for the product.
+    // The alternating size then moves on published streams only, so a suppressed stream is exactly the last one.
+    void SetSuppressUnchanged(bool suppress_unchanged);
+    
+    // Number of prices skipped as unchanged
+    long GetSuppressedCount() const;
+    
+    // Number of streams published so far, which picks the size of the next one (e.g. to snapshot and restore it)
+    long GetStreamCount() const;
+    void SetStreamCount(long count);
 };
 
 template<typename T>
@@ -101,9 +117,11 @@ public:
 };
 
 template<typename T>
-AlgoStreamingService<T>::AlgoStreamingService() {
+AlgoStreamingService<T>::AlgoStreamingService() : algo_streams_(ProductRegistry<T>::Instance().Size()) {
     in_listener_ = new PricingToAlgoStreamingListener<T>(this);
     count_ = 0;
+    suppress_unchanged_ = false;
+    suppressed_count_ = 0;
 }
 
 template<typename T>
@@ -113,14 +131,14 @@ AlgoStreamingService<T>::~AlgoStreamingService() {
 
 template <typename T>
 AlgoStream<T>& AlgoStreamingService<T>::GetData(string product_id) {
-    return algo_streams_[product_id];
+    return algo_streams_[ProductRegistry<T>::Instance().GetIndex(product_id)];
 }
 
 template <typename T>
 void AlgoStreamingService<T>::OnMessage(AlgoStream<T>& data) {
-    string product_id = data.GetPriceStream()->GetProduct().GetProductId();
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(data.GetPriceStream().GetProduct());
     
-    algo_streams_[product_id] = data;
+    algo_streams_.InsertOrAssign(index, data);
     
 //    // Also notify listeners
 //    for (auto& listener : Service<string, Price<T>>::listeners_) {
@@ -144,26 +162,69 @@ ServiceListener<Price<T>>* AlgoStreamingService<T>::GetInListener() {
 }
 
 template<typename T>
-void AlgoStreamingService<T>::AlgoPublishPrice(Price<T>& price)
-{
-    T product = price.GetProduct();
-    string product_id = product.GetProductId();
+long AlgoStreamingService<T>::GetStreamCount() const {
+    return count_;
+}
+
+template<typename T>
+void AlgoStreamingService<T>::SetStreamCount(long count) {
+    count_ = count;
+}
+
+template<typename T>
+void AlgoStreamingService<T>::SetSuppressUnchanged(bool suppress_unchanged) {
+    suppress_unchanged_ = suppress_unchanged;
+}
 
-    double mid = price.GetMid();
-    double spread = price.GetBidOfferSpread();
-    double bid_price = mid - spread / 2.;
-    double offer_price = mid + spread / 2.;
+template<typename T>
+long AlgoStreamingService<T>::GetSuppressedCount() const {
+    return suppressed_count_;
+}
+
+template<typename T>
+AlgoStream<T>* AlgoStreamingService<T>::UpdateStream(Price<T>& price)
+{
+    const T& product = price.GetProduct();
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(product);
+
+    PriceTick mid = price.GetMid();
+    PriceTick spread = price.GetBidOfferSpread();
+    // The mid is rounded down, so rebuild the offer from the bid to keep odd spreads exact
+    PriceTick bid_price = mid - spread / 2;
+    PriceTick offer_price = bid_price + spread;
+    
+    AlgoStream<T>* stored = algo_streams_.Find(index);
+    if (suppress_unchanged_ && stored != nullptr) {
+        const PriceStream<T>& last = stored->GetPriceStream();
+        if (last.GetBidOrder().GetPrice() == bid_price && last.GetOfferOrder().GetPrice() == offer_price) {
+            suppressed_count_++;
+            return nullptr;
+        }
+    }
+    
     long visible_quantity = ((count_++) % 2 + 1) * 1000000;  // Alternate visble sizes
     long hidden_quantity = visible_quantity * 2;
 
     PriceStreamOrder bid_order(bid_price, visible_quantity, hidden_quantity, BID);
     PriceStreamOrder offer_order(offer_price, visible_quantity, hidden_quantity, OFFER);
-    AlgoStream<T> algo_stream(product, bid_order, offer_order);
-    algo_streams_[product_id] = algo_stream;
+    if (stored == nullptr) {
+        return algo_streams_.TryEmplace(index, product, bid_order, offer_order).first;
+    }
+    stored->GetPriceStream().Update(bid_order, offer_order);
+    return stored;
+}
+
+template<typename T>
+void AlgoStreamingService<T>::AlgoPublishPrice(Price<T>& price)
+{
+    AlgoStream<T>* algo_stream = UpdateStream(price);
+    if (algo_stream == nullptr) {
+        return;
+    }
 
     for (auto& listener : this->GetListeners())
     {
-        listener->ProcessAdd(algo_stream);
+        listener->ProcessAdd(*algo_stream);
     }
 }
 
@@ -0,0 +1,324 @@
+/**
+ * async_listener.hpp
+ * ServiceListener adapter that hands events to another listener on a dedicated consumer thread
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) AsyncListener<V> is a ServiceListener<V> that can be passed to any Service::AddListener. ProcessAdd/Remove/Update copy the event into a BoundedRing and return; a consumer thread replays the events, in order, on the wrapped listener.
+ (2) The wrapped listener (and whatever it drives) therefore runs on the consumer thread only. This decouples latency-insensitive consumers such as GUIService and HistoricalDataService from the trading path.
+ (3) Both the idle consumer and a producer facing a full ring wait with the configured WaitStrategy. What happens on a full ring is the OverflowPolicy: wait for room (lossless backpressure), drop the new event, or drop the oldest queued event. A producer running on the listener's own consumer thread (a queue feeding another queue of the same executor thread) cannot wait for that thread, so it makes room by processing queued events itself.
+ (4) Flush blocks until every accepted event has been handed to the wrapped listener. The destructor flushes and joins the consumer.
+ (5) The consumer thread can be pinned to a core, for consumers that own a share of the trading path (see sharding.hpp). Pinning is best effort: where the platform has no affinity API it is skipped.
+ (6) The consumer is an ExecutorTask (see executor.hpp): it runs on a thread of its own built from the configuration, or on a shared ExecutorThread given in the configuration, next to other queues. Either way the thread reports its utilization, and the listener the most events it ever had queued.
+ */
+
+#ifndef async_listener_hpp
+#define async_listener_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "soa.hpp"
+#include "bounded_ring.hpp"
+#include "executor.hpp"
+
+using namespace std;
+
+// What AsyncListener does with an event when its ring is full
+enum OverflowPolicy { WAIT_FOR_ROOM, DROP_NEWEST, DROP_OLDEST };
+
+/**
+ * Settings of an AsyncListener.
+ */
+struct AsyncListenerConfig
+{
+    // Number of queued events (rounded up to a power of two)
+    size_t capacity = 1 << 14;
+
+    // How the consumer waits for events, and a producer waits for room
+    WaitStrategy wait_strategy = BLOCK;
+
+    // What happens when the ring is full
+    OverflowPolicy overflow_policy = WAIT_FOR_ROOM;
+
+    // Core the consumer thread is pinned to (-1 to leave it to the scheduler)
+    int core = -1;
+
+    // Shared thread the consumer runs on (nullptr for a thread of its own, set up by wait_strategy and core)
+    ExecutorThread* executor = nullptr;
+
+    // Name in the executor statistics
+    string name = "async";
+};
+
+// Settings of a named queue: its executor thread, wait strategy and capacity if the executor assigns the queue, the given settings otherwise
+AsyncListenerConfig ConfigureQueue(Executor* executor, const string& name, AsyncListenerConfig config = AsyncListenerConfig());
+
+/**
+ * Queues events for a wrapped listener and processes them on a consumer thread.
+ * Type V is the event data type; it must be copyable.
+ */
+template <typename V>
+class AsyncListener : public ServiceListener<V>, public ExecutorTask
+{
+public:
+    // The wrapped listener must outlive this adapter
+    AsyncListener(ServiceListener<V>* listener, AsyncListenerConfig config = AsyncListenerConfig());
+
+    // Processes everything still queued before returning
+    ~AsyncListener();
+
+    AsyncListener(const AsyncListener&) = delete;
+    AsyncListener& operator = (const AsyncListener&) = delete;
+
+    // MARK: SERVICELISTENER CLASS OVERRIDE BELOW
+    // Listener callback to process an add event to the Service
+    virtual void ProcessAdd(V &data) override;
+
+    // Listener callback to process a remove event to the Service
+    virtual void ProcessRemove(V &data) override;
+
+    // Listener callback to process an update event to the Service
+    virtual void ProcessUpdate(V &data) override;
+    // MARK: SERVICELISTENER CLASS OVERRIDE ABOVE
+
+    // Block until every accepted event has been processed
+    void Flush();
+
+    // Number of events dropped by the overflow policy
+    size_t GetDroppedCount() const;
+
+    // Most events queued at once
+    size_t GetHighWaterMark() const;
+
+    // Get the settings
+    const AsyncListenerConfig& GetConfig() const;
+
+    // Get the thread the consumer runs on
+    const ExecutorThread& GetExecutorThread() const;
+
+    // MARK: EXECUTORTASK CLASS OVERRIDE BELOW
+    // Process up to max queued events (on the executor thread)
+    virtual size_t RunPending(size_t max) override;
+
+    // Whether events are queued
+    virtual bool HasPending() const override;
+
+    // Statistics of the queue
+    virtual ExecutorQueueStats GetQueueStats() const override;
+    // MARK: EXECUTORTASK CLASS OVERRIDE ABOVE
+
+private:
+    enum EventType { ADD, REMOVE, UPDATE };
+
+    struct Event
+    {
+        EventType type;
+        V data;
+    };
+
+    // Queue an event according to the overflow policy
+    void Push(EventType type, const V& data);
+
+    // Hand an event to the wrapped listener
+    void Process(Event& event);
+
+    // Whether every accepted event has been retired (processed, or dropped from the ring)
+    bool Idle() const;
+
+    ServiceListener<V>* listener_;
+    AsyncListenerConfig config_;
+    BoundedRing<Event> ring_;
+
+    alignas(kCacheLineSize) atomic<size_t> accepted_;
+    atomic<size_t> high_water_mark_;
+    alignas(kCacheLineSize) atomic<size_t> retired_;
+    atomic<size_t> processed_;
+    atomic<size_t> dropped_;
+
+    WaitPoint room_ready_;
+    WaitPoint idle_;
+
+    unique_ptr<ExecutorThread> own_thread_;     // Unless the consumer runs on a shared thread
+    ExecutorThread* executor_;
+};
+
+AsyncListenerConfig ConfigureQueue(Executor* executor, const string& name, AsyncListenerConfig config)
+{
+    config.name = name;
+    const ExecutorQueueConfig* queue_config = (executor != nullptr) ? executor->FindQueue(name) : nullptr;
+    if (queue_config != nullptr) {
+        config.executor = executor->FindThread(queue_config->thread);
+        config.wait_strategy = queue_config->wait_strategy.value_or(config.wait_strategy);
+        config.capacity = queue_config->capacity.value_or(config.capacity);
+    }
+    return config;
+}
+
+template <typename V>
+AsyncListener<V>::AsyncListener(ServiceListener<V>* listener, AsyncListenerConfig config) :
+  listener_(listener), config_(config), ring_(config.capacity), accepted_(0), high_water_mark_(0), retired_(0), processed_(0), dropped_(0), executor_(config.executor)
+{
+    if (executor_ == nullptr) {
+        ExecutorThreadConfig thread_config;
+        thread_config.name = config_.name;
+        thread_config.core = config_.core;
+        thread_config.wait_strategy = config_.wait_strategy;
+        own_thread_ = make_unique<ExecutorThread>(thread_config);
+        executor_ = own_thread_.get();
+    }
+    executor_->Add(this);
+}
+
+template <typename V>
+AsyncListener<V>::~AsyncListener()
+{
+    Flush();
+    executor_->Remove(this);
+}
+
+template <typename V>
+void AsyncListener<V>::ProcessAdd(V &data)
+{
+    Push(ADD, data);
+}
+
+template <typename V>
+void AsyncListener<V>::ProcessRemove(V &data)
+{
+    Push(REMOVE, data);
+}
+
+template <typename V>
+void AsyncListener<V>::ProcessUpdate(V &data)
+{
+    Push(UPDATE, data);
+}
+
+template <typename V>
+void AsyncListener<V>::Push(EventType type, const V& data)
+{
+    // The event is copied straight into the slot, and only once the slot is claimed
+    while (!ring_.TryPush(type, data)) {
+        switch (config_.overflow_policy) {
+            case WAIT_FOR_ROOM:
+                // Only this thread would drain the ring; the events are processed in order either way
+                if (executor_->RunningInThisThread() && RunPending(1) > 0) {
+                    break;
+                }
+                room_ready_.Wait(config_.wait_strategy, [this] { return ring_.Size() < ring_.Capacity(); });
+                break;
+            case DROP_NEWEST:
+                dropped_.fetch_add(1, memory_order_relaxed);
+                return;
+            case DROP_OLDEST:
+                // The ring is multi-consumer, so the producer can retire the oldest event itself
+                if (ring_.TryConsume([](Event&) {})) {
+                    dropped_.fetch_add(1, memory_order_relaxed);
+                    retired_.fetch_add(1, memory_order_release);
+                }
+                break;
+        }
+    }
+    accepted_.fetch_add(1, memory_order_release);
+    // Racy between producers, so a concurrent maximum may be missed by one event
+    size_t queued = ring_.Size();
+    if (queued > high_water_mark_.load(memory_order_relaxed)) {
+        high_water_mark_.store(queued, memory_order_relaxed);
+    }
+    executor_->Notify();
+}
+
+template <typename V>
+void AsyncListener<V>::Process(Event& event)
+{
+    switch (event.type) {
+        case ADD:
+            listener_->ProcessAdd(event.data);
+            break;
+        case REMOVE:
+            listener_->ProcessRemove(event.data);
+            break;
+        case UPDATE:
+            listener_->ProcessUpdate(event.data);
+            break;
+    }
+}
+
+template <typename V>
+size_t AsyncListener<V>::RunPending(size_t max)
+{
+    size_t count = 0;
+    while (count < max && ring_.TryConsume([this](Event& event) { Process(event); })) {
+        count++;
+    }
+    if (count > 0) {
+        processed_.fetch_add(count, memory_order_relaxed);
+        retired_.fetch_add(count, memory_order_release);
+        room_ready_.Notify();
+        idle_.Notify();
+    }
+    return count;
+}
+
+template <typename V>
+bool AsyncListener<V>::HasPending() const
+{
+    return ring_.Size() > 0;
+}
+
+template <typename V>
+ExecutorQueueStats AsyncListener<V>::GetQueueStats() const
+{
+    ExecutorQueueStats stats;
+    stats.name = config_.name;
+    stats.events = processed_.load(memory_order_relaxed);
+    stats.high_water_mark = GetHighWaterMark();
+    stats.capacity = ring_.Capacity();
+    return stats;
+}
+
+template <typename V>
+bool AsyncListener<V>::Idle() const
+{
+    return retired_.load(memory_order_acquire) >= accepted_.load(memory_order_acquire);
+}
+
+template <typename V>
+void AsyncListener<V>::Flush()
+{
+    // Blocking here regardless of the strategy: flushes are rare and may be long
+    idle_.Wait(BLOCK, [this] { return Idle(); });
+}
+
+template <typename V>
+size_t AsyncListener<V>::GetDroppedCount() const
+{
+    return dropped_.load(memory_order_relaxed);
+}
+
+template <typename V>
+size_t AsyncListener<V>::GetHighWaterMark() const
+{
+    return high_water_mark_.load(memory_order_relaxed);
+}
+
+template <typename V>
+const ExecutorThread& AsyncListener<V>::GetExecutorThread() const
+{
+    return *executor_;
+}
+
+template <typename V>
+const AsyncListenerConfig& AsyncListener<V>::GetConfig() const
+{
+    return config_;
+}
+
+#endif /* async_listener_hpp */
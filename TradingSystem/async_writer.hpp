@@ -0,0 +1,198 @@
+/**
+ * async_writer.hpp
+ * Buffered file writer drained by a background thread
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) Producers copy their bytes into a ring buffer under a short lock. That memcpy is the only cost on the caller's thread.
+ (2) A background thread drains everything pending in one go (group commit), either once enough bytes have piled up, once the flush interval has passed, or when asked to (Flush / shutdown).
+ (3) The file is opened once for the lifetime of the writer.
+ (4) If the ring is full the producer waits for the drain instead of dropping data.
+ */
+
+#ifndef async_writer_hpp
+#define async_writer_hpp
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * When the background thread drains the buffer to the file.
+ */
+struct FlushPolicy
+{
+    // Drain as soon as this many bytes are pending (0 disables the byte trigger)
+    size_t flush_bytes = 64 << 10;
+
+    // Drain at least this often while data is pending (0 disables the timer)
+    chrono::milliseconds flush_interval = chrono::milliseconds(100);
+
+    // Drain what is left when the writer is destroyed (otherwise it is discarded)
+    bool flush_on_shutdown = true;
+};
+
+/**
+ * Append-only file writer with a ring buffer and a background drain thread.
+ * Safe to use from several producer threads.
+ */
+class AsyncFileWriter
+{
+public:
+    static constexpr size_t kDefaultCapacity = 1 << 22;
+
+    AsyncFileWriter(const string& path, FlushPolicy policy = FlushPolicy(), size_t capacity = kDefaultCapacity);
+    ~AsyncFileWriter();
+
+    AsyncFileWriter(const AsyncFileWriter&) = delete;
+    AsyncFileWriter& operator = (const AsyncFileWriter&) = delete;
+
+    // Copy bytes into the ring buffer
+    void Append(const char* data, size_t size);
+    void Append(string_view data);
+
+    // Block until everything appended so far has been handed to the file
+    void Flush();
+
+    // Get the flush policy
+    const FlushPolicy& GetFlushPolicy() const;
+
+private:
+    // Background drain loop
+    void Run();
+
+    // Number of bytes waiting to be drained (requires the lock)
+    size_t Pending() const;
+
+    ofstream file_;
+    FlushPolicy policy_;
+    vector<char> ring_;
+
+    // Monotonic byte counters; positions in the ring are taken modulo its size
+    size_t head_;
+    size_t tail_;
+    size_t flush_target_;
+    bool stopping_;
+
+    mutex mutex_;
+    condition_variable data_cv_;
+    condition_variable space_cv_;
+    thread thread_;
+};
+
+AsyncFileWriter::AsyncFileWriter(const string& path, FlushPolicy policy, size_t capacity) :
+  file_(path, ios::app | ios::binary), policy_(policy), ring_(capacity), head_(0), tail_(0), flush_target_(0), stopping_(false)
+{
+    thread_ = thread(&AsyncFileWriter::Run, this);
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+        if (!policy_.flush_on_shutdown) {
+            tail_ = head_;
+        }
+    }
+    data_cv_.notify_one();
+    thread_.join();
+}
+
+size_t AsyncFileWriter::Pending() const
+{
+    return head_ - tail_;
+}
+
+void AsyncFileWriter::Append(const char* data, size_t size)
+{
+    unique_lock<mutex> lock(mutex_);
+    while (size > 0) {
+        // Records larger than the ring are copied in pieces as space frees up
+        space_cv_.wait(lock, [this] { return Pending() < ring_.size(); });
+
+        size_t chunk = min(size, ring_.size() - Pending());
+        size_t position = head_ % ring_.size();
+        size_t first = min(chunk, ring_.size() - position);
+        memcpy(ring_.data() + position, data, first);
+        memcpy(ring_.data(), data + first, chunk - first);
+
+        head_ += chunk;
+        data += chunk;
+        size -= chunk;
+
+        if (Pending() == ring_.size() || (policy_.flush_bytes > 0 && Pending() >= policy_.flush_bytes)) {
+            data_cv_.notify_one();
+        }
+    }
+}
+
+void AsyncFileWriter::Append(string_view data)
+{
+    Append(data.data(), data.size());
+}
+
+void AsyncFileWriter::Flush()
+{
+    unique_lock<mutex> lock(mutex_);
+    flush_target_ = max(flush_target_, head_);
+    data_cv_.notify_one();
+    space_cv_.wait(lock, [this] { return tail_ >= flush_target_; });
+}
+
+const FlushPolicy& AsyncFileWriter::GetFlushPolicy() const
+{
+    return policy_;
+}
+
+void AsyncFileWriter::Run()
+{
+    unique_lock<mutex> lock(mutex_);
+    while (true) {
+        auto ready = [this] {
+            return stopping_ || flush_target_ > tail_ || Pending() == ring_.size() || (policy_.flush_bytes > 0 && Pending() >= policy_.flush_bytes);
+        };
+        if (policy_.flush_interval.count() > 0) {
+            data_cv_.wait_for(lock, policy_.flush_interval, ready);
+        } else {
+            data_cv_.wait(lock, ready);
+        }
+
+        size_t begin = tail_;
+        size_t end = head_;
+        bool stopping = stopping_;
+
+        if (end > begin) {
+            // The pending region is not touched by producers, so write it without holding the lock
+            lock.unlock();
+            size_t position = begin % ring_.size();
+            size_t size = end - begin;
+            size_t first = min(size, ring_.size() - position);
+            file_.write(ring_.data() + position, first);
+            file_.write(ring_.data(), size - first);
+            file_.flush();
+            lock.lock();
+
+            tail_ = max(tail_, end);
+            space_cv_.notify_all();
+        }
+
+        if (stopping && tail_ == head_) {
+            break;
+        }
+    }
+}
+
+#endif /* async_writer_hpp */
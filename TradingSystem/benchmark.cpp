@@ -0,0 +1,335 @@
+/**
+ * benchmark.cpp
+ * Benchmark suite: micro-benchmarks of the hot helpers, and end-to-end throughput of each feed
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) Built as its own executable next to main.cpp (see README), so measuring does not go through Test() and its file output.
+ (2) Micro-benchmarks run a body a fixed number of times per repetition and report the best repetition, which is the least noisy estimate on a shared machine. Results go through DoNotOptimize so that the compiler cannot drop the work.
+ (3) Feed benchmarks generate the input files once with a fixed seed into a data directory, then stream each file through freshly built services wired as in Test(). GUI and historical data are left out, since they write files off the trading path. One line of a feed file counts as one message.
+ (4) Sharded feed benchmarks route market data through 1, 2, 4, ... shards (up to the cores and the products), timed until every shard has drained, to track how throughput scales with cores.
+ (5) Results are printed as JSON (default) or CSV, one record per benchmark, so runs can be diffed and tracked.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "initialization.hpp"
+
+#include "bond_services.hpp"
+#include "sharding.hpp"
+
+using namespace std;
+
+// One benchmark outcome
+struct BenchmarkResult
+{
+    string suite;
+    string name;
+    long operations;        // Per repetition
+    double seconds;         // Best repetition
+    double ns_per_op;
+    double ops_per_sec;
+};
+
+// Keep a value alive as far as the optimizer is concerned
+template <typename V>
+inline void DoNotOptimize(const V& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Time body(operations) over several repetitions and keep the best
+template <typename F>
+BenchmarkResult Measure(const string& suite, const string& name, long operations, int repetitions, F&& body)
+{
+    double best = numeric_limits<double>::max();
+    for (int repetition = 0; repetition < repetitions; repetition++) {
+        auto start = chrono::steady_clock::now();
+        body(operations);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        best = min(best, elapsed.count());
+    }
+    return BenchmarkResult{ suite, name, operations, best, best * 1e9 / operations, operations / best };
+}
+
+// A five level book for the product, with two orders at every price
+OrderBook<Bond> MakeBook(const Bond& bond)
+{
+    vector<Order> bid_stack;
+    vector<Order> offer_stack;
+    for (long level = 0; level < 5; level++) {
+        for (int copy = 0; copy < 2; copy++) {
+            bid_stack.emplace_back(PriceTick(100 * PriceTick::kTicksPerPoint - 1 - level), 1000000 * (level + 1), BID);
+            offer_stack.emplace_back(PriceTick(100 * PriceTick::kTicksPerPoint + 1 + level), 1000000 * (level + 1), OFFER);
+        }
+    }
+    return OrderBook<Bond>(bond, std::move(bid_stack), std::move(offer_stack));
+}
+
+vector<BenchmarkResult> RunMicroBenchmarks(long operations, int repetitions)
+{
+    vector<BenchmarkResult> results;
+    const Bond& bond = FetchBond(10);
+
+    results.push_back(Measure("micro", "ConvertPrice(string_view)", operations, repetitions, [](long n) {
+        const string_view prices[] = { "99-000", "99-16+", "100-257", "101-31+" };
+        for (long i = 0; i < n; i++) {
+            DoNotOptimize(ConvertPrice(prices[i & 3]));
+        }
+    }));
+
+    results.push_back(Measure("micro", "ConvertPrice(PriceTick)", operations, repetitions, [](long n) {
+        for (long i = 0; i < n; i++) {
+            DoNotOptimize(ConvertPrice(PriceTick(99 * PriceTick::kTicksPerPoint + (i & 511))));
+        }
+    }));
+
+    OrderBook<Bond> book = MakeBook(bond);
+    results.push_back(Measure("micro", "OrderBook::GetBidOffer", operations, repetitions, [&book](long n) {
+        // Escaping the book makes every iteration read it again
+        DoNotOptimize(book);
+        for (long i = 0; i < n; i++) {
+            DoNotOptimize(book.GetBidOffer());
+        }
+    }));
+
+    // AggregateDepth modifies the stored book, so every operation reloads the full book first
+    MarketDataService<Bond> market_data_service;
+    results.push_back(Measure("micro", "MarketDataService::AggregateDepth (with reload)", operations / 10, repetitions, [&](long n) {
+        for (long i = 0; i < n; i++) {
+            market_data_service.OnMessage(book);
+            DoNotOptimize(market_data_service.AggregateDepth(bond.GetProductId()));
+        }
+    }));
+
+    results.push_back(Measure("micro", "Position::AddPosition", operations, repetitions, [&bond](long n) {
+        // Books are interned once, as trades do when they are created
+        Position<Bond> position(bond);
+        BookIndex books[] = { BookRegistry::Instance().Intern("TRSY1"), BookRegistry::Instance().Intern("TRSY2"), BookRegistry::Instance().Intern("TRSY3") };
+        for (long i = 0; i < n; i++) {
+            position.AddPosition(books[i % 3], 1000000, (i & 1) ? BUY : SELL);
+        }
+        DoNotOptimize(position);
+    }));
+
+    // Whole text records (timestamp included), as the historical data connector writes them
+    vector<char> buffer;
+    ExecutionOrder<Bond> execution_order(bond, BID, "ORDER", MARKET, PriceTick(100 * PriceTick::kTicksPerPoint), 1000000, 0, "", false);
+    results.push_back(Measure("micro", "ExecutionOrder::Serialize", operations / 10, repetitions, [&execution_order, &buffer](long n) {
+        for (long i = 0; i < n; i++) {
+            DoNotOptimize(SerializeRecord(buffer, execution_order));
+        }
+    }));
+
+    Position<Bond> position(bond);
+    string position_book = "TRSY1";
+    position.AddPosition(position_book, 1000000, BUY);
+    results.push_back(Measure("micro", "Position::Serialize", operations / 10, repetitions, [&position, &buffer](long n) {
+        for (long i = 0; i < n; i++) {
+            DoNotOptimize(SerializeRecord(buffer, position));
+        }
+    }));
+
+    PV01<Bond> pv01(bond, GetPV01Value(bond.GetProductId()), 1000000);
+    results.push_back(Measure("micro", "PV01::Serialize", operations / 10, repetitions, [&pv01, &buffer](long n) {
+        for (long i = 0; i < n; i++) {
+            DoNotOptimize(SerializeRecord(buffer, pv01));
+        }
+    }));
+
+    return results;
+}
+
+// Services of the trading path, wired as in Test() without GUI and historical data
+struct BenchmarkSystem
+{
+    BenchmarkSystem() {
+        pricing_service.AddListener(algo_streaming_service.GetInListener());
+        algo_streaming_service.AddListener(streaming_service.GetInListener());
+        market_data_service.AddListener(algo_execution_service.GetInListener());
+        algo_execution_service.AddListener(execution_service.GetInListener());
+        execution_service.AddListener(trade_booking_service.GetInListener());
+        trade_booking_service.AddListener(position_service.GetInListener());
+        position_service.AddListener(risk_service.GetInListener());
+    }
+
+    PricingService<Bond> pricing_service;
+    TradeBookingService<Bond> trade_booking_service;
+    PositionService<Bond> position_service;
+    RiskService<Bond> risk_service;
+    MarketDataService<Bond> market_data_service;
+    AlgoExecutionService<Bond> algo_execution_service;
+    AlgoStreamingService<Bond> algo_streaming_service;
+    ExecutionService<Bond> execution_service;
+    StreamingService<Bond> streaming_service;
+    InquiryService<Bond> inquiry_service;
+};
+
+// Number of lines in a file
+long CountLines(const string& path)
+{
+    ifstream file(path);
+    return count(istreambuf_iterator<char>(file), istreambuf_iterator<char>(), '\n');
+}
+
+// Stream one feed file through a fresh system per repetition
+template <typename V>
+BenchmarkResult RunFeed(const string& name, const string& path, Connector<V>* (*connector)(BenchmarkSystem&), int repetitions)
+{
+    long messages = CountLines(path);
+    double best = numeric_limits<double>::max();
+    for (int repetition = 0; repetition < repetitions; repetition++) {
+        BenchmarkSystem system;
+        ifstream data(path);
+        auto start = chrono::steady_clock::now();
+        connector(system)->Subscribe(data);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        best = min(best, elapsed.count());
+    }
+    return BenchmarkResult{ "feed", name, messages, best, best * 1e9 / messages, messages / best };
+}
+
+vector<BenchmarkResult> RunFeedBenchmarks(int repetitions)
+{
+    vector<BenchmarkResult> results;
+    results.push_back(RunFeed<Price<Bond>>("prices", "prices.txt", [](BenchmarkSystem& s) -> Connector<Price<Bond>>* { return s.pricing_service.GetConnector(); }, repetitions));
+    results.push_back(RunFeed<Trade<Bond>>("trades", "trades.txt", [](BenchmarkSystem& s) -> Connector<Trade<Bond>>* { return s.trade_booking_service.GetConnector(); }, repetitions));
+    results.push_back(RunFeed<OrderBook<Bond>>("marketdata", "marketdata.txt", [](BenchmarkSystem& s) -> Connector<OrderBook<Bond>>* { return s.market_data_service.GetConnector(); }, repetitions));
+    results.push_back(RunFeed<Inquiry<Bond>>("inquiries", "inquiries.txt", [](BenchmarkSystem& s) -> Connector<Inquiry<Bond>>* { return s.inquiry_service.GetConnector(); }, repetitions));
+    return results;
+}
+
+// Route market data through a fresh set of shards per repetition, for every shard count up to the cores and the products
+vector<BenchmarkResult> RunShardedFeedBenchmarks(int repetitions)
+{
+    vector<BenchmarkResult> results;
+    long messages = CountLines("marketdata.txt");
+    unsigned max_shards = unsigned(min<size_t>(max(1u, thread::hardware_concurrency()), ProductRegistry<Bond>::Instance().Size()));
+    vector<unsigned> shard_counts;
+    for (unsigned shards = 1; shards < max_shards; shards *= 2) {
+        shard_counts.push_back(shards);
+    }
+    shard_counts.push_back(max_shards);
+    for (unsigned shards : shard_counts) {
+        double best = numeric_limits<double>::max();
+        for (int repetition = 0; repetition < repetitions; repetition++) {
+            ShardConfig config;
+            config.shards = shards;
+            ShardRouter<Bond> router(config);
+            auto start = chrono::steady_clock::now();
+            router.RouteMarketData();
+            router.Drain();
+            chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+            best = min(best, elapsed.count());
+        }
+        results.push_back(BenchmarkResult{ "sharded", "marketdata (" + to_string(shards) + " shards)", messages, best, best * 1e9 / messages, messages / best });
+    }
+    return results;
+}
+
+// Generate the feed files with a fixed seed, so that every run sees the same data
+void GenerateFeeds(unsigned seed)
+{
+    // The generators report progress on cout, which carries the results
+    streambuf* cout_buffer = cout.rdbuf(nullptr);
+    initialization::FeedGeneratorConfig config;
+    config.seed = seed;
+    initialization::GenerateAllFeeds(config);
+    cout.rdbuf(cout_buffer);
+}
+
+void PrintJson(const vector<BenchmarkResult>& results, unsigned seed, ostream& out)
+{
+    out << "{\n  \"seed\": " << seed << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& result = results[i];
+        out << "    {\"suite\": \"" << result.suite << "\", \"name\": \"" << result.name << "\", \"operations\": " << result.operations
+            << ", \"seconds\": " << result.seconds << ", \"ns_per_op\": " << result.ns_per_op << ", \"ops_per_sec\": " << result.ops_per_sec
+            << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}" << endl;
+}
+
+void PrintCsv(const vector<BenchmarkResult>& results, ostream& out)
+{
+    out << "suite,name,operations,seconds,ns_per_op,ops_per_sec\n";
+    for (const auto& result : results) {
+        out << result.suite << ",\"" << result.name << "\"," << result.operations << ',' << result.seconds << ',' << result.ns_per_op << ',' << result.ops_per_sec << '\n';
+    }
+    out.flush();
+}
+
+void PrintUsage()
+{
+    cerr << "usage: benchmark [--format json|csv] [--seed N] [--data-dir DIR] [--operations N] [--repetitions N] [--micro-only | --feeds-only]" << endl;
+}
+
+int main(int argc, const char * argv[]) {
+    string format = "json";
+    unsigned seed = 42;
+    string data_dir = "benchmark_data";
+    long operations = 1000000;
+    int repetitions = 5;
+    bool micro = true;
+    bool feeds = true;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "--format") == 0 && has_value) {
+            format = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            seed = unsigned(stoul(argv[++i]));
+        } else if (strcmp(argv[i], "--data-dir") == 0 && has_value) {
+            data_dir = argv[++i];
+        } else if (strcmp(argv[i], "--operations") == 0 && has_value) {
+            operations = stol(argv[++i]);
+        } else if (strcmp(argv[i], "--repetitions") == 0 && has_value) {
+            repetitions = stoi(argv[++i]);
+        } else if (strcmp(argv[i], "--micro-only") == 0) {
+            feeds = false;
+        } else if (strcmp(argv[i], "--feeds-only") == 0) {
+            micro = false;
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+    if ((format != "json" && format != "csv") || operations < 10 || repetitions < 1) {
+        PrintUsage();
+        return 1;
+    }
+
+    vector<BenchmarkResult> results;
+    if (micro) {
+        results = RunMicroBenchmarks(operations, repetitions);
+    }
+    if (feeds) {
+        // The connectors read their files from the working directory
+        filesystem::create_directories(data_dir);
+        filesystem::current_path(data_dir);
+        GenerateFeeds(seed);
+        vector<BenchmarkResult> feed_results = RunFeedBenchmarks(repetitions);
+        results.insert(results.end(), feed_results.begin(), feed_results.end());
+        vector<BenchmarkResult> sharded_results = RunShardedFeedBenchmarks(repetitions);
+        results.insert(results.end(), sharded_results.begin(), sharded_results.end());
+    }
+
+    if (format == "json") {
+        PrintJson(results, seed, cout);
+    } else {
+        PrintCsv(results, cout);
+    }
+
+    return 0;
+}
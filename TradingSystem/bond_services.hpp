@@ -26,8 +26,87 @@
 #include "historical_data_service.hpp"
 #include "inquiry_service.hpp"
 #include "gui_service.hpp"
+#include "async_listener.hpp"
+#include "conflating_listener.hpp"
 
 typedef OrderBook<Bond> BondOrderBook;
 typedef MarketDataService<Bond> BondMarketDataService;
 
+// Tick-to-trade chain (MarketData -> AlgoExecution -> Execution -> TradeBooking -> Position -> Risk) wired at compile time.
+// Each service notifies the next service's concrete in-listener directly, so the whole chain can be inlined.
+// The dynamic AddListener API stays available on every service, e.g. for historical data.
+template <typename T>
+class StaticPipeline
+{
+public:
+    // Spelled out from the end of the chain, since each service's listener list names the next service
+    typedef RiskService<T> RiskServiceType;
+    typedef PositionService<T, StaticListeners<Position<T>, typename RiskServiceType::InListener>> PositionServiceType;
+    typedef TradeBookingService<T, StaticListeners<Trade<T>, typename PositionServiceType::InListener>> TradeBookingServiceType;
+    typedef ExecutionService<T, StaticListeners<ExecutionOrder<T>, typename TradeBookingServiceType::InListener>> ExecutionServiceType;
+    typedef AlgoExecutionService<T, StaticListeners<AlgoExecutionOrder<T>, typename ExecutionServiceType::InListener>> AlgoExecutionServiceType;
+    typedef MarketDataService<T, StaticListeners<OrderBook<T>, typename AlgoExecutionServiceType::InListener>> MarketDataServiceType;
+    
+    StaticPipeline() {
+        market_data_service.GetStaticListeners().Bind(algo_execution_service.GetInListener());
+        algo_execution_service.GetStaticListeners().Bind(execution_service.GetInListener());
+        execution_service.GetStaticListeners().Bind(trade_booking_service.GetInListener());
+        trade_booking_service.GetStaticListeners().Bind(position_service.GetInListener());
+        position_service.GetStaticListeners().Bind(risk_service.GetInListener());
+    }
+    
+    StaticPipeline(const StaticPipeline&) = delete;
+    StaticPipeline& operator = (const StaticPipeline&) = delete;
+    
+    RiskServiceType risk_service;
+    PositionServiceType position_service;
+    TradeBookingServiceType trade_booking_service;
+    ExecutionServiceType execution_service;
+    AlgoExecutionServiceType algo_execution_service;
+    MarketDataServiceType market_data_service;
+};
+
+// The same chain wired at run time through AddListener, as in Test()
+template <typename T>
+class DynamicPipeline
+{
+public:
+    DynamicPipeline() {
+        market_data_service.AddListener(algo_execution_service.GetInListener());
+        algo_execution_service.AddListener(execution_service.GetInListener());
+        execution_service.AddListener(trade_booking_service.GetInListener());
+        trade_booking_service.AddListener(position_service.GetInListener());
+        position_service.AddListener(risk_service.GetInListener());
+    }
+    
+    DynamicPipeline(const DynamicPipeline&) = delete;
+    DynamicPipeline& operator = (const DynamicPipeline&) = delete;
+    
+    RiskService<T> risk_service;
+    PositionService<T> position_service;
+    TradeBookingService<T> trade_booking_service;
+    ExecutionService<T> execution_service;
+    AlgoExecutionService<T> algo_execution_service;
+    MarketDataService<T> market_data_service;
+};
+
+// The treasury curve buckets: front end, belly, long end
+vector<BucketedSector<Bond>> GetTreasuryBuckets()
+{
+    return {
+        BucketedSector<Bond>({ FetchBond(2), FetchBond(3) }, "FrontEnd"),
+        BucketedSector<Bond>({ FetchBond(5), FetchBond(7), FetchBond(10) }, "Belly"),
+        BucketedSector<Bond>({ FetchBond(20), FetchBond(30) }, "LongEnd")
+    };
+}
+
+// Register the treasury curve buckets, so that their risk is kept up to date on every position
+template <typename RiskServiceType>
+void RegisterTreasuryBuckets(RiskServiceType& risk_service)
+{
+    for (const auto& sector : GetTreasuryBuckets()) {
+        risk_service.RegisterBucket(sector);
+    }
+}
+
 #endif /* bond_services_hpp */
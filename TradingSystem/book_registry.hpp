@@ -0,0 +1,128 @@
+/**
+ * book_registry.hpp
+ * Interns trading book identifiers (TRSY1, TRSY2, ...) into dense indices
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) Like ProductRegistry, BookRegistry hands out a dense index (0, 1, 2, ...) per book identifier, so that positions can keep a flat per-book array instead of a map keyed on strings.
+ (2) Books are interned where a trade is created (the trade carries the index), so PositionService never looks up a string.
+ (3) Trades are created on several feed threads, so Intern takes a lock. Names live in a fixed array that never moves, so GetName reads without one.
+ (4) The known books are interned at startup (see utilities.hpp), in the order positions list them.
+ */
+
+#ifndef book_registry_hpp
+#define book_registry_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using namespace std;
+
+// Dense index of a book in BookRegistry
+typedef uint32_t BookIndex;
+
+constexpr BookIndex kInvalidBookIndex = UINT32_MAX;
+
+/**
+ * Registry of book identifiers.
+ */
+class BookRegistry
+{
+public:
+    // Most books the registry can hold
+    static constexpr size_t kMaxBooks = 1 << 10;
+
+    // Registry shared by all services
+    static BookRegistry& Instance();
+
+    BookRegistry(const BookRegistry&) = delete;
+    BookRegistry& operator = (const BookRegistry&) = delete;
+
+    // Index of the book, interning it if it is new; throws length_error when the registry is full
+    BookIndex Intern(string_view book);
+
+    // Index of the book, or kInvalidBookIndex if it was never interned
+    BookIndex Find(string_view book) const;
+
+    // Get the identifier of the book with the given index; throws if there is none
+    const string& GetName(BookIndex index) const;
+
+    // Number of interned books
+    size_t Size() const;
+
+private:
+    BookRegistry();
+
+    // Transparent hash so that identifiers can be looked up from string_view fields
+    struct IdHash
+    {
+        using is_transparent = void;
+        size_t operator()(string_view id) const { return hash<string_view>()(id); }
+    };
+
+    mutable mutex mutex_;
+    unordered_map<string, BookIndex, IdHash, equal_to<>> indices_;
+    unique_ptr<string[]> names_;
+    atomic<size_t> size_;
+};
+
+BookRegistry::BookRegistry() : names_(new string[kMaxBooks]), size_(0) {}
+
+BookRegistry& BookRegistry::Instance()
+{
+    static BookRegistry registry;
+    return registry;
+}
+
+BookIndex BookRegistry::Intern(string_view book)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto it = indices_.find(book);
+    if (it != indices_.end()) {
+        return it->second;
+    }
+
+    size_t size = size_.load(memory_order_relaxed);
+    if (size == kMaxBooks) {
+        throw length_error("BookRegistry: too many books");
+    }
+    BookIndex index = BookIndex(size);
+    names_[index] = string(book);
+    indices_.emplace(names_[index], index);
+    // Publishes the name to lock-free readers of GetName
+    size_.store(size + 1, memory_order_release);
+    return index;
+}
+
+BookIndex BookRegistry::Find(string_view book) const
+{
+    lock_guard<mutex> lock(mutex_);
+    auto it = indices_.find(book);
+    return (it != indices_.end()) ? it->second : kInvalidBookIndex;
+}
+
+const string& BookRegistry::GetName(BookIndex index) const
+{
+    if (index >= size_.load(memory_order_acquire)) {
+        throw out_of_range("BookRegistry: unknown book index " + to_string(index));
+    }
+    return names_[index];
+}
+
+size_t BookRegistry::Size() const
+{
+    return size_.load(memory_order_acquire);
+}
+
+#endif /* book_registry_hpp */
@@ -0,0 +1,243 @@
+/**
+ * bounded_ring.hpp
+ * Bounded lock-free multi-producer ring buffer, plus the wait strategies used around it
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) BoundedRing is a Vyukov style array queue. Every slot carries a sequence number that tells producers and consumers whose turn it is, so a push or pop is one compare-and-swap on a shared cursor plus a release store on the slot. No locks, no allocation after construction.
+ (2) Any number of threads may push and pop, which covers the SPSC and MPSC cases used by AsyncListener. The capacity is rounded up to a power of two so that slot indices are a mask.
+ (3) Values are constructed in place in raw slot storage, so V does not need a default constructor.
+ (4) WaitPoint lets a thread wait until a condition holds, by spinning, yielding or blocking (C++20 atomic wait). Notify only touches the futex when somebody is actually blocked, so the fast path costs a fence and a load.
+ */
+
+#ifndef bounded_ring_hpp
+#define bounded_ring_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+
+using namespace std;
+
+// How a thread waits for a ring condition
+enum WaitStrategy { SPIN, YIELD, BLOCK };
+
+// Spins between yields under SPIN, so that an oversubscribed machine still makes progress
+constexpr unsigned kSpinsPerYield = 1 << 10;
+
+// Size used to keep hot atomics on separate cache lines
+constexpr size_t kCacheLineSize = 64;
+
+// Hint to the CPU that we are in a spin loop
+inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/**
+ * A point where threads wait for a condition that other threads make true.
+ */
+class WaitPoint
+{
+public:
+    // Return once ready() holds
+    template <typename Ready>
+    void Wait(WaitStrategy strategy, Ready&& ready);
+
+    // Wake blocked waiters after making a condition true
+    void Notify();
+
+private:
+    alignas(kCacheLineSize) atomic<uint32_t> epoch_{0};
+    atomic<uint32_t> waiters_{0};
+};
+
+/**
+ * Bounded lock-free queue with a fixed number of slots.
+ */
+template <typename V>
+class BoundedRing
+{
+public:
+    // Capacity is rounded up to a power of two
+    explicit BoundedRing(size_t capacity);
+    ~BoundedRing();
+
+    BoundedRing(const BoundedRing&) = delete;
+    BoundedRing& operator = (const BoundedRing&) = delete;
+
+    // Construct a value in the next free slot. Returns false if the ring is full.
+    template <typename... Args>
+    bool TryPush(Args&&... args);
+
+    // Move the oldest value out. Returns false if the ring is empty.
+    bool TryPop(V& value);
+
+    // Call f on the oldest value in place, then destroy it. Returns false if the ring is empty.
+    template <typename F>
+    bool TryConsume(F&& f);
+
+    // Number of values in the ring (a snapshot while other threads are active)
+    size_t Size() const;
+
+    // Number of slots
+    size_t Capacity() const;
+
+private:
+    struct Slot
+    {
+        atomic<size_t> sequence;
+        alignas(V) unsigned char storage[sizeof(V)];
+
+        V* Value() { return launder(reinterpret_cast<V*>(storage)); }
+    };
+
+    size_t mask_;
+    unique_ptr<Slot[]> slots_;
+
+    alignas(kCacheLineSize) atomic<size_t> enqueue_pos_;
+    alignas(kCacheLineSize) atomic<size_t> dequeue_pos_;
+};
+
+template <typename Ready>
+void WaitPoint::Wait(WaitStrategy strategy, Ready&& ready)
+{
+    unsigned spins = 0;
+    while (!ready()) {
+        switch (strategy) {
+            case SPIN:
+                if (++spins % kSpinsPerYield == 0) {
+                    this_thread::yield();
+                } else {
+                    CpuRelax();
+                }
+                break;
+            case YIELD:
+                this_thread::yield();
+                break;
+            case BLOCK: {
+                uint32_t epoch = epoch_.load();
+                waiters_.fetch_add(1);
+                // Pairs with the fence in Notify: either we see the condition, or the notifier sees us waiting
+                atomic_thread_fence(memory_order_seq_cst);
+                if (!ready()) {
+                    epoch_.wait(epoch);
+                }
+                waiters_.fetch_sub(1);
+                break;
+            }
+        }
+    }
+}
+
+void WaitPoint::Notify()
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (waiters_.load(memory_order_relaxed) > 0) {
+        epoch_.fetch_add(1);
+        epoch_.notify_all();
+    }
+}
+
+template <typename V>
+BoundedRing<V>::BoundedRing(size_t capacity) : enqueue_pos_(0), dequeue_pos_(0)
+{
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    mask_ = size - 1;
+    slots_.reset(new Slot[size]);
+    for (size_t i = 0; i < size; i++) {
+        slots_[i].sequence.store(i, memory_order_relaxed);
+    }
+}
+
+template <typename V>
+BoundedRing<V>::~BoundedRing()
+{
+    while (TryConsume([](V&) {})) {}
+}
+
+template <typename V>
+template <typename... Args>
+bool BoundedRing<V>::TryPush(Args&&... args)
+{
+    size_t pos = enqueue_pos_.load(memory_order_relaxed);
+    while (true) {
+        Slot& slot = slots_[pos & mask_];
+        size_t sequence = slot.sequence.load(memory_order_acquire);
+        intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+        if (diff == 0) {
+            // The slot is free for this lap: claim it
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                new (slot.storage) V(std::forward<Args>(args)...);
+                slot.sequence.store(pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // The slot still holds the value from the previous lap
+            return false;
+        } else {
+            pos = enqueue_pos_.load(memory_order_relaxed);
+        }
+    }
+}
+
+template <typename V>
+bool BoundedRing<V>::TryPop(V& value)
+{
+    return TryConsume([&value](V& stored) { value = std::move(stored); });
+}
+
+template <typename V>
+template <typename F>
+bool BoundedRing<V>::TryConsume(F&& f)
+{
+    size_t pos = dequeue_pos_.load(memory_order_relaxed);
+    while (true) {
+        Slot& slot = slots_[pos & mask_];
+        size_t sequence = slot.sequence.load(memory_order_acquire);
+        intptr_t diff = intptr_t(sequence) - intptr_t(pos + 1);
+        if (diff == 0) {
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                f(*slot.Value());
+                slot.Value()->~V();
+                // Free the slot for the next lap
+                slot.sequence.store(pos + mask_ + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = dequeue_pos_.load(memory_order_relaxed);
+        }
+    }
+}
+
+template <typename V>
+size_t BoundedRing<V>::Size() const
+{
+    size_t enqueued = enqueue_pos_.load(memory_order_acquire);
+    size_t dequeued = dequeue_pos_.load(memory_order_acquire);
+    return (enqueued > dequeued) ? enqueued - dequeued : 0;
+}
+
+template <typename V>
+size_t BoundedRing<V>::Capacity() const
+{
+    return mask_ + 1;
+}
+
+#endif /* bounded_ring_hpp */
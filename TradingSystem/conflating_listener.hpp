@@ -0,0 +1,250 @@
+/**
+ * conflating_listener.hpp
+ * ServiceListener adapter that hands only the newest event per product to another listener
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) ConflatingListener<V> is a ServiceListener<V> that sits between a service and a slower listener, like AsyncListener. Instead of queueing every event, it keeps one slot per product holding the newest event, with a dirty flag and a sequence number.
+ (2) A producer overwrites the slot under its own short lock (the copy reuses the slot's storage). If the slot was already dirty, the event it replaces is counted as skipped; otherwise the product index is queued for the consumer. The queue therefore never holds more entries than there are products.
+ (3) The consumer thread takes a queued index, swaps the newest event out of the slot, clears the flag, and replays it on the wrapped listener. Products are served in the order they became dirty, each with its current state.
+ (4) The newest event per product wins, whatever its type (add, remove or update). The wrapped listener, and whatever it drives, runs on the consumer thread only.
+ */
+
+#ifndef conflating_listener_hpp
+#define conflating_listener_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "soa.hpp"
+#include "bounded_ring.hpp"
+#include "product_registry.hpp"
+
+using namespace std;
+
+/**
+ * Keeps the newest event per product for a wrapped listener, and processes them on a consumer thread.
+ * Type V is the event data type; it must be default constructible and copyable, and have GetProduct().
+ */
+template <typename V>
+class ConflatingListener : public ServiceListener<V>
+{
+public:
+    typedef remove_cvref_t<decltype(declval<V>().GetProduct())> DataProduct;
+
+    // The wrapped listener must outlive this adapter. Products must be registered before it is built.
+    ConflatingListener(ServiceListener<V>* listener, WaitStrategy wait_strategy = BLOCK);
+
+    // Processes everything still pending before returning
+    ~ConflatingListener();
+
+    ConflatingListener(const ConflatingListener&) = delete;
+    ConflatingListener& operator = (const ConflatingListener&) = delete;
+
+    // MARK: SERVICELISTENER CLASS OVERRIDE BELOW
+    // Listener callback to process an add event to the Service
+    virtual void ProcessAdd(V &data) override;
+
+    // Listener callback to process a remove event to the Service
+    virtual void ProcessRemove(V &data) override;
+
+    // Listener callback to process an update event to the Service
+    virtual void ProcessUpdate(V &data) override;
+    // MARK: SERVICELISTENER CLASS OVERRIDE ABOVE
+
+    // Block until every pending product has been processed
+    void Flush();
+
+    // Number of events replaced by a newer one before the consumer got to them
+    size_t GetSkippedCount() const;
+
+    // Number of events skipped for a product
+    size_t GetSkippedCount(ProductIndex index) const;
+
+    // Number of events received for a product (the sequence number of its newest event)
+    uint64_t GetSequence(ProductIndex index) const;
+
+private:
+    enum EventType { ADD, REMOVE, UPDATE };
+
+    struct Slot
+    {
+        mutex lock;
+        V latest;
+        EventType type = ADD;
+        bool dirty = false;
+        atomic<uint64_t> sequence{0};
+        atomic<size_t> skipped{0};
+    };
+
+    // Overwrite the product's slot, queueing it if it was clean
+    void Store(EventType type, const V& data);
+
+    // Consumer loop
+    void Run();
+
+    // Slot of a product (throws out_of_range for an unknown index)
+    Slot& GetSlot(ProductIndex index) const;
+
+    ServiceListener<V>* listener_;
+    WaitStrategy wait_strategy_;
+    size_t slot_count_;
+    unique_ptr<Slot[]> slots_;
+    BoundedRing<ProductIndex> ready_;     // Dirty products, each queued at most once
+
+    alignas(kCacheLineSize) atomic<size_t> queued_;
+    alignas(kCacheLineSize) atomic<size_t> retired_;
+    atomic<size_t> skipped_;
+    atomic<bool> stopping_;
+
+    WaitPoint data_ready_;
+    WaitPoint idle_;
+    thread thread_;
+};
+
+template <typename V>
+ConflatingListener<V>::ConflatingListener(ServiceListener<V>* listener, WaitStrategy wait_strategy) :
+  listener_(listener), wait_strategy_(wait_strategy), slot_count_(ProductRegistry<DataProduct>::Instance().Size()),
+  slots_(new Slot[slot_count_]), ready_(slot_count_), queued_(0), retired_(0), skipped_(0), stopping_(false)
+{
+    thread_ = thread(&ConflatingListener::Run, this);
+}
+
+template <typename V>
+ConflatingListener<V>::~ConflatingListener()
+{
+    Flush();
+    stopping_.store(true);
+    data_ready_.Notify();
+    thread_.join();
+}
+
+template <typename V>
+void ConflatingListener<V>::ProcessAdd(V &data)
+{
+    Store(ADD, data);
+}
+
+template <typename V>
+void ConflatingListener<V>::ProcessRemove(V &data)
+{
+    Store(REMOVE, data);
+}
+
+template <typename V>
+void ConflatingListener<V>::ProcessUpdate(V &data)
+{
+    Store(UPDATE, data);
+}
+
+template <typename V>
+typename ConflatingListener<V>::Slot& ConflatingListener<V>::GetSlot(ProductIndex index) const
+{
+    if (index >= slot_count_) {
+        throw out_of_range("ConflatingListener: product registered after the listener was built");
+    }
+    return slots_[index];
+}
+
+template <typename V>
+void ConflatingListener<V>::Store(EventType type, const V& data)
+{
+    ProductIndex index = ProductRegistry<DataProduct>::Instance().Resolve(data.GetProduct());
+    Slot& slot = GetSlot(index);
+
+    bool was_dirty;
+    {
+        lock_guard<mutex> lock(slot.lock);
+        slot.latest = data;
+        slot.type = type;
+        slot.sequence.fetch_add(1, memory_order_relaxed);
+        was_dirty = slot.dirty;
+        slot.dirty = true;
+    }
+
+    if (was_dirty) {
+        // The consumer has not taken the previous event yet: it is superseded
+        slot.skipped.fetch_add(1, memory_order_relaxed);
+        skipped_.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    // A clean slot is queued once; the ring holds one entry per product, so this cannot fail
+    ready_.TryPush(index);
+    queued_.fetch_add(1, memory_order_release);
+    data_ready_.Notify();
+}
+
+template <typename V>
+void ConflatingListener<V>::Run()
+{
+    // Events are swapped out of the slots, so this and the slots keep their storage across updates
+    V current;
+    EventType type = ADD;
+    ProductIndex index;
+
+    while (true) {
+        if (ready_.TryPop(index)) {
+            {
+                Slot& slot = slots_[index];
+                lock_guard<mutex> lock(slot.lock);
+                swap(current, slot.latest);
+                type = slot.type;
+                slot.dirty = false;
+            }
+            switch (type) {
+                case ADD:
+                    listener_->ProcessAdd(current);
+                    break;
+                case REMOVE:
+                    listener_->ProcessRemove(current);
+                    break;
+                case UPDATE:
+                    listener_->ProcessUpdate(current);
+                    break;
+            }
+            retired_.fetch_add(1, memory_order_release);
+            idle_.Notify();
+            continue;
+        }
+        if (stopping_.load() && ready_.Size() == 0) {
+            break;
+        }
+        data_ready_.Wait(wait_strategy_, [this] { return ready_.Size() > 0 || stopping_.load(); });
+    }
+}
+
+template <typename V>
+void ConflatingListener<V>::Flush()
+{
+    idle_.Wait(BLOCK, [this] { return retired_.load(memory_order_acquire) >= queued_.load(memory_order_acquire); });
+}
+
+template <typename V>
+size_t ConflatingListener<V>::GetSkippedCount() const
+{
+    return skipped_.load(memory_order_relaxed);
+}
+
+template <typename V>
+size_t ConflatingListener<V>::GetSkippedCount(ProductIndex index) const
+{
+    return GetSlot(index).skipped.load(memory_order_relaxed);
+}
+
+template <typename V>
+uint64_t ConflatingListener<V>::GetSequence(ProductIndex index) const
+{
+    return GetSlot(index).sequence.load(memory_order_relaxed);
+}
+
+#endif /* conflating_listener_hpp */
@@ -10,6 +10,10 @@
 
 #include <vector>
 #include <string>
+#include "price_tick.hpp"
+#include "product_registry.hpp"
+#include "latency.hpp"
+#include "serialization.hpp"
 
 enum OrderType { FOK, IOC, MARKET, LIMIT, STOP };
 
@@ -20,14 +24,14 @@ enum Market { BROKERTEC, ESPEED, CME };
  * Type T is the product type.
  */
 template<typename T>
-class ExecutionOrder
+class ExecutionOrder : public LatencyTagged
 {
 
 public:
 
     ExecutionOrder() = default;
     // ctor for an order
-    ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder);
+    ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, PriceTick _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder);
 
     // Get the product
     const T& GetProduct() const;
@@ -42,7 +46,7 @@ public:
     OrderType GetOrderType() const;
 
     // Get the price on this order
-    double GetPrice() const;
+    PriceTick GetPrice() const;
 
     // Get the visible quantity on this order
     long GetVisibleQuantity() const;
@@ -56,14 +60,18 @@ public:
     // Is child order?
     bool IsChildOrder() const;
     
-    vector<string> ToString() const;
+    // Most characters Serialize may write
+    size_t GetMaxSerializedSize() const;
+    
+    // Write the fields as "field,field,...," into out; returns the end of the text
+    char* Serialize(char* out) const;
 
 private:
-    T product;
+    ProductRef<T> product;     // Registered instance, shared by every copy of the event
     PricingSide side;
     string orderId;
     OrderType orderType;
-    double price;
+    PriceTick price;
     double visibleQuantity;
     double hiddenQuantity;
     string parentOrderId;
@@ -72,7 +80,7 @@ private:
 };
 
 template<typename T>
-ExecutionOrder<T>::ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder) :
+ExecutionOrder<T>::ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, PriceTick _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder) :
   product(_product)
 {
     side = _side;
@@ -88,7 +96,7 @@ ExecutionOrder<T>::ExecutionOrder(const T &_product, PricingSide _side, string _
 template<typename T>
 const T& ExecutionOrder<T>::GetProduct() const
 {
-    return product;
+    return *product;
 }
 
 template<typename T>
@@ -109,7 +117,7 @@ OrderType ExecutionOrder<T>::GetOrderType() const
 }
 
 template<typename T>
-double ExecutionOrder<T>::GetPrice() const
+PriceTick ExecutionOrder<T>::GetPrice() const
 {
     return price;
 }
@@ -139,10 +147,15 @@ bool ExecutionOrder<T>::IsChildOrder() const
 }
 
 template<typename T>
-vector<string> ExecutionOrder<T>::ToString() const
+size_t ExecutionOrder<T>::GetMaxSerializedSize() const
 {
-    string _product = product.GetProductId();
-    string _side;
+    return GetMaxFieldSize(product->GetProductId()) + GetMaxFieldSize("OFFER") + GetMaxFieldSize(orderId) + GetMaxFieldSize("MARKET") + kMaxPriceFieldSize + 2 * kMaxDoubleFieldSize + GetMaxFieldSize(parentOrderId) + GetMaxFieldSize("YES");
+}
+
+template<typename T>
+char* ExecutionOrder<T>::Serialize(char* out) const
+{
+    string_view _side;
     switch (side)
     {
     case BID:
@@ -152,8 +165,7 @@ vector<string> ExecutionOrder<T>::ToString() const
         _side = "OFFER";
         break;
     }
-    string _orderId = orderId;
-    string _orderType;
+    string_view _orderType;
     switch (orderType)
     {
     case FOK:
@@ -172,24 +184,17 @@ vector<string> ExecutionOrder<T>::ToString() const
         _orderType = "STOP";
         break;
     }
-    string _price = ConvertPrice(price);
-    string _visibleQuantity = to_string(visibleQuantity);
-    string _hiddenQuantity = to_string(hiddenQuantity);
-    string _parentOrderId = parentOrderId;
-    string _isChildOrder = isChildOrder ? "YES" : "NO";
-
-    vector<string> _strings;
-    _strings.push_back(_product);
-    _strings.push_back(_side);
-    _strings.push_back(_orderId);
-    _strings.push_back(_orderType);
-    _strings.push_back(_price);
-    _strings.push_back(_visibleQuantity);
-    _strings.push_back(_hiddenQuantity);
-    _strings.push_back(_parentOrderId);
-    _strings.push_back(_isChildOrder);
-    return _strings;
-    
+
+    out = WriteField(out, product->GetProductId());
+    out = WriteField(out, _side);
+    out = WriteField(out, orderId);
+    out = WriteField(out, _orderType);
+    out = WriteField(out, price);
+    out = WriteField(out, visibleQuantity);
+    out = WriteField(out, hiddenQuantity);
+    out = WriteField(out, parentOrderId);
+    out = WriteField(out, isChildOrder ? "YES" : "NO");
+    return out;
 }
 
 #endif /* execution_order_hpp */
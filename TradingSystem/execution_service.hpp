@@ -12,12 +12,17 @@
 
 #include <string>
 #include "soa.hpp"
+#include "static_listeners.hpp"
+#include "latency.hpp"
 #include "market_data_service.hpp"
 #include "algo_execution_service.hpp"
 #include "execution_order.hpp"
+#include "product_registry.hpp"
 
 
-template <typename T>
+template <typename T, typename Static = StaticListeners<ExecutionOrder<T>>>
+class ExecutionService;
+template <typename T, typename S = ExecutionService<T>>
 class AlgoExecutionToExecutionListener;
 
 /**
@@ -25,12 +30,18 @@ class AlgoExecutionToExecutionListener;
  * Keyed on product identifier.
  * Type T is the product type.
  */
-template<typename T>
-class ExecutionService : public Service<string, ExecutionOrder <T> >
+template <typename T, typename Static>
+class ExecutionService final : public Service<string, ExecutionOrder <T> >
 {
+public:
+    // Concrete types of the objects attached to this service, for static wiring
+    typedef AlgoExecutionToExecutionListener<T, ExecutionService> InListener;
+    
 private:
-    unordered_map<string, ExecutionOrder<T>> execution_orders_;
-    AlgoExecutionToExecutionListener<T>* in_listener_;
+    ProductStore<ExecutionOrder<T>> execution_orders_;     // Indexed by product index
+    InListener* in_listener_;
+    Static static_listeners_;
+    Connector<ExecutionOrder<T>>* out_connector_;
     
 public:
     ExecutionService();
@@ -51,20 +62,26 @@ public:
     virtual const vector<ServiceListener<ExecutionOrder<T>>*>& GetListeners() const override;
     // MARK: SERVICE CLASS OVERRIDE ABOVE
     
-    AlgoExecutionToExecutionListener<T>* GetInListener();
+    InListener* GetInListener();
+    
+    // Get the listeners wired at compile time (notified ahead of the dynamic listeners)
+    Static& GetStaticListeners();
     
     // Execute an order on a market
-    void ExecuteOrder(ExecutionOrder<T> order, Market market = CME);
+    void ExecuteOrder(const ExecutionOrder<T>& order, Market market = CME);
+    
+    // Also publish executed orders through a connector, e.g. to a venue (nullptr for none)
+    void SetConnector(Connector<ExecutionOrder<T>>* connector);
 
 };
 
-template <typename T>
-class AlgoExecutionToExecutionListener : public ServiceListener<AlgoExecutionOrder<T>> {
+template <typename T, typename S>
+class AlgoExecutionToExecutionListener final : public ServiceListener<AlgoExecutionOrder<T>> {
 private:
-    ExecutionService<T>* service_;
+    S* service_;
     
 public:
-    AlgoExecutionToExecutionListener(ExecutionService<T>* service);
+    AlgoExecutionToExecutionListener(S* service);
     ~AlgoExecutionToExecutionListener() = default;
     
     // MARK: SERVICELISTENER CLASS OVERRIDE BELOW
@@ -79,65 +96,82 @@ public:
     // MARK: SERVICELISTENER CLASS OVERRIDE ABOVE
 };
 
-template<typename T>
-ExecutionService<T>::ExecutionService() {
-    in_listener_ = new AlgoExecutionToExecutionListener<T>(this);
+template <typename T, typename Static>
+ExecutionService<T, Static>::ExecutionService() : execution_orders_(ProductRegistry<T>::Instance().Size()), out_connector_(nullptr) {
+    in_listener_ = new InListener(this);
 }
 
-template<typename T>
-ExecutionService<T>::~ExecutionService() {
+template <typename T, typename Static>
+ExecutionService<T, Static>::~ExecutionService() {
     delete in_listener_;
 }
 
-template<typename T>
-ExecutionOrder<T>& ExecutionService<T>::GetData(string product_id) {
-    return execution_orders_.at(product_id);
+template <typename T, typename Static>
+ExecutionOrder<T>& ExecutionService<T, Static>::GetData(string product_id) {
+    return execution_orders_.At(ProductRegistry<T>::Instance().GetIndex(product_id));
 }
 
-template<typename T>
-void ExecutionService<T>::OnMessage(ExecutionOrder<T>& data) {
-    string product_id = data.GetProduct().GetProductId();
+template <typename T, typename Static>
+void ExecutionService<T, Static>::OnMessage(ExecutionOrder<T>& data) {
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(data.GetProduct());
     
-    execution_orders_.insert_or_assign(product_id, data);
+    execution_orders_.InsertOrAssign(index, data);
     
     // Also notify listeners
+    static_listeners_.ProcessAdd(data);
     for (auto& listener : this->listeners_) {
         listener->ProcessAdd(data);
     }
 }
 
-template<typename T>
-void ExecutionService<T>::AddListener(ServiceListener<ExecutionOrder<T>>* listener) {
+template <typename T, typename Static>
+void ExecutionService<T, Static>::AddListener(ServiceListener<ExecutionOrder<T>>* listener) {
     this->Service<string, ExecutionOrder<T>>::AddListener(listener);
 }
 
-template<typename T>
-const vector<ServiceListener<ExecutionOrder<T>>*>& ExecutionService<T>::GetListeners() const {
+template <typename T, typename Static>
+const vector<ServiceListener<ExecutionOrder<T>>*>& ExecutionService<T, Static>::GetListeners() const {
     return this->Service<string, ExecutionOrder<T>>::GetListeners();
 }
 
-template<typename T>
-AlgoExecutionToExecutionListener<T>* ExecutionService<T>::GetInListener() {
+template <typename T, typename Static>
+typename ExecutionService<T, Static>::InListener* ExecutionService<T, Static>::GetInListener() {
     return in_listener_;
 }
 
-template<typename T>
-void ExecutionService<T>::ExecuteOrder(ExecutionOrder<T> order, Market market)
+template <typename T, typename Static>
+Static& ExecutionService<T, Static>::GetStaticListeners() {
+    return static_listeners_;
+}
+
+template <typename T, typename Static>
+void ExecutionService<T, Static>::ExecuteOrder(const ExecutionOrder<T>& order, Market market)
 {
-    string _productId = order.GetProduct().GetProductId();
-    execution_orders_[_productId] = order;
+    LATENCY_RECORD(EXECUTE_ORDER, order);
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(order.GetProduct());
+    // Assigned into the product's slot (no allocation once it exists); listeners see the stored order
+    ExecutionOrder<T>& stored = execution_orders_.InsertOrAssign(index, order);
 
+    static_listeners_.ProcessAdd(stored);
     for (auto& l : Service<string, ExecutionOrder<T>>::listeners_)
     {
-        l->ProcessAdd(order);
+        l->ProcessAdd(stored);
+    }
+    if (out_connector_ != nullptr) {
+        out_connector_->Publish(stored);
     }
 }
 
-template <typename T>
-AlgoExecutionToExecutionListener<T>::AlgoExecutionToExecutionListener(ExecutionService<T>* service) : service_(service) {}
+template <typename T, typename Static>
+void ExecutionService<T, Static>::SetConnector(Connector<ExecutionOrder<T>>* connector) {
+    out_connector_ = connector;
+}
+
+template <typename T, typename S>
+AlgoExecutionToExecutionListener<T, S>::AlgoExecutionToExecutionListener(S* service) : service_(service) {}
 
-template<typename T>
-void AlgoExecutionToExecutionListener<T>::ProcessAdd(AlgoExecutionOrder<T>& data)
+template <typename T, typename S>
+void AlgoExecutionToExecutionListener<T, S>::ProcessAdd(AlgoExecutionOrder<T>& data)
 {
     // Get the underlying execution order
     ExecutionOrder<T>* execution_order = data.GetExecutionOrder();
@@ -149,13 +183,13 @@ void AlgoExecutionToExecutionListener<T>::ProcessAdd(AlgoExecutionOrder<T>& data
     service_->ExecuteOrder(*execution_order);
 }
 
-template<typename T>
-void AlgoExecutionToExecutionListener<T>::ProcessRemove(AlgoExecutionOrder<T>& data) {
+template <typename T, typename S>
+void AlgoExecutionToExecutionListener<T, S>::ProcessRemove(AlgoExecutionOrder<T>& data) {
     // Do nothing
 }
 
-template<typename T>
-void AlgoExecutionToExecutionListener<T>::ProcessUpdate(AlgoExecutionOrder<T>& data) {
+template <typename T, typename S>
+void AlgoExecutionToExecutionListener<T, S>::ProcessUpdate(AlgoExecutionOrder<T>& data) {
     // Do nothing
 }
 
@@ -0,0 +1,556 @@
+/**
+ * executor.hpp
+ * Consumer threads that drain one or more queues, pinned and waiting as configured, with utilization and queue statistics
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) An ExecutorThread runs the ExecutorTasks attached to it in rounds: every task processes up to a batch of its queued events, so one busy queue cannot starve the others sharing the thread. When a round finds nothing to do, the thread waits with its WaitStrategy (busy-poll, yield or block) until a producer calls Notify.
+ (2) Every AsyncListener is a task. Without an executor thread in its configuration it gets a thread of its own, so the dedicated and the shared case run the same loop and report the same statistics.
+ (3) The thread is pinned to its core as it starts, best effort (see PinCurrentThread). Busy time is the time spent in rounds that processed something, so the utilization is busy time over the lifetime of the thread, whatever the wait strategy (a busy-polling thread is always on its core, but only busy while it processes).
+ (4) A round runs a snapshot of the attached tasks, taken under a mutex that is not held while the tasks run, so a task may touch the thread (e.g. run another task's pending events inline, see async_listener.hpp) without deadlocking. Detaching waits for the round in progress to end, so it returns only once the thread no longer runs the task, and the task's final statistics are kept for the report. The mutex is uncontended but for attach and detach.
+ (5) An Executor builds the threads of an ExecutorConfig, which names the threads (core, wait strategy) and assigns named queues to them. The text form has one declaration per line:
+        thread NAME [core N] [wait spin|yield|block] [batch N]
+        queue NAME thread THREAD [wait spin|yield|block] [capacity N]
+     A queue's wait strategy is how its producers wait for room; the thread's is how the consumer waits for events. Blank lines and lines starting with '#' are ignored.
+ */
+
+#ifndef executor_hpp
+#define executor_hpp
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "bounded_ring.hpp"
+
+using namespace std;
+
+// Pin the calling thread to a core; false if the platform or the core does not allow it
+bool PinCurrentThread(unsigned core);
+
+/**
+ * Settings of an ExecutorThread.
+ */
+struct ExecutorThreadConfig
+{
+    string name;
+
+    // Core the thread is pinned to (-1 to leave it to the scheduler)
+    int core = -1;
+
+    // How the thread waits for events when every queue is empty
+    WaitStrategy wait_strategy = BLOCK;
+
+    // Events a queue processes per round before the next queue's turn
+    size_t batch = 64;
+};
+
+/**
+ * Statistics of one queue run by an ExecutorThread.
+ */
+struct ExecutorQueueStats
+{
+    string name;
+    uint64_t events = 0;
+    size_t high_water_mark = 0;     // Most events queued at once
+    size_t capacity = 0;
+};
+
+/**
+ * Statistics of an ExecutorThread.
+ */
+struct ExecutorThreadStats
+{
+    uint64_t events = 0;
+    uint64_t wakeups = 0;           // Waits for events that ended
+    double busy_seconds = 0;
+    double elapsed_seconds = 0;
+
+    // Share of the lifetime of the thread spent processing events
+    double GetUtilization() const;
+};
+
+/**
+ * A queue drained by an ExecutorThread.
+ */
+class ExecutorTask
+{
+public:
+    virtual ~ExecutorTask() = default;
+
+    // Process up to max queued events, on the executor thread; returns how many were processed
+    virtual size_t RunPending(size_t max) = 0;
+
+    // Whether events are queued
+    virtual bool HasPending() const = 0;
+
+    // Name, capacity, events processed and high water mark of the queue
+    virtual ExecutorQueueStats GetQueueStats() const = 0;
+};
+
+/**
+ * A consumer thread running the tasks attached to it.
+ */
+class ExecutorThread
+{
+public:
+    // Starts the thread
+    explicit ExecutorThread(ExecutorThreadConfig config);
+
+    // Stops the thread; every task must have been detached
+    ~ExecutorThread();
+
+    ExecutorThread(const ExecutorThread&) = delete;
+    ExecutorThread& operator = (const ExecutorThread&) = delete;
+
+    // Attach a task
+    void Add(ExecutorTask* task);
+
+    // Detach a task; returns once the thread no longer runs it. Not to be called from a task.
+    void Remove(ExecutorTask* task);
+
+    // Whether the caller is this thread (e.g. a task producing into another task of the same thread)
+    bool RunningInThisThread() const;
+
+    // Wake the thread after queuing events
+    void Notify();
+
+    // Get the settings
+    const ExecutorThreadConfig& GetConfig() const;
+
+    // Whether the thread is pinned to its core
+    bool IsPinned() const;
+
+    // Statistics so far
+    ExecutorThreadStats GetStats() const;
+
+    // Statistics of the attached queues, and of the queues detached so far
+    vector<ExecutorQueueStats> GetQueueStats() const;
+
+private:
+    // Thread loop
+    void Run();
+
+    // Whether any attached task has events queued
+    bool HasPending() const;
+
+    ExecutorThreadConfig config_;
+    chrono::steady_clock::time_point start_;
+
+    mutable mutex tasks_mutex_;
+    vector<ExecutorTask*> tasks_;
+    vector<ExecutorQueueStats> detached_;
+    bool tasks_changed_;            // Since the thread last took its snapshot
+    bool in_round_;
+    uint64_t rounds_;               // Rounds ended
+    condition_variable round_ended_;
+    atomic<thread::id> thread_id_;
+
+    WaitPoint work_ready_;
+    atomic<bool> stopping_;
+    atomic<bool> pinned_;
+    atomic<uint64_t> events_;
+    atomic<uint64_t> wakeups_;
+    atomic<uint64_t> busy_nanoseconds_;
+    thread thread_;
+};
+
+/**
+ * Assignment of a named queue to an executor thread.
+ */
+struct ExecutorQueueConfig
+{
+    string name;
+    string thread;
+
+    // How producers wait for room, and the number of slots (the queue's own defaults when not set)
+    optional<WaitStrategy> wait_strategy;
+    optional<size_t> capacity;
+};
+
+/**
+ * The threads of an executor and the queues they run.
+ */
+struct ExecutorConfig
+{
+    vector<ExecutorThreadConfig> threads;
+    vector<ExecutorQueueConfig> queues;
+};
+
+// Parse the text form of an executor configuration; throws invalid_argument with the line of an error
+ExecutorConfig ParseExecutorConfig(istream& in);
+
+// Parse an executor configuration file
+ExecutorConfig LoadExecutorConfig(const string& path);
+
+/**
+ * Owns the threads of an ExecutorConfig.
+ */
+class Executor
+{
+public:
+    // Starts every thread; throws invalid_argument if a queue names an unknown thread or a name is declared twice
+    explicit Executor(ExecutorConfig config);
+
+    // Get a thread by name, or nullptr
+    ExecutorThread* FindThread(const string& name);
+
+    // Get the assignment of a queue by name, or nullptr if it runs as the application sets it up
+    const ExecutorQueueConfig* FindQueue(const string& name) const;
+
+    // Print the utilization of every thread and the high water marks of its queues
+    void PrintStats(ostream& out) const;
+
+private:
+    ExecutorConfig config_;
+    vector<unique_ptr<ExecutorThread>> threads_;
+};
+
+// Name of a wait strategy in the configuration ("spin", "yield" or "block")
+const char* GetWaitStrategyName(WaitStrategy strategy);
+
+// Wait strategy of a name; throws invalid_argument for anything else
+WaitStrategy ParseWaitStrategy(const string& name);
+
+bool PinCurrentThread(unsigned core)
+{
+#if defined(__linux__)
+    if (core >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+    (void)core;
+    return false;
+#endif
+}
+
+double ExecutorThreadStats::GetUtilization() const
+{
+    return (elapsed_seconds > 0) ? busy_seconds / elapsed_seconds : 0.;
+}
+
+ExecutorThread::ExecutorThread(ExecutorThreadConfig config) :
+  config_(std::move(config)), start_(chrono::steady_clock::now()), tasks_changed_(false), in_round_(false), rounds_(0), stopping_(false), pinned_(false), events_(0), wakeups_(0), busy_nanoseconds_(0)
+{
+    if (config_.batch == 0) {
+        config_.batch = 1;
+    }
+    thread_ = thread(&ExecutorThread::Run, this);
+}
+
+ExecutorThread::~ExecutorThread()
+{
+    stopping_.store(true);
+    work_ready_.Notify();
+    thread_.join();
+}
+
+void ExecutorThread::Add(ExecutorTask* task)
+{
+    {
+        lock_guard<mutex> lock(tasks_mutex_);
+        tasks_.push_back(task);
+        tasks_changed_ = true;
+    }
+    work_ready_.Notify();
+}
+
+void ExecutorThread::Remove(ExecutorTask* task)
+{
+    unique_lock<mutex> lock(tasks_mutex_);
+    auto it = find(tasks_.begin(), tasks_.end(), task);
+    if (it == tasks_.end()) {
+        return;
+    }
+    tasks_.erase(it);
+    tasks_changed_ = true;
+    // The round in progress may still run the task from its snapshot; the next one takes a new snapshot
+    if (in_round_ && !RunningInThisThread()) {
+        uint64_t round = rounds_;
+        round_ended_.wait(lock, [this, round] { return rounds_ != round; });
+    }
+    detached_.push_back(task->GetQueueStats());
+}
+
+bool ExecutorThread::RunningInThisThread() const
+{
+    return thread_id_.load(memory_order_relaxed) == this_thread::get_id();
+}
+
+void ExecutorThread::Notify()
+{
+    work_ready_.Notify();
+}
+
+const ExecutorThreadConfig& ExecutorThread::GetConfig() const
+{
+    return config_;
+}
+
+bool ExecutorThread::IsPinned() const
+{
+    return pinned_.load(memory_order_relaxed);
+}
+
+ExecutorThreadStats ExecutorThread::GetStats() const
+{
+    ExecutorThreadStats stats;
+    stats.events = events_.load(memory_order_relaxed);
+    stats.wakeups = wakeups_.load(memory_order_relaxed);
+    stats.busy_seconds = double(busy_nanoseconds_.load(memory_order_relaxed)) * 1e-9;
+    stats.elapsed_seconds = chrono::duration<double>(chrono::steady_clock::now() - start_).count();
+    return stats;
+}
+
+vector<ExecutorQueueStats> ExecutorThread::GetQueueStats() const
+{
+    lock_guard<mutex> lock(tasks_mutex_);
+    vector<ExecutorQueueStats> stats = detached_;
+    for (ExecutorTask* task : tasks_) {
+        stats.push_back(task->GetQueueStats());
+    }
+    return stats;
+}
+
+bool ExecutorThread::HasPending() const
+{
+    lock_guard<mutex> lock(tasks_mutex_);
+    for (ExecutorTask* task : tasks_) {
+        if (task->HasPending()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ExecutorThread::Run()
+{
+    thread_id_.store(this_thread::get_id(), memory_order_relaxed);
+    if (config_.core >= 0) {
+        pinned_.store(PinCurrentThread(unsigned(config_.core)), memory_order_relaxed);
+    }
+
+    vector<ExecutorTask*> round_tasks;
+    while (true) {
+        auto round_start = chrono::steady_clock::now();
+        size_t processed = 0;
+        {
+            lock_guard<mutex> lock(tasks_mutex_);
+            if (tasks_changed_) {
+                round_tasks = tasks_;
+                tasks_changed_ = false;
+            }
+            in_round_ = true;
+        }
+        for (ExecutorTask* task : round_tasks) {
+            processed += task->RunPending(config_.batch);
+        }
+        {
+            lock_guard<mutex> lock(tasks_mutex_);
+            in_round_ = false;
+            rounds_++;
+        }
+        round_ended_.notify_all();
+        if (processed > 0) {
+            events_.fetch_add(processed, memory_order_relaxed);
+            busy_nanoseconds_.fetch_add(uint64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - round_start).count()), memory_order_relaxed);
+            continue;
+        }
+        // Tasks are detached (and so drained) before the thread stops
+        if (stopping_.load()) {
+            break;
+        }
+        work_ready_.Wait(config_.wait_strategy, [this] { return stopping_.load() || HasPending(); });
+        wakeups_.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+const char* GetWaitStrategyName(WaitStrategy strategy)
+{
+    switch (strategy) {
+        case SPIN:
+            return "spin";
+        case YIELD:
+            return "yield";
+        case BLOCK:
+            return "block";
+    }
+    return "block";
+}
+
+WaitStrategy ParseWaitStrategy(const string& name)
+{
+    if (name == "spin") {
+        return SPIN;
+    } else if (name == "yield") {
+        return YIELD;
+    } else if (name == "block") {
+        return BLOCK;
+    }
+    throw invalid_argument("unknown wait strategy " + name);
+}
+
+ExecutorConfig ParseExecutorConfig(istream& in)
+{
+    ExecutorConfig config;
+    string line;
+    for (size_t number = 1; getline(in, line); number++) {
+        istringstream words(line);
+        string kind;
+        if (!(words >> kind) || kind[0] == '#') {
+            continue;
+        }
+        try {
+            string name;
+            if (!(words >> name)) {
+                throw invalid_argument("missing name");
+            }
+            // The rest of the line is key value pairs
+            auto next_value = [&](const string& key) {
+                string value;
+                if (!(words >> value)) {
+                    throw invalid_argument("missing value of " + key);
+                }
+                return value;
+            };
+            if (kind == "thread") {
+                ExecutorThreadConfig thread_config;
+                thread_config.name = name;
+                for (string key; words >> key;) {
+                    if (key == "core") {
+                        string core = next_value(key);
+                        thread_config.core = (core == "-") ? -1 : stoi(core);
+                    } else if (key == "wait") {
+                        thread_config.wait_strategy = ParseWaitStrategy(next_value(key));
+                    } else if (key == "batch") {
+                        thread_config.batch = stoul(next_value(key));
+                    } else {
+                        throw invalid_argument("unknown thread setting " + key);
+                    }
+                }
+                config.threads.push_back(thread_config);
+            } else if (kind == "queue") {
+                ExecutorQueueConfig queue_config;
+                queue_config.name = name;
+                for (string key; words >> key;) {
+                    if (key == "thread") {
+                        queue_config.thread = next_value(key);
+                    } else if (key == "wait") {
+                        queue_config.wait_strategy = ParseWaitStrategy(next_value(key));
+                    } else if (key == "capacity") {
+                        queue_config.capacity = stoul(next_value(key));
+                    } else {
+                        throw invalid_argument("unknown queue setting " + key);
+                    }
+                }
+                if (queue_config.thread.empty()) {
+                    throw invalid_argument("queue " + name + " has no thread");
+                }
+                config.queues.push_back(queue_config);
+            } else {
+                throw invalid_argument("unknown declaration " + kind);
+            }
+        } catch (const logic_error& error) {
+            // invalid_argument and out_of_range, also from stoi and stoul
+            throw invalid_argument("ParseExecutorConfig: line " + to_string(number) + ": " + error.what());
+        }
+    }
+    return config;
+}
+
+ExecutorConfig LoadExecutorConfig(const string& path)
+{
+    ifstream in(path);
+    if (!in) {
+        throw runtime_error("LoadExecutorConfig: cannot open " + path);
+    }
+    return ParseExecutorConfig(in);
+}
+
+Executor::Executor(ExecutorConfig config) : config_(std::move(config))
+{
+    for (size_t i = 0; i < config_.threads.size(); i++) {
+        for (size_t j = 0; j < i; j++) {
+            if (config_.threads[j].name == config_.threads[i].name) {
+                throw invalid_argument("Executor: thread " + config_.threads[i].name + " is declared twice");
+            }
+        }
+    }
+    for (size_t i = 0; i < config_.queues.size(); i++) {
+        for (size_t j = 0; j < i; j++) {
+            if (config_.queues[j].name == config_.queues[i].name) {
+                throw invalid_argument("Executor: queue " + config_.queues[i].name + " is assigned twice");
+            }
+        }
+        bool known = any_of(config_.threads.begin(), config_.threads.end(), [&](const ExecutorThreadConfig& thread_config) { return thread_config.name == config_.queues[i].thread; });
+        if (!known) {
+            throw invalid_argument("Executor: queue " + config_.queues[i].name + " names unknown thread " + config_.queues[i].thread);
+        }
+    }
+    for (const ExecutorThreadConfig& thread_config : config_.threads) {
+        threads_.push_back(make_unique<ExecutorThread>(thread_config));
+    }
+}
+
+ExecutorThread* Executor::FindThread(const string& name)
+{
+    for (auto& executor_thread : threads_) {
+        if (executor_thread->GetConfig().name == name) {
+            return executor_thread.get();
+        }
+    }
+    return nullptr;
+}
+
+const ExecutorQueueConfig* Executor::FindQueue(const string& name) const
+{
+    for (const ExecutorQueueConfig& queue_config : config_.queues) {
+        if (queue_config.name == name) {
+            return &queue_config;
+        }
+    }
+    return nullptr;
+}
+
+void Executor::PrintStats(ostream& out) const
+{
+    for (const auto& executor_thread : threads_) {
+        const ExecutorThreadConfig& thread_config = executor_thread->GetConfig();
+        ExecutorThreadStats stats = executor_thread->GetStats();
+        out << "Executor thread " << thread_config.name << " (";
+        if (thread_config.core >= 0) {
+            out << "core " << thread_config.core << (executor_thread->IsPinned() ? "" : " not pinned") << ", ";
+        }
+        out << GetWaitStrategyName(thread_config.wait_strategy) << "): " << stats.events << " events, " << stats.wakeups << " wakeups, utilization "
+            << stats.GetUtilization() * 100 << "% of " << stats.elapsed_seconds << " s" << endl;
+        for (const ExecutorQueueStats& queue_stats : executor_thread->GetQueueStats()) {
+            out << "  Queue " << queue_stats.name << ": " << queue_stats.events << " events, high water mark " << queue_stats.high_water_mark << " of " << queue_stats.capacity << endl;
+        }
+    }
+}
+
+#endif /* executor_hpp */
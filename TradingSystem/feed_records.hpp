@@ -0,0 +1,96 @@
+/**
+ * feed_records.hpp
+ * Fixed-layout records of the inbound feeds (prices, market data, trades, inquiries), stored as journals
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) The binary form of a feed is a journal (see journal.hpp) with one record per line of the text feed, in the same order. The timestamp of an entry is the time of the line within the feed, so feeds can be lined up against each other.
+ (2) Identifiers are fixed-width, NUL padded fields; prices are ticks and quantities integers, so a record carries exactly what the connector would parse from the text line.
+ (3) Enumerations (sides, inquiry states) are stored as their underlying values in single bytes.
+ */
+
+#ifndef feed_records_hpp
+#define feed_records_hpp
+
+#include <cstdint>
+#include <string>
+
+#include "journal.hpp"
+
+using namespace std;
+
+// Record type tags stored in the feed journal headers (clear of the historical data tags)
+enum FeedRecordType : uint32_t { PRICE_FEED_RECORD = 101, MARKET_DATA_FEED_RECORD, TRADE_FEED_RECORD, INQUIRY_FEED_RECORD, MARKET_DATA_UPDATE_FEED_RECORD };
+
+// Width of product identifier fields
+constexpr size_t kFeedProductIdSize = 16;
+
+// Width of trade, inquiry and book identifier fields
+constexpr size_t kFeedIdSize = 32;
+
+// A line of prices.txt: "product,bid,offer"
+struct PriceFeedRecord
+{
+    char product_id[kFeedProductIdSize];
+    int64_t bid;                 // Ticks
+    int64_t offer;               // Ticks
+};
+
+// A line of marketdata.txt, one order of a book: "product,price,quantity,side"
+struct MarketDataFeedRecord
+{
+    char product_id[kFeedProductIdSize];
+    int64_t price;               // Ticks
+    int64_t quantity;
+    uint8_t side;                // PricingSide
+    uint8_t padding[7];
+};
+
+// A line of marketdata_incremental.txt, one level change of a book: "sequence,product,action,price,quantity,side,end"
+struct MarketDataUpdateFeedRecord
+{
+    char product_id[kFeedProductIdSize];
+    uint64_t sequence;           // Update of the product, from 1
+    int64_t price;               // Ticks
+    int64_t quantity;
+    uint8_t action;              // MarketDataAction
+    uint8_t side;                // PricingSide
+    uint8_t end;                 // Last change of the update
+    uint8_t padding[5];
+};
+
+// A line of trades.txt: "product,trade id,price,book,quantity,side"
+struct TradeFeedRecord
+{
+    char product_id[kFeedProductIdSize];
+    char trade_id[kFeedIdSize];
+    char book[kFeedIdSize];
+    int64_t price;               // Ticks
+    int64_t quantity;
+    uint8_t side;                // Side
+    uint8_t padding[7];
+};
+
+// A line of inquiries.txt: "inquiry id,product,side,quantity,price,state"
+struct InquiryFeedRecord
+{
+    char inquiry_id[kFeedIdSize];
+    char product_id[kFeedProductIdSize];
+    int64_t quantity;
+    int64_t price;               // Ticks
+    uint8_t side;                // Side
+    uint8_t state;               // InquiryState
+    uint8_t padding[6];
+};
+
+// Binary feed file that goes with a text feed file ("prices.txt" -> "prices.bin")
+string GetFeedJournalPath(const string& text_path)
+{
+    size_t dot = text_path.rfind('.');
+    return text_path.substr(0, dot) + ".bin";
+}
+
+#endif /* feed_records_hpp */
@@ -5,12 +5,29 @@
 //  Created by 王明森 on 12/23/22.
 //
 
+/*
+ Design:
+ (1) GUIService conflates: OnMessage only overwrites the latest price of the product in its slot, and a timer thread publishes the slots updated since its last pass every throttle_ ms. GUI output is therefore bounded by (number of products) lines per throttle period, whatever the feed rate.
+ (2) A slot is a seqlock over the two tick counts. The writer never waits, and the timer retries the (rare) read that overlaps a write. The slot's sequence doubles as its dirty flag: it is compared with the sequence published last.
+ (3) OnMessage must be called from one thread at a time (the pricing feed, or a queue consumer), which is what the seqlock assumes.
+ (4) GUIConnector writes to gui.txt through one AsyncFileWriter that stays open for the lifetime of the service. The latest prices are published once more on shutdown.
+ */
+
 #ifndef gui_service_hpp
 #define gui_service_hpp
 
 #include "pricing_service.hpp"
 #include "utilities.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <vector>
+#include "product_registry.hpp"
+#include "async_writer.hpp"
+#include "serialization.hpp"
 
 template<typename T>
 class GUIConnector;
@@ -20,14 +37,39 @@ class PricingToGUIListener;
 template<typename T>
 class GUIService : Service<string, Price<T>> {
 private:
-    unordered_map<string, Price<T>> guis_;
+    // Latest ticks of a product, written by OnMessage and read by the timer thread
+    struct PriceSlot
+    {
+        atomic<uint64_t> sequence{0};     // Odd while being written, advances by two per update
+        atomic<long> mid{0};
+        atomic<long> spread{0};
+    };
+    
+    ProductStore<Price<T>> guis_;     // Indexed by product index
     GUIConnector<T>* out_connector_;
     ServiceListener<Price<T>>* in_listener_;
     int throttle_;
-    long millisec_;
+    
+    unique_ptr<PriceSlot[]> slots_;     // Indexed by product index
+    size_t slot_count_;
+    vector<uint64_t> published_;     // Sequence of each slot at its last publication (timer thread only)
+    
+    mutex timer_mutex_;
+    condition_variable timer_cv_;
+    bool stopping_;
+    thread timer_;
+    
+    // Timer loop: publish the updated slots every throttle period
+    void Run();
+    
+    // Publish every slot updated since its last publication
+    void PublishUpdated();
 
 public:
-    GUIService();
+    // Starts the timer thread; throttle is the publication period in milliseconds
+    GUIService(int throttle = 300);
+    
+    // Publishes the latest prices, then stops the timer thread
     ~GUIService();
 
     // MARK: SERVICE CLASS OVERRIDE BELOW
@@ -50,21 +92,17 @@ public:
     // Get the listener of the service
     ServiceListener<Price<T>>* GetInListener();
 
-    // Get the throttle of the service
+    // Get the throttle of the service (publication period in milliseconds)
     int GetThrottle() const;
 
-    // Get the millisec of the service
-    long GetMillisec() const;
-
-    // Set the millisec of the service
-    void SetMillisec(long _millisec);
-
 };
 
 template<typename T>
 class GUIConnector : public Connector<Price<T>> {
 private:
     GUIService<T>* service_;
+    AsyncFileWriter writer_;
+    vector<char> buffer_;     // Reused line buffer
 
 public:
     GUIConnector(GUIService<T>* _service);
@@ -74,7 +112,7 @@ public:
     void Publish(Price<T>& data);
 
     // Subscribe data from the Connector
-    void Subscribe(ifstream& data);
+    void Subscribe(istream& data);
 
 };
 
@@ -102,29 +140,50 @@ public:
 };
 
 template<typename T>
-GUIService<T>::GUIService() : throttle_(300), millisec_(0) {
+GUIService<T>::GUIService(int throttle) :
+  guis_(ProductRegistry<T>::Instance().Size()), throttle_(throttle), slot_count_(ProductRegistry<T>::Instance().Size()), published_(slot_count_, 0), stopping_(false)
+{
+    slots_.reset(new PriceSlot[slot_count_]);
     out_connector_ = new GUIConnector<T>(this);
     in_listener_ = new PricingToGUIListener<T>(this);
+    timer_ = thread(&GUIService::Run, this);
 }
 
 template<typename T>
 GUIService<T>::~GUIService() {
+    {
+        lock_guard<mutex> lock(timer_mutex_);
+        stopping_ = true;
+    }
+    timer_cv_.notify_one();
+    timer_.join();
     delete out_connector_;
     delete in_listener_;
 }
 
 template <typename T>
 Price<T>& GUIService<T>::GetData(string product_id) {
-    return guis_[product_id];
+    return guis_[ProductRegistry<T>::Instance().GetIndex(product_id)];
 }
 
 template <typename T>
 void GUIService<T>::OnMessage(Price<T>& data) {
-    string product_id = data.GetProduct().GetProductId();
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(data.GetProduct());
     
-    guis_.insert_or_assign(product_id, data);
+    guis_.InsertOrAssign(index, data);
 //    guis_[product_id] = data;
-    out_connector_->Publish(data);
+    
+    // Conflate into the slot; the timer thread publishes it (products are registered before services are built)
+    if (index >= slot_count_) {
+        throw out_of_range("GUIService: product registered after the service was built");
+    }
+    PriceSlot& slot = slots_[index];
+    uint64_t sequence = slot.sequence.load(memory_order_relaxed);
+    slot.sequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot.mid.store(data.GetMid().GetTicks(), memory_order_relaxed);
+    slot.spread.store(data.GetBidOfferSpread().GetTicks(), memory_order_relaxed);
+    slot.sequence.store(sequence + 2, memory_order_release);
 //    // Also notify listeners
 //    for (auto& listener : Service<string, Price<T>>::listeners_) {
 //        listener->ProcessAdd(data);
@@ -157,43 +216,65 @@ int GUIService<T>::GetThrottle() const {
 }
 
 template<typename T>
-long GUIService<T>::GetMillisec() const {
-    return millisec_;
+void GUIService<T>::Run() {
+    unique_lock<mutex> lock(timer_mutex_);
+    while (true) {
+        bool stopping = timer_cv_.wait_for(lock, chrono::milliseconds(throttle_), [this] { return stopping_; });
+        lock.unlock();
+        // On shutdown this is the final pass, so the latest prices are always written
+        PublishUpdated();
+        lock.lock();
+        if (stopping) {
+            break;
+        }
+    }
 }
 
 template<typename T>
-void GUIService<T>::SetMillisec(long millisec) {
-    millisec_ = millisec;
+void GUIService<T>::PublishUpdated() {
+    const ProductRegistry<T>& registry = ProductRegistry<T>::Instance();
+    for (size_t index = 0; index < slot_count_; index++) {
+        PriceSlot& slot = slots_[index];
+        
+        // Seqlock read: retry while a write is in progress or overlapped the read
+        uint64_t sequence;
+        long mid;
+        long spread;
+        while (true) {
+            sequence = slot.sequence.load(memory_order_acquire);
+            if (sequence & 1) {
+                this_thread::yield();
+                continue;
+            }
+            mid = slot.mid.load(memory_order_relaxed);
+            spread = slot.spread.load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            if (slot.sequence.load(memory_order_relaxed) == sequence) {
+                break;
+            }
+        }
+        
+        if (sequence == published_[index]) {
+            continue;
+        }
+        published_[index] = sequence;
+        Price<T> price(registry.Get(ProductIndex(index)), PriceTick(mid), PriceTick(spread));
+        out_connector_->Publish(price);
+    }
 }
 
 template<typename T>
-GUIConnector<T>::GUIConnector(GUIService<T>* service) : service_(service) {}
+GUIConnector<T>::GUIConnector(GUIService<T>* service) : service_(service), writer_("gui.txt") {}
 
 template<typename T>
 void GUIConnector<T>::Publish(Price<T>& data)
 {
-    int throttle = service_->GetThrottle();
-    long millisec = service_->GetMillisec();
-    long millisec_now = GetMillisecond();
-    while (millisec_now < millisec) millisec_now += 1000;
-    if (millisec_now - millisec >= throttle)
-    {
-        service_->SetMillisec(millisec_now);
-        ofstream file;
-        file.open("gui.txt", ios::app);
-
-        file << GetTimestamp() << ",";
-        vector<string> strings = data.ToString();
-        for (auto& s : strings)
-        {
-            file << s << ",";
-        }
-        file << endl;
-    }
+    // Called by the timer thread only, so the line buffer can be reused
+    writer_.Append(SerializeRecord(buffer_, data));
 }
 
 template<typename T>
-void GUIConnector<T>::Subscribe(ifstream& data) {}
+void GUIConnector<T>::Subscribe(istream& data) {}
 
 template<typename T>
 PricingToGUIListener<T>::PricingToGUIListener(GUIService<T>* service) : service_(service) {}
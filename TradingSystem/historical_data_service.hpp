@@ -11,10 +11,44 @@
 
 #include "soa.hpp"
 #include <unordered_map>
+#include <string>
 #include "utilities.hpp"
+#include "async_writer.hpp"
+#include "serialization.hpp"
+#include "journal_records.hpp"
+#include "product_registry.hpp"
+#include <memory>
+#include <type_traits>
+#include <vector>
 
 enum ServiceType { POSITION, RISK, EXECUTION, STREAMING, INQUIRY };
 
+// How historical data is persisted: comma separated text, a binary journal, or both
+enum PersistFormat { TEXT, BINARY, TEXT_AND_BINARY };
+
+// File that a service type is persisted to
+string GetHistoricalDataPath(ServiceType type) {
+    switch (type) {
+        case POSITION:
+            return "positions.txt";
+        case RISK:
+            return "risk.txt";
+        case EXECUTION:
+            return "executions.txt";
+        case STREAMING:
+            return "streaming.txt";
+        case INQUIRY:
+            return "allinquiries.txt";
+    }
+    return "";
+}
+
+// Binary journal that a service type is persisted to
+string GetHistoricalJournalPath(ServiceType type) {
+    string path = GetHistoricalDataPath(type);
+    return path.substr(0, path.rfind('.')) + ".journal";
+}
+
 template<typename T>
 class HistoricalDataConnector;
 template<typename T>
@@ -29,14 +63,19 @@ template<typename T>
 class HistoricalDataService : Service<string,T>
 {
 private:
-    unordered_map<string, T> historical_datas_;
+    // Product type of the persisted data
+    typedef remove_cvref_t<decltype(declval<T>().GetProduct())> DataProduct;
+    
+    ProductStore<T> historical_datas_;     // Indexed by product index
     HistoricalDataConnector<T>* out_connector_;
     ServiceListener<T>* in_listener_;
     ServiceType type_;
+    PersistFormat format_;
+    FlushPolicy flush_policy_;
     
 public:
     HistoricalDataService();
-    HistoricalDataService(ServiceType _type);
+    HistoricalDataService(ServiceType _type, PersistFormat _format = TEXT, FlushPolicy _flush_policy = FlushPolicy());
     ~HistoricalDataService();
     
     // MARK: SERVICE CLASS OVERRIDE BELOW
@@ -61,15 +100,23 @@ public:
     ServiceListener<T>* GetInListener();
     
     // Persist data to a store
-    void PersistData(string persistKey, T data);
+    void PersistData(const string& persistKey, T& data);
     
     ServiceType GetServiceType() const;
+    
+    // Get the persistence format
+    PersistFormat GetPersistFormat() const;
+    
+    // Get the flush policy of the persistent store
+    const FlushPolicy& GetFlushPolicy() const;
 };
 
 template<typename T>
 class HistoricalDataConnector : public Connector<T> {
 private:
     HistoricalDataService<T>* service_;
+    unique_ptr<AsyncFileWriter> writer_;    // Text store
+    unique_ptr<JournalWriter<typename JournalCodec<T>::Record>> journal_;    // Binary store
 
 public:
     HistoricalDataConnector(HistoricalDataService<T>* service_);
@@ -79,7 +126,7 @@ public:
     virtual void Publish(T& data) override;
 
     // Subscribe data from the Connector
-    virtual void Subscribe(ifstream& data) override;
+    virtual void Subscribe(istream& data) override;
 
 };
 
@@ -107,13 +154,13 @@ public:
 
 
 template<typename T>
-HistoricalDataService<T>::HistoricalDataService() : type_(INQUIRY) {
+HistoricalDataService<T>::HistoricalDataService() : historical_datas_(ProductRegistry<DataProduct>::Instance().Size()), type_(INQUIRY), format_(TEXT) {
     out_connector_ = new HistoricalDataConnector<T>(this);
     in_listener_ = new HistoricalDataListener<T>(this);
 }
 
 template<typename T>
-HistoricalDataService<T>::HistoricalDataService(ServiceType type) : type_(type) {
+HistoricalDataService<T>::HistoricalDataService(ServiceType type, PersistFormat format, FlushPolicy flush_policy) : historical_datas_(ProductRegistry<DataProduct>::Instance().Size()), type_(type), format_(format), flush_policy_(flush_policy) {
     out_connector_ = new HistoricalDataConnector<T>(this);
     in_listener_ = new HistoricalDataListener<T>(this);
 }
@@ -126,14 +173,14 @@ HistoricalDataService<T>::~HistoricalDataService() {
 
 template <typename T>
 T& HistoricalDataService<T>::GetData(string product_id) {
-    return historical_datas_[product_id];
+    return historical_datas_[ProductRegistry<DataProduct>::Instance().GetIndex(product_id)];
 }
 
 template <typename T>
 void HistoricalDataService<T>::OnMessage(T& data) {
-    string product_id = data.GetProduct().GetProductId();
+    ProductIndex index = ProductRegistry<DataProduct>::Instance().Resolve(data.GetProduct());
     
-    historical_datas_[product_id] = data;
+    historical_datas_.InsertOrAssign(index, data);
     
 //    // Also notify listeners
 //    for (auto& listener : Service<string, Price<T>>::listeners_) {
@@ -168,48 +215,57 @@ ServiceType HistoricalDataService<T>::GetServiceType() const
 }
 
 template<typename T>
-void HistoricalDataService<T>::PersistData(string persistKey, T data) {
-    out_connector_->Publish(data);
+PersistFormat HistoricalDataService<T>::GetPersistFormat() const
+{
+    return format_;
+}
+
+template<typename T>
+const FlushPolicy& HistoricalDataService<T>::GetFlushPolicy() const
+{
+    return flush_policy_;
 }
 
 template<typename T>
-HistoricalDataConnector<T>::HistoricalDataConnector(HistoricalDataService<T>* service) : service_(service) {}
+void HistoricalDataService<T>::PersistData(const string& persistKey, T& data) {
+    out_connector_->Publish(data);
+}
 
+// The stores stay open for the lifetime of the connector
 template<typename T>
-void HistoricalDataConnector<T>::Publish(T& data)
+HistoricalDataConnector<T>::HistoricalDataConnector(HistoricalDataService<T>* service) : service_(service)
 {
     ServiceType type = service_->GetServiceType();
-    ofstream file;
-    switch (type)
-    {
-    case POSITION:
-        file.open("positions.txt", ios::app);
-        break;
-    case RISK:
-        file.open("risk.txt", ios::app);
-        break;
-    case EXECUTION:
-        file.open("executions.txt", ios::app);
-        break;
-    case STREAMING:
-        file.open("streaming.txt", ios::app);
-        break;
-    case INQUIRY:
-        file.open("allinquiries.txt", ios::app);
-        break;
+    PersistFormat format = service_->GetPersistFormat();
+    if (format != BINARY) {
+        writer_ = make_unique<AsyncFileWriter>(GetHistoricalDataPath(type), service_->GetFlushPolicy());
+    }
+    if (format != TEXT) {
+        // Appended to across runs like the text store, so the two copies hold the same records
+        typedef JournalWriter<typename JournalCodec<T>::Record> Journal;
+        journal_ = make_unique<Journal>(GetHistoricalJournalPath(type), JournalCodec<T>::kRecordType, Journal::kDefaultSegmentEntries, JOURNAL_APPEND);
     }
+}
 
-    file << GetTimestamp() << ",";
-    vector<string> strings = data.ToString();
-    for (auto& s : strings)
-    {
-        file << s << ",";
+template<typename T>
+void HistoricalDataConnector<T>::Publish(T& data)
+{
+    if (journal_) {
+        typename JournalCodec<T>::Record record;
+        JournalCodec<T>::Encode(data, record);
+        journal_->Append(record);
+    }
+    if (!writer_) {
+        return;
     }
-    file << endl;
+
+    // Formatted here, at the persistence edge, straight into a reused buffer handed to the background writer
+    static thread_local vector<char> buffer;
+    writer_->Append(SerializeRecord(buffer, data));
 }
 
 template<typename T>
-void HistoricalDataConnector<T>::Subscribe(ifstream& data) {}
+void HistoricalDataConnector<T>::Subscribe(istream& data) {}
 
 template<typename T>
 HistoricalDataListener<T>::HistoricalDataListener(HistoricalDataService<T>* service)
@@ -220,7 +276,7 @@ HistoricalDataListener<T>::HistoricalDataListener(HistoricalDataService<T>* serv
 template<typename T>
 void HistoricalDataListener<T>::ProcessAdd(T& data)
 {
-    string product_id = data.GetProduct().GetProductId();
+    const string& product_id = data.GetProduct().GetProductId();
     service_->PersistData(product_id, data);
 }
 
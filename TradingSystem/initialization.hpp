@@ -1,229 +1,682 @@
 /**
  * initialization.hpp
- * Generates bond price data
+ * Generates the input feeds (prices, market data, trades and inquiries)
  *
  * @author Mingsen Wang
  */
 
+/*
+ Design:
+ (1) Each feed is split into chunks of kFeedChunkLines lines of one bond. Every chunk has its own random engine, seeded from (seed, feed, bond, chunk), and the price paths are closed-form functions of the line index, so any chunk can be generated on its own. The output only depends on the seed and the volumes, not on the number of threads.
+ (2) Worker threads render chunks into buffers of their own, and the calling thread writes the buffers out in chunk order. At most two chunks per thread are in flight, so memory stays bounded whatever the volume.
+ (3) Text lines are formatted with to_chars and FormatPrice into the chunk buffer. The binary form writes the same lines as feed journal records (see feed_records.hpp), timestamped at a fixed interval.
+ (4) Next to every feed file, a small key file records the parameters it was generated from. Generation is skipped when the key matches, so restarts and repeated load tests reuse their files.
+ (5) The incremental market data feed (marketdata_incremental.txt) describes the same books as level changes: each book is diffed against the one before it, so only the levels that moved are written, with a full snapshot every market_data_snapshot_interval books.
+ */
+
 #ifndef initialization_hpp
 #define initialization_hpp
 
 #include "utilities.hpp"
+#include "market_data_service.hpp"
+#include "trade_booking_service.hpp"
+#include "inquiry_service.hpp"
+#include "feed_records.hpp"
+#include "journal.hpp"
 
-#include <random>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
 #include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace initialization {
 
-// Generate Bernoulli(0.5), used in price generation (during initialization of `price.txt`)
-class BernoulliRng {
+// Which files a feed is written to
+enum FeedFormat { TEXT_FEED, BINARY_FEED, TEXT_AND_BINARY_FEED };
+
+// Lines (books for market data) per chunk: the unit of parallel work and of seeding
+constexpr uint64_t kFeedChunkLines = 1 << 14;
+
+// Version of the generators and line formats, part of every feed key: bump it whenever either changes
+// so that feed files cached by an older build are regenerated
+constexpr unsigned kFeedVersion = 2;
+
+// Trades and inquiries repeat their price and quantity pattern every kTradeCycle lines
+constexpr uint64_t kTradeCycle = 128;
+
+/**
+ * What to generate.
+ */
+struct FeedGeneratorConfig
+{
+    uint64_t seed = 42;
+
+    // Volumes per bond
+    uint64_t prices_per_bond = 10000;
+    uint64_t books_per_bond = 10000;      // 10 lines each
+
+    // Also write the market data as level changes (marketdata_incremental.txt), with a snapshot every interval books
+    bool incremental_market_data = false;
+    uint64_t market_data_snapshot_interval = 256;
+    uint64_t trades_per_bond = 10;
+    uint64_t inquiries_per_bond = 10;
+
+    FeedFormat format = TEXT_FEED;
+
+    // Worker threads (0 for one per hardware thread)
+    unsigned threads = 0;
+
+    // Keep feed files whose key matches this configuration
+    bool reuse_cached = true;
+
+    // Timestamps of binary records: start, then one interval per line
+    int64_t start_timestamp = 0;
+    int64_t timestamp_interval = 1000;
+};
+
+// Random bits for one chunk (SplitMix64)
+class FeedRng {
 private:
-    // Random device
-    static thread_local random_device rv_;
-    
-    // Random engine initially seeded with rv
-    static thread_local mt19937_64 eng_;
-    
-    // Standard uniform distribution
-    static thread_local bernoulli_distribution dist_;
-    
+    uint64_t state_;
+    uint64_t bits_;
+    unsigned bits_left_;
+
 public:
-    // No instances of UniformRng is needed.
-    BernoulliRng() = delete;
-    ~BernoulliRng() = default;
-    
-    // Generate new standard uniform random variable
-    static bool gen();
-    
-    static void reseed(unsigned new_seed);
+    FeedRng(uint64_t seed);
+
+    // Next 64 random bits
+    uint64_t Next();
+
+    // Bernoulli(0.5)
+    bool Flip();
+
+    // Mix a value into a well spread 64-bit seed
+    static uint64_t Mix(uint64_t value);
 };
 
-// Random device (used to seed the engine)
-thread_local random_device BernoulliRng::rv_ = std::random_device();
-
-// Seed engine with std::random_device
-thread_local mt19937_64 BernoulliRng::eng_ = mt19937_64(BernoulliRng::rv_());
-
-// Standard normal distribution N(0, 1)
-thread_local bernoulli_distribution BernoulliRng::dist_ = bernoulli_distribution(.5);
-
-// Generate a new standard uniform random variable
-bool BernoulliRng::gen() {
-    return ((BernoulliRng::dist_)(BernoulliRng::eng_));
-}
-
-// Re-seed the engine with custom seed
-void BernoulliRng::reseed(unsigned new_seed) {
-    BernoulliRng::eng_.seed(new_seed);
-}
-
-void GeneratePrice(string bond_id, unsigned number_of_prices, ofstream& file) {
-    
-    // Minimal increment
-    float increment = 1. / 256.;
-    
-    // Mid price oscillates between 99-002 and 100-316
-    float mid_price_lower_limit = 99. + increment * 2.;
-    float mid_price_upper_limit = 101. - increment * 2.;
-    float mid_price = mid_price_lower_limit;
-    
-    // Goes up and down and up and down...
-    bool price_goes_up = true;
-    
-    // Generate bid and ask around central price and write to file.
-    // Bid has 50% prob to be (central price - 1/256)
-    //  and 50% prob to be (central price - 2/256)
-    // Ask has 50% prob to be (central price + 1/256)
-    //  and 50% prob to be (central price + 2/256)
-    for (unsigned i = 0; i < number_of_prices; i++) {
-        float bid = mid_price - increment;
-        float ask = mid_price + increment;
-        
-        if (BernoulliRng::gen()) {
-            bid -= increment;
-        }
-        
-        if (BernoulliRng::gen()) {
-            ask += increment;
+FeedRng::FeedRng(uint64_t seed) : state_(seed), bits_(0), bits_left_(0) {}
+
+uint64_t FeedRng::Mix(uint64_t value) {
+    value += 0x9E3779B97F4A7C15ULL;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+uint64_t FeedRng::Next() {
+    state_ += 0x9E3779B97F4A7C15ULL;
+    uint64_t value = state_;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+bool FeedRng::Flip() {
+    if (bits_left_ == 0) {
+        bits_ = Next();
+        bits_left_ = 64;
+    }
+    bool bit = bits_ & 1;
+    bits_ >>= 1;
+    bits_left_--;
+    return bit;
+}
+
+// Seed of a chunk of a feed for a bond
+uint64_t GetChunkSeed(uint64_t seed, unsigned feed, uint64_t bond, uint64_t chunk) {
+    return FeedRng::Mix(FeedRng::Mix(FeedRng::Mix(seed + feed) + bond) + chunk);
+}
+
+// Value at step i of a path that starts at lower, moves one tick per step up to upper, then back down, and so on
+PriceTick GetOscillatingPrice(PriceTick lower, PriceTick upper, uint64_t i) {
+    long range = (upper - lower).GetTicks();
+    long phase = long(i % uint64_t(2 * range));
+    return lower + PriceTick(phase <= range ? phase : 2 * range - phase);
+}
+
+// Append text or numbers to a line buffer
+void AppendText(string& out, string_view text) {
+    out.append(text);
+}
+
+void AppendNumber(string& out, uint64_t value) {
+    char buffer[24];
+    out.append(buffer, to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+void AppendPrice(string& out, PriceTick price) {
+    char buffer[kMaxPriceTextSize];
+    out.append(buffer, FormatPrice(buffer, price));
+}
+
+// A line of a feed, in both text and binary form
+struct PriceLine {
+    PriceTick bid;
+    PriceTick offer;
+
+    void AppendTo(string& out, const string& bond_id) const;
+    void FillRecord(PriceFeedRecord& record, const string& bond_id) const;
+};
+
+struct MarketDataLine {
+    PriceTick price;
+    long quantity;
+    PricingSide side;
+
+    void AppendTo(string& out, const string& bond_id) const;
+    void FillRecord(MarketDataFeedRecord& record, const string& bond_id) const;
+};
+
+// A level change of the incremental market data feed
+struct MarketDataUpdateLine {
+    uint64_t sequence;
+    MarketDataAction action;
+    PriceTick price;
+    long quantity;          // 0 to delete a level
+    PricingSide side;
+    bool end;               // Last change of the update
+
+    void AppendTo(string& out, const string& bond_id) const;
+    void FillRecord(MarketDataUpdateFeedRecord& record, const string& bond_id) const;
+};
+
+struct TradeLine {
+    uint64_t index;
+    PriceTick price;
+    long book;          // 1, 2 or 3 for TRSY1..3
+    long quantity;
+    Side side;
+
+    void AppendTo(string& out, const string& bond_id) const;
+    void FillRecord(TradeFeedRecord& record, const string& bond_id) const;
+};
+
+struct InquiryLine {
+    uint64_t index;
+    Side side;
+    long quantity;
+    PriceTick price;
+
+    void AppendTo(string& out, const string& bond_id) const;
+    void FillRecord(InquiryFeedRecord& record, const string& bond_id) const;
+};
+
+void PriceLine::AppendTo(string& out, const string& bond_id) const {
+    AppendText(out, bond_id);
+    out += ',';
+    AppendPrice(out, bid);
+    out += ',';
+    AppendPrice(out, offer);
+    out += '\n';
+}
+
+void PriceLine::FillRecord(PriceFeedRecord& record, const string& bond_id) const {
+    CopyJournalField(record.product_id, bond_id);
+    record.bid = bid.GetTicks();
+    record.offer = offer.GetTicks();
+}
+
+void MarketDataLine::AppendTo(string& out, const string& bond_id) const {
+    AppendText(out, bond_id);
+    out += ',';
+    AppendPrice(out, price);
+    out += ',';
+    AppendNumber(out, uint64_t(quantity));
+    AppendText(out, (side == BID) ? ",BID\n" : ",OFFER\n");
+}
+
+void MarketDataLine::FillRecord(MarketDataFeedRecord& record, const string& bond_id) const {
+    record = MarketDataFeedRecord{};
+    CopyJournalField(record.product_id, bond_id);
+    record.price = price.GetTicks();
+    record.quantity = quantity;
+    record.side = uint8_t(side);
+}
+
+void MarketDataUpdateLine::AppendTo(string& out, const string& bond_id) const {
+    AppendNumber(out, sequence);
+    out += ',';
+    AppendText(out, bond_id);
+    out += ',';
+    out += char(action);
+    out += ',';
+    AppendPrice(out, price);
+    out += ',';
+    AppendNumber(out, uint64_t(quantity));
+    AppendText(out, (side == BID) ? ",BID," : ",OFFER,");
+    out += end ? '1' : '0';
+    out += '\n';
+}
+
+void MarketDataUpdateLine::FillRecord(MarketDataUpdateFeedRecord& record, const string& bond_id) const {
+    record = MarketDataUpdateFeedRecord{};
+    CopyJournalField(record.product_id, bond_id);
+    record.sequence = sequence;
+    record.price = price.GetTicks();
+    record.quantity = quantity;
+    record.action = uint8_t(action);
+    record.side = uint8_t(side);
+    record.end = uint8_t(end);
+}
+
+void TradeLine::AppendTo(string& out, const string& bond_id) const {
+    AppendText(out, bond_id);
+    out += ',';
+    AppendText(out, bond_id);
+    out += '0';
+    AppendNumber(out, index);
+    out += ',';
+    AppendPrice(out, price);
+    AppendText(out, ",TRSY");
+    AppendNumber(out, uint64_t(book));
+    out += ',';
+    AppendNumber(out, uint64_t(quantity));
+    AppendText(out, (side == BUY) ? ",BUY\n" : ",SELL\n");
+}
+
+void TradeLine::FillRecord(TradeFeedRecord& record, const string& bond_id) const {
+    record = TradeFeedRecord{};
+    CopyJournalField(record.product_id, bond_id);
+    CopyJournalField(record.trade_id, bond_id + '0' + to_string(index));
+    CopyJournalField(record.book, "TRSY" + to_string(book));
+    record.price = price.GetTicks();
+    record.quantity = quantity;
+    record.side = uint8_t(side);
+}
+
+void InquiryLine::AppendTo(string& out, const string& bond_id) const {
+    AppendText(out, bond_id);
+    out += '0';
+    AppendNumber(out, index);
+    out += ',';
+    AppendText(out, bond_id);
+    AppendText(out, (side == BUY) ? ",BUY," : ",SELL,");
+    AppendNumber(out, uint64_t(quantity));
+    out += ',';
+    AppendPrice(out, price);
+    AppendText(out, ",RECEIVED\n");
+}
+
+void InquiryLine::FillRecord(InquiryFeedRecord& record, const string& bond_id) const {
+    record = InquiryFeedRecord{};
+    CopyJournalField(record.inquiry_id, bond_id + '0' + to_string(index));
+    CopyJournalField(record.product_id, bond_id);
+    record.quantity = quantity;
+    record.price = price.GetTicks();
+    record.side = uint8_t(side);
+    record.state = uint8_t(RECEIVED);
+}
+
+// Prices: the mid oscillates between 99-002 and 100-316.
+// Bid has 50% prob to be (mid - 1/256) and 50% prob to be (mid - 2/256)
+// Ask has 50% prob to be (mid + 1/256) and 50% prob to be (mid + 2/256)
+template <typename Emit>
+void GeneratePrices(uint64_t begin, uint64_t end, FeedRng& rng, Emit&& emit) {
+    PriceTick increment(1);
+    PriceTick lower = PriceTick(99 * PriceTick::kTicksPerPoint) + increment * 2;
+    PriceTick upper = PriceTick(101 * PriceTick::kTicksPerPoint) - increment * 2;
+    for (uint64_t i = begin; i < end; i++) {
+        PriceTick mid = GetOscillatingPrice(lower, upper, i);
+        PriceLine line{mid - increment, mid + increment};
+        if (rng.Flip()) {
+            line.bid -= increment;
         }
-        
-        // Change mid price
-        if (price_goes_up) {
-            mid_price += increment;
-            if (mid_price == mid_price_upper_limit) {
-                price_goes_up = false;
-            }
-        } else {
-            mid_price -= increment;
-            if (mid_price == mid_price_lower_limit) {
-                price_goes_up = true;
-            }
+        if (rng.Flip()) {
+            line.offer += increment;
         }
-        
-        // Write to file!
-        file << bond_id << ',' << ConvertPrice(bid) << ',' << ConvertPrice(ask) << '\n';
-//        file << bond_id << ',' << bid * 256. << ',' << ask * 256. << '\n';
+        emit(line);
     }
 }
 
-void GenerateAllBondPrices () {
-    // !!!: ADDRESS MAY VARY
-    const string file_address("prices.txt");
-    ofstream file(file_address);
-    
-    // Number of prices per bond
-    unsigned number_of_prices = 10000;
-    for (const auto& [year, bond] : kBondMapMaturity) {
-        cout << "Generating prices for " << bond.first << "... ";
-        GeneratePrice(bond.first, number_of_prices, file);
-        cout << "Success!" << endl;
-    }
-}
-
-void GenerateMarketData(string bond_id, unsigned number_of_books, ofstream& file) {
-    
-    // Minimal increment
-    float increment = 1. / 256.;
-    
-    // Mid price oscillates between 99-010 and 100-310
-    float mid_price_lower_limit = 99. + increment * 8.;
-    float mid_price_upper_limit = 101. - increment * 8.;
-    float mid_price = mid_price_lower_limit;
-    
-    // Goes up and down and up and down...
-    bool price_goes_up = true;
-    
-    for (unsigned i = 0; i < number_of_books; i++) {
-        unsigned spread = i % 4 + 1;
-        for (int j = 0; j < 5; j++) {
-            float bid = mid_price - increment * (spread + j);
-            float ask = mid_price + increment * (spread + j);
-            // Write to file!
-            file << bond_id << ',' << ConvertPrice(bid) << ',' << ((j+1) * 10000000) << ',' << "BID" << '\n';
-            file << bond_id << ',' << ConvertPrice(ask) << ',' << ((j+1) * 10000000) << ',' << "OFFER" << '\n';
-        }
-        
-        // Change mid price
-        if (price_goes_up) {
-            mid_price += increment;
-            if (mid_price == mid_price_upper_limit) {
-                price_goes_up = false;
+// Levels of market data book i: the mid oscillates between 99-010 and 100-310, with 5 levels a side around a spread cycling through 1-4 ticks
+template <typename Emit>
+void GenerateMarketDataBook(uint64_t i, Emit&& emit) {
+    PriceTick increment(1);
+    PriceTick lower = PriceTick(99 * PriceTick::kTicksPerPoint) + increment * 8;
+    PriceTick upper = PriceTick(101 * PriceTick::kTicksPerPoint) - increment * 8;
+    PriceTick mid = GetOscillatingPrice(lower, upper, i);
+    long spread = long(i % 4) + 1;
+    for (long j = 0; j < 5; j++) {
+        long quantity = (j + 1) * 10000000;
+        emit(MarketDataLine{mid - increment * (spread + j), quantity, BID});
+        emit(MarketDataLine{mid + increment * (spread + j), quantity, OFFER});
+    }
+}
+
+template <typename Emit>
+void GenerateMarketData(uint64_t begin, uint64_t end, Emit&& emit) {
+    for (uint64_t i = begin; i < end; i++) {
+        GenerateMarketDataBook(i, emit);
+    }
+}
+
+// Market data as level changes: book i is update i + 1, sent as the changes from book i - 1,
+// or in full (SNAPSHOT_LEVEL lines) every snapshot_interval books so that a receiver can recover from a gap.
+// Books are a function of their index, so a chunk starts from its previous book without reading the previous chunk.
+template <typename Emit>
+void GenerateMarketDataUpdates(uint64_t begin, uint64_t end, Emit&& emit, uint64_t snapshot_interval) {
+    vector<MarketDataLine> previous[2], current[2];     // By side, best first
+    vector<MarketDataUpdateLine> changes;
+    auto generate_book = [](uint64_t i, vector<MarketDataLine>* book) {
+        book[BID].clear();
+        book[OFFER].clear();
+        GenerateMarketDataBook(i, [&](const MarketDataLine& line) { book[line.side].push_back(line); });
+    };
+    if (begin > 0) {
+        generate_book(begin - 1, previous);
+    }
+
+    for (uint64_t i = begin; i < end; i++) {
+        generate_book(i, current);
+        uint64_t sequence = i + 1;
+        changes.clear();
+        if (i == 0 || (snapshot_interval > 0 && i % snapshot_interval == 0)) {
+            for (unsigned side = 0; side < 2; side++) {
+                for (const MarketDataLine& level : current[side]) {
+                    changes.push_back({sequence, SNAPSHOT_LEVEL, level.price, level.quantity, level.side, false});
+                }
             }
         } else {
-            mid_price -= increment;
-            if (mid_price == mid_price_lower_limit) {
-                price_goes_up = true;
+            for (unsigned side = 0; side < 2; side++) {
+                // Deletions first, so that a receiver never holds more levels than the book has
+                for (const MarketDataLine& level : previous[side]) {
+                    bool kept = any_of(current[side].begin(), current[side].end(), [&](const MarketDataLine& other) { return other.price == level.price; });
+                    if (!kept) {
+                        changes.push_back({sequence, DELETE_LEVEL, level.price, 0, level.side, false});
+                    }
+                }
+                for (const MarketDataLine& level : current[side]) {
+                    auto it = find_if(previous[side].begin(), previous[side].end(), [&](const MarketDataLine& other) { return other.price == level.price; });
+                    if (it == previous[side].end()) {
+                        changes.push_back({sequence, ADD_LEVEL, level.price, level.quantity, level.side, false});
+                    } else if (it->quantity != level.quantity) {
+                        changes.push_back({sequence, MODIFY_LEVEL, level.price, level.quantity, level.side, false});
+                    }
+                }
             }
+            // An unchanged book is still sent, as its top bid, so that every book is one update
+            if (changes.empty()) {
+                const MarketDataLine& top = current[BID].front();
+                changes.push_back({sequence, MODIFY_LEVEL, top.price, top.quantity, BID, false});
+            }
+        }
+        changes.back().end = true;
+        for (const MarketDataUpdateLine& change : changes) {
+            emit(change);
         }
+        swap(previous[BID], current[BID]);
+        swap(previous[OFFER], current[OFFER]);
     }
 }
 
-void GenerateAllMarketData() {
-    // !!!: ADDRESS MAY VARY
-    const string file_address("marketdata.txt");
-    ofstream file(file_address);
-    
-    // Number of prices per bond
-    unsigned number_of_books = 10000;
-    for (const auto& [year, bond] : kBondMapMaturity) {
-        cout << "Generating market data for " << bond.first << "... ";
-        GenerateMarketData(bond.first, number_of_books, file);
-        cout << "Success!" << endl;
+// Trades alternate sides around 100-000, moving 2 ticks further away each time, across the three books;
+// the pattern restarts every kTradeCycle trades so that prices and quantities stay bounded at any volume
+template <typename Emit>
+void GenerateTrades(uint64_t begin, uint64_t end, Emit&& emit) {
+    for (uint64_t i = begin; i < end; i++) {
+        long step = long(i % kTradeCycle);
+        PriceTick price(100 * PriceTick::kTicksPerPoint);
+        if (i % 2) {
+            price -= PriceTick(step << 1);
+        } else {
+            price += PriceTick(step << 1);
+        }
+        emit(TradeLine{i, price, long(i % 3) + 1, ((step << 1) + 1) * 1000000, (i % 2) ? BUY : SELL});
     }
 }
 
-void GenerateInquiries(string bond_id, unsigned number_of_inquiries, ofstream& file) {
-    for (unsigned i = 0; i < number_of_inquiries; i++) {
-        float price = 100.;
+// Inquiries follow the same pattern as trades
+template <typename Emit>
+void GenerateInquiries(uint64_t begin, uint64_t end, Emit&& emit) {
+    for (uint64_t i = begin; i < end; i++) {
+        long step = long(i % kTradeCycle);
+        PriceTick price(100 * PriceTick::kTicksPerPoint);
         if (i % 2) {
-            price -= (i << 1) / 256.;
+            price -= PriceTick(step << 1);
         } else {
-            price += (i << 1) / 256.;
+            price += PriceTick(step << 1);
         }
-        file << bond_id << '0' << i << ',' << bond_id << ',' << ((i % 2) ? "BUY" : "SELL") << ',' << ((i << 1) + 1) * 1000000 << ',' << ConvertPrice(price) << ',' << "RECEIVED\n";
+        emit(InquiryLine{i, (i % 2) ? BUY : SELL, ((step << 1) + 1) * 1000000, price});
     }
 }
 
-void GenerateAllInquiries() {
-    // !!!: ADDRESS MAY VARY
-    const string file_address("inquiries.txt");
-    ofstream file(file_address);
-    
-    // Number of prices per bond
-    unsigned number_of_inquiries = 10;
-    for (const auto& [year, bond] : kBondMapMaturity) {
-        cout << "Generating inquiries for " << bond.first << "... ";
-        GenerateInquiries(bond.first, number_of_inquiries, file);
-        cout << "Success!" << endl;
+// Render chunks on worker threads and hand them to sink on the calling thread, in chunk order
+template <typename Chunk, typename Render, typename Sink>
+void GenerateChunksInOrder(uint64_t chunk_count, unsigned threads, Render&& render, Sink&& sink) {
+    if (chunk_count == 0) {
+        return;
     }
-}
+    threads = unsigned(max<uint64_t>(1, min<uint64_t>(threads, chunk_count)));
+    size_t window = 2 * threads;
 
-void GenerateTrades(string bond_id, unsigned number_of_trades, ofstream& file) {
-    for (unsigned i = 0; i < number_of_trades; i++) {
-        float price = 100.;
-        if (i % 2) {
-            price -= (i << 1) / 256.;
-        } else {
-            price += (i << 1) / 256.;
+    // Chunk c is rendered into slot c % window once chunk c - window has been written
+    vector<Chunk> slots(window);
+    vector<char> ready(window, 0);
+    mutex slots_mutex;
+    condition_variable changed;
+    uint64_t next = 0;
+    uint64_t written = 0;
+    exception_ptr error;
+
+    auto work = [&] {
+        Chunk chunk;
+        while (true) {
+            uint64_t c;
+            {
+                unique_lock<mutex> lock(slots_mutex);
+                changed.wait(lock, [&] { return next >= chunk_count || next < written + window || error; });
+                if (next >= chunk_count || error) {
+                    return;
+                }
+                c = next++;
+            }
+            try {
+                render(c, chunk);
+            } catch (...) {
+                lock_guard<mutex> lock(slots_mutex);
+                error = current_exception();
+                changed.notify_all();
+                return;
+            }
+            {
+                lock_guard<mutex> lock(slots_mutex);
+                swap(slots[c % window], chunk);
+                ready[c % window] = 1;
+            }
+            changed.notify_all();
+        }
+    };
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back(work);
+    }
+
+    // Buffers are swapped back into the slots, so they are reused across chunks
+    Chunk chunk;
+    for (uint64_t c = 0; c < chunk_count; c++) {
+        {
+            unique_lock<mutex> lock(slots_mutex);
+            changed.wait(lock, [&] { return ready[c % window] || error; });
+            if (error) {
+                break;
+            }
+            swap(chunk, slots[c % window]);
+            ready[c % window] = 0;
+            written++;
+        }
+        changed.notify_all();
+        try {
+            sink(chunk);
+        } catch (...) {
+            lock_guard<mutex> lock(slots_mutex);
+            error = current_exception();
+            changed.notify_all();
+            break;
         }
-        file << bond_id << ',' << bond_id << '0' << i << ',' << ConvertPrice(price) << ',' << "TRSY" << (i % 3 + 1) << ',' << ((i << 1) + 1) * 1000000 << ',' << ((i % 2) ? "BUY" : "SELL") << '\n';
     }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        rethrow_exception(error);
+    }
+}
+
+// Key of a feed file generated with a configuration; a file is reused only if its key file matches
+string GetFeedKey(const FeedGeneratorConfig& config, unsigned feed, uint64_t lines_per_bond, bool binary) {
+    ostringstream key;
+    key << "version=" << kFeedVersion << " feed=" << feed << " seed=" << config.seed << " bonds=" << kBondMapMaturity.size() << " per_bond=" << lines_per_bond << " chunk=" << kFeedChunkLines;
+    if (feed == 4) {
+        key << " snapshot_interval=" << config.market_data_snapshot_interval;
+    }
+    if (binary) {
+        key << " start=" << config.start_timestamp << " interval=" << config.timestamp_interval;
+    }
+    return key.str();
+}
+
+bool IsFeedCached(const string& path, const string& key) {
+    ifstream key_file(path + ".key");
+    string stored;
+    return filesystem::exists(path) && getline(key_file, stored) && stored == key;
 }
 
-void GenerateAllTrades() {
-    // !!!: ADDRESS MAY VARY
-    const string file_address("trades.txt");
-    ofstream file(file_address);
-    
-    // Number of prices per bond
-    unsigned number_of_trades = 10;
+void StoreFeedKey(const string& path, const string& key) {
+    ofstream key_file(path + ".key", ios::trunc);
+    key_file << key << '\n';
+}
+
+// Generate one feed: lines_per_bond units of Generate per bond, to text and/or binary
+template <typename Line, typename Record, typename Generate>
+void GenerateFeed(const FeedGeneratorConfig& config, unsigned feed, const string& name, const string& text_path, uint32_t record_type, uint64_t lines_per_bond, Generate&& generate) {
+    vector<string> bond_ids;
     for (const auto& [year, bond] : kBondMapMaturity) {
-        cout << "Generating trades for " << bond.first << "... ";
-        GenerateTrades(bond.first, number_of_trades, file);
-        cout << "Success!" << endl;
+        bond_ids.push_back(bond.first);
     }
+    uint64_t chunks_per_bond = (lines_per_bond + kFeedChunkLines - 1) / kFeedChunkLines;
+    uint64_t chunk_count = chunks_per_bond * bond_ids.size();
+    unsigned threads = (config.threads > 0) ? config.threads : max(1u, thread::hardware_concurrency());
+
+    // Generate the lines of a chunk
+    auto generate_chunk = [&](uint64_t c, auto&& emit) {
+        uint64_t bond = c / chunks_per_bond;
+        uint64_t begin = (c % chunks_per_bond) * kFeedChunkLines;
+        uint64_t end = min(lines_per_bond, begin + kFeedChunkLines);
+        FeedRng rng(GetChunkSeed(config.seed, feed, bond, c % chunks_per_bond));
+        generate(begin, end, rng, emit);
+    };
+
+    auto run = [&](const string& path, bool binary) {
+        string key = GetFeedKey(config, feed, lines_per_bond, binary);
+        if (config.reuse_cached && IsFeedCached(path, key)) {
+            cout << GetTimestamp() << " Using cached " << name << " in " << path << "." << endl;
+            return;
+        }
+        cout << GetTimestamp() << " Generating " << name << " in " << path << "..." << endl;
+        auto start = chrono::steady_clock::now();
+        filesystem::remove(path + ".key");
+        uint64_t written = 0;
+
+        if (binary) {
+            typedef vector<Record> Chunk;
+            // Preallocate every line once; generated market data has 10 lines per book (at most 10 changes per update)
+            constexpr uint64_t lines_per_unit = (is_same_v<Line, MarketDataLine> || is_same_v<Line, MarketDataUpdateLine>) ? 10 : 1;
+            size_t expected = size_t(max<uint64_t>(1, lines_per_bond * bond_ids.size() * lines_per_unit));
+            JournalWriter<Record> journal(path, record_type, expected);
+            GenerateChunksInOrder<Chunk>(chunk_count, threads, [&](uint64_t c, Chunk& chunk) {
+                const string& bond_id = bond_ids[c / chunks_per_bond];
+                chunk.clear();
+                generate_chunk(c, [&](const Line& line) {
+                    line.FillRecord(chunk.emplace_back(), bond_id);
+                });
+            }, [&](Chunk& chunk) {
+                for (const Record& record : chunk) {
+                    journal.Append(record, config.start_timestamp + int64_t(written++) * config.timestamp_interval);
+                }
+            });
+        } else {
+            struct Chunk { uint64_t lines = 0; string text; };
+            ofstream file(path, ios::trunc | ios::binary);
+            if (!file) {
+                throw runtime_error("GenerateFeed: cannot open " + path);
+            }
+            GenerateChunksInOrder<Chunk>(chunk_count, threads, [&](uint64_t c, Chunk& chunk) {
+                const string& bond_id = bond_ids[c / chunks_per_bond];
+                chunk.lines = 0;
+                chunk.text.clear();
+                generate_chunk(c, [&](const Line& line) {
+                    line.AppendTo(chunk.text, bond_id);
+                    chunk.lines++;
+                });
+            }, [&](Chunk& chunk) {
+                file.write(chunk.text.data(), streamsize(chunk.text.size()));
+                written += chunk.lines;
+            });
+            file.close();
+            if (!file) {
+                throw runtime_error("GenerateFeed: cannot write " + path);
+            }
+        }
+
+        StoreFeedKey(path, key);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << GetTimestamp() << " Generated " << written << " lines in " << seconds << " s." << endl;
+    };
+
+    if (config.format != BINARY_FEED) {
+        run(text_path, false);
+    }
+    if (config.format != TEXT_FEED) {
+        run(GetFeedJournalPath(text_path), true);
+    }
+}
+
+void GenerateAllBondPrices(const FeedGeneratorConfig& config = FeedGeneratorConfig()) {
+    GenerateFeed<PriceLine, PriceFeedRecord>(config, 0, "prices", "prices.txt", PRICE_FEED_RECORD, config.prices_per_bond,
+        [](uint64_t begin, uint64_t end, FeedRng& rng, auto&& emit) { GeneratePrices(begin, end, rng, emit); });
+}
+
+void GenerateAllMarketData(const FeedGeneratorConfig& config = FeedGeneratorConfig()) {
+    GenerateFeed<MarketDataLine, MarketDataFeedRecord>(config, 1, "market data", "marketdata.txt", MARKET_DATA_FEED_RECORD, config.books_per_bond,
+        [](uint64_t begin, uint64_t end, FeedRng&, auto&& emit) { GenerateMarketData(begin, end, emit); });
 }
 
+void GenerateAllMarketDataUpdates(const FeedGeneratorConfig& config = FeedGeneratorConfig()) {
+    uint64_t snapshot_interval = config.market_data_snapshot_interval;
+    GenerateFeed<MarketDataUpdateLine, MarketDataUpdateFeedRecord>(config, 4, "market data updates", "marketdata_incremental.txt", MARKET_DATA_UPDATE_FEED_RECORD, config.books_per_bond,
+        [=](uint64_t begin, uint64_t end, FeedRng&, auto&& emit) { GenerateMarketDataUpdates(begin, end, emit, snapshot_interval); });
+}
+
+void GenerateAllTrades(const FeedGeneratorConfig& config = FeedGeneratorConfig()) {
+    GenerateFeed<TradeLine, TradeFeedRecord>(config, 2, "trades", "trades.txt", TRADE_FEED_RECORD, config.trades_per_bond,
+        [](uint64_t begin, uint64_t end, FeedRng&, auto&& emit) { GenerateTrades(begin, end, emit); });
+}
+
+void GenerateAllInquiries(const FeedGeneratorConfig& config = FeedGeneratorConfig()) {
+    GenerateFeed<InquiryLine, InquiryFeedRecord>(config, 3, "inquiries", "inquiries.txt", INQUIRY_FEED_RECORD, config.inquiries_per_bond,
+        [](uint64_t begin, uint64_t end, FeedRng&, auto&& emit) { GenerateInquiries(begin, end, emit); });
+}
+
+// Generate every feed
+void GenerateAllFeeds(const FeedGeneratorConfig& config = FeedGeneratorConfig()) {
+    GenerateAllBondPrices(config);
+    GenerateAllMarketData(config);
+    if (config.incremental_market_data) {
+        GenerateAllMarketDataUpdates(config);
+    }
+    GenerateAllTrades(config);
+    GenerateAllInquiries(config);
+}
 
 }
 
@@ -9,6 +9,13 @@
 
 #include "soa.hpp"
 #include "trade_booking_service.hpp"
+#include "pricing_service.hpp"
+#include "line_reader.hpp"
+#include "serialization.hpp"
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <string_view>
 #include <unordered_map>
 
 // Various inqyury states
@@ -26,7 +33,7 @@ public:
 
     Inquiry() = default;
     // ctor for an inquiry
-    Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state);
+    Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, PriceTick _price, InquiryState _state);
 
     // Get the inquiry ID
     const string& GetInquiryId() const;
@@ -41,21 +48,28 @@ public:
     long GetQuantity() const;
 
     // Get the price that we have responded back with
-    double GetPrice() const;
+    PriceTick GetPrice() const;
 
     // Get the current state on the inquiry
     InquiryState GetState() const;
     
     void SetState(InquiryState new_state);
     
-    vector<string> ToString() const;
+    // Set the price that we respond back with
+    void SetPrice(PriceTick new_price);
+    
+    // Most characters Serialize may write
+    size_t GetMaxSerializedSize() const;
+    
+    // Write the fields as "field,field,...," into out; returns the end of the text
+    char* Serialize(char* out) const;
 
 private:
     string inquiryId;
-    T product;
+    ProductRef<T> product;     // Registered instance, shared by every copy of the event
     Side side;
     long quantity;
-    double price;
+    PriceTick price;
     InquiryState state;
 
 };
@@ -63,19 +77,88 @@ private:
 template<typename T>
 class InquiryConnector;
 
+// Handle of an inquiry: the index of its slot in the InquiryStore, valid for the life of the store
+typedef uint32_t InquiryHandle;
 
+/*
+ Design:
+ (1) Inquiries live in stable slots (a deque), so a handle or a reference to an inquiry stays valid as more arrive.
+ (2) The inquiry identifier is hashed once, when the inquiry enters the service. Transitions and quotes after that go through the handle.
+ (3) Open inquiries (received and not yet quoted) are kept in a dense list for batch quoting. Each slot remembers its position in the list, so closing an inquiry is a swap-remove.
+ */
+
+/**
+ * Store of inquiries in stable slots, with the list of those still open.
+ * Type T is the product type.
+ */
+template<typename T>
+class InquiryStore
+{
+public:
+    // Slot of the inquiry with the given identifier, creating an empty one if it is new. Returns the handle and whether it was created.
+    pair<InquiryHandle, bool> Insert(const string& inquiry_id);
+
+    // Handle of the inquiry with the given identifier; throws if it is unknown
+    InquiryHandle GetHandle(string_view inquiry_id) const;
+
+    // Get the inquiry in a slot; throws if the handle is not one of this store's
+    Inquiry<T>& Get(InquiryHandle handle);
+    const Inquiry<T>& Get(InquiryHandle handle) const;
+
+    // Number of inquiries
+    size_t Size() const;
+
+    // Mark an inquiry as open (waiting for a quote) or as closed; these throw on an invalid handle as well
+    void Open(InquiryHandle handle);
+    void Close(InquiryHandle handle);
+    bool IsOpen(InquiryHandle handle) const;
+
+    // Handles of the open inquiries, in no particular order
+    const vector<InquiryHandle>& GetOpen() const;
+
+private:
+    // Position in open_ of a closed inquiry
+    static constexpr uint32_t kNotOpen = UINT32_MAX;
+
+    // Throw out_of_range unless the handle names a slot
+    void CheckHandle(InquiryHandle handle) const;
+
+    // Transparent hash so that identifiers can be looked up from string_view fields
+    struct IdHash
+    {
+        using is_transparent = void;
+        size_t operator()(string_view id) const { return hash<string_view>()(id); }
+    };
+
+    deque<Inquiry<T>> inquiries_;
+    vector<uint32_t> open_positions_;   // Indexed by handle
+    vector<InquiryHandle> open_;
+    unordered_map<string, InquiryHandle, IdHash, equal_to<>> handles_;
+};
 
 /**
  * Service for customer inquirry objects.
  * Keyed on inquiry identifier (NOTE: this is NOT a product identifier since each inquiry must be unique).
+ * Inquiries are quoted with their own price and completed as they arrive, unless auto quoting is turned off, in which case they stay open until SendQuote, QuoteOpenInquiries or RejectInquiry.
  * Type T is the product type.
  */
 template<typename T>
 class InquiryService : public Service<string,Inquiry <T> >
 {
 private:
-    unordered_map<string, Inquiry<T>> inquiries_;
+    InquiryStore<T> inquiries_;
     InquiryConnector<T>* connector_;    // Both in and out
+    bool auto_quote_;
+    vector<pair<InquiryHandle, PriceTick>> quotes_;     // Reused by QuoteOpenInquiries
+    
+    // Apply the transitions of an inquiry in its slot until it waits for a quote or is closed
+    void Advance(InquiryHandle handle);
+    
+    // Send the quote of an inquiry to the client and mark it QUOTED
+    void Quote(Inquiry<T>& inquiry);
+    
+    // Notify the listeners of a closed inquiry
+    void Notify(Inquiry<T>& inquiry);
     
 public:
     
@@ -83,8 +166,8 @@ public:
     ~InquiryService();
     
     // MARK: SERVICE CLASS OVERRIDE BELOW
-    // Get data on our service given a key (orderbook)
-    virtual Inquiry<T>& GetData(string product_id) override;
+    // Get data on our service given a key (inquiry identifier); throws if it is unknown
+    virtual Inquiry<T>& GetData(string inquiry_id) override;
     
     // The callback that a Connector should invoke for any new or updated data
     virtual void OnMessage(Inquiry<T>& data) override;
@@ -100,11 +183,36 @@ public:
     // Get the connector of the service
     InquiryConnector<T>* GetConnector();
 
-    // Send a quote back to the client
-    void SendQuote(const string &inquiryId, double price);
+    // Handle of an inquiry, for the calls below without hashing its identifier; throws if it is unknown
+    InquiryHandle GetHandle(const string &inquiryId) const;
+
+    // Get an inquiry by handle
+    Inquiry<T>& GetInquiry(InquiryHandle handle);
 
-    // Reject an inquiry from the client
+    // Whether received inquiries are quoted and completed right away (the default)
+    void SetAutoQuote(bool auto_quote);
+
+    // Number of inquiries waiting for a quote
+    size_t GetOpenCount() const;
+
+    // Send a quote back to the client, completing the inquiry; throws if it is unknown or not open
+    void SendQuote(const string &inquiryId, PriceTick price);
+    void SendQuote(InquiryHandle handle, PriceTick price);
+
+    // Reject an inquiry from the client; throws if it is unknown or already closed
     void RejectInquiry(const string &inquiryId);
+    void RejectInquiry(InquiryHandle handle);
+
+    // Call f on every open inquiry
+    template <typename F>
+    void ForEachOpenInquiry(F&& f) const;
+
+    // Store an inquiry as it was, e.g. from a snapshot: a received one is kept open, without quoting it or notifying the listeners
+    void RestoreInquiry(const Inquiry<T>& inquiry);
+
+    // Quote every open inquiry whose product has a price, on the side of the latest price the client trades against
+    // (our offer when the client buys, our bid when the client sells). Returns the number of inquiries quoted.
+    size_t QuoteOpenInquiries(const PricingService<T>& pricing_service);
 
 };
 
@@ -117,11 +225,14 @@ public:
     InquiryConnector(InquiryService<T>* service);
     ~InquiryConnector() = default;
 
-    // Publish data to the Connector
+    // Publish a quote to the client (there is no client session here, so this only emits it)
     void Publish(Inquiry<T>& data);
 
     // Subscribe data from the Connector
-    void Subscribe(ifstream& data);
+    void Subscribe(istream& data);
+
+    // Subscribe the lines of a reader, e.g. over a network receive buffer (see network_connectors.hpp)
+    void Subscribe(LineReader& reader);
     
     // Re-subscribe data from the Connector
     void Subscribe(Inquiry<T>& data);
@@ -129,7 +240,7 @@ public:
 };
 
 template<typename T>
-Inquiry<T>::Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, double _price, InquiryState _state) :
+Inquiry<T>::Inquiry(string _inquiryId, const T &_product, Side _side, long _quantity, PriceTick _price, InquiryState _state) :
   product(_product)
 {
     inquiryId = _inquiryId;
@@ -147,7 +258,7 @@ const string& Inquiry<T>::GetInquiryId() const {
 template<typename T>
 const T& Inquiry<T>::GetProduct() const
 {
-    return product;
+    return *product;
 }
 
 template<typename T>
@@ -163,7 +274,7 @@ long Inquiry<T>::GetQuantity() const
 }
 
 template<typename T>
-double Inquiry<T>::GetPrice() const
+PriceTick Inquiry<T>::GetPrice() const
 {
     return price;
 }
@@ -181,7 +292,100 @@ void Inquiry<T>::SetState(InquiryState new_state)
 }
 
 template<typename T>
-InquiryService<T>::InquiryService() {
+void Inquiry<T>::SetPrice(PriceTick new_price)
+{
+    price = new_price;
+}
+
+template<typename T>
+pair<InquiryHandle, bool> InquiryStore<T>::Insert(const string& inquiry_id)
+{
+    auto [it, inserted] = handles_.try_emplace(inquiry_id, static_cast<InquiryHandle>(inquiries_.size()));
+    if (inserted) {
+        inquiries_.emplace_back();
+        open_positions_.push_back(kNotOpen);
+    }
+    return {it->second, inserted};
+}
+
+template<typename T>
+InquiryHandle InquiryStore<T>::GetHandle(string_view inquiry_id) const
+{
+    auto it = handles_.find(inquiry_id);
+    if (it == handles_.end()) {
+        throw out_of_range("InquiryStore: unknown inquiry " + string(inquiry_id));
+    }
+    return it->second;
+}
+
+template<typename T>
+void InquiryStore<T>::CheckHandle(InquiryHandle handle) const
+{
+    if (handle >= inquiries_.size()) {
+        throw out_of_range("InquiryStore: invalid handle " + to_string(handle));
+    }
+}
+
+template<typename T>
+Inquiry<T>& InquiryStore<T>::Get(InquiryHandle handle)
+{
+    CheckHandle(handle);
+    return inquiries_[handle];
+}
+
+template<typename T>
+const Inquiry<T>& InquiryStore<T>::Get(InquiryHandle handle) const
+{
+    CheckHandle(handle);
+    return inquiries_[handle];
+}
+
+template<typename T>
+size_t InquiryStore<T>::Size() const
+{
+    return inquiries_.size();
+}
+
+template<typename T>
+void InquiryStore<T>::Open(InquiryHandle handle)
+{
+    CheckHandle(handle);
+    if (open_positions_[handle] == kNotOpen) {
+        open_positions_[handle] = static_cast<uint32_t>(open_.size());
+        open_.push_back(handle);
+    }
+}
+
+template<typename T>
+void InquiryStore<T>::Close(InquiryHandle handle)
+{
+    CheckHandle(handle);
+    uint32_t position = open_positions_[handle];
+    if (position == kNotOpen) {
+        return;
+    }
+    InquiryHandle last = open_.back();
+    open_[position] = last;
+    open_positions_[last] = position;
+    open_.pop_back();
+    open_positions_[handle] = kNotOpen;
+}
+
+template<typename T>
+bool InquiryStore<T>::IsOpen(InquiryHandle handle) const
+{
+    CheckHandle(handle);
+    return open_positions_[handle] != kNotOpen;
+}
+
+template<typename T>
+const vector<InquiryHandle>& InquiryStore<T>::GetOpen() const
+{
+    return open_;
+}
+
+template<typename T>
+InquiryService<T>::InquiryService() : auto_quote_(true) {
     connector_ = new InquiryConnector<T>(this);
 }
 
@@ -193,30 +397,56 @@ InquiryService<T>::~InquiryService() {
 template<typename T>
 Inquiry<T>& InquiryService<T>::GetData(string key)
 {
-    return inquiries_[key];
+    return inquiries_.Get(inquiries_.GetHandle(key));
 }
 
 template<typename T>
 void InquiryService<T>::OnMessage(Inquiry<T>& data)
 {
-    InquiryState state = data.GetState();
-    string inquiry_id = data.GetInquiryId();
-    switch (state) {
-        case RECEIVED:
-            inquiries_.insert_or_assign(inquiry_id, data);
-            connector_->Publish(data);
-            break;
-        case QUOTED:
-            data.SetState(DONE);
-            inquiries_.insert_or_assign(inquiry_id, data);
-
-            for (auto& listener : this->GetListeners())
-            {
-                listener->ProcessAdd(data);
-            }
-            break;
-        default:
-            break;
+    // The only copy of the inquiry; transitions from here on happen in its slot
+    InquiryHandle handle = inquiries_.Insert(data.GetInquiryId()).first;
+    inquiries_.Get(handle) = data;
+    Advance(handle);
+}
+
+template<typename T>
+void InquiryService<T>::Advance(InquiryHandle handle)
+{
+    Inquiry<T>& inquiry = inquiries_.Get(handle);
+    while (true) {
+        switch (inquiry.GetState()) {
+            case RECEIVED:
+                if (!auto_quote_) {
+                    inquiries_.Open(handle);
+                    return;
+                }
+                Quote(inquiry);
+                break;
+            case QUOTED:
+                inquiry.SetState(DONE);
+                inquiries_.Close(handle);
+                Notify(inquiry);
+                return;
+            default:
+                inquiries_.Close(handle);
+                return;
+        }
+    }
+}
+
+template<typename T>
+void InquiryService<T>::Quote(Inquiry<T>& inquiry)
+{
+    connector_->Publish(inquiry);
+    inquiry.SetState(QUOTED);
+}
+
+template<typename T>
+void InquiryService<T>::Notify(Inquiry<T>& inquiry)
+{
+    for (auto& listener : this->GetListeners())
+    {
+        listener->ProcessAdd(inquiry);
     }
 }
 
@@ -239,20 +469,105 @@ InquiryConnector<T>* InquiryService<T>::GetConnector()
 }
 
 template<typename T>
-void InquiryService<T>::SendQuote(const string& inquiryId, double price)
+InquiryHandle InquiryService<T>::GetHandle(const string& inquiryId) const
 {
-    Inquiry<T>& inquiry = inquiries_[inquiryId];
-//    InquiryState state = inquiry.GetState();
+    return inquiries_.GetHandle(inquiryId);
+}
+
+template<typename T>
+Inquiry<T>& InquiryService<T>::GetInquiry(InquiryHandle handle)
+{
+    return inquiries_.Get(handle);
+}
+
+template<typename T>
+void InquiryService<T>::SetAutoQuote(bool auto_quote)
+{
+    auto_quote_ = auto_quote;
+}
+
+template<typename T>
+size_t InquiryService<T>::GetOpenCount() const
+{
+    return inquiries_.GetOpen().size();
+}
+
+template<typename T>
+void InquiryService<T>::SendQuote(const string& inquiryId, PriceTick price)
+{
+    SendQuote(inquiries_.GetHandle(inquiryId), price);
+}
+
+template<typename T>
+void InquiryService<T>::SendQuote(InquiryHandle handle, PriceTick price)
+{
+    if (!inquiries_.IsOpen(handle)) {
+        throw logic_error("InquiryService: inquiry " + inquiries_.Get(handle).GetInquiryId() + " is not open for a quote");
+    }
+    Inquiry<T>& inquiry = inquiries_.Get(handle);
     inquiry.SetPrice(price);
-    for (auto& listener : this->GetListeners())
-    {
-        listener->ProcessAdd(inquiry);
+    Quote(inquiry);
+    Advance(handle);
+}
+
+template<typename T>
+void InquiryService<T>::RejectInquiry(const string& inquiryId)
+{
+    RejectInquiry(inquiries_.GetHandle(inquiryId));
+}
+
+template<typename T>
+void InquiryService<T>::RejectInquiry(InquiryHandle handle)
+{
+    Inquiry<T>& inquiry = inquiries_.Get(handle);
+    if (inquiry.GetState() != RECEIVED && inquiry.GetState() != QUOTED) {
+        throw logic_error("InquiryService: inquiry " + inquiry.GetInquiryId() + " is already closed");
+    }
+    inquiry.SetState(REJECTED);
+    inquiries_.Close(handle);
+    Notify(inquiry);
+}
+
+template<typename T>
+template <typename F>
+void InquiryService<T>::ForEachOpenInquiry(F&& f) const
+{
+    for (InquiryHandle handle : inquiries_.GetOpen()) {
+        f(inquiries_.Get(handle));
+    }
+}
+
+template<typename T>
+void InquiryService<T>::RestoreInquiry(const Inquiry<T>& inquiry)
+{
+    InquiryHandle handle = inquiries_.Insert(inquiry.GetInquiryId()).first;
+    inquiries_.Get(handle) = inquiry;
+    if (inquiry.GetState() == RECEIVED) {
+        inquiries_.Open(handle);
+    } else {
+        inquiries_.Close(handle);
     }
 }
 
 template<typename T>
-void InquiryService<T>::RejectInquiry(const string& inquiryId) {
-    inquiries_[inquiryId].SetState(REJECTED);
+size_t InquiryService<T>::QuoteOpenInquiries(const PricingService<T>& pricing_service)
+{
+    // Price the open inquiries first, since quoting them reorders the open list
+    ProductRegistry<T>& registry = ProductRegistry<T>::Instance();
+    quotes_.clear();
+    for (InquiryHandle handle : inquiries_.GetOpen()) {
+        const Inquiry<T>& inquiry = inquiries_.Get(handle);
+        const Price<T>* price = pricing_service.FindPrice(registry.Resolve(inquiry.GetProduct()));
+        if (price == nullptr) {
+            continue;
+        }
+        PriceTick half_spread = price->GetBidOfferSpread() / 2;
+        quotes_.emplace_back(handle, inquiry.GetSide() == BUY ? price->GetMid() + half_spread : price->GetMid() - half_spread);
+    }
+    for (auto [handle, quote] : quotes_) {
+        SendQuote(handle, quote);
+    }
+    return quotes_.size();
 }
 
 template<typename T>
@@ -261,43 +576,43 @@ InquiryConnector<T>::InquiryConnector(InquiryService<T>* service) {
 }
 
 template<typename T>
-void InquiryConnector<T>::Publish(Inquiry<T>& data)
+void InquiryConnector<T>::Publish(Inquiry<T>& data) {}
+
+template<typename T>
+void InquiryConnector<T>::Subscribe(istream& data)
 {
-    InquiryState state = data.GetState();
-    if (state == RECEIVED)
-    {
-        data.SetState(QUOTED);
-        this->Subscribe(data);
-    }
+    LineReader reader(data);
+    Subscribe(reader);
 }
 
 template<typename T>
-void InquiryConnector<T>::Subscribe(ifstream& data)
+void InquiryConnector<T>::Subscribe(LineReader& reader)
 {
-    string line;
-    while (getline(data, line))
+    LineFields line_entries;
+    while (reader.ReadFields(line_entries))
     {
-        // Separate line with delimiter ','
-        stringstream line_stream(line);
-        string line_entry;
-        vector<string> line_entries;
-        while (getline(line_stream, line_entry, ',')) {
-            line_entries.push_back(line_entry);
-        }
-
+        line_entries.RequireFields(6, "InquiryConnector");
         // Parse data into Inquiry
-        string inquiry_id = line_entries[0];
-        string product_id = line_entries[1];
+        string inquiry_id(line_entries[0]);
+        string_view product_id = line_entries[1];
         Side side = (line_entries[2] == "BUY") ? BUY : SELL;
-        long quantity = stol(line_entries[3]);
-        double price = ConvertPrice(line_entries[4]);
+        long quantity = ParseNumber<long>(line_entries[3]);
+        PriceTick price = ConvertPrice(line_entries[4]);
         InquiryState state;
-        if (line_entries[5] == "RECEIVED") state = RECEIVED;
-        else if (line_entries[5] == "QUOTED") state = QUOTED;
-        else if (line_entries[5] == "DONE") state = DONE;
-        else if (line_entries[5] == "REJECTED") state = REJECTED;
-        else if (line_entries[5] == "CUSTOMER_REJECTED") state = CUSTOMER_REJECTED;
-        T product = FetchBond(product_id);
+        if (line_entries[5] == "RECEIVED") {
+            state = RECEIVED;
+        } else if (line_entries[5] == "QUOTED") {
+            state = QUOTED;
+        } else if (line_entries[5] == "DONE") {
+            state = DONE;
+        } else if (line_entries[5] == "REJECTED") {
+            state = REJECTED;
+        } else if (line_entries[5] == "CUSTOMER_REJECTED") {
+            state = CUSTOMER_REJECTED;
+        } else {
+            throw invalid_argument("InquiryConnector: unknown state " + string(line_entries[5]));
+        }
+        const T& product = FetchBond(product_id);
         Inquiry<T> inquiry(inquiry_id, product, side, quantity, price, state);
         service_->OnMessage(inquiry);
     }
@@ -310,11 +625,15 @@ void InquiryConnector<T>::Subscribe(Inquiry<T>& data)
 }
 
 template<typename T>
-vector<string> Inquiry<T>::ToString() const
+size_t Inquiry<T>::GetMaxSerializedSize() const
+{
+    return GetMaxFieldSize(inquiryId) + GetMaxFieldSize(product->GetProductId()) + GetMaxFieldSize("SELL") + kMaxLongFieldSize + kMaxPriceFieldSize + GetMaxFieldSize("CUSTOMER_REJECTED");
+}
+
+template<typename T>
+char* Inquiry<T>::Serialize(char* out) const
 {
-    string _inquiryId = inquiryId;
-    string _product = product.GetProductId();
-    string _side;
+    string_view _side;
     switch (side)
     {
     case BUY:
@@ -324,9 +643,7 @@ vector<string> Inquiry<T>::ToString() const
         _side = "SELL";
         break;
     }
-    string _quantity = to_string(quantity);
-    string _price = ConvertPrice(price);
-    string _state;
+    string_view _state;
     switch (state)
     {
     case RECEIVED:
@@ -346,14 +663,13 @@ vector<string> Inquiry<T>::ToString() const
         break;
     }
 
-    vector<string> _strings;
-    _strings.push_back(_inquiryId);
-    _strings.push_back(_product);
-    _strings.push_back(_side);
-    _strings.push_back(_quantity);
-    _strings.push_back(_price);
-    _strings.push_back(_state);
-    return _strings;
+    out = WriteField(out, inquiryId);
+    out = WriteField(out, product->GetProductId());
+    out = WriteField(out, _side);
+    out = WriteField(out, quantity);
+    out = WriteField(out, price);
+    out = WriteField(out, _state);
+    return out;
 }
 
 #endif
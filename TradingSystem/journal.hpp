@@ -0,0 +1,389 @@
+/**
+ * journal.hpp
+ * Binary memory-mapped journal of fixed-layout records, with a matching zero-copy reader
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) A journal file holds records of a single type. It starts with a JournalHeader followed by JournalEntry<R> slots: a timestamp, a sequence number and the record itself.
+ (2) The writer preallocates the file and maps it. Appending a record is a copy into the mapping. When the segment is full, it is extended by the same size and remapped. On close, the file is truncated to the records actually written.
+ (3) A journal is either created afresh (generated feeds) or appended to across runs, as the text stores are (historical data). Appending reopens the existing entries and continues their sequence and timestamps.
+ (4) Timestamps never decrease within a journal, so the reader can seek by timestamp with a binary search.
+ (5) The reader maps the file read-only and hands out pointers into the mapping. Nothing is parsed or copied.
+ (6) Record types must be trivially copyable and have the same layout on the writing and reading machine.
+ */
+
+#ifndef journal_hpp
+#define journal_hpp
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// "TSJRNL01"
+constexpr uint64_t kJournalMagic = 0x31304C4E524A5354ULL;
+
+/**
+ * Header at the start of every journal file.
+ */
+struct JournalHeader
+{
+    uint64_t magic;
+    uint32_t record_type;
+    uint32_t entry_size;
+    uint64_t count;      // Number of committed entries
+    uint64_t reserved;
+};
+
+/**
+ * A record as stored in the journal.
+ */
+template <typename R>
+struct JournalEntry
+{
+    int64_t timestamp;   // Nanoseconds since the epoch (wall clock)
+    uint64_t sequence;   // Position of the entry in the journal
+    R record;
+};
+
+// Copy a string into a fixed-width, NUL padded field (truncates if too long)
+template <size_t N>
+void CopyJournalField(char (&field)[N], string_view text)
+{
+    size_t size = min(text.size(), N);
+    memcpy(field, text.data(), size);
+    memset(field + size, 0, N - size);
+}
+
+// Copy a string into a fixed-width, NUL padded field; throws if it does not fit
+template <size_t N>
+void CopyJournalFieldExact(char (&field)[N], string_view text)
+{
+    if (text.size() > N) {
+        throw length_error("CopyJournalFieldExact: \"" + string(text) + "\" is longer than " + to_string(N) + " characters");
+    }
+    CopyJournalField(field, text);
+}
+
+// View a fixed-width, NUL padded field as a string
+template <size_t N>
+string_view JournalFieldView(const char (&field)[N])
+{
+    return string_view(field, strnlen(field, N));
+}
+
+// Current wall clock time in nanoseconds since the epoch
+int64_t GetJournalTimestamp()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Whether a JournalWriter starts a new file or continues an existing one
+enum JournalOpenMode { JOURNAL_TRUNCATE, JOURNAL_APPEND };
+
+/**
+ * Appends records of type R to a preallocated, memory-mapped journal file.
+ * Safe to use from several threads.
+ */
+template <typename R>
+class JournalWriter
+{
+    static_assert(is_trivially_copyable_v<R>, "Journal records must be trivially copyable");
+
+public:
+    static constexpr size_t kDefaultSegmentEntries = 1 << 16;
+
+    // Create (or truncate) the journal file, or append to it if it exists, preallocating room for segment_entries more entries.
+    // Throws if an existing file to append to is not a journal of the expected type.
+    JournalWriter(const string& path, uint32_t record_type, size_t segment_entries = kDefaultSegmentEntries, JournalOpenMode mode = JOURNAL_TRUNCATE);
+    ~JournalWriter();
+
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator = (const JournalWriter&) = delete;
+
+    // Append a record stamped with the current time
+    void Append(const R& record);
+
+    // Append a record with an explicit timestamp (e.g. a recorded feed). Earlier timestamps are clamped to the last one.
+    void Append(const R& record, int64_t timestamp);
+
+    // Number of entries written
+    size_t Size() const;
+
+    // Make the written entries durable
+    void Sync();
+
+private:
+    // Map room for the given number of entries
+    void Map(size_t capacity);
+
+    JournalHeader* Header() const;
+    JournalEntry<R>* Entries() const;
+
+    int fd_;
+    char* base_;
+    size_t capacity_;
+    size_t segment_entries_;
+    int64_t last_timestamp_;
+    mutable mutex mutex_;
+};
+
+/**
+ * Read-only, zero-copy view of a journal file.
+ */
+template <typename R>
+class JournalReader
+{
+    static_assert(is_trivially_copyable_v<R>, "Journal records must be trivially copyable");
+
+public:
+    typedef const JournalEntry<R>* const_iterator;
+
+    // Map an existing journal; throws if the file is not a journal of the expected type
+    JournalReader(const string& path, uint32_t record_type);
+    ~JournalReader();
+
+    JournalReader(const JournalReader&) = delete;
+    JournalReader& operator = (const JournalReader&) = delete;
+
+    // Number of entries in the journal
+    size_t Size() const;
+
+    // Get the i-th entry
+    const JournalEntry<R>& operator[](size_t i) const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    // First entry with a timestamp no earlier than the given one
+    const_iterator Seek(int64_t timestamp) const;
+
+    // Call f on every entry with a timestamp in [from, to)
+    template <typename F>
+    void Replay(int64_t from, int64_t to, F&& f) const;
+
+private:
+    const char* base_;
+    size_t mapped_size_;
+};
+
+template <typename R>
+JournalWriter<R>::JournalWriter(const string& path, uint32_t record_type, size_t segment_entries, JournalOpenMode mode) :
+  fd_(-1), base_(nullptr), capacity_(0), segment_entries_(max<size_t>(segment_entries, 1)), last_timestamp_(0)
+{
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | (mode == JOURNAL_TRUNCATE ? O_TRUNC : 0), 0644);
+    if (fd_ < 0) {
+        throw runtime_error("JournalWriter: cannot open " + path);
+    }
+
+    // The destructor does not run if the constructor throws, so the file is closed here
+    try {
+        struct stat file_stat;
+        if (fstat(fd_, &file_stat) != 0) {
+            throw runtime_error("JournalWriter: cannot stat " + path);
+        }
+        if (file_stat.st_size > 0) {
+            // Continue an existing journal after its committed entries
+            JournalHeader header;
+            bool valid = size_t(file_stat.st_size) >= sizeof(JournalHeader) && pread(fd_, &header, sizeof(header), 0) == ssize_t(sizeof(header))
+                         && header.magic == kJournalMagic && header.record_type == record_type && header.entry_size == sizeof(JournalEntry<R>)
+                         && sizeof(JournalHeader) + header.count * sizeof(JournalEntry<R>) <= size_t(file_stat.st_size);
+            if (!valid) {
+                throw runtime_error("JournalWriter: " + path + " does not hold the expected records");
+            }
+            Map(header.count + segment_entries_);
+            if (header.count > 0) {
+                last_timestamp_ = Entries()[header.count - 1].timestamp;
+            }
+            return;
+        }
+        Map(segment_entries_);
+    } catch (...) {
+        close(fd_);
+        throw;
+    }
+
+    JournalHeader* header = Header();
+    header->magic = kJournalMagic;
+    header->record_type = record_type;
+    header->entry_size = sizeof(JournalEntry<R>);
+    header->count = 0;
+    header->reserved = 0;
+}
+
+template <typename R>
+JournalWriter<R>::~JournalWriter()
+{
+    size_t used = sizeof(JournalHeader) + Header()->count * sizeof(JournalEntry<R>);
+    munmap(base_, sizeof(JournalHeader) + capacity_ * sizeof(JournalEntry<R>));
+    // Give back the preallocated tail; readers only trust the committed count anyway
+    int result = ftruncate(fd_, used);
+    (void)result;
+    close(fd_);
+}
+
+template <typename R>
+void JournalWriter<R>::Map(size_t capacity)
+{
+    size_t old_size = sizeof(JournalHeader) + capacity_ * sizeof(JournalEntry<R>);
+    size_t new_size = sizeof(JournalHeader) + capacity * sizeof(JournalEntry<R>);
+
+    if (ftruncate(fd_, new_size) != 0) {
+        throw runtime_error("JournalWriter: cannot preallocate segment");
+    }
+    // Map the new size before unmapping the old one, so a failure leaves the writer on its current mapping
+    void* mapping = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (mapping == MAP_FAILED) {
+        throw runtime_error("JournalWriter: cannot map segment");
+    }
+    if (base_ != nullptr) {
+        munmap(base_, old_size);
+    }
+    base_ = static_cast<char*>(mapping);
+    capacity_ = capacity;
+}
+
+template <typename R>
+JournalHeader* JournalWriter<R>::Header() const
+{
+    return reinterpret_cast<JournalHeader*>(base_);
+}
+
+template <typename R>
+JournalEntry<R>* JournalWriter<R>::Entries() const
+{
+    return reinterpret_cast<JournalEntry<R>*>(base_ + sizeof(JournalHeader));
+}
+
+template <typename R>
+void JournalWriter<R>::Append(const R& record)
+{
+    Append(record, GetJournalTimestamp());
+}
+
+template <typename R>
+void JournalWriter<R>::Append(const R& record, int64_t timestamp)
+{
+    lock_guard<mutex> lock(mutex_);
+
+    size_t count = Header()->count;
+    if (count == capacity_) {
+        // Extend by another segment
+        Map(capacity_ + segment_entries_);
+    }
+
+    last_timestamp_ = max(last_timestamp_, timestamp);
+
+    JournalEntry<R>& entry = Entries()[count];
+    entry.timestamp = last_timestamp_;
+    entry.sequence = count;
+    entry.record = record;
+
+    Header()->count = count + 1;
+}
+
+template <typename R>
+size_t JournalWriter<R>::Size() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return Header()->count;
+}
+
+template <typename R>
+void JournalWriter<R>::Sync()
+{
+    lock_guard<mutex> lock(mutex_);
+    msync(base_, sizeof(JournalHeader) + capacity_ * sizeof(JournalEntry<R>), MS_SYNC);
+}
+
+template <typename R>
+JournalReader<R>::JournalReader(const string& path, uint32_t record_type) : base_(nullptr), mapped_size_(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("JournalReader: cannot open " + path);
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || size_t(file_stat.st_size) < sizeof(JournalHeader)) {
+        close(fd);
+        throw runtime_error("JournalReader: " + path + " is not a journal");
+    }
+
+    mapped_size_ = file_stat.st_size;
+    void* mapping = mmap(nullptr, mapped_size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw runtime_error("JournalReader: cannot map " + path);
+    }
+    base_ = static_cast<const char*>(mapping);
+
+    const JournalHeader* header = reinterpret_cast<const JournalHeader*>(base_);
+    bool valid = header->magic == kJournalMagic && header->record_type == record_type && header->entry_size == sizeof(JournalEntry<R>) && sizeof(JournalHeader) + header->count * sizeof(JournalEntry<R>) <= mapped_size_;
+    if (!valid) {
+        munmap(const_cast<char*>(base_), mapped_size_);
+        throw runtime_error("JournalReader: " + path + " does not hold the expected records");
+    }
+}
+
+template <typename R>
+JournalReader<R>::~JournalReader()
+{
+    munmap(const_cast<char*>(base_), mapped_size_);
+}
+
+template <typename R>
+size_t JournalReader<R>::Size() const
+{
+    return reinterpret_cast<const JournalHeader*>(base_)->count;
+}
+
+template <typename R>
+const JournalEntry<R>& JournalReader<R>::operator[](size_t i) const
+{
+    return begin()[i];
+}
+
+template <typename R>
+typename JournalReader<R>::const_iterator JournalReader<R>::begin() const
+{
+    return reinterpret_cast<const JournalEntry<R>*>(base_ + sizeof(JournalHeader));
+}
+
+template <typename R>
+typename JournalReader<R>::const_iterator JournalReader<R>::end() const
+{
+    return begin() + Size();
+}
+
+template <typename R>
+typename JournalReader<R>::const_iterator JournalReader<R>::Seek(int64_t timestamp) const
+{
+    return lower_bound(begin(), end(), timestamp, [](const JournalEntry<R>& entry, int64_t t) { return entry.timestamp < t; });
+}
+
+template <typename R>
+template <typename F>
+void JournalReader<R>::Replay(int64_t from, int64_t to, F&& f) const
+{
+    for (const_iterator it = Seek(from); it != end() && it->timestamp < to; ++it) {
+        f(*it);
+    }
+}
+
+#endif /* journal_hpp */
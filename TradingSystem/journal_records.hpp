@@ -0,0 +1,194 @@
+/**
+ * journal_records.hpp
+ * Fixed-layout journal records for the data persisted by HistoricalDataService
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) Every persisted type gets a trivially copyable record and a JournalCodec specialization. The specialization supplies the record type tag and the encoding from the service object.
+ (2) Identifiers are stored in fixed-width, NUL padded character fields; encoding an identifier that does not fit throws rather than cutting it. Prices are stored as ticks, so no precision is lost.
+ (3) Records are read back straight from the mapping through JournalReader<Codec::Record>. Nothing is decoded into service objects.
+ */
+
+#ifndef journal_records_hpp
+#define journal_records_hpp
+
+#include <cstdint>
+
+#include "journal.hpp"
+#include "position_service.hpp"
+#include "risk_service.hpp"
+#include "execution_order.hpp"
+#include "price_stream.hpp"
+#include "inquiry_service.hpp"
+
+// Record type tags stored in the journal header
+enum JournalRecordType : uint32_t { POSITION_RECORD = 1, PV01_RECORD, EXECUTION_ORDER_RECORD, PRICE_STREAM_RECORD, INQUIRY_RECORD };
+
+// Width of identifier fields
+constexpr size_t kJournalIdSize = 16;
+
+// Books a position record can hold (encoding a position with more throws)
+constexpr size_t kJournalMaxBooks = 8;
+
+struct PositionRecord
+{
+    char product_id[kJournalIdSize];
+    uint32_t book_count;
+    uint32_t padding;
+    struct {
+        char book[kJournalIdSize];
+        int64_t position;
+    } books[kJournalMaxBooks];
+};
+
+struct PV01Record
+{
+    char product_id[kJournalIdSize];
+    double pv01;
+    int64_t quantity;
+};
+
+struct ExecutionOrderRecord
+{
+    char product_id[kJournalIdSize];
+    char order_id[kJournalIdSize];
+    char parent_order_id[kJournalIdSize];
+    int64_t price;               // Ticks
+    double visible_quantity;
+    double hidden_quantity;
+    uint8_t side;                // PricingSide
+    uint8_t order_type;          // OrderType
+    uint8_t is_child_order;
+    uint8_t padding[5];
+};
+
+struct PriceStreamRecord
+{
+    char product_id[kJournalIdSize];
+    struct {
+        int64_t price;           // Ticks
+        int64_t visible_quantity;
+        int64_t hidden_quantity;
+    } bid, offer;
+};
+
+struct InquiryRecord
+{
+    char inquiry_id[kJournalIdSize];
+    char product_id[kJournalIdSize];
+    int64_t quantity;
+    int64_t price;               // Ticks
+    uint8_t side;                // Side
+    uint8_t state;               // InquiryState
+    uint8_t padding[6];
+};
+
+/**
+ * Maps a persisted type onto its journal record.
+ * Specializations define Record, kRecordType and Encode.
+ */
+template <typename V>
+struct JournalCodec;
+
+template <typename T>
+struct JournalCodec<Position<T>>
+{
+    typedef PositionRecord Record;
+    static constexpr uint32_t kRecordType = POSITION_RECORD;
+
+    static void Encode(const Position<T>& position, Record& record)
+    {
+        record = Record{};
+        CopyJournalFieldExact(record.product_id, position.GetProduct().GetProductId());
+        position.ForEachBook([&record](const string& book, long quantity) {
+            if (record.book_count == kJournalMaxBooks) {
+                throw length_error("JournalCodec<Position>: a position record holds at most " + to_string(kJournalMaxBooks) + " books");
+            }
+            auto& entry = record.books[record.book_count++];
+            CopyJournalFieldExact(entry.book, book);
+            entry.position = quantity;
+        });
+    }
+};
+
+template <typename T>
+struct JournalCodec<PV01<T>>
+{
+    typedef PV01Record Record;
+    static constexpr uint32_t kRecordType = PV01_RECORD;
+
+    static void Encode(const PV01<T>& pv01, Record& record)
+    {
+        CopyJournalFieldExact(record.product_id, pv01.GetProduct().GetProductId());
+        record.pv01 = pv01.GetPV01();
+        record.quantity = pv01.GetQuantity();
+    }
+};
+
+template <typename T>
+struct JournalCodec<ExecutionOrder<T>>
+{
+    typedef ExecutionOrderRecord Record;
+    static constexpr uint32_t kRecordType = EXECUTION_ORDER_RECORD;
+
+    static void Encode(const ExecutionOrder<T>& order, Record& record)
+    {
+        record = Record{};
+        CopyJournalFieldExact(record.product_id, order.GetProduct().GetProductId());
+        CopyJournalFieldExact(record.order_id, order.GetOrderId());
+        CopyJournalFieldExact(record.parent_order_id, order.GetParentOrderId());
+        record.price = order.GetPrice().GetTicks();
+        record.visible_quantity = order.GetVisibleQuantity();
+        record.hidden_quantity = order.GetHiddenQuantity();
+        record.side = order.GetPricingSide();
+        record.order_type = order.GetOrderType();
+        record.is_child_order = order.IsChildOrder();
+    }
+};
+
+template <typename T>
+struct JournalCodec<PriceStream<T>>
+{
+    typedef PriceStreamRecord Record;
+    static constexpr uint32_t kRecordType = PRICE_STREAM_RECORD;
+
+    static void Encode(const PriceStream<T>& stream, Record& record)
+    {
+        CopyJournalFieldExact(record.product_id, stream.GetProduct().GetProductId());
+        const PriceStreamOrder& bid = stream.GetBidOrder();
+        record.bid = { bid.GetPrice().GetTicks(), bid.GetVisibleQuantity(), bid.GetHiddenQuantity() };
+        const PriceStreamOrder& offer = stream.GetOfferOrder();
+        record.offer = { offer.GetPrice().GetTicks(), offer.GetVisibleQuantity(), offer.GetHiddenQuantity() };
+    }
+};
+
+template <typename T>
+struct JournalCodec<Inquiry<T>>
+{
+    typedef InquiryRecord Record;
+    static constexpr uint32_t kRecordType = INQUIRY_RECORD;
+
+    static void Encode(const Inquiry<T>& inquiry, Record& record)
+    {
+        record = Record{};
+        CopyJournalFieldExact(record.inquiry_id, inquiry.GetInquiryId());
+        CopyJournalFieldExact(record.product_id, inquiry.GetProduct().GetProductId());
+        record.quantity = inquiry.GetQuantity();
+        record.price = inquiry.GetPrice().GetTicks();
+        record.side = inquiry.GetSide();
+        record.state = inquiry.GetState();
+    }
+};
+
+// Open a journal written by HistoricalDataService<V>
+template <typename V>
+class HistoricalJournalReader : public JournalReader<typename JournalCodec<V>::Record>
+{
+public:
+    explicit HistoricalJournalReader(const string& path) : JournalReader<typename JournalCodec<V>::Record>(path, JournalCodec<V>::kRecordType) {}
+};
+
+#endif /* journal_records_hpp */
@@ -0,0 +1,252 @@
+/**
+ * latency.hpp
+ * Per-hop latency instrumentation for the tick-to-trade chain, compiled in with TRADING_LATENCY
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) Connectors stamp each event with its ingest time, and the stamp is carried over whenever an event is turned into the next one (OrderBook -> ExecutionOrder -> Trade -> Position -> PV01). Each service hop records now - ingest, so a hop's histogram is the latency from ingest up to that hop.
+ (2) Histograms are log-linear (HDR style): a power of two is split into 32 linear sub-buckets, which bounds the relative error to about 3% over the whole 64-bit range with a fixed array and no allocation.
+ (3) Each thread records into its own set of histograms, so a record is an uncontended relaxed store. The sets are owned by LatencyRecorder and merged when a report is printed, at shutdown or on demand.
+ (4) Time is GetMonotonicNanoseconds (steady clock) rather than raw TSC, which would need calibrating per machine; on Linux it is a vDSO call.
+ (5) Without TRADING_LATENCY, LatencyTagged is an empty base and every LATENCY_* macro expands to nothing, so the instrumentation costs nothing.
+ */
+
+#ifndef latency_hpp
+#define latency_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include "timestamp.hpp"
+
+#ifdef TRADING_LATENCY
+#include <array>
+#include <atomic>
+#include <bit>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#endif
+
+using namespace std;
+
+// Timed hops of the tick-to-trade chain
+enum LatencyHop { MARKET_DATA_ON_MESSAGE, ALGO_EXECUTE, EXECUTE_ORDER, BOOK_TRADE, ADD_TRADE, ADD_POSITION };
+
+constexpr size_t kLatencyHopCount = ADD_POSITION + 1;
+
+/**
+ * Base class of the events that carry their ingest time.
+ * Empty unless TRADING_LATENCY is defined.
+ */
+class LatencyTagged
+{
+#ifdef TRADING_LATENCY
+public:
+    // Get the ingest time in steady clock nanoseconds (0 if never stamped)
+    uint64_t GetIngestStamp() const;
+
+    // Set the ingest time
+    void SetIngestStamp(uint64_t stamp);
+
+private:
+    uint64_t ingest_stamp_ = 0;
+#endif
+};
+
+#ifdef TRADING_LATENCY
+
+/**
+ * Log-linear histogram of nanosecond values, written by one thread and readable by any.
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned kSubBucketBits = 5;
+    static constexpr size_t kSubBuckets = size_t(1) << kSubBucketBits;
+    static constexpr size_t kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+    // Count a value (owning thread only)
+    void Record(uint64_t value);
+
+    // Add the counts to a merged array
+    void MergeInto(array<uint64_t, kBuckets>& counts) const;
+
+    // Bucket of a value
+    static size_t IndexOf(uint64_t value);
+
+    // Highest value falling in a bucket
+    static uint64_t HighestValueOf(size_t index);
+
+private:
+    array<atomic<uint64_t>, kBuckets> counts_{};
+};
+
+/**
+ * Owner of the per-thread histograms.
+ */
+class LatencyRecorder
+{
+public:
+    // Get the recorder
+    static LatencyRecorder& Instance();
+
+    // Current steady clock time in nanoseconds
+    static uint64_t Now();
+
+    // Record the time since an ingest stamp against a hop (unstamped events are skipped)
+    void Record(LatencyHop hop, uint64_t ingest_stamp);
+
+    // Print count, p50, p99, p99.9 and max of every hop, merged over all threads
+    void Report(ostream& out) const;
+
+private:
+    typedef array<LatencyHistogram, kLatencyHopCount> HopHistograms;
+
+    LatencyRecorder() = default;
+
+    // Histograms of the calling thread, created on its first record
+    HopHistograms& Local();
+
+    mutable mutex mutex_;
+    vector<unique_ptr<HopHistograms>> threads_;
+};
+
+#define LATENCY_STAMP(event) (event).SetIngestStamp(LatencyRecorder::Now())
+#define LATENCY_CARRY(to, from) (to).SetIngestStamp((from).GetIngestStamp())
+#define LATENCY_RECORD(hop, event) LatencyRecorder::Instance().Record((hop), (event).GetIngestStamp())
+#define LATENCY_REPORT(out) LatencyRecorder::Instance().Report(out)
+
+uint64_t LatencyTagged::GetIngestStamp() const
+{
+    return ingest_stamp_;
+}
+
+void LatencyTagged::SetIngestStamp(uint64_t stamp)
+{
+    ingest_stamp_ = stamp;
+}
+
+void LatencyHistogram::Record(uint64_t value)
+{
+    // Single writer: a plain increment, kept atomic only so that reports may read concurrently
+    atomic<uint64_t>& count = counts_[IndexOf(value)];
+    count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+void LatencyHistogram::MergeInto(array<uint64_t, kBuckets>& counts) const
+{
+    for (size_t i = 0; i < kBuckets; i++) {
+        counts[i] += counts_[i].load(memory_order_relaxed);
+    }
+}
+
+size_t LatencyHistogram::IndexOf(uint64_t value)
+{
+    if (value < kSubBuckets) {
+        return value;
+    }
+    // Keep the top kSubBucketBits + 1 bits; the leading one selects the power of two
+    unsigned shift = unsigned(bit_width(value)) - 1 - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+}
+
+uint64_t LatencyHistogram::HighestValueOf(size_t index)
+{
+    if (index < 2 * kSubBuckets) {
+        return index;
+    }
+    unsigned shift = unsigned(index / kSubBuckets) - 1;
+    uint64_t top = index % kSubBuckets + kSubBuckets;
+    return ((top + 1) << shift) - 1;
+}
+
+LatencyRecorder& LatencyRecorder::Instance()
+{
+    static LatencyRecorder recorder;
+    return recorder;
+}
+
+uint64_t LatencyRecorder::Now()
+{
+    return GetMonotonicNanoseconds();
+}
+
+void LatencyRecorder::Record(LatencyHop hop, uint64_t ingest_stamp)
+{
+    if (ingest_stamp == 0) {
+        return;
+    }
+    uint64_t now = Now();
+    Local()[hop].Record(now > ingest_stamp ? now - ingest_stamp : 0);
+}
+
+LatencyRecorder::HopHistograms& LatencyRecorder::Local()
+{
+    // The histograms stay with the recorder after their thread exits, so they still show up in reports
+    thread_local HopHistograms* local = [this] {
+        lock_guard<mutex> lock(mutex_);
+        threads_.push_back(make_unique<HopHistograms>());
+        return threads_.back().get();
+    }();
+    return *local;
+}
+
+void LatencyRecorder::Report(ostream& out) const
+{
+    static const char* hop_names[kLatencyHopCount] = {
+        "MarketDataService::OnMessage",
+        "AlgoExecutionService::AlgoExecute",
+        "ExecutionService::ExecuteOrder",
+        "TradeBookingService::BookTrade",
+        "PositionService::AddTrade",
+        "RiskService::AddPosition"
+    };
+
+    lock_guard<mutex> lock(mutex_);
+    out << "Latency since ingest (ns)" << endl;
+    out << left << setw(36) << "hop" << right << setw(12) << "count" << setw(12) << "p50" << setw(12) << "p99" << setw(12) << "p99.9" << setw(12) << "max" << endl;
+    for (size_t hop = 0; hop < kLatencyHopCount; hop++) {
+        array<uint64_t, LatencyHistogram::kBuckets> counts{};
+        for (const auto& histograms : threads_) {
+            (*histograms)[hop].MergeInto(counts);
+        }
+        uint64_t total = 0;
+        for (uint64_t count : counts) {
+            total += count;
+        }
+
+        // Value at each quantile: the highest value of the bucket where the running count reaches it
+        const double quantiles[] = { 0.5, 0.99, 0.999, 1.0 };
+        uint64_t values[4] = {};
+        size_t next = 0;
+        uint64_t running = 0;
+        for (size_t i = 0; i < LatencyHistogram::kBuckets && total > 0 && next < 4; i++) {
+            running += counts[i];
+            while (next < 4 && running > 0 && running >= quantiles[next] * total) {
+                values[next++] = LatencyHistogram::HighestValueOf(i);
+            }
+        }
+
+        out << left << setw(36) << hop_names[hop] << right << setw(12) << total;
+        for (uint64_t value : values) {
+            out << setw(12) << value;
+        }
+        out << endl;
+    }
+}
+
+#else
+
+#define LATENCY_STAMP(event) ((void)0)
+#define LATENCY_CARRY(to, from) ((void)0)
+#define LATENCY_RECORD(hop, event) ((void)0)
+#define LATENCY_REPORT(out) ((void)0)
+
+#endif /* TRADING_LATENCY */
+
+#endif /* latency_hpp */
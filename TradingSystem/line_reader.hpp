@@ -0,0 +1,215 @@
+/**
+ * line_reader.hpp
+ * Allocation-free line reader and tokenizer shared by the file connectors
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) LineReader reads through one large reusable buffer instead of `getline` into a fresh string per line. It can also walk an in-memory region directly (e.g. an mmap'd file), in which case nothing is copied at all.
+ (2) LineFields splits a line into `string_view`s pointing into that buffer. The views are only valid until the next line is read, so connectors must finish with a line (or copy what they keep) before reading the next one.
+ (3) Numbers are parsed in place with `from_chars`.
+ */
+
+#ifndef line_reader_hpp
+#define line_reader_hpp
+
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Comma separated fields of a single line, as views into the reader's buffer.
+ */
+class LineFields
+{
+public:
+    // Maximum number of fields per line. Extra fields are folded into the last one.
+    static constexpr size_t kMaxFields = 16;
+
+    LineFields() = default;
+
+    // Split a line on the delimiter
+    void Split(string_view line, char delimiter = ',');
+
+    // Number of fields on the line
+    size_t Size() const;
+
+    // Get the i-th field (i must be below Size(): fields past the end are left over from earlier lines)
+    string_view operator[](size_t i) const;
+
+    // Throw invalid_argument, naming the source, unless the line has at least count fields
+    void RequireFields(size_t count, const char* source) const;
+
+private:
+    array<string_view, kMaxFields> fields_;
+    size_t size_ = 0;
+};
+
+/**
+ * Line reader over a stream (through a reusable buffer) or over a memory region.
+ */
+class LineReader
+{
+public:
+    static constexpr size_t kDefaultBufferSize = 1 << 20;
+
+    // Read from a stream through a buffer of the given size
+    explicit LineReader(istream& in, size_t buffer_size = kDefaultBufferSize);
+
+    // Read from a memory region, e.g. an mmap'd file. The region must outlive the reader.
+    LineReader(const char* begin, const char* end);
+
+    // Read the next non-empty line (without the line terminator). Returns false at the end of input.
+    bool ReadLine(string_view& line);
+
+    // Read the next non-empty line and split it into fields
+    bool ReadFields(LineFields& fields, char delimiter = ',');
+
+    // Number of bytes consumed from the start of the input
+    size_t GetOffset() const;
+
+private:
+    // Move the partial line to the front of the buffer and read more from the stream
+    bool Refill();
+
+    istream* in_;
+    vector<char> buffer_;
+    const char* cursor_;
+    const char* end_;
+    size_t consumed_;
+};
+
+// Parse a number from a field in place
+template <typename N>
+N ParseNumber(string_view field)
+{
+    N value{};
+    auto [ptr, ec] = from_chars(field.data(), field.data() + field.size(), value);
+    if (ec != errc() || ptr == field.data()) {
+        throw invalid_argument("ParseNumber: invalid field \"" + string(field) + "\"");
+    }
+    return value;
+}
+
+void LineFields::Split(string_view line, char delimiter)
+{
+    size_ = 0;
+    size_t start = 0;
+    while (size_ < kMaxFields - 1) {
+        size_t pos = line.find(delimiter, start);
+        if (pos == string_view::npos) {
+            break;
+        }
+        fields_[size_++] = line.substr(start, pos - start);
+        start = pos + 1;
+    }
+    // A trailing delimiter does not open an extra empty field (same as `getline` splitting)
+    if (start < line.size() || size_ == 0) {
+        fields_[size_++] = line.substr(start);
+    }
+}
+
+size_t LineFields::Size() const
+{
+    return size_;
+}
+
+string_view LineFields::operator[](size_t i) const
+{
+    return fields_[i];
+}
+
+void LineFields::RequireFields(size_t count, const char* source) const
+{
+    if (size_ < count) {
+        throw invalid_argument(string(source) + ": expected " + to_string(count) + " fields, got " + to_string(size_));
+    }
+}
+
+LineReader::LineReader(istream& in, size_t buffer_size) :
+  in_(&in), buffer_(buffer_size), cursor_(buffer_.data()), end_(buffer_.data()), consumed_(0) {}
+
+LineReader::LineReader(const char* begin, const char* end) :
+  in_(nullptr), buffer_(), cursor_(begin), end_(end), consumed_(0) {}
+
+bool LineReader::Refill()
+{
+    if (in_ == nullptr || !*in_) {
+        return false;
+    }
+
+    // Keep the partial line at the front of the buffer
+    size_t remaining = end_ - cursor_;
+    if (remaining == buffer_.size()) {
+        // A single line does not fit: grow the buffer (only happens on malformed input)
+        vector<char> larger(buffer_.size() << 1);
+        memcpy(larger.data(), cursor_, remaining);
+        buffer_.swap(larger);
+    } else if (remaining > 0) {
+        memmove(buffer_.data(), cursor_, remaining);
+    }
+
+    in_->read(buffer_.data() + remaining, buffer_.size() - remaining);
+    size_t read_count = in_->gcount();
+    cursor_ = buffer_.data();
+    end_ = buffer_.data() + remaining + read_count;
+    return read_count > 0;
+}
+
+bool LineReader::ReadLine(string_view& line)
+{
+    while (true) {
+        const char* newline = static_cast<const char*>(memchr(cursor_, '\n', end_ - cursor_));
+        if (newline == nullptr && Refill()) {
+            continue;
+        }
+
+        const char* line_end = (newline == nullptr) ? end_ : newline;
+        if (line_end == cursor_ && newline == nullptr) {
+            // Input exhausted
+            return false;
+        }
+
+        const char* line_begin = cursor_;
+        size_t line_size = line_end - line_begin;
+        cursor_ = (newline == nullptr) ? end_ : newline + 1;
+        consumed_ += cursor_ - line_begin;
+
+        // Handle CRLF files
+        if (line_size > 0 && line_begin[line_size - 1] == '\r') {
+            line_size--;
+        }
+        if (line_size == 0) {
+            continue;
+        }
+
+        line = string_view(line_begin, line_size);
+        return true;
+    }
+}
+
+bool LineReader::ReadFields(LineFields& fields, char delimiter)
+{
+    string_view line;
+    if (!ReadLine(line)) {
+        return false;
+    }
+    fields.Split(line, delimiter);
+    return true;
+}
+
+size_t LineReader::GetOffset() const
+{
+    return consumed_;
+}
+
+#endif /* line_reader_hpp */
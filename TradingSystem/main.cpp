@@ -7,9 +7,22 @@
 
 #include <iostream>
 #include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include "initialization.hpp"
 
 #include "bond_services.hpp"
+#include "replay.hpp"
+#include "sharding.hpp"
+#include "snapshot.hpp"
+#include "executor.hpp"
+#include "network_connectors.hpp"
 
 using namespace std;
 
@@ -24,6 +37,457 @@ void TestUtilities() {
     cout << GetTimestamp() << endl;
 }
 
+// Print the outcome of a self-test check, and fold it into passed
+void Check(bool& passed, bool condition, const string& name) {
+    cout << (condition ? "PASS " : "FAIL ") << name << endl;
+    passed = passed && condition;
+}
+
+// Whether f throws invalid_argument
+template <typename F>
+bool RejectsInput(F&& f) {
+    try {
+        f();
+    } catch (const invalid_argument&) {
+        return true;
+    }
+    return false;
+}
+
+// Prices: every 1/256 fraction round-trips through the "100-xyz" notation, arithmetic rounds as documented, and malformed prices are rejected
+bool TestPriceTick() {
+    bool passed = true;
+    bool round_trips = true;
+    for (long ticks = -2 * PriceTick::kTicksPerPoint; ticks <= 101 * PriceTick::kTicksPerPoint; ticks++) {
+        round_trips = round_trips && ConvertPrice(ConvertPrice(PriceTick(ticks))) == PriceTick(ticks);
+    }
+    Check(passed, round_trips, "every tick round-trips through the notation");
+    Check(passed, ConvertPrice("99-16+") == PriceTick(99 * 256 + 16 * 8 + 4), "'+' is half a 32nd");
+    Check(passed, ConvertPrice(PriceTick(100 * 256 + 31 * 8 + 7)) == "100-317", "formats 32nds and 8ths");
+    Check(passed, (PriceTick(-3) / 2) == PriceTick(-2) && (PriceTick(3) / 2) == PriceTick(1), "division rounds toward negative infinity");
+    
+    bool rejects_all = true;
+    for (const char* text : { "100", "100-", "100-01", "100-0123", "100-320", "100-018", "1x0-000", "-000", "100-a00" }) {
+        rejects_all = rejects_all && RejectsInput([text] { ConvertPrice(string_view(text)); });
+    }
+    Check(passed, rejects_all, "malformed prices are rejected");
+    return passed;
+}
+
+// Records the events it is handed, optionally holding the consumer until the gate opens
+class RecordingListener : public ServiceListener<long> {
+public:
+    explicit RecordingListener(atomic<bool>* gate = nullptr) : gate_(gate), entered_(false) {}
+    
+    virtual void ProcessAdd(long& data) override {
+        entered_.store(true);
+        while (gate_ != nullptr && !gate_->load()) {
+            this_thread::yield();
+        }
+        events_.push_back(data);
+    }
+    virtual void ProcessRemove(long&) override {}
+    virtual void ProcessUpdate(long&) override {}
+    
+    const vector<long>& GetEvents() const { return events_; }
+    bool HasEntered() const { return entered_.load(); }
+    
+private:
+    atomic<bool>* gate_;
+    atomic<bool> entered_;
+    vector<long> events_;
+};
+
+// BoundedRing keeps FIFO order across wraparound and refuses a push when full, also between two threads
+bool TestBoundedRing() {
+    bool passed = true;
+    BoundedRing<long> ring(3);
+    Check(passed, ring.Capacity() == 4, "capacity rounds up to a power of two");
+    
+    long pushed = 0;
+    long popped = 0;
+    bool in_order = true;
+    while (ring.TryPush(pushed)) {
+        pushed++;
+    }
+    Check(passed, pushed == 4 && ring.Size() == 4, "a full ring refuses the next push");
+    // Many laps, alternating two pushes and two pops on a ring kept half full
+    for (int lap = 0; lap < 1000; lap++) {
+        for (long value; popped < pushed - 2 && ring.TryPop(value); popped++) {
+            in_order = in_order && value == popped;
+        }
+        while (pushed - popped < 4 && ring.TryPush(pushed)) {
+            pushed++;
+        }
+    }
+    for (long value; ring.TryPop(value); popped++) {
+        in_order = in_order && value == popped;
+    }
+    Check(passed, in_order && popped == pushed && ring.Size() == 0, "values come out in order across wraparound");
+    
+    constexpr long kCount = 200000;
+    BoundedRing<long> shared_ring(64);
+    thread producer([&shared_ring] {
+        for (long value = 0; value < kCount;) {
+            if (shared_ring.TryPush(value)) {
+                value++;
+            } else {
+                this_thread::yield();
+            }
+        }
+    });
+    bool shared_in_order = true;
+    for (long expected = 0, value; expected < kCount;) {
+        if (shared_ring.TryPop(value)) {
+            shared_in_order = shared_in_order && value == expected;
+            expected++;
+        } else {
+            this_thread::yield();
+        }
+    }
+    producer.join();
+    Check(passed, shared_in_order, "values cross threads in order");
+    return passed;
+}
+
+// AsyncListener overflow policies, on a full ring whose consumer is held by another queue of the same executor thread
+bool TestAsyncListenerOverflow() {
+    bool passed = true;
+    auto run = [](OverflowPolicy policy, long events, RecordingListener& recorder, size_t& dropped) {
+        ExecutorThreadConfig thread_config;
+        thread_config.name = "self-test";
+        ExecutorThread executor_thread(thread_config);
+        atomic<bool> gate(false);
+        RecordingListener blocker(&gate);
+        AsyncListenerConfig blocker_config;
+        blocker_config.executor = &executor_thread;
+        AsyncListener<long> blocking_queue(&blocker, blocker_config);
+        AsyncListenerConfig config;
+        config.capacity = 2;
+        config.overflow_policy = policy;
+        config.executor = &executor_thread;
+        AsyncListener<long> queue(&recorder, config);
+        
+        long hold = -1;
+        blocking_queue.ProcessAdd(hold);
+        while (!blocker.HasEntered()) {
+            this_thread::yield();
+        }
+        thread producer([&] {
+            for (long value = 0; value < events; value++) {
+                queue.ProcessAdd(value);
+            }
+        });
+        if (policy == WAIT_FOR_ROOM) {
+            // The producer is held back by the full ring until the consumer runs again
+            this_thread::sleep_for(chrono::milliseconds(20));
+        } else {
+            producer.join();
+        }
+        gate.store(true);
+        if (producer.joinable()) {
+            producer.join();
+        }
+        queue.Flush();
+        dropped = queue.GetDroppedCount();
+    };
+    
+    RecordingListener newest;
+    size_t newest_dropped = 0;
+    run(DROP_NEWEST, 10, newest, newest_dropped);
+    Check(passed, newest.GetEvents() == vector<long>({ 0, 1 }) && newest_dropped == 8, "DROP_NEWEST keeps the first events");
+    
+    RecordingListener oldest;
+    size_t oldest_dropped = 0;
+    run(DROP_OLDEST, 10, oldest, oldest_dropped);
+    Check(passed, oldest.GetEvents() == vector<long>({ 8, 9 }) && oldest_dropped == 8, "DROP_OLDEST keeps the last events");
+    
+    RecordingListener waiting;
+    size_t waiting_dropped = 0;
+    run(WAIT_FOR_ROOM, 1000, waiting, waiting_dropped);
+    bool all_in_order = waiting.GetEvents().size() == 1000;
+    for (size_t i = 0; all_in_order && i < waiting.GetEvents().size(); i++) {
+        all_in_order = waiting.GetEvents()[i] == long(i);
+    }
+    Check(passed, all_in_order && waiting_dropped == 0, "WAIT_FOR_ROOM delivers every event in order");
+    return passed;
+}
+
+// Dynamic book levels: several orders at a price form one level, which ModifyOrder sets and RemoveLevel removes as a whole
+bool TestOrderBookLevels() {
+    OrderBook<Bond> book(FetchBond(2), vector<Order>(), vector<Order>());
+    PriceTick top(100 * PriceTick::kTicksPerPoint);
+    book.AddOrder(Order(top, 1000000, BID));
+    book.AddOrder(Order(top, 2000000, BID));
+    book.AddOrder(Order(top - PriceTick(1), 3000000, BID));
+    
+    bool passed = true;
+    book.ModifyOrder(Order(top, 5000000, BID));
+    Check(passed, book.GetBidStack().size() == 2 && book.GetBestBid().GetQuantity() == 5000000, "modifying a level replaces all of its orders");
+    book.AddOrder(Order(top, 1000000, BID));
+    book.RemoveLevel(top, BID);
+    Check(passed, book.GetBidStack().size() == 1 && book.GetBestBid().GetPrice() == top - PriceTick(1), "removing a level removes all of its orders");
+    book.ModifyOrder(Order(top + PriceTick(1), 1000000, BID));
+    Check(passed, book.GetBidStack().size() == 2 && book.GetBestBid().GetPrice() == top + PriceTick(1), "modifying a missing level inserts it in order");
+    return passed;
+}
+
+// Feed lines with too few fields are rejected by the connectors and the replay parser, rather than read past their end
+bool TestShortFeedLines() {
+    PricingService<Bond> pricing_service;
+    MarketDataService<Bond> market_data_service;
+    const string cusip = FetchCusip(2);
+    
+    bool passed = true;
+    Check(passed, RejectsInput([&] {
+        istringstream stream(cusip + ",100-000\n");
+        pricing_service.GetConnector()->Subscribe(stream);
+    }), "short price line is rejected");
+    Check(passed, RejectsInput([&] {
+        istringstream stream(cusip + ",100-000,1000000\n");
+        market_data_service.GetConnector()->Subscribe(stream);
+    }), "short market data line is rejected");
+    Check(passed, RejectsInput([&] {
+        LineFields fields;
+        fields.Split(cusip + ",T1,100-000");
+        TradeFeedRecord record;
+        ParseFeedLine(fields, record);
+    }), "short trade line is rejected by the replay parser");
+    return passed;
+}
+
+// Positions: every trade moves its book and the running aggregate, for books interned by id
+bool TestPositionTotals() {
+    PositionService<Bond> position_service;
+    const Bond& two_year = FetchBond(2);
+    PriceTick price(100 * PriceTick::kTicksPerPoint);
+    auto book = [&](const string& trade_id, const string& book_id, long quantity, Side side) {
+        Trade<Bond> trade(two_year, trade_id, price, book_id, quantity, side);
+        position_service.AddTrade(trade);
+    };
+    book("T1", "TRSY1", 1000000, BUY);
+    book("T2", "TRSY2", 300000, SELL);
+    book("T3", "TRSY1", 200000, BUY);
+    book("T4", "TRSY3", 400000, SELL);
+    
+    bool passed = true;
+    Position<Bond>& position = position_service.GetData(two_year.GetProductId());
+    string trsy1 = "TRSY1", trsy2 = "TRSY2", trsy3 = "TRSY3", untraded = "SELF-TEST-UNTRADED";
+    Check(passed, position.GetPosition(trsy1) == 1200000 && position.GetPosition(trsy2) == -300000 && position.GetPosition(trsy3) == -400000,
+          "trades move their own books, signed by side");
+    Check(passed, position.GetPosition(untraded) == 0, "an untraded book holds nothing");
+    long sum = 0;
+    position.ForEachBook([&sum](const string&, long quantity) { sum += quantity; });
+    Check(passed, position.GetAggregatePosition() == 500000 && sum == 500000, "the running aggregate is the sum over the books");
+    
+    book("T5", "TRSY1", 1200000, SELL);
+    Check(passed, position.GetPosition(trsy1) == 0 && position.GetAggregatePosition() == -700000, "selling a book flat keeps the aggregate in step");
+    return passed;
+}
+
+// Bucketed risk: the totals kept up to date from each position change match a sum over the products' current PV01s
+bool TestBucketedRiskTotals() {
+    PositionService<Bond> position_service;
+    RiskService<Bond> risk_service;
+    position_service.AddListener(risk_service.GetInListener());
+    RegisterTreasuryBuckets(risk_service);
+    
+    PriceTick price(100 * PriceTick::kTicksPerPoint);
+    long trade_number = 0;
+    auto book = [&](unsigned maturity, long quantity, Side side) {
+        trade_number++;
+        Trade<Bond> trade(FetchBond(maturity), "T" + to_string(trade_number), price, "TRSY" + to_string(1 + trade_number % 3), quantity, side);
+        position_service.AddTrade(trade);
+    };
+    // Total over the products of a sector of unit PV01 times aggregate position
+    auto expected_risk = [&](const BucketedSector<Bond>& sector) {
+        double pv01 = 0.;
+        for (const Bond& bond : sector.GetProducts()) {
+            const PV01<Bond>* product_pv01 = risk_service.FindPV01(ProductRegistry<Bond>::Instance().Resolve(bond));
+            pv01 += (product_pv01 != nullptr) ? product_pv01->GetPV01() * double(product_pv01->GetQuantity()) : 0.;
+        }
+        return pv01;
+    };
+    auto buckets_match = [&] {
+        bool match = true;
+        for (const auto& sector : GetTreasuryBuckets()) {
+            double expected = expected_risk(sector);
+            match = match && abs(risk_service.GetBucketedRisk(sector).GetPV01() - expected) <= 1e-9 * max(1., abs(expected));
+        }
+        return match;
+    };
+    
+    bool passed = true;
+    for (unsigned maturity : { 2u, 3u, 5u, 7u, 10u, 20u, 30u }) {
+        book(maturity, 1000000 * maturity, BUY);
+        book(maturity, 300000, SELL);
+    }
+    Check(passed, buckets_match(), "bucket totals match the products after buying");
+    
+    book(5, 2000000, SELL);
+    book(30, 29700000, SELL);
+    Check(passed, buckets_match(), "bucket totals follow sells and a flattened product");
+    Check(passed, abs(risk_service.GetBucketedRisk(GetTreasuryBuckets()[0]).GetPV01()) > 0., "a bucket with positions carries risk");
+    return passed;
+}
+
+// Incremental market data: deleting the last level of a side publishes a one-sided book, which the algo must leave alone,
+// a truncated line is rejected, and an update cut short by another product's update does not leak into it. Returns whether every check passed.
+bool TestIncrementalMarketData() {
+    MarketDataService<Bond> market_data_service;
+    AlgoExecutionService<Bond> algo_execution_service;
+    market_data_service.AddListener(algo_execution_service.GetInListener());
+    const string cusip = FetchCusip(2);
+    
+    bool passed = true;
+    auto feed = [&market_data_service](const string& lines) {
+        istringstream stream(lines);
+        market_data_service.GetUpdateConnector()->Subscribe(stream);
+    };
+    
+    // One tick wide, so the algo crosses whenever both sides are there
+    feed("1," + cusip + ",S,100-000,1000000,BID,0\n1," + cusip + ",S,100-001,1000000,OFFER,1\n");
+    Check(passed, algo_execution_service.GetExecutionCount() == 1, "two-sided snapshot executes");
+    
+    feed("2," + cusip + ",D,100-000,0,BID,1\n");
+    const OrderBook<Bond>& book = market_data_service.GetData(cusip);
+    Check(passed, book.GetBidStack().empty() && book.GetOfferStack().size() == 1, "deleting the last bid empties the bid side");
+    Check(passed, algo_execution_service.GetExecutionCount() == 1, "one-sided book does not execute");
+    
+    feed("3," + cusip + ",A,100-000,2000000,BID,1\n");
+    Check(passed, algo_execution_service.GetExecutionCount() == 2, "re-adding a bid executes again");
+    
+    Check(passed, RejectsInput([&] { feed("4," + cusip + ",D\n"); }), "truncated line is rejected");
+    
+    // An update whose end marker is lost, followed by another product's update
+    const string other_cusip = FetchCusip(5);
+    feed("4," + cusip + ",M,100-000,3000000,BID,0\n1," + other_cusip + ",S,100-100,1000000,BID,1\n");
+    ProductRegistry<Bond>& registry = ProductRegistry<Bond>::Instance();
+    const OrderBook<Bond>* other_book = market_data_service.FindBook(registry.Resolve(FetchBond(5)));
+    bool leaked = any_of(book.GetBidStack().begin(), book.GetBidStack().end(), [](const Order& order) { return order.GetPrice() == ConvertPrice("100-100"); });
+    Check(passed, market_data_service.GetUpdateConnector()->IsStale(registry.Resolve(FetchBond(2))) && !leaked,
+          "a truncated update leaves its book stale and untouched by the next product");
+    Check(passed, other_book != nullptr && other_book->GetBidStack().size() == 1 && other_book->GetBidStack().front().GetPrice() == ConvertPrice("100-100"),
+          "the next product's update goes to its own book");
+    
+    return passed;
+}
+
+// Network connectors: price lines sent over loopback TCP in fragments reach the pricing service, and prices published
+// to a TcpPublishConnector arrive as historical records. Returns whether every check passed.
+bool TestNetworkLoopback() {
+    NetworkEventLoop loop;
+    asio::io_context venue_context;
+    asio::ip::tcp::acceptor acceptor(venue_context, asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+    unsigned short port = acceptor.local_endpoint().port();
+    
+    PricingService<Bond> pricing_service;
+    vector<unsigned> maturities = { 2, 5, 30 };
+    vector<PriceTick> bids, offers;
+    string lines;
+    for (size_t i = 0; i < maturities.size(); i++) {
+        bids.push_back(PriceTick(99 * PriceTick::kTicksPerPoint + long(i) * 37));
+        offers.push_back(bids.back() + PriceTick(long(i) + 2));
+        lines += FetchCusip(maturities[i]) + ',' + ConvertPrice(bids.back()) + ',' + ConvertPrice(offers.back()) + '\n';
+    }
+    
+    bool passed = true;
+    {
+        // A tiny receive buffer, and writes of a few bytes, so lines are cut across receives and the buffer grows
+        TcpFeedSubscriber<PricingConnector<Bond>> subscriber(loop, pricing_service.GetConnector(), 8);
+        subscriber.Connect("127.0.0.1", port);
+        asio::ip::tcp::socket venue(venue_context);
+        acceptor.accept(venue);
+        venue.set_option(asio::ip::tcp::no_delay(true));
+        for (size_t offset = 0; offset < lines.size(); offset += 5) {
+            asio::write(venue, asio::buffer(lines.data() + offset, min<size_t>(5, lines.size() - offset)));
+        }
+        venue.close();
+        Check(passed, subscriber.WaitClosed() && subscriber.GetState().GetBytes() == lines.size(), "subscriber receives the whole feed and ends cleanly");
+    }
+    bool prices_match = true;
+    for (size_t i = 0; i < maturities.size(); i++) {
+        const Price<Bond>& price = pricing_service.GetData(FetchCusip(maturities[i]));
+        prices_match = prices_match && price.GetMid() == (bids[i] + offers[i]) / 2 && price.GetBidOfferSpread() == offers[i] - bids[i];
+    }
+    Check(passed, prices_match, "prices received over TCP reach the service");
+    
+    string received;
+    {
+        TcpPublishConnector<Price<Bond>> publisher(loop);
+        publisher.Connect("127.0.0.1", port);
+        asio::ip::tcp::socket venue(venue_context);
+        acceptor.accept(venue);
+        for (unsigned maturity : maturities) {
+            publisher.Publish(pricing_service.GetData(FetchCusip(maturity)));
+        }
+        publisher.Flush();
+        publisher.Close();
+        NetworkError error;
+        asio::read(venue, asio::dynamic_buffer(received), error);
+        Check(passed, error == asio::error::eof && publisher.GetState().GetBytes() == received.size(), "publisher writes everything before closing");
+    }
+    // Records are "timestamp,product,mid,spread,"
+    LineReader reader(received.data(), received.data() + received.size());
+    LineFields fields;
+    size_t records = 0;
+    bool records_match = true;
+    while (reader.ReadFields(fields)) {
+        if (records >= maturities.size() || fields.Size() < 4) {
+            records_match = false;
+            break;
+        }
+        const Price<Bond>& price = pricing_service.GetData(FetchCusip(maturities[records]));
+        records_match = records_match && fields[1] == price.GetProduct().GetProductId() &&
+                        ConvertPrice(fields[2]) == price.GetMid() && ConvertPrice(fields[3]) == price.GetBidOfferSpread();
+        records++;
+    }
+    Check(passed, records_match && records == maturities.size(), "published prices round-trip as records");
+    return passed;
+}
+
+// Inquiries: an auto-quoted inquiry completes with a single notification, a manual quote completes an open one,
+// and a handle from outside the store is rejected. Returns whether every check passed.
+bool TestInquiryQuotes() {
+    // Records the state of every inquiry the service notifies
+    class StateListener : public ServiceListener<Inquiry<Bond>> {
+    public:
+        virtual void ProcessAdd(Inquiry<Bond>& data) override { states.push_back(data.GetState()); }
+        virtual void ProcessRemove(Inquiry<Bond>&) override {}
+        virtual void ProcessUpdate(Inquiry<Bond>&) override {}
+        vector<InquiryState> states;
+    };
+    InquiryService<Bond> inquiry_service;
+    StateListener listener;
+    inquiry_service.AddListener(&listener);
+    const string cusip = FetchCusip(2);
+    auto feed = [&inquiry_service](const string& lines) {
+        istringstream stream(lines);
+        inquiry_service.GetConnector()->Subscribe(stream);
+    };
+    
+    bool passed = true;
+    feed("Q1," + cusip + ",BUY,1000000,100-000,RECEIVED\n");
+    Check(passed, listener.states == vector<InquiryState>{ DONE } && inquiry_service.GetOpenCount() == 0, "an auto-quoted inquiry completes once");
+    
+    inquiry_service.SetAutoQuote(false);
+    feed("Q2," + cusip + ",SELL,2000000,100-000,RECEIVED\n");
+    Check(passed, listener.states.size() == 1 && inquiry_service.GetOpenCount() == 1, "a manual inquiry waits for its quote");
+    inquiry_service.SendQuote("Q2", PriceTick(100 * PriceTick::kTicksPerPoint - 1));
+    const Inquiry<Bond>& quoted = inquiry_service.GetData("Q2");
+    Check(passed, listener.states.size() == 2 && quoted.GetState() == DONE && quoted.GetPrice() == PriceTick(100 * PriceTick::kTicksPerPoint - 1) &&
+          inquiry_service.GetOpenCount() == 0, "sending a quote completes the inquiry");
+    
+    bool rejected = false;
+    try {
+        inquiry_service.GetInquiry(InquiryHandle(2));
+    } catch (const out_of_range&) {
+        rejected = true;
+    }
+    Check(passed, rejected, "an invalid handle is rejected");
+    return passed;
+}
+
 //void TestMarketDataService() {
 //
 //    vector<Order> bid_stack;
@@ -69,7 +533,36 @@ void TestUtilities() {
 //
 //}
 
-void Test() {
+// Print a timestamped progress line. Lines are assembled first so that concurrent feeds do not interleave within a line.
+void LogProgress(const string& message) {
+    static mutex log_mutex;
+    string line = GetTimestamp() + " " + message;
+    lock_guard<mutex> lock(log_mutex);
+    cout << line << endl;
+}
+
+// Run a feed file through a connector, logging around it
+template <typename V>
+void ProcessFeed(const string& name, const string& path, Connector<V>* connector) {
+    LogProgress(name + " Processing...");
+    ifstream data(path);
+    connector->Subscribe(data);
+    LogProgress(name + " Processed.");
+}
+
+// Log how many prices the algo found unchanged (only when they are suppressed)
+void LogSuppressedStreams(const AlgoStreamingService<Bond>& algo_streaming_service) {
+    if (algo_streaming_service.GetSuppressedCount() > 0) {
+        LogProgress("Price Data Suppressed " + to_string(algo_streaming_service.GetSuppressedCount()) + " Unchanged Streams.");
+    }
+}
+
+// With a replay, the recorded feeds are merged in timestamp order and injected at their recorded pace (see replay.hpp).
+// With snapshots, the feeds run one after the other from the latest snapshot, snapshotting as they go (see snapshot.hpp).
+// With suppress_unchanged_streams, prices that leave the streamed two-way quote unchanged are not streamed again.
+// With incremental_market_data, market data is read as level changes from marketdata_incremental.txt.
+// With an executor, the queues it assigns run on its threads (see executor.hpp), and the algos may be moved off the feed threads.
+void Test(bool concurrent = false, bool conflate_market_data = false, optional<ReplayOptions> replay = nullopt, optional<SnapshotConfig> snapshot = nullopt, bool suppress_unchanged_streams = false, bool incremental_market_data = false, Executor* executor = nullptr) {
     cout << GetTimestamp() << " Program Starting..." << endl;
     cout << GetTimestamp() << " Program Started." << endl;
 
@@ -93,41 +586,289 @@ void Test() {
     cout << GetTimestamp() << " Services Initialized." << endl;
     
     cout << GetTimestamp() << " Services Linking..." << endl;
-    pricing_service.AddListener(algo_streaming_service.GetInListener());
+    // Historical data is off the trading path: it is fed through queues and runs on its own threads.
+    // Declared after the services, so they are flushed before any service goes away.
+    // (GUIService needs no queue: it only conflates into slots, and publishes from its own timer thread.)
+    AsyncListener<PriceStream<Bond>> historical_streaming_listener(historical_streaming_service.GetInListener(), ConfigureQueue(executor, "historical_streaming"));
+    AsyncListener<ExecutionOrder<Bond>> historical_execution_listener(historical_execution_service.GetInListener(), ConfigureQueue(executor, "historical_execution"));
+    AsyncListener<Position<Bond>> historical_position_listener(historical_position_service.GetInListener(), ConfigureQueue(executor, "historical_position"));
+    AsyncListener<PV01<Bond>> historical_risk_listener(historical_risk_service.GetInListener(), ConfigureQueue(executor, "historical_risk"));
+    AsyncListener<Inquiry<Bond>> historical_inquiry_listener(historical_inquiry_service.GetInListener(), ConfigureQueue(executor, "historical_inquiry"));
+    // Queues in front of the algos, when the executor assigns them to its threads (declared after the listeners they feed)
+    unique_ptr<AsyncListener<Price<Bond>>> algo_streaming_queue;
+    unique_ptr<AsyncListener<OrderBook<Bond>>> algo_execution_queue;
+    if (executor && executor->FindQueue("algo_streaming")) {
+        algo_streaming_queue = make_unique<AsyncListener<Price<Bond>>>(algo_streaming_service.GetInListener(), ConfigureQueue(executor, "algo_streaming"));
+    }
+    if (executor && executor->FindQueue("algo_execution")) {
+        algo_execution_queue = make_unique<AsyncListener<OrderBook<Bond>>>(algo_execution_service.GetInListener(), ConfigureQueue(executor, "algo_execution"));
+    }
+    
+    if (algo_streaming_queue) {
+        pricing_service.AddListener(algo_streaming_queue.get());
+    } else {
+        pricing_service.AddListener(algo_streaming_service.GetInListener());
+    }
     pricing_service.AddListener(gui_service.GetInListener());
     algo_streaming_service.AddListener(streaming_service.GetInListener());
-    streaming_service.AddListener(historical_streaming_service.GetInListener());
-    market_data_service.AddListener(algo_execution_service.GetInListener());
+    algo_streaming_service.SetSuppressUnchanged(suppress_unchanged_streams);
+    streaming_service.AddListener(&historical_streaming_listener);
+    // Optionally the algo only sees the newest book of each product, and runs on the conflater's thread
+    unique_ptr<ConflatingListener<OrderBook<Bond>>> market_data_conflater;
+    if (conflate_market_data) {
+        market_data_conflater = make_unique<ConflatingListener<OrderBook<Bond>>>(algo_execution_service.GetInListener());
+        market_data_service.AddListener(market_data_conflater.get());
+    } else if (algo_execution_queue) {
+        market_data_service.AddListener(algo_execution_queue.get());
+    } else {
+        market_data_service.AddListener(algo_execution_service.GetInListener());
+    }
     algo_execution_service.AddListener(execution_service.GetInListener());
     execution_service.AddListener(trade_booking_service.GetInListener());
-    execution_service.AddListener(historical_execution_service.GetInListener());
+    execution_service.AddListener(&historical_execution_listener);
     trade_booking_service.AddListener(position_service.GetInListener());
     position_service.AddListener(risk_service.GetInListener());
-    position_service.AddListener(historical_position_service.GetInListener());
-    risk_service.AddListener(historical_risk_service.GetInListener());
-    inquiry_service.AddListener(historical_inquiry_service.GetInListener());
+    position_service.AddListener(&historical_position_listener);
+    risk_service.AddListener(&historical_risk_listener);
+    RegisterTreasuryBuckets(risk_service);
+    inquiry_service.AddListener(&historical_inquiry_listener);
     cout << GetTimestamp() << " Services Linked." << endl;
     
-    cout << GetTimestamp() << " Price Data Processing..." << endl;
-    ifstream price_data("prices.txt");
-    pricing_service.GetConnector()->Subscribe(price_data);
-    cout << GetTimestamp() << " Price Data Processed." << endl;
+    // A feed is done once the algo queue behind it is drained
+    auto flush_algo_streaming = [&] {
+        if (algo_streaming_queue) {
+            algo_streaming_queue->Flush();
+        }
+    };
+    auto flush_algo_execution = [&] {
+        if (algo_execution_queue) {
+            algo_execution_queue->Flush();
+        }
+    };
+    
+    vector<function<void()>> feeds = {
+        [&] {
+            ProcessFeed("Price Data", "prices.txt", pricing_service.GetConnector());
+            flush_algo_streaming();
+            LogSuppressedStreams(algo_streaming_service);
+        },
+        [&] { ProcessFeed("Trade Data", "trades.txt", trade_booking_service.GetConnector()); },
+        [&] {
+            if (incremental_market_data) {
+                auto* connector = market_data_service.GetUpdateConnector();
+                ProcessFeed("Market Data", "marketdata_incremental.txt", connector);
+                LogProgress("Market Data Applied " + to_string(connector->GetMessageCount()) + " Level Changes in " + to_string(connector->GetUpdateCount()) + " Updates ("
+                            + to_string(connector->GetSnapshotCount()) + " Snapshots, " + to_string(connector->GetGapCount()) + " Gaps, " + to_string(connector->GetDroppedCount()) + " Dropped).");
+            } else {
+                ProcessFeed("Market Data", "marketdata.txt", market_data_service.GetConnector());
+            }
+            flush_algo_execution();
+            if (market_data_conflater) {
+                market_data_conflater->Flush();
+                cout << GetTimestamp() << " Market Data Conflation Skipped " << market_data_conflater->GetSkippedCount() << " Books." << endl;
+            }
+        },
+        [&] { ProcessFeed("Inquiry Data", "inquiries.txt", inquiry_service.GetConnector()); }
+    };
+    
+    if (replay) {
+        // The replay books trades on this thread while the books are interleaved with them, so an execution algo
+        // off this thread (conflater or algo_execution queue) books into the same services: serialize them on a strand
+        unique_ptr<Strand> trade_booking_strand;
+        if (market_data_conflater || algo_execution_queue) {
+            trade_booking_strand = make_unique<Strand>();
+            trade_booking_service.SetStrand(trade_booking_strand.get());
+        }
+        
+        cout << GetTimestamp() << " Feeds Replaying..." << endl;
+        ReplayEngine engine(*replay);
+        engine.AddPriceFeed(pricing_service);
+        engine.AddTradeFeed(trade_booking_service);
+        engine.AddMarketDataFeed(market_data_service);
+        engine.AddInquiryFeed(inquiry_service);
+        ReplayStats stats = engine.Run();
+        flush_algo_streaming();
+        flush_algo_execution();
+        if (market_data_conflater) {
+            market_data_conflater->Flush();
+        }
+        if (trade_booking_strand) {
+            trade_booking_strand->Drain();
+            trade_booking_service.SetStrand(nullptr);
+        }
+        cout << GetTimestamp() << " Feeds Replayed." << endl;
+        LogSuppressedStreams(algo_streaming_service);
+        stats.Print(cout);
+        return;
+    }
+    
+    if (snapshot) {
+        SnapshotServices<Bond> snapshot_services;
+        snapshot_services.market_data = &market_data_service;
+        snapshot_services.algo_execution = &algo_execution_service;
+        snapshot_services.algo_streaming = &algo_streaming_service;
+        snapshot_services.trade_booking = &trade_booking_service;
+        snapshot_services.positions = &position_service;
+        snapshot_services.risk = &risk_service;
+        snapshot_services.inquiries = &inquiry_service;
+        
+        SnapshotFeedRunner<Bond> runner(*snapshot, snapshot_services);
+        runner.AddFeed("Price Data", "prices.txt", [&](LineReader& reader) { pricing_service.GetConnector()->Subscribe(reader); });
+        runner.AddFeed("Trade Data", "trades.txt", [&](LineReader& reader) { trade_booking_service.GetConnector()->Subscribe(reader); });
+        runner.AddFeed("Market Data", "marketdata.txt", [&](LineReader& reader) { market_data_service.GetConnector()->Subscribe(reader); },
+                       unsigned(market_data_service.GetBookDepth()) * 2, [&] { return market_data_service.GetConnector()->GetPendingOrderCount() == 0; });
+        runner.AddFeed("Inquiry Data", "inquiries.txt", [&](LineReader& reader) { inquiry_service.GetConnector()->Subscribe(reader); });
+        runner.Restore();
+        runner.Run();
+        LogSuppressedStreams(algo_streaming_service);
+        return;
+    }
+    
+    if (!concurrent) {
+        for (auto& feed : feeds) {
+            feed();
+        }
+        return;
+    }
+    
+    // One thread per feed. The feeds only meet at TradeBookingService (trade file and executions),
+    // so that service is driven through a strand; every other service is owned by a single feed thread.
+    Strand trade_booking_strand;
+    trade_booking_service.SetStrand(&trade_booking_strand);
+    
+    vector<thread> feed_threads;
+    for (auto& feed : feeds) {
+        feed_threads.emplace_back(feed);
+    }
+    for (auto& feed_thread : feed_threads) {
+        feed_thread.join();
+    }
+    
+    trade_booking_strand.Drain();
+    trade_booking_service.SetStrand(nullptr);
+    cout << GetTimestamp() << " All Feeds Processed." << endl;
+}
 
-    cout << GetTimestamp() << " Trade Data Processing..." << endl;
-    ifstream trade_data("trades.txt");
-    trade_booking_service.GetConnector()->Subscribe(trade_data);
-    cout << GetTimestamp() << " Trade Data Processed." << endl;
+// Sharded deployment: market data and trades are routed by product to shards, each running its own
+// tick-to-risk chain on its own core (see sharding.hpp). Prices and inquiries run on their own feed threads as in concurrent mode.
+// With an executor, the historical queues it assigns run on its threads.
+void TestSharded(ShardConfig config, bool suppress_unchanged_streams = false, Executor* executor = nullptr) {
+    cout << GetTimestamp() << " Program Starting..." << endl;
+    cout << GetTimestamp() << " Program Started." << endl;
 
-    cout << GetTimestamp() << " Market Data Processing..." << endl;
-    ifstream market_data("marketdata.txt");
-    market_data_service.GetConnector()->Subscribe(market_data);
-    cout << GetTimestamp() << " Market Data Processed." << endl;
+    cout << GetTimestamp() << " Services Initializing..." << endl;
+    PricingService<Bond> pricing_service;
+    AlgoStreamingService<Bond> algo_streaming_service;
+    GUIService<Bond> gui_service;
+    StreamingService<Bond> streaming_service;
+    InquiryService<Bond> inquiry_service;
+    HistoricalDataService<Position<Bond>> historical_position_service(POSITION);
+    HistoricalDataService<PV01<Bond>> historical_risk_service(RISK);
+    HistoricalDataService<ExecutionOrder<Bond>> historical_execution_service(EXECUTION);
+    HistoricalDataService<PriceStream<Bond>> historical_streaming_service(STREAMING);
+    HistoricalDataService<Inquiry<Bond>> historical_inquiry_service(INQUIRY);
+    cout << GetTimestamp() << " Services Initialized." << endl;
+
+    cout << GetTimestamp() << " Services Linking..." << endl;
+    AsyncListener<PriceStream<Bond>> historical_streaming_listener(historical_streaming_service.GetInListener(), ConfigureQueue(executor, "historical_streaming"));
+    AsyncListener<ExecutionOrder<Bond>> historical_execution_listener(historical_execution_service.GetInListener(), ConfigureQueue(executor, "historical_execution"));
+    AsyncListener<Position<Bond>> historical_position_listener(historical_position_service.GetInListener(), ConfigureQueue(executor, "historical_position"));
+    AsyncListener<PV01<Bond>> historical_risk_listener(historical_risk_service.GetInListener(), ConfigureQueue(executor, "historical_risk"));
+    AsyncListener<Inquiry<Bond>> historical_inquiry_listener(historical_inquiry_service.GetInListener(), ConfigureQueue(executor, "historical_inquiry"));
+
+    pricing_service.AddListener(algo_streaming_service.GetInListener());
+    pricing_service.AddListener(gui_service.GetInListener());
+    algo_streaming_service.AddListener(streaming_service.GetInListener());
+    algo_streaming_service.SetSuppressUnchanged(suppress_unchanged_streams);
+    streaming_service.AddListener(&historical_streaming_listener);
+    inquiry_service.AddListener(&historical_inquiry_listener);
+
+    // Declared after the historical listeners, so the shards are drained and gone before them.
+    // Every shard publishes into the same historical listeners (their rings take several producers).
+    ShardRouter<Bond> router(config);
+    router.ForEachShard([&](Shard<Bond>& shard) {
+        auto& pipeline = shard.GetPipeline();
+        pipeline.execution_service.AddListener(&historical_execution_listener);
+        pipeline.position_service.AddListener(&historical_position_listener);
+        pipeline.risk_service.AddListener(&historical_risk_listener);
+        RegisterTreasuryBuckets(pipeline.risk_service);
+    });
+    cout << GetTimestamp() << " Services Linked." << endl;
+
+    vector<function<void()>> feeds = {
+        [&] {
+            ProcessFeed("Price Data", "prices.txt", pricing_service.GetConnector());
+            LogSuppressedStreams(algo_streaming_service);
+        },
+        [&] {
+            LogProgress("Trade Data Routing...");
+            router.RouteTrades();
+            LogProgress("Trade Data Routed.");
+        },
+        [&] {
+            LogProgress("Market Data Routing...");
+            router.RouteMarketData();
+            LogProgress("Market Data Routed.");
+        },
+        [&] { ProcessFeed("Inquiry Data", "inquiries.txt", inquiry_service.GetConnector()); }
+    };
+    vector<thread> feed_threads;
+    for (auto& feed : feeds) {
+        feed_threads.emplace_back(feed);
+    }
+    for (auto& feed_thread : feed_threads) {
+        feed_thread.join();
+    }
+    router.Drain();
+    cout << GetTimestamp() << " All Feeds Processed." << endl;
+
+    router.PrintSummary(cout);
+    for (const auto& sector : GetTreasuryBuckets()) {
+        cout << sector.GetName() << " PV01: " << router.GetBucketedRisk(sector).GetPV01() << endl;
+    }
+}
 
-    cout << GetTimestamp() << " Inquiry Data Processing..." << endl;
-    ifstream inquiry_data("inquiries.txt");
-    inquiry_service.GetConnector()->Subscribe(inquiry_data);
-    cout << GetTimestamp() << " Inquiry Data Processed." << endl;
+// Push the same books through a tick-to-trade pipeline and return the mean time per book in nanoseconds
+template <typename Pipeline>
+double TimePipeline(Pipeline& pipeline, vector<OrderBook<Bond>>& books, long rounds) {
+    auto start = chrono::steady_clock::now();
+    for (long round = 0; round < rounds; round++) {
+        for (auto& book : books) {
+            pipeline.market_data_service.OnMessage(book);
+        }
+    }
+    auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+    return double(elapsed.count()) / (rounds * books.size());
+}
+
+// Compare virtual listener dispatch with the compile-time wired chain
+void BenchmarkDispatch(long rounds = 200000) {
+    // One book per bond, one tick wide so that every book crosses and runs the whole chain
+    vector<OrderBook<Bond>> books;
+    for (const auto& [maturity, cusip_date] : kBondMapMaturity) {
+        vector<Order> bid_stack;
+        vector<Order> offer_stack;
+        for (long level = 0; level < 5; level++) {
+            bid_stack.emplace_back(PriceTick(100 * PriceTick::kTicksPerPoint - level), 1000000 * (level + 1), BID);
+            offer_stack.emplace_back(PriceTick(100 * PriceTick::kTicksPerPoint + 1 + level), 1000000 * (level + 1), OFFER);
+        }
+        books.emplace_back(FetchBond(maturity), std::move(bid_stack), std::move(offer_stack));
+    }
+    
+    DynamicPipeline<Bond> dynamic_pipeline;
+    StaticPipeline<Bond> static_pipeline;
+    
+    // Warm up both before timing
+    TimePipeline(dynamic_pipeline, books, rounds / 10);
+    TimePipeline(static_pipeline, books, rounds / 10);
     
+    double dynamic_ns = TimePipeline(dynamic_pipeline, books, rounds);
+    double static_ns = TimePipeline(static_pipeline, books, rounds);
+    
+    cout << fixed << setprecision(1);
+    cout << "Tick-to-trade, " << rounds * books.size() << " books" << endl;
+    cout << "  Dynamic dispatch: " << dynamic_ns << " ns/book" << endl;
+    cout << "  Static dispatch:  " << static_ns << " ns/book" << endl;
 }
 
 int main(int argc, const char * argv[]) {
@@ -135,13 +876,243 @@ int main(int argc, const char * argv[]) {
     // TestUtilities();
 //    TestMarketDataService();
     
-    initialization::GenerateAllBondPrices();
-    initialization::GenerateAllMarketData();
-    initialization::GenerateAllTrades();
-    initialization::GenerateAllInquiries();
+    // --concurrent runs each inbound feed on its own thread
+    // --conflate-market-data lets the algo skip books superseded before it got to them
+    // --seed, --prices, --books, --trades, --inquiries (per bond) and --feed-threads set up the feed generator
+    // --feed-format text|binary|both picks the feed files, --regenerate-feeds ignores cached ones,
+    // and --generate-only stops once the feeds are written (e.g. to prepare load tests)
+    // --replay SPEED|max replays the feeds in timestamp order at SPEED times their recorded pace, from --replay-format text|binary
+    // --shards N (0 for one per core) partitions the tick-to-risk chain by product over N pinned shards, by --shard-partition hash|range,
+    // routing market data and trades from --shard-feed text|binary
+    // --suppress-unchanged-streams skips prices that leave the streamed two-way quote unchanged
+    // --market-data-format full|incremental reads market data as full books or as level changes (marketdata_incremental.txt)
+    // --snapshot-every N snapshots the services every N feed lines into --snapshot-path (default state.snapshot),
+    // and --restore starts from that snapshot, processing only the rest of the feeds
+    // --executor-config FILE runs the queues it names on the threads it declares, pinned and waiting as configured (see executor.hpp)
+    // --benchmark-dispatch compares listener dispatch modes instead of running the system, and --self-test runs the Test* checks
+    bool benchmark_dispatch = false;
+    bool self_test = false;
+    bool concurrent = false;
+    bool conflate_market_data = false;
+    bool generate_only = false;
+    initialization::FeedGeneratorConfig feed_config;
+    optional<ReplayOptions> replay;
+    optional<ShardConfig> sharding;
+    optional<SnapshotConfig> snapshot;
+    bool suppress_unchanged_streams = false;
+    bool incremental_market_data = false;
+    optional<ExecutorConfig> executor_config;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "--benchmark-dispatch") == 0) {
+            benchmark_dispatch = true;
+        } else if (strcmp(argv[i], "--self-test") == 0) {
+            self_test = true;
+        } else if (strcmp(argv[i], "--concurrent") == 0) {
+            concurrent = true;
+        } else if (strcmp(argv[i], "--conflate-market-data") == 0) {
+            conflate_market_data = true;
+        } else if (strcmp(argv[i], "--suppress-unchanged-streams") == 0) {
+            suppress_unchanged_streams = true;
+        } else if (strcmp(argv[i], "--generate-only") == 0) {
+            generate_only = true;
+        } else if (strcmp(argv[i], "--regenerate-feeds") == 0) {
+            feed_config.reuse_cached = false;
+        } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+            feed_config.seed = stoull(argv[++i]);
+        } else if (strcmp(argv[i], "--prices") == 0 && has_value) {
+            feed_config.prices_per_bond = stoull(argv[++i]);
+        } else if (strcmp(argv[i], "--books") == 0 && has_value) {
+            feed_config.books_per_bond = stoull(argv[++i]);
+        } else if (strcmp(argv[i], "--trades") == 0 && has_value) {
+            feed_config.trades_per_bond = stoull(argv[++i]);
+        } else if (strcmp(argv[i], "--inquiries") == 0 && has_value) {
+            feed_config.inquiries_per_bond = stoull(argv[++i]);
+        } else if (strcmp(argv[i], "--feed-threads") == 0 && has_value) {
+            feed_config.threads = unsigned(stoul(argv[++i]));
+        } else if (strcmp(argv[i], "--replay") == 0 && has_value) {
+            string speed = argv[++i];
+            replay = replay.value_or(ReplayOptions());
+            replay->speed = (speed == "max") ? 0. : stod(speed);
+        } else if (strcmp(argv[i], "--replay-format") == 0 && has_value) {
+            string format = argv[++i];
+            replay = replay.value_or(ReplayOptions());
+            if (format == "text") {
+                replay->source = TEXT_REPLAY;
+            } else if (format == "binary") {
+                replay->source = BINARY_REPLAY;
+            } else {
+                cerr << "Unknown replay format " << format << endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--shards") == 0 && has_value) {
+            sharding = sharding.value_or(ShardConfig());
+            sharding->shards = unsigned(stoul(argv[++i]));
+        } else if (strcmp(argv[i], "--shard-partition") == 0 && has_value) {
+            string partition = argv[++i];
+            sharding = sharding.value_or(ShardConfig());
+            if (partition == "hash") {
+                sharding->partition = HASH_PARTITION;
+            } else if (partition == "range") {
+                sharding->partition = RANGE_PARTITION;
+            } else {
+                cerr << "Unknown shard partition " << partition << endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--shard-feed") == 0 && has_value) {
+            string format = argv[++i];
+            sharding = sharding.value_or(ShardConfig());
+            if (format == "text") {
+                sharding->feed_source = TEXT_REPLAY;
+            } else if (format == "binary") {
+                sharding->feed_source = BINARY_REPLAY;
+            } else {
+                cerr << "Unknown shard feed format " << format << endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--snapshot-every") == 0 && has_value) {
+            snapshot = snapshot.value_or(SnapshotConfig());
+            snapshot->interval = stoull(argv[++i]);
+        } else if (strcmp(argv[i], "--snapshot-path") == 0 && has_value) {
+            snapshot = snapshot.value_or(SnapshotConfig());
+            snapshot->path = argv[++i];
+        } else if (strcmp(argv[i], "--restore") == 0) {
+            snapshot = snapshot.value_or(SnapshotConfig());
+            snapshot->restore = true;
+        } else if (strcmp(argv[i], "--executor-config") == 0 && has_value) {
+            try {
+                executor_config = LoadExecutorConfig(argv[++i]);
+            } catch (const exception& error) {
+                cerr << error.what() << endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--market-data-format") == 0 && has_value) {
+            string format = argv[++i];
+            if (format == "full") {
+                incremental_market_data = false;
+            } else if (format == "incremental") {
+                incremental_market_data = true;
+            } else {
+                cerr << "Unknown market data format " << format << endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--feed-format") == 0 && has_value) {
+            string format = argv[++i];
+            if (format == "text") {
+                feed_config.format = initialization::TEXT_FEED;
+            } else if (format == "binary") {
+                feed_config.format = initialization::BINARY_FEED;
+            } else if (format == "both") {
+                feed_config.format = initialization::TEXT_AND_BINARY_FEED;
+            } else {
+                cerr << "Unknown feed format " << format << endl;
+                return 1;
+            }
+        } else {
+            cerr << "Unknown option " << argv[i] << endl;
+            return 1;
+        }
+    }
+    // These need no feeds, so they run before any are generated
+    if (benchmark_dispatch) {
+        BenchmarkDispatch();
+        return 0;
+    }
+    if (self_test) {
+        bool passed = true;
+        for (bool (*test)() : { TestShortFeedLines, TestPriceTick, TestOrderBookLevels, TestBoundedRing, TestAsyncListenerOverflow, TestPositionTotals, TestBucketedRiskTotals, TestIncrementalMarketData, TestNetworkLoopback, TestInquiryQuotes }) {
+            passed = test() && passed;
+        }
+        return passed ? 0 : 1;
+    }
+    if (replay) {
+        if (concurrent) {
+            cerr << "--replay injects every feed from one thread, and cannot be combined with --concurrent" << endl;
+            return 1;
+        }
+        if (replay->speed < 0) {
+            cerr << "--replay speed must not be negative" << endl;
+            return 1;
+        }
+        // Text lines are stamped as the generator stamps binary records, and a binary replay needs the journals
+        replay->text_start_timestamp = feed_config.start_timestamp;
+        replay->text_timestamp_interval = feed_config.timestamp_interval;
+        if (replay->source == BINARY_REPLAY && feed_config.format == initialization::TEXT_FEED) {
+            feed_config.format = initialization::TEXT_AND_BINARY_FEED;
+        }
+    }
+    if (sharding && (concurrent || conflate_market_data || replay)) {
+        cerr << "--shards runs its own threads, and cannot be combined with --concurrent, --conflate-market-data or --replay" << endl;
+        return 1;
+    }
+    if (snapshot && (concurrent || conflate_market_data || replay || sharding)) {
+        cerr << "Snapshots are taken between feed lines of a sequential run, and cannot be combined with --concurrent, --conflate-market-data, --replay or --shards" << endl;
+        return 1;
+    }
+    if (incremental_market_data && (replay || sharding || snapshot)) {
+        cerr << "--market-data-format incremental is read by the market data service directly, and cannot be combined with --replay, --shards or snapshots" << endl;
+        return 1;
+    }
+    feed_config.incremental_market_data = incremental_market_data;
+    if (executor_config) {
+        // Queues the program sets up; the algo queues move the algos off the feed threads, except in a sharded run
+        vector<string> queues = { "historical_streaming", "historical_execution", "historical_position", "historical_risk", "historical_inquiry" };
+        if (!sharding) {
+            queues.insert(queues.end(), { "algo_streaming", "algo_execution" });
+        }
+        for (const ExecutorQueueConfig& queue_config : executor_config->queues) {
+            if (find(queues.begin(), queues.end(), queue_config.name) == queues.end()) {
+                cerr << "--executor-config assigns unknown queue " << queue_config.name << (sharding ? " (the algos of a sharded run have no queue)" : "") << endl;
+                return 1;
+            }
+            bool algo_queue = queue_config.name.rfind("algo_", 0) == 0;
+            if (algo_queue && snapshot) {
+                cerr << "Snapshots are taken between feed lines of a sequential run, and cannot be combined with the algo queues of --executor-config" << endl;
+                return 1;
+            }
+            if (queue_config.name == "algo_execution" && conflate_market_data) {
+                cerr << "--conflate-market-data already runs the execution algo on its own thread, and cannot be combined with the algo_execution queue of --executor-config" << endl;
+                return 1;
+            }
+        }
+    }
+    // The router of a sharded run reads the market data and trade journals
+    if (sharding && sharding->feed_source == BINARY_REPLAY && feed_config.format == initialization::TEXT_FEED) {
+        feed_config.format = initialization::TEXT_AND_BINARY_FEED;
+    }
+    // The services read the text feeds, unless they are replayed from the journals
+    bool reads_text = !replay || replay->source == TEXT_REPLAY;
+    if (feed_config.format == initialization::BINARY_FEED && !generate_only && reads_text) {
+        cerr << "--feed-format binary needs --generate-only or --replay-format binary" << endl;
+        return 1;
+    }
+    
+    initialization::GenerateAllFeeds(feed_config);
+    if (generate_only) {
+        return 0;
+    }
+    
+    unique_ptr<Executor> executor;
+    if (executor_config) {
+        try {
+            executor = make_unique<Executor>(*executor_config);
+        } catch (const exception& error) {
+            cerr << error.what() << endl;
+            return 1;
+        }
+    }
     
-    Test();
+    if (sharding) {
+        TestSharded(*sharding, suppress_unchanged_streams, executor.get());
+    } else {
+        Test(concurrent, conflate_market_data, replay, snapshot, suppress_unchanged_streams, incremental_market_data, executor.get());
+    }
+    if (executor) {
+        executor->PrintStats(cout);
+    }
     
+    // Per-hop latencies since ingest (only when built with -DTRADING_LATENCY)
+    LATENCY_REPORT(cout);
     
     return 0;
 }
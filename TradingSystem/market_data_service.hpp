@@ -15,6 +15,8 @@
  (2) Added class MarketDataServiceConnector
  (3) rvalue construction for OrderBook to improve performance (when aggregating the book, for example)
  (4) Default constructor for OrderBook, or else the map `at` and `operator[]` methods will not work (require the default constructibility of OrderBook)
+ (5) OrderBook keeps each side as sorted contiguous price levels (bids descending, offers ascending), so the top of book is the first order and GetBidOffer is O(1). Orders at the same price keep their arrival order. Orders can be added, modified and removed in place; MarketDataConnector rebuilds the service's book in place instead of building and copying new stacks.
+ (6) Added class MarketDataUpdateConnector for the incremental feed (marketdata_incremental.txt): each line is one level change ("sequence,product,action,price,quantity,side,end"), applied to the stored book in place, and the book is published at the last change of an update. Updates carry a sequence per product; a gap leaves the book stale until the next snapshot (all levels with action S), and replayed sequences are dropped.
  */
 #ifndef MARKET_DATA_SERVICE_HPP
 #define MARKET_DATA_SERVICE_HPP
@@ -22,19 +24,28 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <cstdint>
 #include "soa.hpp"
+#include "static_listeners.hpp"
+#include "latency.hpp"
 
 #include <unordered_map>
+#include "product_registry.hpp"
 
-#include <sstream>
 #include <string>
+#include <string_view>
 #include "utilities.hpp"
+#include "line_reader.hpp"
 
 using namespace std;
 
 // Side for market data
 enum PricingSide { BID, OFFER };
 
+// Level change of an incremental market data update (the character is the action field of the text feed)
+enum MarketDataAction : char { ADD_LEVEL = 'A', MODIFY_LEVEL = 'M', DELETE_LEVEL = 'D', SNAPSHOT_LEVEL = 'S' };
+
 /**
  * A market data order with price, quantity, and side.
  */
@@ -44,10 +55,10 @@ class Order
 public:
 
     // ctor for an order
-    Order(double _price, long _quantity, PricingSide _side);
+    Order(PriceTick _price, long _quantity, PricingSide _side);
 
     // Get the price on the order
-    double GetPrice() const;
+    PriceTick GetPrice() const;
 
     // Get the quantity on the order
     long GetQuantity() const;
@@ -56,7 +67,7 @@ public:
     PricingSide GetSide() const;
 
 private:
-    double price;
+    PriceTick price;
     long quantity;
     PricingSide side;
 
@@ -86,10 +97,11 @@ private:
 
 /**
  * Order book with a bid and offer stack.
+ * A price level may hold several orders (AddOrder queues behind them, AggregateLevels merges them); ModifyOrder and RemoveLevel act on the whole level.
  * Type T is the product type.
  */
 template <typename T>
-class OrderBook
+class OrderBook : public LatencyTagged
 {
 
 public:
@@ -110,29 +122,73 @@ public:
     
     // Get the best bid/offer order
     const BidOffer GetBidOffer() const;
+    
+    // Get the best bid order (the book must have bids)
+    const Order& GetBestBid() const;
+    
+    // Get the best offer order (the book must have offers)
+    const Order& GetBestOffer() const;
+    
+    // Remove all levels, keeping the storage for reuse
+    void Clear();
+    
+    // Add an order behind the orders at the same price
+    void AddOrder(const Order& order);
+    
+    // Replace every order at the order's price by the order, adding it if there is none
+    void ModifyOrder(const Order& order);
+    
+    // Remove all orders at a price
+    void RemoveLevel(PriceTick price, PricingSide side);
+    
+    // Merge the orders at each price into one level, in place
+    void AggregateLevels();
 
 private:
-    T product;
-    vector<Order> bidStack;
-    vector<Order> offerStack;
+    // Merge runs of equal prices in a stack that is in level order
+    static void AggregateStack(vector<Order>& stack, PricingSide side);
+    
+    // Sort both stacks into level order
+    void SortLevels();
+    
+    // Stack of the side
+    vector<Order>& GetStack(PricingSide side);
+    
+    // First order not better than the price (or, if behind is set, first order worse than the price)
+    vector<Order>::iterator FindLevel(vector<Order>& stack, PriceTick price, PricingSide side, bool behind = false);
+    
+    ProductRef<T> product;     // Registered instance, shared by every copy of the event
+    vector<Order> bidStack;     // Best (highest) bid first
+    vector<Order> offerStack;   // Best (lowest) offer first
 
 };
 
-template <typename T>
+template <typename T, typename Static = StaticListeners<OrderBook<T>>>
+class MarketDataService;
+template <typename T, typename S = MarketDataService<T>>
 class MarketDataConnector;
+template <typename T, typename S = MarketDataService<T>>
+class MarketDataUpdateConnector;
 
 /**
  * Market Data Service which distributes market data
  * Keyed on product identifier.
  * Type T is the product type.
  */
-template <typename T>
-class MarketDataService : public Service<string,OrderBook <T> >
+template <typename T, typename Static>
+class MarketDataService final : public Service<string,OrderBook <T> >
 {
+public:
+    // Concrete types of the objects attached to this service, for static wiring
+    typedef MarketDataConnector<T, MarketDataService> ConnectorType;
+    typedef MarketDataUpdateConnector<T, MarketDataService> UpdateConnectorType;
+    
 private:
     
-    unordered_map<string, OrderBook<T>> order_books_;
-    MarketDataConnector<T>* in_connector_;
+    ProductStore<OrderBook<T>> order_books_;     // Indexed by product index
+    ConnectorType* in_connector_;
+    UpdateConnectorType* update_connector_;
+    Static static_listeners_;
     int book_depth_;
     
 public:
@@ -156,30 +212,46 @@ public:
     // MARK: SERVICE CLASS OVERRIDE ABOVE
     
     // Get the MarketDataConnector
-    MarketDataConnector<T>* GetConnector();
+    ConnectorType* GetConnector();
+    
+    // Get the connector of the incremental feed
+    UpdateConnectorType* GetUpdateConnector();
+    
+    // Get the listeners wired at compile time (notified ahead of the dynamic listeners)
+    Static& GetStaticListeners();
     
     // Get the book depth
     int GetBookDepth() const;
     
+    // Get the book of a product for in-place updates, creating an empty one if needed
+    OrderBook<T>& GetBook(const T& product);
+    
+    // Get the book of a product, or nullptr if it has none
+    const OrderBook<T>* FindBook(ProductIndex index) const;
+    
     // Get the best bid/offer order
     virtual const BidOffer GetBestBidOffer(const string &productId) const;
 
     // Aggregate the order book
     virtual const OrderBook<T>& AggregateDepth(const string &productId);
     
-private:
-    // AggregateDepth helper function
-    vector<Order> AggregateStack(const vector<Order>& original_stack) const;
+    // Aggregate the order books of several products in one pass
+    void AggregateDepth(const vector<string>& product_ids);
+    
+    // Aggregate every stored order book
+    void AggregateAllDepth();
 
 };
 
-template <typename T>
-class MarketDataConnector : public Connector<OrderBook<T>> {
+template <typename T, typename S>
+class MarketDataConnector final : public Connector<OrderBook<T>> {
 private:
-    MarketDataService<T>* service_;
+    S* service_;
+    OrderBook<T>* book_;        // Book being rebuilt, kept across calls so that a book may span reads
+    unsigned order_count_;      // Orders of it read so far
     
 public:
-    MarketDataConnector(MarketDataService<T>* service);
+    MarketDataConnector(S* service);
     ~MarketDataConnector() = default;
     
     // Publish data to the Connector
@@ -188,17 +260,89 @@ public:
     virtual void Publish(OrderBook<T> &data) override;
     
     // Subscribe data from the Connector
-    virtual void Subscribe(ifstream& data) override;
+    virtual void Subscribe(istream& data) override;
+
+    // Subscribe the lines of a reader, e.g. over a network receive buffer (see network_connectors.hpp)
+    void Subscribe(LineReader& reader);
+    
+    // Orders read of a book not yet complete (0 between books)
+    unsigned GetPendingOrderCount() const;
 };
 
-Order::Order(double _price, long _quantity, PricingSide _side)
+/**
+ * Subscribes the incremental market data feed into the service's books.
+ * Only the changed levels of a book are sent, with a sequence number per product and update,
+ * and the lines of an update are applied to the stored book in place, so nothing is rebuilt.
+ * Type T is the product type.
+ */
+template <typename T, typename S>
+class MarketDataUpdateConnector final : public Connector<OrderBook<T>> {
+private:
+    S* service_;
+    vector<uint64_t> sequences_;    // Last applied sequence, by product index
+    vector<bool> stale_;            // Books missing an update, waiting for a snapshot
+    
+    // Update being read, kept across calls so that an update may span reads
+    OrderBook<T>* book_;
+    ProductIndex index_;
+    uint64_t sequence_;
+    bool in_update_;
+    bool apply_;
+    
+    uint64_t messages_;
+    uint64_t updates_;
+    uint64_t gaps_;
+    uint64_t dropped_;
+    uint64_t snapshots_;
+    
+    // Start an update of a book: decide whether it applies
+    void BeginUpdate(string_view product_id, uint64_t sequence, MarketDataAction action);
+    
+    // End an update that lost its last change: if it was partly applied, its book waits for a snapshot
+    void AbandonUpdate();
+    
+public:
+    MarketDataUpdateConnector(S* service);
+    ~MarketDataUpdateConnector() = default;
+    
+    // Publish data to the Connector
+    // Does nothing
+    // MarketDataUpdateConnector is subscribe only
+    virtual void Publish(OrderBook<T> &data) override;
+    
+    // Subscribe data from the Connector
+    virtual void Subscribe(istream& data) override;
+    
+    // Subscribe the lines of a reader, e.g. over a network receive buffer (see network_connectors.hpp)
+    void Subscribe(LineReader& reader);
+    
+    // Level changes read
+    uint64_t GetMessageCount() const;
+    
+    // Updates applied and published
+    uint64_t GetUpdateCount() const;
+    
+    // Sequence gaps found (each leaves its book stale until a snapshot)
+    uint64_t GetGapCount() const;
+    
+    // Updates dropped, as replayed or arriving on a stale book
+    uint64_t GetDroppedCount() const;
+    
+    // Snapshots applied
+    uint64_t GetSnapshotCount() const;
+    
+    // Whether the book of a product waits for a snapshot
+    bool IsStale(ProductIndex index) const;
+};
+
+Order::Order(PriceTick _price, long _quantity, PricingSide _side)
 {
     price = _price;
     quantity = _quantity;
     side = _side;
 }
 
-double Order::GetPrice() const
+PriceTick Order::GetPrice() const
 {
     return price;
 }
@@ -232,15 +376,25 @@ template <typename T>
 OrderBook<T>::OrderBook(const T &_product, const vector<Order> &_bidStack, const vector<Order> &_offerStack) :
   product(_product), bidStack(_bidStack), offerStack(_offerStack)
 {
+    SortLevels();
 }
 
 template <typename T>
-OrderBook<T>::OrderBook(const T &_product, vector<Order>&& _bidStack, vector<Order>&& _offerStack) : product(_product), bidStack(_bidStack), offerStack(_offerStack) {}
+OrderBook<T>::OrderBook(const T &_product, vector<Order>&& _bidStack, vector<Order>&& _offerStack) : product(_product), bidStack(std::move(_bidStack)), offerStack(std::move(_offerStack)) {
+    SortLevels();
+}
+
+template <typename T>
+void OrderBook<T>::SortLevels() {
+    // Stable, so that among equal prices the first order received stays in front
+    stable_sort(bidStack.begin(), bidStack.end(), [](const Order& a, const Order& b) { return a.GetPrice() > b.GetPrice(); });
+    stable_sort(offerStack.begin(), offerStack.end(), [](const Order& a, const Order& b) { return a.GetPrice() < b.GetPrice(); });
+}
 
 template <typename T>
 const T& OrderBook<T>::GetProduct() const
 {
-    return product;
+    return *product;
 }
 
 template <typename T>
@@ -257,190 +411,399 @@ const vector<Order>& OrderBook<T>::GetOfferStack() const
 
 template <typename T>
 const BidOffer OrderBook<T>::GetBidOffer() const {
-    // Get highest bid order
-    const Order* highest_bid_order(&bidStack[0]);
-    double highest_bid_price = highest_bid_order->GetPrice();
-    for (std::size_t i = 1; i < bidStack.size(); i++) {
-        if (bidStack[i].GetPrice() > highest_bid_price) {
-            highest_bid_order = &bidStack[i];
-            highest_bid_price = highest_bid_order->GetPrice();
-        }
-    }
+    return BidOffer(GetBestBid(), GetBestOffer());
+}
 
-    // Get lowest offer order
-    const Order* lowest_offer_order(&offerStack[0]);
-    double lowest_offer_price = lowest_offer_order->GetPrice();
-    for (std::size_t i = 1; i < offerStack.size(); i++) {
-        if (offerStack[i].GetPrice() < lowest_offer_price) {
-            lowest_offer_order = &offerStack[i];
-            lowest_offer_price = lowest_offer_order->GetPrice();
-        }
+template <typename T>
+const Order& OrderBook<T>::GetBestBid() const {
+    return bidStack.front();
+}
+
+template <typename T>
+const Order& OrderBook<T>::GetBestOffer() const {
+    return offerStack.front();
+}
+
+template <typename T>
+void OrderBook<T>::Clear() {
+    bidStack.clear();
+    offerStack.clear();
+}
+
+template <typename T>
+vector<Order>& OrderBook<T>::GetStack(PricingSide side) {
+    return (side == BID) ? bidStack : offerStack;
+}
+
+template <typename T>
+vector<Order>::iterator OrderBook<T>::FindLevel(vector<Order>& stack, PriceTick price, PricingSide side, bool behind) {
+    // Books are shallow and contiguous, so a linear scan from the top beats a binary search
+    auto it = stack.begin();
+    if (side == BID) {
+        while (it != stack.end() && (it->GetPrice() > price || (behind && it->GetPrice() == price))) ++it;
+    } else {
+        while (it != stack.end() && (it->GetPrice() < price || (behind && it->GetPrice() == price))) ++it;
     }
+    return it;
+}
 
-    return BidOffer(*highest_bid_order, *lowest_offer_order);
+template <typename T>
+void OrderBook<T>::AddOrder(const Order& order) {
+    vector<Order>& stack = GetStack(order.GetSide());
+    // Orders usually arrive from the top of book down, so this is an append
+    stack.insert(FindLevel(stack, order.GetPrice(), order.GetSide(), true), order);
 }
 
 template <typename T>
-MarketDataService<T>::MarketDataService() : order_books_(), in_connector_(new MarketDataConnector<T>(this)), book_depth_(10) {}
+void OrderBook<T>::ModifyOrder(const Order& order) {
+    vector<Order>& stack = GetStack(order.GetSide());
+    auto first = FindLevel(stack, order.GetPrice(), order.GetSide());
+    auto last = FindLevel(stack, order.GetPrice(), order.GetSide(), true);
+    if (first != last) {
+        // The level becomes the one order, as RemoveLevel takes the whole level away
+        *first = order;
+        stack.erase(first + 1, last);
+    } else {
+        stack.insert(first, order);
+    }
+}
 
 template <typename T>
-MarketDataService<T>::~MarketDataService() {
-    delete in_connector_;
+void OrderBook<T>::RemoveLevel(PriceTick price, PricingSide side) {
+    vector<Order>& stack = GetStack(side);
+    auto first = FindLevel(stack, price, side);
+    auto last = FindLevel(stack, price, side, true);
+    stack.erase(first, last);
 }
 
 template <typename T>
-OrderBook<T>& MarketDataService<T>::GetData(string product_id) {
-    return order_books_.at(product_id);
+void OrderBook<T>::AggregateLevels() {
+    AggregateStack(bidStack, BID);
+    AggregateStack(offerStack, OFFER);
 }
 
 template <typename T>
-void MarketDataService<T>::OnMessage(OrderBook<T>& book) {
-    string product_id = book.GetProduct().GetProductId();
+void OrderBook<T>::AggregateStack(vector<Order>& stack, PricingSide side) {
+    // Levels are kept sorted, so equal prices are adjacent and one linear pass merges them in place.
+    // No allocation, and the output stays in level order.
+    size_t levels = 0;
+    size_t begin = 0;
+    while (begin < stack.size()) {
+        PriceTick price = stack[begin].GetPrice();
+        long quantity = 0;
+        size_t end = begin;
+        for (; end < stack.size() && stack[end].GetPrice() == price; end++) {
+            quantity += stack[end].GetQuantity();
+        }
+        stack[levels++] = Order(price, quantity, side);
+        begin = end;
+    }
+    stack.erase(stack.begin() + levels, stack.end());
+}
+
+template <typename T, typename Static>
+MarketDataService<T, Static>::MarketDataService() : order_books_(ProductRegistry<T>::Instance().Size()), in_connector_(new ConnectorType(this)), update_connector_(new UpdateConnectorType(this)), book_depth_(10) {}
+
+template <typename T, typename Static>
+MarketDataService<T, Static>::~MarketDataService() {
+    delete in_connector_;
+    delete update_connector_;
+}
+
+template <typename T, typename Static>
+OrderBook<T>& MarketDataService<T, Static>::GetData(string product_id) {
+    return order_books_.At(ProductRegistry<T>::Instance().GetIndex(product_id));
+}
+
+template <typename T, typename Static>
+void MarketDataService<T, Static>::OnMessage(OrderBook<T>& book) {
+    LATENCY_RECORD(MARKET_DATA_ON_MESSAGE, book);
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(book.GetProduct());
     
-    order_books_.insert_or_assign(product_id, book);
+    // Books updated in place through GetBook are already stored.
+    // Otherwise assign into the stored book so that its level storage is reused.
+    auto [stored, inserted] = order_books_.TryEmplace(index, book);
+    if (!inserted && stored != &book) {
+        *stored = book;
+    }
     
     // Also notify listeners
+    static_listeners_.ProcessAdd(book);
     for (auto& listener : Service<string, OrderBook<T>>::listeners_) {
         listener->ProcessAdd(book);
     }
 }
 
-template <typename T>
-void MarketDataService<T>::AddListener(ServiceListener<OrderBook<T>>* listener) {
+template <typename T, typename Static>
+void MarketDataService<T, Static>::AddListener(ServiceListener<OrderBook<T>>* listener) {
     this->Service<string, OrderBook<T>>::AddListener(listener);
 }
 
-template <typename T>
-const vector<ServiceListener<OrderBook<T>>*>& MarketDataService<T>::GetListeners() const {
+template <typename T, typename Static>
+const vector<ServiceListener<OrderBook<T>>*>& MarketDataService<T, Static>::GetListeners() const {
     return this->Service<string, OrderBook<T>>::GetListeners();
 }
 
 // Get the MarketDataConnector
-template <typename T>
-MarketDataConnector<T>* MarketDataService<T>::GetConnector() {
+template <typename T, typename Static>
+typename MarketDataService<T, Static>::ConnectorType* MarketDataService<T, Static>::GetConnector() {
     return in_connector_;
 }
 
+template <typename T, typename Static>
+typename MarketDataService<T, Static>::UpdateConnectorType* MarketDataService<T, Static>::GetUpdateConnector() {
+    return update_connector_;
+}
+
+template <typename T, typename Static>
+Static& MarketDataService<T, Static>::GetStaticListeners() {
+    return static_listeners_;
+}
+
 // Get the book depth
-template <typename T>
-int MarketDataService<T>::GetBookDepth() const {
+template <typename T, typename Static>
+int MarketDataService<T, Static>::GetBookDepth() const {
     return book_depth_;
 }
 
+template <typename T, typename Static>
+OrderBook<T>& MarketDataService<T, Static>::GetBook(const T& product) {
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(product);
+    return *order_books_.TryEmplace(index, product, vector<Order>(), vector<Order>()).first;
+}
+
+template <typename T, typename Static>
+const OrderBook<T>* MarketDataService<T, Static>::FindBook(ProductIndex index) const {
+    return order_books_.Find(index);
+}
+
 // Get the best bid/offer order
-template <typename T>
-const BidOffer MarketDataService<T>::GetBestBidOffer(const string &productId) const {
-    return order_books_.find(productId)->second.GetBidOffer();
+template <typename T, typename Static>
+const BidOffer MarketDataService<T, Static>::GetBestBidOffer(const string &productId) const {
+    return order_books_.Find(ProductRegistry<T>::Instance().GetIndex(productId))->GetBidOffer();
 }
 
-// AggregateDepth helper function
-template <typename T>
-vector<Order> MarketDataService<T>::AggregateStack(const vector<Order>& original_stack) const {
-    
-    unordered_map<double, long> order_map;
-    
-    for (const auto& order : original_stack) {
-        if (order_map.find(order.GetPrice()) == order_map.end()) {
-            // The price does not exist yet
-            order_map[order.GetPrice()] = order.GetQuantity();
-        } else {
-            // The price already exists
-            order_map[order.GetPrice()] += order.GetQuantity();
-        }
+// Aggregate the order book
+// Also modify that book
+template <typename T, typename Static>
+const OrderBook<T>& MarketDataService<T, Static>::AggregateDepth(const string &productId) {
+    OrderBook<T>& order_book = order_books_.At(ProductRegistry<T>::Instance().GetIndex(productId));
+    order_book.AggregateLevels();
+    return order_book;
+}
+
+template <typename T, typename Static>
+void MarketDataService<T, Static>::AggregateDepth(const vector<string>& product_ids) {
+    // Resolve first, so that an unknown product throws before any book is modified
+    const ProductRegistry<T>& registry = ProductRegistry<T>::Instance();
+    vector<OrderBook<T>*> books;
+    books.reserve(product_ids.size());
+    for (const auto& product_id : product_ids) {
+        books.push_back(&order_books_.At(registry.GetIndex(product_id)));
     }
-    
-    vector<Order> aggregated_stack;
-    aggregated_stack.reserve(order_map.size());
-    for (auto [price, quantity] : order_map) {
-        Order order(price, quantity, BID);
-        aggregated_stack.push_back(order);
+    for (OrderBook<T>* book : books) {
+        book->AggregateLevels();
     }
-    
-    return aggregated_stack;
 }
 
-// Aggregate the order book
-// Also modify that book
-template <typename T>
-const OrderBook<T>& MarketDataService<T>::AggregateDepth(const string &productId) {
-    const T& product = order_books_.at(productId).GetProduct();
-    
-    // Aggregate bid orders
-    const vector<Order>& original_bid_stack = order_books_.at(productId).GetBidStack();
-    
-    vector<Order> aggregated_bid_stack = this->AggregateStack(original_bid_stack);
-    
-    // Aggregate offer orders
-    const vector<Order>& original_offer_stack = order_books_.at(productId).GetOfferStack();
-    
-    vector<Order> aggregated_offer_stack = this->AggregateStack(original_offer_stack);
-    
-    OrderBook<T> aggregated_order_book(product, std::move(aggregated_bid_stack), std::move(aggregated_offer_stack));
-//    OrderBook<T> aggregated_order_book(product, aggregated_bid_stack, aggregated_offer_stack);
-    
-    order_books_.at(productId) = aggregated_order_book;
-    
-    return order_books_.at(productId);
+template <typename T, typename Static>
+void MarketDataService<T, Static>::AggregateAllDepth() {
+    order_books_.ForEach([](OrderBook<T>& book) { book.AggregateLevels(); });
 }
 
-template <typename T>
-MarketDataConnector<T>::MarketDataConnector(MarketDataService<T>* service) : service_(service) {}
+template <typename T, typename S>
+MarketDataConnector<T, S>::MarketDataConnector(S* service) : service_(service), book_(nullptr), order_count_(0) {}
 
-template <typename T>
-void MarketDataConnector<T>::Publish(OrderBook<T> &data) {
+template <typename T, typename S>
+void MarketDataConnector<T, S>::Publish(OrderBook<T> &data) {
     // Does nothing
     // MarketDataConnector is subscribe only
 }
 
-template <typename T>
-void MarketDataConnector<T>::Subscribe(ifstream &data) {
+template <typename T, typename S>
+void MarketDataConnector<T, S>::Subscribe(istream &data) {
+    LineReader reader(data);
+    Subscribe(reader);
+    // A truncated book at the end of a file is dropped
+    order_count_ = 0;
+}
+
+template <typename T, typename S>
+unsigned MarketDataConnector<T, S>::GetPendingOrderCount() const {
+    return order_count_;
+}
+
+template <typename T, typename S>
+void MarketDataConnector<T, S>::Subscribe(LineReader& reader) {
     
     int book_depth = service_->GetBookDepth();
-    int read_lines = book_depth << 1;
-    
-    vector<Order> bid_stack;
-    vector<Order> offer_stack;
-    
-    string line;
-    unsigned order_count = 0;
-    while (getline(data, line)) {
-        // Separate line with delimiter ','
-        stringstream line_stream(line);
-        string line_entry;
-        vector<string> line_entries;
-        while (getline(line_stream, line_entry, ',')) {
-            line_entries.push_back(line_entry);
-        }
-        
+    unsigned read_lines = book_depth << 1;
+    
+    LineFields line_entries;
+    while (reader.ReadFields(line_entries)) {
+        line_entries.RequireFields(4, "MarketDataConnector");
         // Parse data into Order
-        string product_id = line_entries[0];
-        double price = ConvertPrice(line_entries[1]);
-        long quantity = stol(line_entries[2]);
+        string_view product_id = line_entries[0];
+        PriceTick price = ConvertPrice(line_entries[1]);
+        long quantity = ParseNumber<long>(line_entries[2]);
         PricingSide side = (line_entries[3] == "BID") ? BID : OFFER;
         Order order(price, quantity, side);
         
-        // Push data to stack
-        if (side == BID) {
-            bid_stack.push_back(order);
-        } else {
-            offer_stack.push_back(order);
+        // A new snapshot starts: rebuild the stored book in place
+        if (order_count_ == 0) {
+            book_ = &service_->GetBook(FetchBond(product_id));
+            book_->Clear();
+            LATENCY_STAMP(*book_);
+            // Note: This operation does not shrink the capacity of the levels.
+            //   It is intended behavior since they will be filled to the same size soon.
         }
+        book_->AddOrder(order);
         
         // Publish the entire book if the OrderBook is deep enough
-        order_count++;
-        if (order_count == (read_lines)) {
-            T product = FetchBond(product_id);
-            OrderBook<T> orderbook(product, bid_stack, offer_stack);
-            service_->OnMessage(orderbook);
-            
-            bid_stack.clear();
-            offer_stack.clear();
-            // Note: This operation does not shrink the capacity of the vectors.
-            //   It is intended behavior since they will be filled to the same size soon.
-            
-            order_count = 0;
+        order_count_++;
+        if (order_count_ == read_lines) {
+            order_count_ = 0;
+            service_->OnMessage(*book_);
+        }
+    }
+}
+
+template <typename T, typename S>
+MarketDataUpdateConnector<T, S>::MarketDataUpdateConnector(S* service) : service_(service), book_(nullptr), index_(0), sequence_(0), in_update_(false), apply_(false), messages_(0), updates_(0), gaps_(0), dropped_(0), snapshots_(0) {}
+
+template <typename T, typename S>
+void MarketDataUpdateConnector<T, S>::Publish(OrderBook<T> &data) {
+    // Does nothing
+    // MarketDataUpdateConnector is subscribe only
+}
+
+template <typename T, typename S>
+void MarketDataUpdateConnector<T, S>::Subscribe(istream &data) {
+    LineReader reader(data);
+    Subscribe(reader);
+    // An update truncated at the end of a file
+    AbandonUpdate();
+}
+
+template <typename T, typename S>
+void MarketDataUpdateConnector<T, S>::AbandonUpdate() {
+    if (in_update_ && apply_) {
+        stale_[index_] = true;
+    }
+    in_update_ = false;
+}
+
+template <typename T, typename S>
+void MarketDataUpdateConnector<T, S>::BeginUpdate(string_view product_id, uint64_t sequence, MarketDataAction action) {
+    book_ = &service_->GetBook(FetchBond(product_id));
+    index_ = ProductRegistry<T>::Instance().Resolve(book_->GetProduct());
+    if (index_ >= sequences_.size()) {
+        sequences_.resize(index_ + 1, 0);
+        stale_.resize(index_ + 1, false);
+    }
+    sequence_ = sequence;
+    in_update_ = true;
+    
+    uint64_t last = sequences_[index_];
+    if (sequence <= last) {
+        // Replayed, e.g. after a reconnect
+        apply_ = false;
+    } else if (action == SNAPSHOT_LEVEL) {
+        // A snapshot replaces the book, whatever was missed
+        apply_ = true;
+        stale_[index_] = false;
+        snapshots_++;
+        book_->Clear();
+    } else {
+        if (!stale_[index_] && sequence != last + 1) {
+            stale_[index_] = true;
+            gaps_++;
+        }
+        apply_ = !stale_[index_];
+    }
+    if (apply_) {
+        LATENCY_STAMP(*book_);
+    } else {
+        dropped_++;
+    }
+}
+
+template <typename T, typename S>
+void MarketDataUpdateConnector<T, S>::Subscribe(LineReader& reader) {
+    LineFields line_entries;
+    while (reader.ReadFields(line_entries)) {
+        line_entries.RequireFields(7, "MarketDataUpdateConnector");
+        messages_++;
+        uint64_t sequence = ParseNumber<uint64_t>(line_entries[0]);
+        MarketDataAction action = MarketDataAction(line_entries[2].empty() ? '\0' : line_entries[2][0]);
+        // A line of another product or update means the end of the current update was lost: its changes must not reach this book
+        if (in_update_ && (sequence != sequence_ || line_entries[1] != book_->GetProduct().GetProductId())) {
+            AbandonUpdate();
+        }
+        if (!in_update_) {
+            BeginUpdate(line_entries[1], sequence, action);
+        }
+        
+        if (apply_) {
+            PriceTick price = ConvertPrice(line_entries[3]);
+            long quantity = ParseNumber<long>(line_entries[4]);
+            PricingSide side = (line_entries[5] == "BID") ? BID : OFFER;
+            switch (action) {
+                case SNAPSHOT_LEVEL:
+                case ADD_LEVEL:
+                    book_->AddOrder(Order(price, quantity, side));
+                    break;
+                case MODIFY_LEVEL:
+                    book_->ModifyOrder(Order(price, quantity, side));
+                    break;
+                case DELETE_LEVEL:
+                    book_->RemoveLevel(price, side);
+                    break;
+                default:
+                    throw invalid_argument("MarketDataUpdateConnector: unknown action " + string(line_entries[2]));
+            }
+        }
+        
+        // Publish the book at the last change of the update
+        if (line_entries[6] == "1") {
+            in_update_ = false;
+            if (apply_) {
+                sequences_[index_] = sequence_;
+                updates_++;
+                service_->OnMessage(*book_);
+            }
         }
     }
 }
 
+template <typename T, typename S>
+uint64_t MarketDataUpdateConnector<T, S>::GetMessageCount() const {
+    return messages_;
+}
+
+template <typename T, typename S>
+uint64_t MarketDataUpdateConnector<T, S>::GetUpdateCount() const {
+    return updates_;
+}
+
+template <typename T, typename S>
+uint64_t MarketDataUpdateConnector<T, S>::GetGapCount() const {
+    return gaps_;
+}
+
+template <typename T, typename S>
+uint64_t MarketDataUpdateConnector<T, S>::GetDroppedCount() const {
+    return dropped_;
+}
+
+template <typename T, typename S>
+uint64_t MarketDataUpdateConnector<T, S>::GetSnapshotCount() const {
+    return snapshots_;
+}
+
+template <typename T, typename S>
+bool MarketDataUpdateConnector<T, S>::IsStale(ProductIndex index) const {
+    return index < stale_.size() && stale_[index];
+}
+
 #endif /* MARKET_DATA_SERVICE_HPP */
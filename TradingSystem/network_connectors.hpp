@@ -0,0 +1,781 @@
+/**
+ * network_connectors.hpp
+ * Non-blocking TCP and UDP multicast connectors over Boost.Asio, for live venue feeds and outbound streams
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) NetworkEventLoop runs an asio io_context on its own thread. Every socket operation and every callback of the connectors below happens on that thread, so the services fed by a loop see a single feed thread, as with a file connector. Several feeds may share one loop, or get a loop each to run in parallel.
+ (2) Subscribers receive straight into a ReceiveBuffer, a reusable buffer that only grows when one line outgrows it. The complete lines of each receive are handed in place (a LineReader over the buffer, no copy) to the file connector's Subscribe(LineReader&), which parses and delivers them in one batch. A line cut by a receive stays in the buffer and is completed by the next one: only that partial line is ever moved.
+ (3) TcpFeedSubscriber reads a line stream until the venue closes it. UdpFeedSubscriber receives datagrams, each carrying whole lines, on a port and optionally a multicast group.
+ (4) TcpPublishConnector is a publish-only Connector (attach it with StreamingService::SetConnector or ExecutionService::SetConnector). Publish serializes the record as the historical files do (see serialization.hpp) into a pending buffer under a short lock and returns; the loop writes the pending bytes in one gathered write while the next records accumulate (double buffering), so publishing never waits for the network.
+ (5) Setup errors (unresolvable hosts, unusable addresses) throw. Errors once running end the connection: they are kept for GetError, and WaitClosed returns.
+ */
+
+#ifndef network_connectors_hpp
+#define network_connectors_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <istream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "soa.hpp"
+#include "line_reader.hpp"
+#include "serialization.hpp"
+
+using namespace std;
+
+namespace asio = boost::asio;
+// Outcome of a network operation (not std::error_code)
+typedef boost::system::error_code NetworkError;
+
+/**
+ * An io_context driven by a dedicated thread.
+ */
+class NetworkEventLoop
+{
+public:
+    // Starts the loop thread
+    NetworkEventLoop();
+
+    // Stops the loop and joins its thread; connectors on the loop must be closed first
+    ~NetworkEventLoop();
+
+    NetworkEventLoop(const NetworkEventLoop&) = delete;
+    NetworkEventLoop& operator = (const NetworkEventLoop&) = delete;
+
+    asio::io_context& GetContext();
+
+    // Whether the caller is the loop thread
+    bool RunningInThisThread() const;
+
+    // Run f on the loop thread, after everything posted before, and wait for it
+    template <typename F>
+    void RunAndWait(F&& f);
+
+private:
+    asio::io_context context_;
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+    thread thread_;
+};
+
+/**
+ * Reusable receive buffer of a line stream: bytes are received into its tail, complete lines are consumed from its head.
+ */
+class ReceiveBuffer
+{
+public:
+    static constexpr size_t kDefaultCapacity = 1 << 16;
+
+    explicit ReceiveBuffer(size_t capacity = kDefaultCapacity);
+
+    // Free space to receive into. The partial line is moved to the front, or the buffer grown, only when the tail is full.
+    asio::mutable_buffer Prepare();
+
+    // Account for bytes received into the prepared space
+    void Commit(size_t size);
+
+    // Call f(LineReader&) over the complete lines received so far, and drop them. Returns whether there were any.
+    template <typename F>
+    bool ConsumeLines(F&& f);
+
+    // Call f(LineReader&) over whatever is left (a last line without terminator), and empty the buffer
+    template <typename F>
+    bool ConsumeRest(F&& f);
+
+    // Bytes received but not consumed yet
+    size_t GetPending() const;
+
+private:
+    vector<char> buffer_;
+    size_t begin_;
+    size_t end_;
+};
+
+/**
+ * Progress and outcome of a network connection.
+ */
+class ConnectionState
+{
+public:
+    ConnectionState();
+
+    // Mark the connection closed, with the error that closed it (none for an orderly close)
+    void Close(const NetworkError& error = NetworkError());
+
+    // Block until the connection is closed; returns whether it closed without error
+    bool WaitClosed();
+
+    bool IsClosed() const;
+    NetworkError GetError() const;
+
+    // Receive / write statistics
+    void Count(size_t bytes);
+    uint64_t GetBytes() const;
+    uint64_t GetBatches() const;
+
+private:
+    mutable mutex mutex_;
+    condition_variable closed_cv_;
+    bool closed_;
+    NetworkError error_;
+    atomic<uint64_t> bytes_;
+    atomic<uint64_t> batches_;
+};
+
+/**
+ * Subscribes a line feed from a TCP connection.
+ * Type C is a file connector with Subscribe(LineReader&) (e.g. MarketDataConnector).
+ */
+template <typename C>
+class TcpFeedSubscriber
+{
+public:
+    TcpFeedSubscriber(NetworkEventLoop& loop, C* connector, size_t buffer_size = ReceiveBuffer::kDefaultCapacity);
+
+    // Closes the connection and waits for its callbacks to finish
+    ~TcpFeedSubscriber();
+
+    TcpFeedSubscriber(const TcpFeedSubscriber&) = delete;
+    TcpFeedSubscriber& operator = (const TcpFeedSubscriber&) = delete;
+
+    // Resolve the venue (throws if it cannot be resolved), then connect and receive on the loop
+    void Connect(const string& host, unsigned short port);
+
+    // Close the connection from any thread
+    void Close();
+
+    // Block until the venue ends the feed (or the connection fails or is closed); true for an orderly end
+    bool WaitClosed();
+
+    const ConnectionState& GetState() const;
+
+private:
+    // On the loop: close the socket, which aborts the pending operation (or mark the state closed if there is none)
+    void CloseSocket();
+
+    void Receive();
+    void OnReceive(const NetworkError& error, size_t size);
+    void Finish(const NetworkError& error);
+
+    NetworkEventLoop& loop_;
+    C* connector_;
+    asio::ip::tcp::socket socket_;
+    ReceiveBuffer buffer_;
+    ConnectionState state_;
+};
+
+/**
+ * Subscribes a line feed from UDP datagrams, unicast or multicast. Every datagram must hold whole lines.
+ * Type C is a file connector with Subscribe(LineReader&).
+ */
+template <typename C>
+class UdpFeedSubscriber
+{
+public:
+    // Largest datagram accepted
+    static constexpr size_t kMaxDatagramSize = 1 << 16;
+
+    UdpFeedSubscriber(NetworkEventLoop& loop, C* connector);
+
+    // Closes the socket and waits for its callbacks to finish
+    ~UdpFeedSubscriber();
+
+    UdpFeedSubscriber(const UdpFeedSubscriber&) = delete;
+    UdpFeedSubscriber& operator = (const UdpFeedSubscriber&) = delete;
+
+    // Receive on a local address and port, joining the multicast group if one is given (throws on invalid addresses)
+    void Open(const string& listen_address, unsigned short port, const string& multicast_group = "");
+
+    // Close the socket from any thread
+    void Close();
+
+    // Block until the socket is closed or fails
+    bool WaitClosed();
+
+    const ConnectionState& GetState() const;
+
+private:
+    // On the loop: close the socket, which aborts the pending receive (or mark the state closed if there is none)
+    void CloseSocket();
+
+    void Receive();
+    void OnReceive(const NetworkError& error, size_t size);
+
+    NetworkEventLoop& loop_;
+    C* connector_;
+    asio::ip::udp::socket socket_;
+    asio::ip::udp::endpoint sender_;
+    vector<char> datagram_;
+    ConnectionState state_;
+};
+
+/**
+ * Publish-only connector writing records to a TCP connection, one text line per record.
+ * Type V is the data type; it must provide GetMaxSerializedSize and Serialize (see serialization.hpp).
+ */
+template <typename V>
+class TcpPublishConnector : public Connector<V>
+{
+public:
+    TcpPublishConnector(NetworkEventLoop& loop);
+
+    // Writes out what was published, then closes the connection
+    ~TcpPublishConnector();
+
+    TcpPublishConnector(const TcpPublishConnector&) = delete;
+    TcpPublishConnector& operator = (const TcpPublishConnector&) = delete;
+
+    // Resolve the venue (throws if it cannot be resolved), then connect on the loop. Records published meanwhile are kept.
+    void Connect(const string& host, unsigned short port);
+
+    // Queue a record for writing; returns at once
+    virtual void Publish(V& data) override;
+
+    // Does nothing: the connector is publish only
+    virtual void Subscribe(istream& data) override;
+
+    // Block until everything published so far has been written (or the connection is gone)
+    void Flush();
+
+    // Close the connection from any thread (records not written yet are dropped)
+    void Close();
+
+    const ConnectionState& GetState() const;
+
+private:
+    // Start writing the pending records, unless a write is in flight (on the loop, lock held)
+    void StartWrite();
+    void OnWrite(const NetworkError& error, size_t size);
+
+    // On the loop: drop what is pending and close the socket
+    void CloseSocket();
+
+    // Give up on the connection (on the loop)
+    void Fail(const NetworkError& error);
+
+    NetworkEventLoop& loop_;
+    asio::ip::tcp::socket socket_;
+
+    mutex mutex_;
+    condition_variable written_cv_;
+    vector<char> record_;           // Reused serialization buffer
+    vector<char> pending_;          // Published, not written yet
+    vector<char> writing_;          // Being written
+    bool connecting_;               // Connect was called and the connection is not closed
+    bool connected_;
+    bool write_in_flight_;
+    ConnectionState state_;
+};
+
+NetworkEventLoop::NetworkEventLoop() : work_(asio::make_work_guard(context_))
+{
+    thread_ = thread([this] { context_.run(); });
+}
+
+NetworkEventLoop::~NetworkEventLoop()
+{
+    work_.reset();
+    context_.stop();
+    thread_.join();
+}
+
+asio::io_context& NetworkEventLoop::GetContext()
+{
+    return context_;
+}
+
+bool NetworkEventLoop::RunningInThisThread() const
+{
+    return this_thread::get_id() == thread_.get_id();
+}
+
+template <typename F>
+void NetworkEventLoop::RunAndWait(F&& f)
+{
+    if (RunningInThisThread()) {
+        f();
+        return;
+    }
+    promise<void> done;
+    asio::post(context_, [&f, &done] {
+        f();
+        done.set_value();
+    });
+    done.get_future().wait();
+}
+
+ReceiveBuffer::ReceiveBuffer(size_t capacity) : buffer_(capacity), begin_(0), end_(0)
+{
+    if (capacity == 0) {
+        throw invalid_argument("ReceiveBuffer: capacity must be positive");
+    }
+}
+
+asio::mutable_buffer ReceiveBuffer::Prepare()
+{
+    if (end_ == buffer_.size()) {
+        if (begin_ > 0) {
+            memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        } else {
+            // A single line fills the buffer
+            buffer_.resize(buffer_.size() << 1);
+        }
+    }
+    return asio::buffer(buffer_.data() + end_, buffer_.size() - end_);
+}
+
+void ReceiveBuffer::Commit(size_t size)
+{
+    end_ += size;
+}
+
+template <typename F>
+bool ReceiveBuffer::ConsumeLines(F&& f)
+{
+    string_view received(buffer_.data() + begin_, end_ - begin_);
+    size_t last_newline = received.rfind('\n');
+    if (last_newline == string_view::npos) {
+        return false;
+    }
+    const char* begin = received.data();
+    const char* end = begin + last_newline + 1;
+    LineReader reader(begin, end);
+    f(reader);
+
+    begin_ += last_newline + 1;
+    if (begin_ == end_) {
+        begin_ = end_ = 0;
+    }
+    return true;
+}
+
+template <typename F>
+bool ReceiveBuffer::ConsumeRest(F&& f)
+{
+    if (begin_ == end_) {
+        return false;
+    }
+    LineReader reader(buffer_.data() + begin_, buffer_.data() + end_);
+    f(reader);
+    begin_ = end_ = 0;
+    return true;
+}
+
+size_t ReceiveBuffer::GetPending() const
+{
+    return end_ - begin_;
+}
+
+ConnectionState::ConnectionState() : closed_(false), bytes_(0), batches_(0) {}
+
+void ConnectionState::Close(const NetworkError& error)
+{
+    // Notified under the lock: a waiter may destroy the state as soon as it sees it closed
+    lock_guard<mutex> lock(mutex_);
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+    error_ = error;
+    closed_cv_.notify_all();
+}
+
+bool ConnectionState::WaitClosed()
+{
+    unique_lock<mutex> lock(mutex_);
+    closed_cv_.wait(lock, [this] { return closed_; });
+    return !error_;
+}
+
+bool ConnectionState::IsClosed() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return closed_;
+}
+
+NetworkError ConnectionState::GetError() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return error_;
+}
+
+void ConnectionState::Count(size_t bytes)
+{
+    bytes_.fetch_add(bytes, memory_order_relaxed);
+    batches_.fetch_add(1, memory_order_relaxed);
+}
+
+uint64_t ConnectionState::GetBytes() const
+{
+    return bytes_.load(memory_order_relaxed);
+}
+
+uint64_t ConnectionState::GetBatches() const
+{
+    return batches_.load(memory_order_relaxed);
+}
+
+template <typename C>
+TcpFeedSubscriber<C>::TcpFeedSubscriber(NetworkEventLoop& loop, C* connector, size_t buffer_size) :
+  loop_(loop), connector_(connector), socket_(loop.GetContext()), buffer_(buffer_size) {}
+
+template <typename C>
+TcpFeedSubscriber<C>::~TcpFeedSubscriber()
+{
+    // No callback may run once the subscriber is gone: close on the loop, then wait for the aborted operation
+    loop_.RunAndWait([this] { CloseSocket(); });
+    state_.WaitClosed();
+}
+
+template <typename C>
+void TcpFeedSubscriber<C>::Connect(const string& host, unsigned short port)
+{
+    asio::ip::tcp::resolver resolver(loop_.GetContext());
+    auto endpoints = resolver.resolve(host, to_string(port));
+    asio::post(loop_.GetContext(), [this, endpoints] {
+        asio::async_connect(socket_, endpoints, [this](const NetworkError& error, const asio::ip::tcp::endpoint&) {
+            if (error) {
+                Finish(error == asio::error::operation_aborted ? NetworkError() : error);
+                return;
+            }
+            socket_.set_option(asio::ip::tcp::no_delay(true));
+            Receive();
+        });
+    });
+}
+
+template <typename C>
+void TcpFeedSubscriber<C>::Close()
+{
+    asio::post(loop_.GetContext(), [this] { CloseSocket(); });
+}
+
+template <typename C>
+void TcpFeedSubscriber<C>::CloseSocket()
+{
+    if (!socket_.is_open()) {
+        // Never connected, or already finished
+        state_.Close();
+        return;
+    }
+    NetworkError ignored;
+    socket_.close(ignored);
+}
+
+template <typename C>
+bool TcpFeedSubscriber<C>::WaitClosed()
+{
+    return state_.WaitClosed();
+}
+
+template <typename C>
+const ConnectionState& TcpFeedSubscriber<C>::GetState() const
+{
+    return state_;
+}
+
+template <typename C>
+void TcpFeedSubscriber<C>::Receive()
+{
+    socket_.async_read_some(buffer_.Prepare(), [this](const NetworkError& error, size_t size) { OnReceive(error, size); });
+}
+
+template <typename C>
+void TcpFeedSubscriber<C>::OnReceive(const NetworkError& error, size_t size)
+{
+    buffer_.Commit(size);
+    try {
+        if (size > 0) {
+            state_.Count(size);
+            buffer_.ConsumeLines([this](LineReader& reader) { connector_->Subscribe(reader); });
+        }
+        if (error == asio::error::eof) {
+            // The venue ended the feed: its last line may lack a terminator
+            buffer_.ConsumeRest([this](LineReader& reader) { connector_->Subscribe(reader); });
+            Finish(NetworkError());
+            return;
+        }
+    } catch (const exception&) {
+        // A malformed line ends the feed, rather than the loop thread
+        Finish(make_error_code(boost::system::errc::bad_message));
+        return;
+    }
+    if (error) {
+        Finish(error == asio::error::operation_aborted ? NetworkError() : error);
+        return;
+    }
+    Receive();
+}
+
+template <typename C>
+void TcpFeedSubscriber<C>::Finish(const NetworkError& error)
+{
+    NetworkError ignored;
+    socket_.close(ignored);
+    // Last: the subscriber may be destroyed as soon as it is marked closed
+    state_.Close(error);
+}
+
+template <typename C>
+UdpFeedSubscriber<C>::UdpFeedSubscriber(NetworkEventLoop& loop, C* connector) :
+  loop_(loop), connector_(connector), socket_(loop.GetContext()), datagram_(kMaxDatagramSize) {}
+
+template <typename C>
+UdpFeedSubscriber<C>::~UdpFeedSubscriber()
+{
+    loop_.RunAndWait([this] { CloseSocket(); });
+    state_.WaitClosed();
+}
+
+template <typename C>
+void UdpFeedSubscriber<C>::Open(const string& listen_address, unsigned short port, const string& multicast_group)
+{
+    asio::ip::udp::endpoint endpoint(asio::ip::make_address(listen_address), port);
+    optional<asio::ip::address> group;
+    if (!multicast_group.empty()) {
+        group = asio::ip::make_address(multicast_group);
+        if (!group->is_multicast()) {
+            throw invalid_argument("UdpFeedSubscriber: " + multicast_group + " is not a multicast group");
+        }
+    }
+    asio::post(loop_.GetContext(), [this, endpoint, group] {
+        NetworkError error;
+        socket_.open(endpoint.protocol(), error);
+        if (!error) {
+            socket_.set_option(asio::ip::udp::socket::reuse_address(true), error);
+        }
+        if (!error) {
+            socket_.bind(endpoint, error);
+        }
+        if (!error && group) {
+            socket_.set_option(asio::ip::multicast::join_group(*group), error);
+        }
+        if (error) {
+            NetworkError ignored;
+            socket_.close(ignored);
+            state_.Close(error);
+            return;
+        }
+        Receive();
+    });
+}
+
+template <typename C>
+void UdpFeedSubscriber<C>::Close()
+{
+    asio::post(loop_.GetContext(), [this] { CloseSocket(); });
+}
+
+template <typename C>
+void UdpFeedSubscriber<C>::CloseSocket()
+{
+    if (!socket_.is_open()) {
+        state_.Close();
+        return;
+    }
+    NetworkError ignored;
+    socket_.close(ignored);
+}
+
+template <typename C>
+bool UdpFeedSubscriber<C>::WaitClosed()
+{
+    return state_.WaitClosed();
+}
+
+template <typename C>
+const ConnectionState& UdpFeedSubscriber<C>::GetState() const
+{
+    return state_;
+}
+
+template <typename C>
+void UdpFeedSubscriber<C>::Receive()
+{
+    socket_.async_receive_from(asio::buffer(datagram_), sender_, [this](const NetworkError& error, size_t size) { OnReceive(error, size); });
+}
+
+template <typename C>
+void UdpFeedSubscriber<C>::OnReceive(const NetworkError& error, size_t size)
+{
+    if (error) {
+        NetworkError ignored;
+        socket_.close(ignored);
+        state_.Close(error == asio::error::operation_aborted ? NetworkError() : error);
+        return;
+    }
+    if (size > 0) {
+        state_.Count(size);
+        LineReader reader(datagram_.data(), datagram_.data() + size);
+        try {
+            connector_->Subscribe(reader);
+        } catch (const exception&) {
+            // A malformed datagram is skipped: the next one starts afresh
+        }
+    }
+    Receive();
+}
+
+template <typename V>
+TcpPublishConnector<V>::TcpPublishConnector(NetworkEventLoop& loop) :
+  loop_(loop), socket_(loop.GetContext()), connecting_(false), connected_(false), write_in_flight_(false) {}
+
+template <typename V>
+TcpPublishConnector<V>::~TcpPublishConnector()
+{
+    Flush();
+    loop_.RunAndWait([this] { CloseSocket(); });
+    state_.WaitClosed();
+}
+
+template <typename V>
+void TcpPublishConnector<V>::Connect(const string& host, unsigned short port)
+{
+    asio::ip::tcp::resolver resolver(loop_.GetContext());
+    auto endpoints = resolver.resolve(host, to_string(port));
+    {
+        lock_guard<mutex> lock(mutex_);
+        connecting_ = true;
+    }
+    asio::post(loop_.GetContext(), [this, endpoints] {
+        asio::async_connect(socket_, endpoints, [this](const NetworkError& error, const asio::ip::tcp::endpoint&) {
+            if (error) {
+                Fail(error);
+                return;
+            }
+            socket_.set_option(asio::ip::tcp::no_delay(true));
+            lock_guard<mutex> lock(mutex_);
+            connected_ = true;
+            StartWrite();
+        });
+    });
+}
+
+template <typename V>
+void TcpPublishConnector<V>::Publish(V& data)
+{
+    lock_guard<mutex> lock(mutex_);
+    if (state_.IsClosed()) {
+        return;
+    }
+    string_view record = SerializeRecord(record_, data);
+    bool idle = pending_.empty() && !write_in_flight_;
+    pending_.insert(pending_.end(), record.begin(), record.end());
+    if (idle && connected_) {
+        // Later records join this write until the loop gets to it
+        asio::post(loop_.GetContext(), [this] {
+            lock_guard<mutex> lock(mutex_);
+            StartWrite();
+        });
+    }
+}
+
+template <typename V>
+void TcpPublishConnector<V>::Subscribe(istream& data) {}
+
+template <typename V>
+void TcpPublishConnector<V>::StartWrite()
+{
+    if (write_in_flight_ || pending_.empty() || !socket_.is_open()) {
+        return;
+    }
+    writing_.swap(pending_);
+    pending_.clear();
+    write_in_flight_ = true;
+    asio::async_write(socket_, asio::buffer(writing_), [this](const NetworkError& error, size_t size) { OnWrite(error, size); });
+}
+
+template <typename V>
+void TcpPublishConnector<V>::OnWrite(const NetworkError& error, size_t size)
+{
+    if (error) {
+        {
+            lock_guard<mutex> lock(mutex_);
+            write_in_flight_ = false;
+            writing_.clear();
+        }
+        Fail(error == asio::error::operation_aborted ? NetworkError() : error);
+        return;
+    }
+    {
+        lock_guard<mutex> lock(mutex_);
+        write_in_flight_ = false;
+        writing_.clear();
+        state_.Count(size);
+        StartWrite();
+    }
+    written_cv_.notify_all();
+}
+
+template <typename V>
+void TcpPublishConnector<V>::Flush()
+{
+    unique_lock<mutex> lock(mutex_);
+    written_cv_.wait(lock, [this] { return (pending_.empty() && !write_in_flight_) || !connecting_; });
+}
+
+template <typename V>
+void TcpPublishConnector<V>::Close()
+{
+    asio::post(loop_.GetContext(), [this] { CloseSocket(); });
+}
+
+template <typename V>
+void TcpPublishConnector<V>::CloseSocket()
+{
+    bool in_flight;
+    {
+        lock_guard<mutex> lock(mutex_);
+        pending_.clear();
+        in_flight = write_in_flight_;
+    }
+    if (socket_.is_open() && in_flight) {
+        // The aborted write fails the connection
+        NetworkError ignored;
+        socket_.close(ignored);
+        return;
+    }
+    Fail(NetworkError());
+}
+
+template <typename V>
+void TcpPublishConnector<V>::Fail(const NetworkError& error)
+{
+    NetworkError ignored;
+    socket_.close(ignored);
+    {
+        lock_guard<mutex> lock(mutex_);
+        pending_.clear();
+        connecting_ = false;
+        connected_ = false;
+    }
+    written_cv_.notify_all();
+    // Last: the connector may be destroyed as soon as it is marked closed
+    state_.Close(error);
+}
+
+template <typename V>
+const ConnectionState& TcpPublishConnector<V>::GetState() const
+{
+    return state_;
+}
+
+#endif /* network_connectors_hpp */
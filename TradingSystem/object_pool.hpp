@@ -0,0 +1,249 @@
+/**
+ * object_pool.hpp
+ * Per-owner object pool handing out move-only handles, for objects created on the hot path
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) ObjectPool<V> carves objects out of fixed-size chunks and keeps released slots on an intrusive free list. A chunk is allocated only when the free list is empty, so once the pool has grown to the working set, acquiring and releasing an object does not touch the heap.
+ (2) Acquire constructs the object in place and returns a PooledPtr, a move-only handle (like unique_ptr) that destroys the object and gives its slot back to the pool when it goes away. Ownership is always that of exactly one handle.
+ (3) A pool belongs to one service and is used by the thread driving that service, so it takes no locks. Handles must not outlive their pool: owners declare the pool ahead of anything holding its handles.
+ (4) Chunks never move, so a pooled object keeps its address for as long as its handle lives.
+ */
+
+#ifndef object_pool_hpp
+#define object_pool_hpp
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+template <typename V>
+class ObjectPool;
+
+/**
+ * Owning handle of an object taken from an ObjectPool.
+ * Type V is the pooled object type.
+ */
+template <typename V>
+class PooledPtr
+{
+public:
+    PooledPtr() = default;
+    ~PooledPtr();
+
+    PooledPtr(PooledPtr&& other) noexcept;
+    PooledPtr& operator = (PooledPtr&& other) noexcept;
+
+    PooledPtr(const PooledPtr&) = delete;
+    PooledPtr& operator = (const PooledPtr&) = delete;
+
+    // Give the object back to its pool, leaving the handle empty
+    void Reset();
+
+    // Get the object (nullptr if the handle is empty)
+    V* Get() const;
+
+    // Get the pool the object came from (nullptr if the handle is empty)
+    ObjectPool<V>* GetPool() const;
+
+    V& operator * () const;
+    V* operator -> () const;
+    explicit operator bool () const;
+
+private:
+    friend class ObjectPool<V>;
+
+    PooledPtr(ObjectPool<V>* pool, V* object);
+
+    ObjectPool<V>* pool_ = nullptr;
+    V* object_ = nullptr;
+};
+
+/**
+ * Pool of objects of one type, grown a chunk at a time.
+ * Type V is the pooled object type.
+ */
+template <typename V>
+class ObjectPool
+{
+public:
+    // Chunk size is the number of objects allocated whenever the pool runs dry
+    explicit ObjectPool(size_t chunk_size = 64);
+
+    // Every handle must have been released
+    ~ObjectPool() = default;
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator = (const ObjectPool&) = delete;
+
+    // Construct an object from the arguments in a free slot
+    template <typename... Args>
+    PooledPtr<V> Acquire(Args&&... args);
+
+    // Number of slots allocated so far
+    size_t GetCapacity() const;
+
+    // Number of objects currently handed out
+    size_t GetInUse() const;
+
+private:
+    friend class PooledPtr<V>;
+
+    // A slot holds either an object or the link to the next free slot
+    union Slot
+    {
+        Slot* next;
+        alignas(V) unsigned char storage[sizeof(V)];
+    };
+
+    // Destroy an object and put its slot on the free list
+    void Release(V* object);
+
+    // Allocate a chunk and put its slots on the free list
+    void Grow();
+
+    size_t chunk_size_;
+    vector<unique_ptr<Slot[]>> chunks_;
+    Slot* free_;
+    size_t in_use_;
+};
+
+template <typename V>
+PooledPtr<V>::PooledPtr(ObjectPool<V>* pool, V* object) : pool_(pool), object_(object) {}
+
+template <typename V>
+PooledPtr<V>::~PooledPtr()
+{
+    Reset();
+}
+
+template <typename V>
+PooledPtr<V>::PooledPtr(PooledPtr&& other) noexcept : pool_(other.pool_), object_(other.object_)
+{
+    other.pool_ = nullptr;
+    other.object_ = nullptr;
+}
+
+template <typename V>
+PooledPtr<V>& PooledPtr<V>::operator = (PooledPtr&& other) noexcept
+{
+    if (this != &other) {
+        Reset();
+        swap(pool_, other.pool_);
+        swap(object_, other.object_);
+    }
+    return *this;
+}
+
+template <typename V>
+void PooledPtr<V>::Reset()
+{
+    if (object_ != nullptr) {
+        pool_->Release(object_);
+        pool_ = nullptr;
+        object_ = nullptr;
+    }
+}
+
+template <typename V>
+V* PooledPtr<V>::Get() const
+{
+    return object_;
+}
+
+template <typename V>
+ObjectPool<V>* PooledPtr<V>::GetPool() const
+{
+    return pool_;
+}
+
+template <typename V>
+V& PooledPtr<V>::operator * () const
+{
+    return *object_;
+}
+
+template <typename V>
+V* PooledPtr<V>::operator -> () const
+{
+    return object_;
+}
+
+template <typename V>
+PooledPtr<V>::operator bool () const
+{
+    return object_ != nullptr;
+}
+
+template <typename V>
+ObjectPool<V>::ObjectPool(size_t chunk_size) : chunk_size_(chunk_size), free_(nullptr), in_use_(0)
+{
+    if (chunk_size_ == 0) {
+        throw invalid_argument("ObjectPool: chunk size must be positive");
+    }
+}
+
+template <typename V>
+template <typename... Args>
+PooledPtr<V> ObjectPool<V>::Acquire(Args&&... args)
+{
+    if (free_ == nullptr) {
+        Grow();
+    }
+    // The object overwrites the link, so unlink the slot first, and put it back if construction throws
+    Slot* slot = free_;
+    free_ = slot->next;
+    V* object;
+    try {
+        object = new (slot->storage) V(forward<Args>(args)...);
+    } catch (...) {
+        slot->next = free_;
+        free_ = slot;
+        throw;
+    }
+    in_use_++;
+    return PooledPtr<V>(this, object);
+}
+
+template <typename V>
+void ObjectPool<V>::Release(V* object)
+{
+    object->~V();
+    Slot* slot = reinterpret_cast<Slot*>(object);
+    slot->next = free_;
+    free_ = slot;
+    in_use_--;
+}
+
+template <typename V>
+void ObjectPool<V>::Grow()
+{
+    chunks_.push_back(make_unique<Slot[]>(chunk_size_));
+    Slot* chunk = chunks_.back().get();
+    for (size_t i = 0; i < chunk_size_; i++) {
+        chunk[i].next = (i + 1 < chunk_size_) ? &chunk[i + 1] : free_;
+    }
+    free_ = chunk;
+}
+
+template <typename V>
+size_t ObjectPool<V>::GetCapacity() const
+{
+    return chunks_.size() * chunk_size_;
+}
+
+template <typename V>
+size_t ObjectPool<V>::GetInUse() const
+{
+    return in_use_;
+}
+
+#endif /* object_pool_hpp */
@@ -8,9 +8,14 @@
 #define POSITION_SERVICE_HPP
 
 #include <string>
-#include <map>
 #include <unordered_map>
+#include <optional>
+#include "product_registry.hpp"
+#include "book_registry.hpp"
 #include "soa.hpp"
+#include "static_listeners.hpp"
+#include "latency.hpp"
+#include "serialization.hpp"
 #include "trade_booking_service.hpp"
 #include <vector>
 
@@ -21,7 +26,7 @@ using namespace std;
  * Type T is the product type.
  */
 template<typename T>
-class Position
+class Position : public LatencyTagged
 {
 
 public:
@@ -33,24 +38,37 @@ public:
     // Get the product
     const T& GetProduct() const;
 
-    // Get the position quantity
+    // Get the position quantity (0 for a book never traded)
     long GetPosition(string &book);
+    long GetPosition(BookIndex book) const;
 
-    // Get the aggregate position
-    long GetAggregatePosition();
+    // Get the aggregate position (kept up to date by AddPosition)
+    long GetAggregatePosition() const;
+    
+    // Call f(book, position) for every book traded, in book index order
+    template <typename F>
+    void ForEachBook(F&& f) const;
     
     // Add position to designated book
     void AddPosition(string& book, long position, Side side);
+    void AddPosition(BookIndex book, long position, Side side);
 
-    vector<string> ToString() const;
+    // Most characters Serialize may write
+    size_t GetMaxSerializedSize() const;
+    
+    // Write the fields as "field,field,...," into out; returns the end of the text
+    char* Serialize(char* out) const;
     
 private:
-    T product;
-    map<string, long> positions;
+    ProductRef<T> product;     // Registered instance, shared by every copy of the event
+    vector<optional<long>> positions;     // Indexed by book index, empty for books never traded
+    long aggregate = 0;
 
 };
 
-template<typename T>
+template <typename T, typename Static = StaticListeners<Position<T>>>
+class PositionService;
+template <typename T, typename S = PositionService<T>>
 class TradeBookingToPositionListener;
 
 
@@ -60,12 +78,17 @@ class TradeBookingToPositionListener;
  * Keyed on product identifier.
  * Type T is the product type.
  */
-template<typename T>
-class PositionService : public Service<string,Position <T> >
+template <typename T, typename Static>
+class PositionService final : public Service<string,Position <T> >
 {
+public:
+    // Concrete types of the objects attached to this service, for static wiring
+    typedef TradeBookingToPositionListener<T, PositionService> InListener;
+    
 private:
-    unordered_map<string, Position<T>> positions_;
-    TradeBookingToPositionListener<T>* in_listener_;
+    ProductStore<Position<T>> positions_;     // Indexed by product index
+    InListener* in_listener_;
+    Static static_listeners_;
 
 public:
     PositionService();
@@ -86,19 +109,25 @@ public:
     virtual const vector<ServiceListener<Position<T>>*>& GetListeners() const override;
     // MARK: SERVICE CLASS OVERRIDE ABOVE
     
-    TradeBookingToPositionListener<T>* GetInListener();
+    InListener* GetInListener();
+    
+    // Get the listeners wired at compile time (notified ahead of the dynamic listeners)
+    Static& GetStaticListeners();
 
     // Add a trade to the service
     virtual void AddTrade(const Trade<T> &trade);
+    
+    // Get the position of a product, or nullptr if it has none
+    const Position<T>* FindPosition(ProductIndex index) const;
 };
 
-template<typename T>
-class TradeBookingToPositionListener : public ServiceListener<Trade<T>> {
+template <typename T, typename S>
+class TradeBookingToPositionListener final : public ServiceListener<Trade<T>> {
 private:
-    PositionService<T>* service_;
+    S* service_;
     
 public:
-    TradeBookingToPositionListener(PositionService<T>* service);
+    TradeBookingToPositionListener(S* service);
     ~TradeBookingToPositionListener() = default;
     
     // MARK: SERVICELISTENER CLASS OVERRIDE BELOW
@@ -120,60 +149,74 @@ Position<T>::Position(const T &_product) :
 template<typename T>
 const T& Position<T>::GetProduct() const
 {
-    return product;
+    return *product;
 }
 
 template<typename T>
 long Position<T>::GetPosition(string &book)
 {
-    return positions[book];
+    return GetPosition(BookRegistry::Instance().Find(book));
+}
+
+template<typename T>
+long Position<T>::GetPosition(BookIndex book) const
+{
+    return (book < positions.size()) ? positions[book].value_or(0) : 0;
 }
 
 template<typename T>
 void Position<T>::AddPosition(string& book, long position, Side side) {
-    // Insert 0 if the book does not exist
-    positions.try_emplace(book, 0);
-    
-    switch (side) {
-        case BUY:
-            positions[book] += position;
-            break;
-        case SELL:
-            positions[book] -= position;
-            break;
-    }
+    AddPosition(BookRegistry::Instance().Intern(book), position, side);
 }
 
 template<typename T>
-long Position<T>::GetAggregatePosition() {
-    long res = 0;
-    for (const auto& [book, pos] : positions) {
-        res += pos;
+void Position<T>::AddPosition(BookIndex book, long position, Side side) {
+    if (book >= positions.size()) {
+        // Room for every book known so far, so that the array rarely grows again
+        positions.resize(max(size_t(book) + 1, BookRegistry::Instance().Size()));
     }
     
-    return res;
+    long signed_position = (side == BUY) ? position : -position;
+    positions[book] = positions[book].value_or(0) + signed_position;
+    aggregate += signed_position;
 }
 
-template <typename T>
-PositionService<T>::PositionService() {
-    in_listener_ = new TradeBookingToPositionListener<T>(this);
+template<typename T>
+template <typename F>
+void Position<T>::ForEachBook(F&& f) const {
+    const BookRegistry& registry = BookRegistry::Instance();
+    for (BookIndex book = 0; book < positions.size(); book++) {
+        if (positions[book]) {
+            f(registry.GetName(book), *positions[book]);
+        }
+    }
 }
 
-template <typename T>
-PositionService<T>::~PositionService() {
+template<typename T>
+long Position<T>::GetAggregatePosition() const {
+    return aggregate;
+}
+
+template <typename T, typename Static>
+PositionService<T, Static>::PositionService() : positions_(ProductRegistry<T>::Instance().Size()) {
+    in_listener_ = new InListener(this);
+}
+
+template <typename T, typename Static>
+PositionService<T, Static>::~PositionService() {
     delete in_listener_;
 }
 
-template <typename T>
-Position<T>& PositionService<T>::GetData(string product_id) {
-    return positions_[product_id];
+template <typename T, typename Static>
+Position<T>& PositionService<T, Static>::GetData(string product_id) {
+    return positions_[ProductRegistry<T>::Instance().GetIndex(product_id)];
 }
 
-template <typename T>
-void PositionService<T>::OnMessage(Position<T>& data) {
-    string product_id = data.GetProduct().GetProductId();
+template <typename T, typename Static>
+void PositionService<T, Static>::OnMessage(Position<T>& data) {
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(data.GetProduct());
     
-    positions_[product_id] = data;
+    positions_.InsertOrAssign(index, data);
     
 //    // Also notify listeners
 //    for (auto& listener : Service<string, Trade<T>>::listeners_) {
@@ -181,73 +224,91 @@ void PositionService<T>::OnMessage(Position<T>& data) {
 //    }
 }
 
-template <typename T>
-void PositionService<T>::AddListener(ServiceListener<Position<T>>* listener) {
+template <typename T, typename Static>
+void PositionService<T, Static>::AddListener(ServiceListener<Position<T>>* listener) {
     this->Service<string, Position<T>>::AddListener(listener);
 }
 
-template <typename T>
-const vector<ServiceListener<Position<T>>*>& PositionService<T>::GetListeners() const {
+template <typename T, typename Static>
+const vector<ServiceListener<Position<T>>*>& PositionService<T, Static>::GetListeners() const {
     return this->Service<string, Position<T>>::GetListeners();
 }
 
-template <typename T>
-TradeBookingToPositionListener<T>* PositionService<T>::GetInListener() {
+template <typename T, typename Static>
+typename PositionService<T, Static>::InListener* PositionService<T, Static>::GetInListener() {
     return in_listener_;
 }
 
-template <typename T>
-void PositionService<T>::AddTrade(const Trade<T> &trade) {
+template <typename T, typename Static>
+Static& PositionService<T, Static>::GetStaticListeners() {
+    return static_listeners_;
+}
+
+template <typename T, typename Static>
+void PositionService<T, Static>::AddTrade(const Trade<T> &trade) {
+    LATENCY_RECORD(ADD_TRADE, trade);
     
     // Get data from the trade
-    T product = trade.GetProduct();
-    string product_id = product.GetProductId();
-    double price = trade.GetPrice();
-    string book = trade.GetBook();
+    const T& product = trade.GetProduct();
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(product);
+    BookIndex book = trade.GetBookIndex();
+    if (book == kInvalidBookIndex) {
+        // Default constructed trades carry no index
+        book = BookRegistry::Instance().Intern(trade.GetBook());
+    }
     long quantity = trade.GetQuantity();
     Side side = trade.GetSide();
     
-    positions_.try_emplace(product_id, product);
-    positions_[product_id].AddPosition(book, quantity, side);
+    Position<T>& position = *positions_.TryEmplace(index, product).first;
+    position.AddPosition(book, quantity, side);
+    LATENCY_CARRY(position, trade);
     
     // Notify listeners
+    static_listeners_.ProcessAdd(position);
     for (auto& listener : Service<string, Position<T>>::listeners_) {
-        listener->ProcessAdd(positions_[product_id]);
+        listener->ProcessAdd(position);
     }
 }
 
-template <typename T>
-TradeBookingToPositionListener<T>::TradeBookingToPositionListener(PositionService<T>* service) : service_(service) {}
+template <typename T, typename Static>
+const Position<T>* PositionService<T, Static>::FindPosition(ProductIndex index) const {
+    return positions_.Find(index);
+}
+
+template <typename T, typename S>
+TradeBookingToPositionListener<T, S>::TradeBookingToPositionListener(S* service) : service_(service) {}
 
-template<typename T>
-void TradeBookingToPositionListener<T>::ProcessAdd(Trade<T>& data)
+template <typename T, typename S>
+void TradeBookingToPositionListener<T, S>::ProcessAdd(Trade<T>& data)
 {
     service_->AddTrade(data);
 }
 
-template<typename T>
-void TradeBookingToPositionListener<T>::ProcessRemove(Trade<T>& data) {}
+template <typename T, typename S>
+void TradeBookingToPositionListener<T, S>::ProcessRemove(Trade<T>& data) {}
 
-template<typename T>
-void TradeBookingToPositionListener<T>::ProcessUpdate(Trade<T>& data) {}
+template <typename T, typename S>
+void TradeBookingToPositionListener<T, S>::ProcessUpdate(Trade<T>& data) {}
 
 template<typename T>
-vector<string> Position<T>::ToString() const
+size_t Position<T>::GetMaxSerializedSize() const
 {
-    string _product = product.GetProductId();
-    vector<string> _positions;
-    for (auto& p : positions)
-    {
-        string _book = p.first;
-        string _position = to_string(p.second);
-        _positions.push_back(_book);
-        _positions.push_back(_position);
-    }
+    size_t size = GetMaxFieldSize(product->GetProductId());
+    ForEachBook([&size](const string& book, long) {
+        size += GetMaxFieldSize(book) + kMaxLongFieldSize;
+    });
+    return size;
+}
 
-    vector<string> _strings;
-    _strings.push_back(_product);
-    _strings.insert(_strings.end(), _positions.begin(), _positions.end());
-    return _strings;
+template<typename T>
+char* Position<T>::Serialize(char* out) const
+{
+    out = WriteField(out, product->GetProductId());
+    ForEachBook([&out](const string& book, long position) {
+        out = WriteField(out, book);
+        out = WriteField(out, position);
+    });
+    return out;
 }
 
 
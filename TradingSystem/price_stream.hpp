@@ -11,6 +11,7 @@
 #include <string>
 #include "soa.hpp"
 #include "pricing_service.hpp"
+#include "serialization.hpp"
 #include <vector>
 
 /**
@@ -23,13 +24,13 @@ public:
 
     PriceStreamOrder() = default;
     // ctor for an order
-    PriceStreamOrder(double _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side);
+    PriceStreamOrder(PriceTick _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side);
 
     // The side on this order
     PricingSide GetSide() const;
 
     // Get the price on this order
-    double GetPrice() const;
+    PriceTick GetPrice() const;
 
     // Get the visible quantity on this order
     long GetVisibleQuantity() const;
@@ -37,10 +38,14 @@ public:
     // Get the hidden quantity on this order
     long GetHiddenQuantity() const;
     
-    vector<string> ToString() const;
+    // Most characters Serialize may write
+    size_t GetMaxSerializedSize() const;
+    
+    // Write the fields as "field,field,...," into out; returns the end of the text
+    char* Serialize(char* out) const;
 
 private:
-    double price;
+    PriceTick price;
     long visibleQuantity;
     long hiddenQuantity;
     PricingSide side;
@@ -70,16 +75,23 @@ public:
     // Get the offer order
     const PriceStreamOrder& GetOfferOrder() const;
     
-    vector<string> ToString() const;
+    // Set both orders
+    void Update(const PriceStreamOrder &_bidOrder, const PriceStreamOrder &_offerOrder);
+    
+    // Most characters Serialize may write
+    size_t GetMaxSerializedSize() const;
+    
+    // Write the fields as "field,field,...," into out; returns the end of the text
+    char* Serialize(char* out) const;
 
 private:
-    T product;
+    ProductRef<T> product;     // Registered instance, shared by every copy of the event
     PriceStreamOrder bidOrder;
     PriceStreamOrder offerOrder;
 
 };
 
-PriceStreamOrder::PriceStreamOrder(double _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side)
+PriceStreamOrder::PriceStreamOrder(PriceTick _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side)
 {
     price = _price;
     visibleQuantity = _visibleQuantity;
@@ -92,7 +104,7 @@ PricingSide PriceStreamOrder::GetSide() const
     return side;
 }
 
-double PriceStreamOrder::GetPrice() const
+PriceTick PriceStreamOrder::GetPrice() const
 {
     return price;
 }
@@ -114,7 +126,7 @@ PriceStream<T>::PriceStream(const T &_product, const PriceStreamOrder &_bidOrder
 template<typename T>
 const T& PriceStream<T>::GetProduct() const
 {
-    return product;
+    return *product;
 }
 
 template<typename T>
@@ -129,12 +141,21 @@ const PriceStreamOrder& PriceStream<T>::GetOfferOrder() const
     return offerOrder;
 }
 
-vector<string> PriceStreamOrder::ToString() const
+template<typename T>
+void PriceStream<T>::Update(const PriceStreamOrder &_bidOrder, const PriceStreamOrder &_offerOrder)
+{
+    bidOrder = _bidOrder;
+    offerOrder = _offerOrder;
+}
+
+size_t PriceStreamOrder::GetMaxSerializedSize() const
 {
-    string _price = ConvertPrice(price);
-    string _visibleQuantity = to_string(visibleQuantity);
-    string _hiddenQuantity = to_string(hiddenQuantity);
-    string _side;
+    return kMaxPriceFieldSize + 2 * kMaxLongFieldSize + GetMaxFieldSize("OFFER");
+}
+
+char* PriceStreamOrder::Serialize(char* out) const
+{
+    string_view _side;
     switch (side)
     {
     case BID:
@@ -145,26 +166,26 @@ vector<string> PriceStreamOrder::ToString() const
         break;
     }
 
-    vector<string> _strings;
-    _strings.push_back(_price);
-    _strings.push_back(_visibleQuantity);
-    _strings.push_back(_hiddenQuantity);
-    _strings.push_back(_side);
-    return _strings;
+    out = WriteField(out, price);
+    out = WriteField(out, visibleQuantity);
+    out = WriteField(out, hiddenQuantity);
+    out = WriteField(out, _side);
+    return out;
+}
+
+template<typename T>
+size_t PriceStream<T>::GetMaxSerializedSize() const
+{
+    return GetMaxFieldSize(product->GetProductId()) + bidOrder.GetMaxSerializedSize() + offerOrder.GetMaxSerializedSize();
 }
 
 template<typename T>
-vector<string> PriceStream<T>::ToString() const
+char* PriceStream<T>::Serialize(char* out) const
 {
-    string _product = product.GetProductId();
-    vector<string> _bidOrder = bidOrder.ToString();
-    vector<string> _offerOrder = offerOrder.ToString();
-
-    vector<string> _strings;
-    _strings.push_back(_product);
-    _strings.insert(_strings.end(), _bidOrder.begin(), _bidOrder.end());
-    _strings.insert(_strings.end(), _offerOrder.begin(), _offerOrder.end());
-    return _strings;
+    out = WriteField(out, product->GetProductId());
+    out = bidOrder.Serialize(out);
+    out = offerOrder.Serialize(out);
+    return out;
 }
 
 #endif /* price_stream_hpp */
@@ -0,0 +1,133 @@
+/**
+ * price_tick.hpp
+ * Fixed-point bond price in 1/256 ticks, with parser and formatter for the "100-xyz" notation
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) Treasury prices are quoted in 32nds with a 1/8 of a 32nd refinement, i.e. every price is an exact multiple of 1/256. Storing the number of 1/256 ticks in an integer makes comparison, aggregation and spread checks exact integer work.
+ (2) "100-xyz" is parsed and formatted without branches on the fraction: the low 8 bits of the tick count index a table holding the three characters "xyz".
+ */
+
+#ifndef price_tick_hpp
+#define price_tick_hpp
+
+#include <array>
+#include <charconv>
+#include <cctype>
+#include <compare>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+/**
+ * A price expressed as an integer number of 1/256 ticks.
+ */
+class PriceTick
+{
+public:
+    // 32nds and 8ths of a 32nd
+    static constexpr long kTicksPerPoint = 256;
+
+    constexpr PriceTick() : ticks(0) {}
+    constexpr explicit PriceTick(long _ticks) : ticks(_ticks) {}
+
+    // Get the number of 1/256 ticks
+    constexpr long GetTicks() const { return ticks; }
+
+    // Get the price as a floating point number (for display or risk math only)
+    constexpr double ToDouble() const { return double(ticks) / kTicksPerPoint; }
+
+    constexpr auto operator<=>(const PriceTick&) const = default;
+
+    constexpr PriceTick operator+(PriceTick other) const { return PriceTick(ticks + other.ticks); }
+    constexpr PriceTick operator-(PriceTick other) const { return PriceTick(ticks - other.ticks); }
+    constexpr PriceTick operator*(long factor) const { return PriceTick(ticks * factor); }
+    // Rounds toward negative infinity, so that (a + b) / 2 and (b - a) / 2 recover a exactly
+    constexpr PriceTick operator/(long divisor) const { return PriceTick((ticks >= 0 ? ticks : ticks - divisor + 1) / divisor); }
+    constexpr PriceTick& operator+=(PriceTick other) { ticks += other.ticks; return *this; }
+    constexpr PriceTick& operator-=(PriceTick other) { ticks -= other.ticks; return *this; }
+
+private:
+    long ticks;
+};
+
+namespace price_tick_detail {
+
+// "xyz" for every 1/256 fraction: xy in 32nds, z in 1/256 with 4 written as '+'
+constexpr array<array<char, 3>, PriceTick::kTicksPerPoint> MakeFractionTable()
+{
+    array<array<char, 3>, PriceTick::kTicksPerPoint> table{};
+    for (int fraction = 0; fraction < PriceTick::kTicksPerPoint; fraction++) {
+        int thirty_seconds = fraction >> 3;
+        int eighths = fraction & 7;
+        table[fraction][0] = char('0' + thirty_seconds / 10);
+        table[fraction][1] = char('0' + thirty_seconds % 10);
+        table[fraction][2] = (eighths == 4) ? '+' : char('0' + eighths);
+    }
+    return table;
+}
+
+// Tick value of the last character of the notation ('0'-'7', or '+' for 4)
+constexpr array<unsigned char, 256> MakeEighthTable()
+{
+    array<unsigned char, 256> table{};
+    for (int c = '0'; c <= '7'; c++) {
+        table[c] = c - '0';
+    }
+    table['+'] = 4;
+    return table;
+}
+
+constexpr auto kFractionText = MakeFractionTable();
+constexpr auto kEighthTicks = MakeEighthTable();
+
+}
+
+// Maximum length of a formatted price ("-9223372036854775808-31+")
+constexpr size_t kMaxPriceTextSize = 24;
+
+// Parse "100-xyz" into ticks
+PriceTick ParsePrice(string_view text)
+{
+    auto delimiter_pos = text.find('-', 1);
+    if (delimiter_pos == string_view::npos || text.size() != delimiter_pos + 4) {
+        throw invalid_argument("ParsePrice: invalid price \"" + string(text) + "\"");
+    }
+    long points = 0;
+    auto [ptr, ec] = from_chars(text.data(), text.data() + delimiter_pos, points);
+
+    const char* fraction = text.data() + delimiter_pos + 1;
+    long thirty_seconds = (fraction[0] - '0') * 10 + (fraction[1] - '0');
+    long eighths = price_tick_detail::kEighthTicks[static_cast<unsigned char>(fraction[2])];
+    // '0' is the only character whose table entry is 0
+    bool valid_fraction = isdigit(static_cast<unsigned char>(fraction[0])) && isdigit(static_cast<unsigned char>(fraction[1])) && thirty_seconds < 32
+                          && (eighths != 0 || fraction[2] == '0');
+    if (ec != errc() || ptr != text.data() + delimiter_pos || !valid_fraction) {
+        throw invalid_argument("ParsePrice: invalid price \"" + string(text) + "\"");
+    }
+
+    return PriceTick(points * PriceTick::kTicksPerPoint + (thirty_seconds << 3) + eighths);
+}
+
+// Write "100-xyz" to the buffer (at least kMaxPriceTextSize bytes) and return the end of the text
+char* FormatPrice(char* out, PriceTick price)
+{
+    // Floor division keeps the fraction in [0, 256) for negative values too
+    long ticks = price.GetTicks();
+    long points = ticks >> 8;
+    const auto& fraction = price_tick_detail::kFractionText[ticks & 0xFF];
+
+    out = to_chars(out, out + 20, points).ptr;
+    out[0] = '-';
+    out[1] = fraction[0];
+    out[2] = fraction[1];
+    out[3] = fraction[2];
+    return out + 4;
+}
+
+#endif /* price_tick_hpp */
@@ -10,7 +10,11 @@
 #include <string>
 #include "soa.hpp"
 #include <unordered_map>
+#include "product_registry.hpp"
 #include <vector>
+#include "utilities.hpp"
+#include "line_reader.hpp"
+#include "serialization.hpp"
 
 /**
  * A price object consisting of mid and bid/offer spread.
@@ -24,7 +28,7 @@ public:
 
     Price() = default;
     // ctor for a price
-    Price(const T &_product, double _mid, double _bidOfferSpread);
+    Price(const T &_product, PriceTick _mid, PriceTick _bidOfferSpread);
     Price(const Price<T>& price);
     
     Price<T>& operator = (const Price<T>& price);
@@ -32,18 +36,22 @@ public:
     // Get the product
     const T& GetProduct() const;
 
-    // Get the mid price
-    double GetMid() const;
+    // Get the mid price (rounded down to a whole tick)
+    PriceTick GetMid() const;
 
     // Get the bid/offer spread around the mid
-    double GetBidOfferSpread() const;
+    PriceTick GetBidOfferSpread() const;
     
-    vector<string> ToString() const;
+    // Most characters Serialize may write
+    size_t GetMaxSerializedSize() const;
+    
+    // Write the fields as "field,field,...," into out; returns the end of the text
+    char* Serialize(char* out) const;
 
 private:
-    T product;
-    double mid;
-    double bidOfferSpread;
+    ProductRef<T> product;     // Registered instance, shared by every copy of the event
+    PriceTick mid;
+    PriceTick bidOfferSpread;
 
 };
 
@@ -58,7 +66,7 @@ class PricingConnector;
 template <typename T>
 class PricingService : public Service<string,Price <T> > {
 private:
-    unordered_map<string, Price<T>> prices_;
+    ProductStore<Price<T>> prices_;     // Indexed by product index
     PricingConnector<T>* in_connector_;
     
 public:
@@ -80,6 +88,9 @@ public:
     virtual const vector<ServiceListener<Price<T>>*>& GetListeners() const override;
     // MARK: SERVICE CLASS OVERRIDE ABOVE
     
+    // Latest price of a product, or nullptr if none has arrived yet
+    const Price<T>* FindPrice(ProductIndex index) const;
+    
     PricingConnector<T>* GetConnector();
 };
 
@@ -96,11 +107,14 @@ public:
     virtual void Publish(Price<T>& data) override;
 
     // Subscribe data from the Connector
-    virtual void Subscribe(ifstream& data) override;
+    virtual void Subscribe(istream& data) override;
+
+    // Subscribe the lines of a reader, e.g. over a network receive buffer (see network_connectors.hpp)
+    void Subscribe(LineReader& reader);
 };
 
 template <typename T>
-Price<T>::Price(const T &_product, double _mid, double _bidOfferSpread) :
+Price<T>::Price(const T &_product, PriceTick _mid, PriceTick _bidOfferSpread) :
   product(_product)
 {
   mid = _mid;
@@ -124,23 +138,23 @@ Price<T>& Price<T>::operator = (const Price<T>& price) {
 template <typename T>
 const T& Price<T>::GetProduct() const
 {
-  return product;
+  return *product;
 }
 
 template <typename T>
-double Price<T>::GetMid() const
+PriceTick Price<T>::GetMid() const
 {
   return mid;
 }
 
 template <typename T>
-double Price<T>::GetBidOfferSpread() const
+PriceTick Price<T>::GetBidOfferSpread() const
 {
   return bidOfferSpread;
 }
 
 template <typename T>
-PricingService<T>::PricingService() {
+PricingService<T>::PricingService() : prices_(ProductRegistry<T>::Instance().Size()) {
     in_connector_ = new PricingConnector<T>(this);
 }
 
@@ -151,12 +165,19 @@ PricingService<T>::~PricingService() {
 
 template <typename T>
 Price<T>& PricingService<T>::GetData(string product_id) {
-    return prices_[product_id];
+    return prices_[ProductRegistry<T>::Instance().GetIndex(product_id)];
+}
+
+template <typename T>
+const Price<T>* PricingService<T>::FindPrice(ProductIndex index) const {
+    return prices_.Find(index);
 }
 
 template <typename T>
 void PricingService<T>::OnMessage(Price<T>& data) {
-    string product_id = data.GetProduct().GetProductId();
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(data.GetProduct());
+    
+    prices_.InsertOrAssign(index, data);
     
     // Also notify listeners
     for (auto& listener : Service<string, Price<T>>::listeners_) {
@@ -186,26 +207,26 @@ template<typename T>
 void PricingConnector<T>::Publish(Price<T>& data) {}
 
 template<typename T>
-void PricingConnector<T>::Subscribe(ifstream& data)
+void PricingConnector<T>::Subscribe(istream& data)
 {
-    string line;
-    while (getline(data, line))
-    {
-        // Separate line with delimiter ','
-        stringstream line_stream(line);
-        string line_entry;
-        vector<string> line_entries;
-        while (getline(line_stream, line_entry, ',')) {
-            line_entries.push_back(line_entry);
-        }
+    LineReader reader(data);
+    Subscribe(reader);
+}
 
+template<typename T>
+void PricingConnector<T>::Subscribe(LineReader& reader)
+{
+    LineFields line_entries;
+    while (reader.ReadFields(line_entries))
+    {
+        line_entries.RequireFields(3, "PricingConnector");
         // Parse data into Price
-        string product_id = line_entries[0];
-        double bid_price = ConvertPrice(line_entries[1]);
-        double offer_price = ConvertPrice(line_entries[2]);
-        double mid_price = (bid_price + offer_price) / 2.;
-        double spread = offer_price - bid_price;
-        T product = FetchBond(product_id);
+        string_view product_id = line_entries[0];
+        PriceTick bid_price = ConvertPrice(line_entries[1]);
+        PriceTick offer_price = ConvertPrice(line_entries[2]);
+        PriceTick mid_price = (bid_price + offer_price) / 2;
+        PriceTick spread = offer_price - bid_price;
+        const T& product = FetchBond(product_id);
         Price<T> price(product, mid_price, spread);
         
         // Push price to connecting service
@@ -214,17 +235,18 @@ void PricingConnector<T>::Subscribe(ifstream& data)
 }
 
 template<typename T>
-vector<string> Price<T>::ToString() const
+size_t Price<T>::GetMaxSerializedSize() const
+{
+    return GetMaxFieldSize(product->GetProductId()) + 2 * kMaxPriceFieldSize;
+}
+
+template<typename T>
+char* Price<T>::Serialize(char* out) const
 {
-    string _product = product.GetProductId();
-    string _mid = ConvertPrice(mid);
-    string _bidOfferSpread = ConvertPrice(bidOfferSpread);
-
-    vector<string> _strings;
-    _strings.push_back(_product);
-    _strings.push_back(_mid);
-    _strings.push_back(_bidOfferSpread);
-    return _strings;
+    out = WriteField(out, product->GetProductId());
+    out = WriteField(out, mid);
+    out = WriteField(out, bidOfferSpread);
+    return out;
 }
 
 #endif
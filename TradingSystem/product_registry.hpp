@@ -0,0 +1,322 @@
+/**
+ * product_registry.hpp
+ * Interns products once and hands out dense indices, plus flat per-product storage keyed on them
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) ProductRegistry<T> keeps one instance per product identifier. Registering a product stamps its dense index (0, 1, 2, ...) into the product, so every copy made afterwards carries the index along the service chain.
+ (2) Identifier lookups (string -> index) only happen where data enters the system, e.g. a connector turning a CUSIP field into a product. Services never hash strings on the hot path.
+ (3) ProductStore<V> is a flat vector indexed by product index. Services size it from the registry when they are constructed, so when every product is registered at startup (see utilities.hpp) the vector is allocated once and references into it stay valid.
+ (4) Products constructed directly (not through the registry) are registered on first use by Resolve.
+ (5) Events hold a ProductRef<T> rather than a copy of the product: a pointer to the registered instance, which is immutable and lives as long as the registry. Copying an event along the service chain then copies no identifier strings or dates, and makes no allocation.
+ */
+
+#ifndef product_registry_hpp
+#define product_registry_hpp
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "products.hpp"
+
+using namespace std;
+
+/**
+ * Registry of products of type T, keyed on product identifier.
+ */
+template <typename T>
+class ProductRegistry
+{
+public:
+    // Registry shared by all services of the product type
+    static ProductRegistry& Instance();
+
+    ProductRegistry(const ProductRegistry&) = delete;
+    ProductRegistry& operator = (const ProductRegistry&) = delete;
+
+    // Intern a product and return its index (the existing one if the identifier is already registered)
+    ProductIndex Register(const T& product);
+
+    // Index of the product, registering it if it was not created through the registry
+    ProductIndex Resolve(const T& product);
+
+    // Get the product with the given index
+    const T& Get(ProductIndex index) const;
+
+    // Get the product with the given identifier; throws if it is not registered
+    const T& Get(string_view product_id) const;
+
+    // Index of the product with the given identifier; throws if it is not registered
+    ProductIndex GetIndex(string_view product_id) const;
+
+    // Number of registered products
+    size_t Size() const;
+
+private:
+    ProductRegistry() = default;
+
+    // Transparent hash so that identifiers can be looked up from string_view fields
+    struct IdHash
+    {
+        using is_transparent = void;
+        size_t operator()(string_view id) const { return hash<string_view>()(id); }
+    };
+
+    // Deque, so that references handed out by Get stay valid as products are added
+    deque<T> products_;
+    unordered_map<string, ProductIndex, IdHash, equal_to<>> indices_;
+};
+
+/**
+ * Reference to the registered, immutable instance of a product, as carried by events.
+ * Converts implicitly from a product, so anything taking a product also takes a reference.
+ */
+template <typename T>
+class ProductRef
+{
+public:
+    // Refers to an empty (default constructed) product, for default constructed events
+    ProductRef();
+
+    // Refers to the registered instance of the product, registering it if it was not created through the registry
+    ProductRef(const T& product);
+
+    // Get the product
+    const T& Get() const;
+    const T& operator*() const;
+    const T* operator->() const;
+
+    // Index of the product (kInvalidProductIndex for the empty product)
+    ProductIndex GetIndex() const;
+
+    bool operator==(const ProductRef& other) const;
+
+private:
+    // Shared empty product
+    static const T& Empty();
+
+    const T* product_;
+};
+
+/**
+ * Flat storage of one value per product, indexed by product index.
+ */
+template <typename V>
+class ProductStore
+{
+public:
+    // Room for the given number of products up front (e.g. the registry size)
+    explicit ProductStore(size_t capacity = 0);
+
+    // Get the value of a product, or nullptr if there is none
+    V* Find(ProductIndex index);
+    const V* Find(ProductIndex index) const;
+
+    // Get the value of a product; throws if there is none
+    V& At(ProductIndex index);
+
+    // Get the value of a product, default constructing it if there is none
+    V& operator[](ProductIndex index);
+
+    // Construct the value of a product in place unless there is one. Returns the value and whether it was inserted.
+    template <typename... Args>
+    pair<V*, bool> TryEmplace(ProductIndex index, Args&&... args);
+
+    // Set the value of a product
+    V& InsertOrAssign(ProductIndex index, const V& value);
+
+    // Call f on every stored value, in product index order
+    template <typename F>
+    void ForEach(F&& f);
+
+private:
+    // Make room for the index
+    void Reserve(ProductIndex index);
+
+    vector<optional<V>> slots_;
+};
+
+template <typename T>
+ProductRegistry<T>& ProductRegistry<T>::Instance()
+{
+    static ProductRegistry registry;
+    return registry;
+}
+
+template <typename T>
+ProductIndex ProductRegistry<T>::Register(const T& product)
+{
+    auto it = indices_.find(string_view(product.GetProductId()));
+    if (it != indices_.end()) {
+        return it->second;
+    }
+
+    ProductIndex index = ProductIndex(products_.size());
+    products_.push_back(product);
+    products_.back().productIndex = index;
+    indices_.emplace(product.GetProductId(), index);
+    return index;
+}
+
+template <typename T>
+ProductIndex ProductRegistry<T>::Resolve(const T& product)
+{
+    ProductIndex index = product.GetProductIndex();
+    return (index != kInvalidProductIndex) ? index : Register(product);
+}
+
+template <typename T>
+const T& ProductRegistry<T>::Get(ProductIndex index) const
+{
+    return products_.at(index);
+}
+
+template <typename T>
+const T& ProductRegistry<T>::Get(string_view product_id) const
+{
+    return products_[GetIndex(product_id)];
+}
+
+template <typename T>
+ProductIndex ProductRegistry<T>::GetIndex(string_view product_id) const
+{
+    auto it = indices_.find(product_id);
+    if (it == indices_.end()) {
+        throw out_of_range("ProductRegistry: unknown product " + string(product_id));
+    }
+    return it->second;
+}
+
+template <typename T>
+size_t ProductRegistry<T>::Size() const
+{
+    return products_.size();
+}
+
+template <typename T>
+ProductRef<T>::ProductRef() : product_(&Empty()) {}
+
+template <typename T>
+ProductRef<T>::ProductRef(const T& product) : product_(&ProductRegistry<T>::Instance().Get(ProductRegistry<T>::Instance().Resolve(product))) {}
+
+template <typename T>
+const T& ProductRef<T>::Empty()
+{
+    static const T empty;
+    return empty;
+}
+
+template <typename T>
+const T& ProductRef<T>::Get() const
+{
+    return *product_;
+}
+
+template <typename T>
+const T& ProductRef<T>::operator*() const
+{
+    return *product_;
+}
+
+template <typename T>
+const T* ProductRef<T>::operator->() const
+{
+    return product_;
+}
+
+template <typename T>
+ProductIndex ProductRef<T>::GetIndex() const
+{
+    return product_->GetProductIndex();
+}
+
+template <typename T>
+bool ProductRef<T>::operator==(const ProductRef& other) const
+{
+    return product_ == other.product_;
+}
+
+template <typename V>
+ProductStore<V>::ProductStore(size_t capacity) : slots_(capacity) {}
+
+template <typename V>
+void ProductStore<V>::Reserve(ProductIndex index)
+{
+    if (index >= slots_.size()) {
+        slots_.resize(index + 1);
+    }
+}
+
+template <typename V>
+V* ProductStore<V>::Find(ProductIndex index)
+{
+    return (index < slots_.size() && slots_[index]) ? &*slots_[index] : nullptr;
+}
+
+template <typename V>
+const V* ProductStore<V>::Find(ProductIndex index) const
+{
+    return (index < slots_.size() && slots_[index]) ? &*slots_[index] : nullptr;
+}
+
+template <typename V>
+V& ProductStore<V>::At(ProductIndex index)
+{
+    V* value = Find(index);
+    if (value == nullptr) {
+        throw out_of_range("ProductStore: no value for product index " + to_string(index));
+    }
+    return *value;
+}
+
+template <typename V>
+V& ProductStore<V>::operator[](ProductIndex index)
+{
+    return *TryEmplace(index).first;
+}
+
+template <typename V>
+template <typename... Args>
+pair<V*, bool> ProductStore<V>::TryEmplace(ProductIndex index, Args&&... args)
+{
+    Reserve(index);
+    optional<V>& slot = slots_[index];
+    if (slot) {
+        return { &*slot, false };
+    }
+    slot.emplace(std::forward<Args>(args)...);
+    return { &*slot, true };
+}
+
+template <typename V>
+V& ProductStore<V>::InsertOrAssign(ProductIndex index, const V& value)
+{
+    auto [stored, inserted] = TryEmplace(index, value);
+    if (!inserted) {
+        *stored = value;
+    }
+    return *stored;
+}
+
+template <typename V>
+template <typename F>
+void ProductStore<V>::ForEach(F&& f)
+{
+    for (optional<V>& slot : slots_) {
+        if (slot) {
+            f(*slot);
+        }
+    }
+}
+
+#endif /* product_registry_hpp */
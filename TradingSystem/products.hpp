@@ -8,11 +8,13 @@
 /*
  Design modification:
  1) Virtualized the destructor of all base classes
+ 2) Products carry the dense index handed out by ProductRegistry, so services can store per-product state in flat vectors
  */
 
 #ifndef PRODUCTS_HPP
 #define PRODUCTS_HPP
 
+#include <cstdint>
 #include <iostream>
 #include <string>
 
@@ -23,6 +25,13 @@ using namespace boost::gregorian;
 
 enum ProductType { IRSWAP, BOND };
 
+// Dense index of a registered product
+typedef uint32_t ProductIndex;
+constexpr ProductIndex kInvalidProductIndex = UINT32_MAX;
+
+template <typename T>
+class ProductRegistry;
+
 /**
  * Base class for a product.
  */
@@ -41,9 +50,16 @@ public:
     // Ge the product type
     ProductType GetProductType() const;
 
+    // Get the registry index (kInvalidProductIndex if the product was not registered)
+    ProductIndex GetProductIndex() const;
+
 private:
+    template <typename T>
+    friend class ProductRegistry;
+
     string productId;
     ProductType productType;
+    ProductIndex productIndex = kInvalidProductIndex;
 
 };
 
@@ -182,6 +198,11 @@ ProductType Product::GetProductType() const
     return productType;
 }
 
+ProductIndex Product::GetProductIndex() const
+{
+    return productIndex;
+}
+
 Bond::Bond(string _productId, BondIdType _bondIdType, string _ticker, float _coupon, date _maturityDate) : Product(_productId, BOND)
 {
     bondIdType = _bondIdType;
@@ -190,7 +211,7 @@ Bond::Bond(string _productId, BondIdType _bondIdType, string _ticker, float _cou
     maturityDate =_maturityDate;
 }
 
-Bond::Bond() : Product(0, BOND)
+Bond::Bond() : Product("", BOND)
 {
 }
 
@@ -238,7 +259,7 @@ IRSwap::IRSwap(string _productId, DayCountConvention _fixedLegDayCountConvention
     terminationDate =_terminationDate;
 }
 
-IRSwap::IRSwap() : Product(0, IRSWAP)
+IRSwap::IRSwap() : Product("", IRSWAP)
 {
 }
 
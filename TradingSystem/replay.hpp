@@ -0,0 +1,602 @@
+/**
+ * replay.hpp
+ * Replays recorded feeds into the services in timestamp order, at their original pace or faster
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) A ReplayStream reads one recorded feed, from its text file or its binary journal (see feed_records.hpp), and turns each event into the object its connector would build before injecting it into the service. Text lines carry no time, so they are stamped start + line * interval, as the generator stamps the binary feeds; both forms then replay identically.
+ (2) ReplayEngine merges its streams by event timestamp (a linear scan for the earliest: there are only a handful of streams) and injects all events from the calling thread, like a single sequencer in front of the service graph.
+ (3) At speed N, an event is due at start + (timestamp - first timestamp) / N of wall time. The engine sleeps until shortly before it is due and spins for the rest. Lag is how late an event is injected relative to when it was due: it stays near zero while the pipeline keeps up, and grows without bound once the pipeline saturates. Speed 0 replays as fast as possible.
+ (4) The engine reports events, achieved rate and lag percentiles (power of two buckets) per run.
+ */
+
+#ifndef replay_hpp
+#define replay_hpp
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_ring.hpp"
+#include "feed_records.hpp"
+#include "journal.hpp"
+#include "line_reader.hpp"
+#include "timestamp.hpp"
+#include "utilities.hpp"
+#include "pricing_service.hpp"
+#include "market_data_service.hpp"
+#include "trade_booking_service.hpp"
+#include "inquiry_service.hpp"
+
+using namespace std;
+
+// Where recorded feeds are read from
+enum ReplaySource { TEXT_REPLAY, BINARY_REPLAY };
+
+/**
+ * How to replay.
+ */
+struct ReplayOptions
+{
+    // Replay speed relative to the recorded timestamps (0 for as fast as possible)
+    double speed = 1.;
+
+    ReplaySource source = TEXT_REPLAY;
+
+    // Timestamps given to text lines (match FeedGeneratorConfig)
+    int64_t text_start_timestamp = 0;
+    int64_t text_timestamp_interval = 1000;
+};
+
+// Parse a text feed line into its record; throws invalid_argument on a line with too few fields
+void ParseFeedLine(const LineFields& fields, PriceFeedRecord& record);
+void ParseFeedLine(const LineFields& fields, MarketDataFeedRecord& record);
+void ParseFeedLine(const LineFields& fields, TradeFeedRecord& record);
+void ParseFeedLine(const LineFields& fields, InquiryFeedRecord& record);
+
+/**
+ * Records of one recorded feed with their timestamps, read from text or from a journal.
+ * Type R is the feed record type.
+ */
+template <typename R>
+class FeedSource
+{
+public:
+    FeedSource(const string& text_path, uint32_t record_type, const ReplayOptions& options);
+
+    // Read the next record; false at the end of the feed
+    bool Next(R& record, int64_t& timestamp);
+
+private:
+    unique_ptr<ifstream> file_;
+    unique_ptr<LineReader> reader_;
+    LineFields fields_;
+    uint64_t line_;
+    int64_t start_timestamp_;
+    int64_t timestamp_interval_;
+
+    unique_ptr<JournalReader<R>> journal_;
+    size_t position_;
+};
+
+/**
+ * One recorded feed, injected event by event into a service.
+ */
+class ReplayStream
+{
+public:
+    ReplayStream(string name);
+    virtual ~ReplayStream() = default;
+
+    // Timestamp of the next event; false once the feed is exhausted
+    virtual bool Peek(int64_t& timestamp) = 0;
+
+    // Inject the next event into the service
+    virtual void Dispatch() = 0;
+
+    // Get the name of the feed
+    const string& GetName() const;
+
+    // Number of events injected
+    uint64_t GetCount() const;
+
+protected:
+    string name_;
+    uint64_t count_;
+};
+
+/**
+ * Distribution of lags, in power of two buckets of nanoseconds.
+ */
+class LagHistogram
+{
+public:
+    void Record(int64_t lag);
+
+    // Upper bound of the bucket holding the quantile
+    int64_t GetQuantile(double quantile) const;
+
+    int64_t GetMax() const;
+    uint64_t GetCount() const;
+
+private:
+    array<uint64_t, 64> counts_{};
+    uint64_t count_ = 0;
+    int64_t max_ = 0;
+};
+
+/**
+ * Outcome of a replay.
+ */
+struct ReplayStats
+{
+    double speed = 0.;
+    uint64_t events = 0;
+    double wall_seconds = 0.;
+    double feed_seconds = 0.;      // Span of the recorded timestamps
+    vector<pair<string, uint64_t>> stream_events;
+    LagHistogram lag;
+
+    // Events per second of wall time
+    double GetRate() const;
+
+    // Events per second the replay was asked for (0 at max speed)
+    double GetTargetRate() const;
+
+    void Print(ostream& out) const;
+};
+
+/**
+ * Merges recorded feeds by timestamp and injects them into the services.
+ */
+class ReplayEngine
+{
+public:
+    ReplayEngine(ReplayOptions options = ReplayOptions());
+
+    // Feeds are read from the same files the connectors read, or from their journals
+    template <typename T>
+    void AddPriceFeed(PricingService<T>& service, const string& path = "prices.txt");
+
+    template <typename T, typename Static>
+    void AddMarketDataFeed(MarketDataService<T, Static>& service, const string& path = "marketdata.txt");
+
+    template <typename T, typename Static>
+    void AddTradeFeed(TradeBookingService<T, Static>& service, const string& path = "trades.txt");
+
+    template <typename T>
+    void AddInquiryFeed(InquiryService<T>& service, const string& path = "inquiries.txt");
+
+    // Add a stream of any other kind
+    void AddStream(unique_ptr<ReplayStream> stream);
+
+    // Replay every stream to the end
+    ReplayStats Run();
+
+private:
+    // Wait until a wall time (steady clock nanoseconds)
+    static void WaitUntil(int64_t wall_time);
+
+    ReplayOptions options_;
+    vector<unique_ptr<ReplayStream>> streams_;
+};
+
+/**
+ * A stream over the records of one feed: the next record is read ahead to know when it is due.
+ * Type R is the feed record type.
+ */
+template <typename R>
+class RecordReplayStream : public ReplayStream
+{
+public:
+    RecordReplayStream(string name, const string& path, uint32_t record_type, const ReplayOptions& options);
+    virtual bool Peek(int64_t& timestamp) override;
+
+protected:
+    FeedSource<R> source_;
+    R record_;
+    int64_t timestamp_;
+    bool has_record_;
+};
+
+/**
+ * Prices: one line per Price.
+ */
+template <typename T>
+class PriceReplayStream : public RecordReplayStream<PriceFeedRecord>
+{
+public:
+    PriceReplayStream(PricingService<T>& service, const string& path, const ReplayOptions& options);
+    virtual void Dispatch() override;
+
+private:
+    PricingService<T>& service_;
+};
+
+/**
+ * Market data: one book per 2 * depth lines, built in place in the service's book as the connector does.
+ */
+template <typename T, typename Static>
+class MarketDataReplayStream : public RecordReplayStream<MarketDataFeedRecord>
+{
+public:
+    MarketDataReplayStream(MarketDataService<T, Static>& service, const string& path, const ReplayOptions& options);
+    virtual void Dispatch() override;
+
+private:
+    MarketDataService<T, Static>& service_;
+};
+
+/**
+ * Trades: one line per Trade.
+ */
+template <typename T, typename Static>
+class TradeReplayStream : public RecordReplayStream<TradeFeedRecord>
+{
+public:
+    TradeReplayStream(TradeBookingService<T, Static>& service, const string& path, const ReplayOptions& options);
+    virtual void Dispatch() override;
+
+private:
+    TradeBookingService<T, Static>& service_;
+};
+
+/**
+ * Inquiries: one line per Inquiry.
+ */
+template <typename T>
+class InquiryReplayStream : public RecordReplayStream<InquiryFeedRecord>
+{
+public:
+    InquiryReplayStream(InquiryService<T>& service, const string& path, const ReplayOptions& options);
+    virtual void Dispatch() override;
+
+private:
+    InquiryService<T>& service_;
+};
+
+void ParseFeedLine(const LineFields& fields, PriceFeedRecord& record)
+{
+    fields.RequireFields(3, "ParseFeedLine (prices)");
+    CopyJournalField(record.product_id, fields[0]);
+    record.bid = ConvertPrice(fields[1]).GetTicks();
+    record.offer = ConvertPrice(fields[2]).GetTicks();
+}
+
+void ParseFeedLine(const LineFields& fields, MarketDataFeedRecord& record)
+{
+    fields.RequireFields(4, "ParseFeedLine (market data)");
+    record = MarketDataFeedRecord{};
+    CopyJournalField(record.product_id, fields[0]);
+    record.price = ConvertPrice(fields[1]).GetTicks();
+    record.quantity = ParseNumber<long>(fields[2]);
+    record.side = uint8_t((fields[3] == "BID") ? BID : OFFER);
+}
+
+void ParseFeedLine(const LineFields& fields, TradeFeedRecord& record)
+{
+    fields.RequireFields(6, "ParseFeedLine (trades)");
+    record = TradeFeedRecord{};
+    CopyJournalField(record.product_id, fields[0]);
+    CopyJournalField(record.trade_id, fields[1]);
+    record.price = ConvertPrice(fields[2]).GetTicks();
+    CopyJournalField(record.book, fields[3]);
+    record.quantity = ParseNumber<long>(fields[4]);
+    record.side = uint8_t((fields[5] == "BUY") ? BUY : SELL);
+}
+
+void ParseFeedLine(const LineFields& fields, InquiryFeedRecord& record)
+{
+    fields.RequireFields(6, "ParseFeedLine (inquiries)");
+    record = InquiryFeedRecord{};
+    CopyJournalField(record.inquiry_id, fields[0]);
+    CopyJournalField(record.product_id, fields[1]);
+    record.side = uint8_t((fields[2] == "BUY") ? BUY : SELL);
+    record.quantity = ParseNumber<long>(fields[3]);
+    record.price = ConvertPrice(fields[4]).GetTicks();
+    InquiryState state = RECEIVED;
+    if (fields[5] == "QUOTED") state = QUOTED;
+    else if (fields[5] == "DONE") state = DONE;
+    else if (fields[5] == "REJECTED") state = REJECTED;
+    else if (fields[5] == "CUSTOMER_REJECTED") state = CUSTOMER_REJECTED;
+    record.state = uint8_t(state);
+}
+
+template <typename R>
+FeedSource<R>::FeedSource(const string& text_path, uint32_t record_type, const ReplayOptions& options) :
+  line_(0), start_timestamp_(options.text_start_timestamp), timestamp_interval_(options.text_timestamp_interval), position_(0)
+{
+    if (options.source == BINARY_REPLAY) {
+        journal_ = make_unique<JournalReader<R>>(GetFeedJournalPath(text_path), record_type);
+        return;
+    }
+    file_ = make_unique<ifstream>(text_path);
+    if (!*file_) {
+        throw runtime_error("FeedSource: cannot open " + text_path);
+    }
+    reader_ = make_unique<LineReader>(*file_);
+}
+
+template <typename R>
+bool FeedSource<R>::Next(R& record, int64_t& timestamp)
+{
+    if (journal_) {
+        if (position_ == journal_->Size()) {
+            return false;
+        }
+        const JournalEntry<R>& entry = (*journal_)[position_++];
+        record = entry.record;
+        timestamp = entry.timestamp;
+        return true;
+    }
+    if (!reader_->ReadFields(fields_)) {
+        return false;
+    }
+    ParseFeedLine(fields_, record);
+    timestamp = start_timestamp_ + int64_t(line_++) * timestamp_interval_;
+    return true;
+}
+
+ReplayStream::ReplayStream(string name) : name_(move(name)), count_(0) {}
+
+const string& ReplayStream::GetName() const
+{
+    return name_;
+}
+
+uint64_t ReplayStream::GetCount() const
+{
+    return count_;
+}
+
+void LagHistogram::Record(int64_t lag)
+{
+    lag = max<int64_t>(lag, 0);
+    counts_[lag == 0 ? 0 : size_t(bit_width(uint64_t(lag))) - 1]++;
+    count_++;
+    max_ = max(max_, lag);
+}
+
+int64_t LagHistogram::GetQuantile(double quantile) const
+{
+    uint64_t running = 0;
+    for (size_t i = 0; i < counts_.size(); i++) {
+        running += counts_[i];
+        if (running > 0 && running >= quantile * count_) {
+            return min(max_, (int64_t(2) << i) - 1);
+        }
+    }
+    return max_;
+}
+
+int64_t LagHistogram::GetMax() const
+{
+    return max_;
+}
+
+uint64_t LagHistogram::GetCount() const
+{
+    return count_;
+}
+
+double ReplayStats::GetRate() const
+{
+    return (wall_seconds > 0) ? events / wall_seconds : 0.;
+}
+
+double ReplayStats::GetTargetRate() const
+{
+    return (speed > 0 && feed_seconds > 0) ? events / (feed_seconds / speed) : 0.;
+}
+
+void ReplayStats::Print(ostream& out) const
+{
+    out << "Replay at " << (speed > 0 ? to_string(speed) + "x" : string("max speed")) << ": " << events << " events in " << wall_seconds << " s"
+        << " (recorded span " << feed_seconds << " s)" << endl;
+    for (const auto& [name, count] : stream_events) {
+        out << "  " << left << setw(12) << name << right << setw(12) << count << " events" << endl;
+    }
+    out << "  Achieved rate: " << GetRate() << " events/s";
+    if (speed > 0) {
+        out << " (target " << GetTargetRate() << " events/s)" << endl;
+        out << "  Lag (ns): p50 <= " << lag.GetQuantile(0.5) << ", p99 <= " << lag.GetQuantile(0.99) << ", p99.9 <= " << lag.GetQuantile(0.999) << ", max " << lag.GetMax() << endl;
+    } else {
+        out << endl;
+    }
+}
+
+ReplayEngine::ReplayEngine(ReplayOptions options) : options_(options)
+{
+    if (options_.speed < 0) {
+        throw invalid_argument("ReplayEngine: speed must not be negative");
+    }
+}
+
+template <typename T>
+void ReplayEngine::AddPriceFeed(PricingService<T>& service, const string& path)
+{
+    AddStream(make_unique<PriceReplayStream<T>>(service, path, options_));
+}
+
+template <typename T, typename Static>
+void ReplayEngine::AddMarketDataFeed(MarketDataService<T, Static>& service, const string& path)
+{
+    AddStream(make_unique<MarketDataReplayStream<T, Static>>(service, path, options_));
+}
+
+template <typename T, typename Static>
+void ReplayEngine::AddTradeFeed(TradeBookingService<T, Static>& service, const string& path)
+{
+    AddStream(make_unique<TradeReplayStream<T, Static>>(service, path, options_));
+}
+
+template <typename T>
+void ReplayEngine::AddInquiryFeed(InquiryService<T>& service, const string& path)
+{
+    AddStream(make_unique<InquiryReplayStream<T>>(service, path, options_));
+}
+
+void ReplayEngine::AddStream(unique_ptr<ReplayStream> stream)
+{
+    streams_.push_back(move(stream));
+}
+
+void ReplayEngine::WaitUntil(int64_t wall_time)
+{
+    // Sleep for most of the wait (the scheduler is coarse), and spin for the last stretch
+    constexpr int64_t kSpinNanoseconds = 100000;
+    int64_t now = int64_t(GetMonotonicNanoseconds());
+    if (wall_time - now > 2 * kSpinNanoseconds) {
+        this_thread::sleep_for(chrono::nanoseconds(wall_time - now - kSpinNanoseconds));
+    }
+    while (int64_t(GetMonotonicNanoseconds()) < wall_time) {
+        CpuRelax();
+    }
+}
+
+ReplayStats ReplayEngine::Run()
+{
+    ReplayStats stats;
+    stats.speed = options_.speed;
+
+    int64_t first_timestamp = 0;
+    int64_t last_timestamp = 0;
+    bool started = false;
+    int64_t start = int64_t(GetMonotonicNanoseconds());
+
+    while (true) {
+        // Earliest pending event over all streams (ties go to the stream added first)
+        ReplayStream* next = nullptr;
+        int64_t next_timestamp = 0;
+        for (auto& stream : streams_) {
+            int64_t timestamp;
+            if (stream->Peek(timestamp) && (next == nullptr || timestamp < next_timestamp)) {
+                next = stream.get();
+                next_timestamp = timestamp;
+            }
+        }
+        if (next == nullptr) {
+            break;
+        }
+        if (!started) {
+            first_timestamp = next_timestamp;
+            started = true;
+        }
+        last_timestamp = max(last_timestamp, next_timestamp);
+
+        if (options_.speed > 0) {
+            int64_t due = start + int64_t(double(next_timestamp - first_timestamp) / options_.speed);
+            WaitUntil(due);
+            stats.lag.Record(int64_t(GetMonotonicNanoseconds()) - due);
+        }
+        next->Dispatch();
+        stats.events++;
+    }
+
+    stats.wall_seconds = double(int64_t(GetMonotonicNanoseconds()) - start) * 1e-9;
+    stats.feed_seconds = double(last_timestamp - first_timestamp) * 1e-9;
+    for (const auto& stream : streams_) {
+        stats.stream_events.emplace_back(stream->GetName(), stream->GetCount());
+    }
+    return stats;
+}
+
+template <typename R>
+RecordReplayStream<R>::RecordReplayStream(string name, const string& path, uint32_t record_type, const ReplayOptions& options) :
+  ReplayStream(move(name)), source_(path, record_type, options), timestamp_(0), has_record_(false) {}
+
+template <typename R>
+bool RecordReplayStream<R>::Peek(int64_t& timestamp)
+{
+    if (!has_record_) {
+        has_record_ = source_.Next(record_, timestamp_);
+    }
+    timestamp = timestamp_;
+    return has_record_;
+}
+
+template <typename T>
+PriceReplayStream<T>::PriceReplayStream(PricingService<T>& service, const string& path, const ReplayOptions& options) :
+  RecordReplayStream("prices", path, PRICE_FEED_RECORD, options), service_(service) {}
+
+template <typename T>
+void PriceReplayStream<T>::Dispatch()
+{
+    // As PricingConnector: mid and spread from the two sides
+    PriceTick bid_price(record_.bid);
+    PriceTick offer_price(record_.offer);
+    Price<T> price(FetchBond(JournalFieldView(record_.product_id)), (bid_price + offer_price) / 2, offer_price - bid_price);
+    has_record_ = false;
+    count_++;
+    service_.OnMessage(price);
+}
+
+template <typename T, typename Static>
+MarketDataReplayStream<T, Static>::MarketDataReplayStream(MarketDataService<T, Static>& service, const string& path, const ReplayOptions& options) :
+  RecordReplayStream("marketdata", path, MARKET_DATA_FEED_RECORD, options), service_(service) {}
+
+template <typename T, typename Static>
+void MarketDataReplayStream<T, Static>::Dispatch()
+{
+    // As MarketDataConnector: the book is due when its first order is, and is published once all its orders are in
+    unsigned read_lines = unsigned(service_.GetBookDepth()) << 1;
+    OrderBook<T>& book = service_.GetBook(FetchBond(JournalFieldView(record_.product_id)));
+    book.Clear();
+    LATENCY_STAMP(book);
+    int64_t timestamp;
+    for (unsigned order_count = 0; order_count < read_lines; order_count++) {
+        if (order_count > 0 && !source_.Next(record_, timestamp)) {
+            // A truncated book is dropped, as the connector drops it
+            has_record_ = false;
+            return;
+        }
+        book.AddOrder(Order(PriceTick(record_.price), record_.quantity, PricingSide(record_.side)));
+    }
+    has_record_ = false;
+    count_++;
+    service_.OnMessage(book);
+}
+
+template <typename T, typename Static>
+TradeReplayStream<T, Static>::TradeReplayStream(TradeBookingService<T, Static>& service, const string& path, const ReplayOptions& options) :
+  RecordReplayStream("trades", path, TRADE_FEED_RECORD, options), service_(service) {}
+
+template <typename T, typename Static>
+void TradeReplayStream<T, Static>::Dispatch()
+{
+    Trade<T> trade(FetchBond(JournalFieldView(record_.product_id)), string(JournalFieldView(record_.trade_id)), PriceTick(record_.price),
+                   string(JournalFieldView(record_.book)), record_.quantity, Side(record_.side));
+    LATENCY_STAMP(trade);
+    has_record_ = false;
+    count_++;
+    service_.OnMessage(trade);
+}
+
+template <typename T>
+InquiryReplayStream<T>::InquiryReplayStream(InquiryService<T>& service, const string& path, const ReplayOptions& options) :
+  RecordReplayStream("inquiries", path, INQUIRY_FEED_RECORD, options), service_(service) {}
+
+template <typename T>
+void InquiryReplayStream<T>::Dispatch()
+{
+    Inquiry<T> inquiry(string(JournalFieldView(record_.inquiry_id)), FetchBond(JournalFieldView(record_.product_id)), Side(record_.side),
+                       record_.quantity, PriceTick(record_.price), InquiryState(record_.state));
+    has_record_ = false;
+    count_++;
+    service_.OnMessage(inquiry);
+}
+
+#endif /* replay_hpp */
@@ -8,18 +8,24 @@
 #define RISK_SERVICE_HPP
 
 #include "soa.hpp"
+#include "static_listeners.hpp"
+#include "latency.hpp"
+#include "serialization.hpp"
 #include "position_service.hpp"
 #include <vector>
 #include <unordered_map>
+#include "product_registry.hpp"
 #include "utilities.hpp"
+#include <cstdint>
 #include <string>
+#include <type_traits>
 
 /**
  * PV01 risk.
  * Type T is the product type.
  */
 template <typename T>
-class PV01
+class PV01 : public LatencyTagged
 {
 
 public:
@@ -39,10 +45,15 @@ public:
     
     void SetQuantity(long _quantity);
     
-    vector<string> ToString() const;
+    // Most characters Serialize may write
+    size_t GetMaxSerializedSize() const;
+    
+    // Write the fields as "field,field,...," into out; returns the end of the text
+    char* Serialize(char* out) const;
 
 private:
-    T product;
+    // Registered instance for a product, shared by every copy of the event; a copy for a sector of products
+    conditional_t<is_base_of_v<Product, T>, ProductRef<T>, T> product;
     double pv01;
     long quantity;
 
@@ -75,20 +86,49 @@ private:
 
 };
 
-template <typename T>
+// Dense index of a bucket registered with a RiskService
+typedef uint32_t BucketIndex;
+
+template <typename T, typename Static = StaticListeners<PV01<T>>>
+class RiskService;
+template <typename T, typename S = RiskService<T>>
 class PositionToRiskListener;
 
 /**
  * Risk Service to vend out risk for a particular security and across a risk bucketed sector.
  * Keyed on product identifier.
+ * Unit PV01s and quantities are kept in flat arrays indexed by product index, and the total of every
+ * registered bucket is updated from the quantity change of each position, so bucket queries are O(1).
  * Type T is the product type.
  */
-template <typename T>
-class RiskService : public Service<string,PV01 <T> >
+template <typename T, typename Static>
+class RiskService final : public Service<string,PV01 <T> >
 {
+public:
+    // Concrete types of the objects attached to this service, for static wiring
+    typedef PositionToRiskListener<T, RiskService> InListener;
+    
 private:
-    unordered_map<string, PV01<T>> pv01s_;
-    PositionToRiskListener<T>* in_listener_;
+    ProductStore<PV01<T>> pv01s_;     // Indexed by product index
+    InListener* in_listener_;
+    Static static_listeners_;
+    
+    // Risk of every product, structure of arrays indexed by product index
+    vector<double> unit_pv01s_;
+    vector<long> quantities_;
+    
+    // Registered buckets: the sector, its running total, and its members both as a list and as dense 0/1 weights
+    vector<BucketedSector<T>> buckets_;
+    vector<double> bucket_pv01s_;
+    vector<vector<double>> bucket_weights_;     // [bucket][product]
+    vector<vector<BucketIndex>> product_buckets_;     // [product] -> buckets containing it
+    unordered_map<string, BucketIndex> bucket_indices_;     // Keyed on bucket name
+    
+    // Make room in the product arrays for the index (new products get their unit PV01 from kPV01Map)
+    void Reserve(ProductIndex index);
+    
+    // Sum of unit PV01 * quantity over the products of a bucket
+    double ComputeBucketRisk(BucketIndex bucket) const;
     
 public:
     RiskService();
@@ -109,24 +149,40 @@ public:
     virtual const vector<ServiceListener<PV01<T>>*>& GetListeners() const override;
     // MARK: SERVICE CLASS OVERRIDE ABOVE
     
-    PositionToRiskListener<T>* GetInListener();
+    InListener* GetInListener();
+    
+    // Get the listeners wired at compile time (notified ahead of the dynamic listeners)
+    Static& GetStaticListeners();
 
     // Add a position that the service will risk
     void AddPosition(Position<T> &position);
 
-    // Get the bucketed risk for the bucket sector
-    const PV01< BucketedSector<T> >& GetBucketedRisk(const BucketedSector<T> &sector) const;
+    // Register a bucket so that its risk is maintained on every position update; returns its index
+    BucketIndex RegisterBucket(const BucketedSector<T>& sector);
+    
+    // Get the bucketed risk for the bucket sector (O(1) for a registered bucket, otherwise summed over its products)
+    PV01< BucketedSector<T> > GetBucketedRisk(const BucketedSector<T> &sector) const;
+    PV01< BucketedSector<T> > GetBucketedRisk(BucketIndex bucket) const;
+    
+    // Reload every unit PV01 from kPV01Map (e.g. after a curve change), and recompute all risk from scratch
+    void RefreshPV01s();
+    
+    // Get the risk of a product, or nullptr if it has none
+    const PV01<T>* FindPV01(ProductIndex index) const;
+    
+    // Set the quantity at risk of a product, e.g. from a snapshot, keeping the bucket totals in step (listeners are not notified)
+    void RestorePV01(const PV01<T>& pv01);
 
 };
 
-template <typename T>
-class PositionToRiskListener : public ServiceListener<Position<T>> {
+template <typename T, typename S>
+class PositionToRiskListener final : public ServiceListener<Position<T>> {
 private:
-    RiskService<T>* service_;
+    S* service_;
 
 public:
 
-    PositionToRiskListener(RiskService<T>* _service);
+    PositionToRiskListener(S* _service);
     ~PositionToRiskListener() = default;
 
     // MARK: SERVICELISTENER CLASS OVERRIDE BELOW
@@ -148,7 +204,11 @@ PV01<T>::PV01(const T &_product, double _pv01, long _quantity) :
 
 template<typename T>
 const T& PV01<T>::GetProduct() const {
-    return product;
+    if constexpr (is_base_of_v<Product, T>) {
+        return *product;
+    } else {
+        return product;
+    }
 }
 
 template<typename T>
@@ -182,26 +242,49 @@ const string& BucketedSector<T>::GetName() const
     return name;
 }
 
-template <typename T>
-RiskService<T>::RiskService() {
-    in_listener_ = new PositionToRiskListener<T>(this);
+template <typename T, typename Static>
+RiskService<T, Static>::RiskService() : pv01s_(ProductRegistry<T>::Instance().Size()) {
+    in_listener_ = new InListener(this);
+    size_t product_count = ProductRegistry<T>::Instance().Size();
+    if (product_count > 0) {
+        Reserve(ProductIndex(product_count - 1));
+    }
 }
 
-template <typename T>
-RiskService<T>::~RiskService() {
+template <typename T, typename Static>
+void RiskService<T, Static>::Reserve(ProductIndex index) {
+    size_t old_size = unit_pv01s_.size();
+    if (index < old_size) {
+        return;
+    }
+    size_t new_size = size_t(index) + 1;
+    const ProductRegistry<T>& registry = ProductRegistry<T>::Instance();
+    unit_pv01s_.resize(new_size);
+    for (size_t i = old_size; i < new_size; i++) {
+        unit_pv01s_[i] = GetPV01Value(registry.Get(ProductIndex(i)).GetProductId());
+    }
+    quantities_.resize(new_size, 0);
+    product_buckets_.resize(new_size);
+    for (auto& weights : bucket_weights_) {
+        weights.resize(new_size, 0.);
+    }
+}
+
+template <typename T, typename Static>
+RiskService<T, Static>::~RiskService() {
     delete in_listener_;
 }
 
-template <typename T>
-PV01<T>& RiskService<T>::GetData(string product_id) {
-    return pv01s_[product_id];
+template <typename T, typename Static>
+PV01<T>& RiskService<T, Static>::GetData(string product_id) {
+    return pv01s_[ProductRegistry<T>::Instance().GetIndex(product_id)];
 }
 
-template <typename T>
-void RiskService<T>::OnMessage(PV01<T>& data) {
-    string product_id = data.GetProduct().GetProductId();
+template <typename T, typename Static>
+void RiskService<T, Static>::OnMessage(PV01<T>& data) {
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(data.GetProduct());
     
-    pv01s_[product_id] = data;
+    pv01s_.InsertOrAssign(index, data);
     
 //    // Also notify listeners
 //    for (auto& listener : Service<string, Trade<T>>::listeners_) {
@@ -209,88 +292,192 @@ void RiskService<T>::OnMessage(PV01<T>& data) {
 //    }
 }
 
-template <typename T>
-void RiskService<T>::AddListener(ServiceListener<PV01<T>>* listener) {
+template <typename T, typename Static>
+void RiskService<T, Static>::AddListener(ServiceListener<PV01<T>>* listener) {
     this->Service<string, PV01<T>>::AddListener(listener);
 }
 
-template <typename T>
-const vector<ServiceListener<PV01<T>>*>& RiskService<T>::GetListeners() const {
+template <typename T, typename Static>
+const vector<ServiceListener<PV01<T>>*>& RiskService<T, Static>::GetListeners() const {
     return this->Service<string, PV01<T>>::GetListeners();
 }
 
-template <typename T>
-PositionToRiskListener<T>* RiskService<T>::GetInListener() {
+template <typename T, typename Static>
+typename RiskService<T, Static>::InListener* RiskService<T, Static>::GetInListener() {
     return in_listener_;
 }
 
+template <typename T, typename Static>
+Static& RiskService<T, Static>::GetStaticListeners() {
+    return static_listeners_;
+}
+
 // Add a position that the service will risk
-template <typename T>
-void RiskService<T>::AddPosition(Position<T>& position) {
+template <typename T, typename Static>
+void RiskService<T, Static>::AddPosition(Position<T>& position) {
+    LATENCY_RECORD(ADD_POSITION, position);
     
     // Parse info from position
-    T product = position.GetProduct();
-    string product_id = product.GetProductId();
+    const T& product = position.GetProduct();
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(product);
     long quantity = position.GetAggregatePosition();
     
+    // Update the product's risk, and move every bucket containing it by the change alone
+    Reserve(index);
+    double unit_pv01 = unit_pv01s_[index];
+    double pv01_change = unit_pv01 * double(quantity - quantities_[index]);
+    quantities_[index] = quantity;
+    for (BucketIndex bucket : product_buckets_[index]) {
+        bucket_pv01s_[bucket] += pv01_change;
+    }
+    
     // Convert to PV01 obj
-    double pv01_value = GetPV01Value(product_id);
-    PV01<T> pv01(product, pv01_value, quantity);
-    pv01s_.insert_or_assign(product_id, pv01);
+    PV01<T> pv01(product, unit_pv01, quantity);
+    LATENCY_CARRY(pv01, position);
+    pv01s_.InsertOrAssign(index, pv01);
 
     // Notify listeners
+    static_listeners_.ProcessAdd(pv01);
     for (auto& listener : Service<string, PV01<T>>::listeners_)
     {
         listener->ProcessAdd(pv01);
     }
 }
 
-// Get the bucketed risk for the bucket sector
-template <typename T>
-const PV01<BucketedSector<T>>& RiskService<T>::GetBucketedRisk(const BucketedSector<T>& sector) const {
+template <typename T, typename Static>
+BucketIndex RiskService<T, Static>::RegisterBucket(const BucketedSector<T>& sector) {
+    auto it = bucket_indices_.find(sector.GetName());
+    if (it != bucket_indices_.end()) {
+        return it->second;
+    }
     
-    BucketedSector<T> product = sector;
+    BucketIndex bucket = BucketIndex(buckets_.size());
+    buckets_.push_back(sector);
+    bucket_weights_.emplace_back(unit_pv01s_.size(), 0.);
+    for (const auto& product : sector.GetProducts()) {
+        ProductIndex index = ProductRegistry<T>::Instance().Resolve(product);
+        Reserve(index);
+        if (bucket_weights_[bucket][index] == 0.) {
+            bucket_weights_[bucket][index] = 1.;
+            product_buckets_[index].push_back(bucket);
+        }
+    }
+    bucket_pv01s_.push_back(ComputeBucketRisk(bucket));
+    bucket_indices_.emplace(sector.GetName(), bucket);
+    return bucket;
+}
+
+template <typename T, typename Static>
+double RiskService<T, Static>::ComputeBucketRisk(BucketIndex bucket) const {
+    // Dense multiply-accumulate over the arrays, which the compiler can vectorize
+    const double* weights = bucket_weights_[bucket].data();
+    const double* unit_pv01s = unit_pv01s_.data();
+    const long* quantities = quantities_.data();
+    size_t count = unit_pv01s_.size();
+    double pv01 = 0.;
+    for (size_t i = 0; i < count; i++) {
+        pv01 += weights[i] * unit_pv01s[i] * double(quantities[i]);
+    }
+    return pv01;
+}
+
+// Get the bucketed risk for the bucket sector
+template <typename T, typename Static>
+PV01<BucketedSector<T>> RiskService<T, Static>::GetBucketedRisk(const BucketedSector<T>& sector) const {
+    auto it = bucket_indices_.find(sector.GetName());
+    if (it != bucket_indices_.end()) {
+        return GetBucketedRisk(it->second);
+    }
     
     double pv01 = 0.;
     long quantity = 1;  // Dummy
 
-    vector<T>& products = sector.GetProducts();
+    const vector<T>& products = sector.GetProducts();
     for (auto& product : products)
     {
-        string product_id = product.GetProductId();
-        pv01 += pv01s_[product_id].GetPV01() * pv01s_[product_id].GetQuantity();
+        ProductIndex index = ProductRegistry<T>::Instance().Resolve(product);
+        if (index < unit_pv01s_.size()) {
+            pv01 += unit_pv01s_[index] * double(quantities_[index]);
+        }
     }
 
-    return PV01<BucketedSector<T>>(product, pv01, quantity);
+    return PV01<BucketedSector<T>>(sector, pv01, quantity);
 }
 
-template<typename T>
-PositionToRiskListener<T>::PositionToRiskListener(RiskService<T>* service) : service_(service) {}
+template <typename T, typename Static>
+PV01<BucketedSector<T>> RiskService<T, Static>::GetBucketedRisk(BucketIndex bucket) const {
+    long quantity = 1;  // Dummy
+    return PV01<BucketedSector<T>>(buckets_.at(bucket), bucket_pv01s_[bucket], quantity);
+}
 
-template<typename T>
-void PositionToRiskListener<T>::ProcessAdd(Position<T>& data)
+template <typename T, typename Static>
+void RiskService<T, Static>::RefreshPV01s() {
+    const ProductRegistry<T>& registry = ProductRegistry<T>::Instance();
+    for (size_t i = 0; i < unit_pv01s_.size(); i++) {
+        unit_pv01s_[i] = GetPV01Value(registry.Get(ProductIndex(i)).GetProductId());
+    }
+    
+    // Recomputing also drops the rounding accumulated by the incremental updates
+    for (BucketIndex bucket = 0; bucket < buckets_.size(); bucket++) {
+        bucket_pv01s_[bucket] = ComputeBucketRisk(bucket);
+    }
+    
+    // Stored PV01s follow the new curve (listeners are not notified: no position changed)
+    pv01s_.ForEach([this](PV01<T>& pv01) {
+        ProductIndex index = ProductRegistry<T>::Instance().Resolve(pv01.GetProduct());
+        pv01 = PV01<T>(pv01.GetProduct(), unit_pv01s_[index], pv01.GetQuantity());
+    });
+}
+
+template <typename T, typename Static>
+const PV01<T>* RiskService<T, Static>::FindPV01(ProductIndex index) const {
+    return pv01s_.Find(index);
+}
+
+template <typename T, typename Static>
+void RiskService<T, Static>::RestorePV01(const PV01<T>& pv01) {
+    const T& product = pv01.GetProduct();
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(product);
+    long quantity = pv01.GetQuantity();
+    
+    Reserve(index);
+    double unit_pv01 = unit_pv01s_[index];
+    double pv01_change = unit_pv01 * double(quantity - quantities_[index]);
+    quantities_[index] = quantity;
+    for (BucketIndex bucket : product_buckets_[index]) {
+        bucket_pv01s_[bucket] += pv01_change;
+    }
+    pv01s_.InsertOrAssign(index, PV01<T>(product, unit_pv01, quantity));
+}
+
+template <typename T, typename S>
+PositionToRiskListener<T, S>::PositionToRiskListener(S* service) : service_(service) {}
+
+template <typename T, typename S>
+void PositionToRiskListener<T, S>::ProcessAdd(Position<T>& data)
 {
     service_->AddPosition(data);
 }
 
-template<typename T>
-void PositionToRiskListener<T>::ProcessRemove(Position<T>& data) {}
+template <typename T, typename S>
+void PositionToRiskListener<T, S>::ProcessRemove(Position<T>& data) {}
+
+template <typename T, typename S>
+void PositionToRiskListener<T, S>::ProcessUpdate(Position<T>& data) {}
 
 template<typename T>
-void PositionToRiskListener<T>::ProcessUpdate(Position<T>& data) {}
+size_t PV01<T>::GetMaxSerializedSize() const
+{
+    return GetMaxFieldSize(GetProduct().GetProductId()) + kMaxDoubleFieldSize + kMaxLongFieldSize;
+}
 
 template<typename T>
-vector<string> PV01<T>::ToString() const
+char* PV01<T>::Serialize(char* out) const
 {
-    string _product = product.GetProductId();
-    string _pv01 = to_string(pv01);
-    string _quantity = to_string(quantity);
-
-    vector<string> _strings;
-    _strings.push_back(_product);
-    _strings.push_back(_pv01);
-    _strings.push_back(_quantity);
-    return _strings;
+    out = WriteField(out, GetProduct().GetProductId());
+    out = WriteField(out, pv01);
+    out = WriteField(out, quantity);
+    return out;
 }
 
 #endif
@@ -0,0 +1,97 @@
+/**
+ * serialization.hpp
+ * Field writers for the text records persisted by historical data and the GUI
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) A persisted text record is "timestamp,field,field,...,\n": every field, including the last, is followed by a comma. Each data type writes its fields straight into a caller buffer with Serialize(char*), and bounds what it may write with GetMaxSerializedSize(), so a record is built in one pass with no intermediate strings.
+ (2) Numbers are written with to_chars and prices with FormatPrice. Doubles keep the "%f" format of to_string (fixed, 6 decimals), so the files read exactly as before.
+ (3) SerializeRecord builds a whole line, timestamp first, into a reused buffer that only grows. The result is handed to AsyncFileWriter as is.
+ */
+
+#ifndef serialization_hpp
+#define serialization_hpp
+
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include "price_tick.hpp"
+#include "timestamp.hpp"
+
+using namespace std;
+
+// Most characters a field of each kind takes, including its comma
+constexpr size_t kMaxLongFieldSize = 21;
+constexpr size_t kMaxDoubleFieldSize = 330;    // Fixed notation of DBL_MAX with 6 decimals
+constexpr size_t kMaxPriceFieldSize = kMaxPriceTextSize + 1;
+
+// Most characters a text field takes, including its comma
+constexpr size_t GetMaxFieldSize(string_view text) { return text.size() + 1; }
+
+// Write a text field and its comma; returns the end of the field
+char* WriteField(char* out, string_view text);
+
+// Write an integer field and its comma
+char* WriteField(char* out, long value);
+
+// Write a floating point field (fixed, 6 decimals) and its comma
+char* WriteField(char* out, double value);
+
+// Write a price field in bond notation and its comma
+char* WriteField(char* out, PriceTick price);
+
+// Build "timestamp,fields...,\n" for data in the buffer, growing it if needed; returns the record
+template <typename V>
+string_view SerializeRecord(vector<char>& buffer, const V& data);
+
+char* WriteField(char* out, string_view text)
+{
+    memcpy(out, text.data(), text.size());
+    out += text.size();
+    *out++ = ',';
+    return out;
+}
+
+char* WriteField(char* out, long value)
+{
+    out = to_chars(out, out + kMaxLongFieldSize, value).ptr;
+    *out++ = ',';
+    return out;
+}
+
+char* WriteField(char* out, double value)
+{
+    out = to_chars(out, out + kMaxDoubleFieldSize, value, chars_format::fixed, 6).ptr;
+    *out++ = ',';
+    return out;
+}
+
+char* WriteField(char* out, PriceTick price)
+{
+    out = FormatPrice(out, price);
+    *out++ = ',';
+    return out;
+}
+
+template <typename V>
+string_view SerializeRecord(vector<char>& buffer, const V& data)
+{
+    size_t max_size = kTimestampSize + 1 + data.GetMaxSerializedSize() + 1;
+    if (buffer.size() < max_size) {
+        buffer.resize(max_size);
+    }
+
+    char* begin = buffer.data();
+    char* out = begin + WriteTimestamp(begin);
+    *out++ = ',';
+    out = data.Serialize(out);
+    *out++ = '\n';
+    return string_view(begin, size_t(out - begin));
+}
+
+#endif /* serialization_hpp */
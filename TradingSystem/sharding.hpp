@@ -0,0 +1,489 @@
+/**
+ * sharding.hpp
+ * Sharded deployment of the tick-to-risk chain: products are partitioned over shards, each running its own services on its own core
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) A Shard owns a complete tick-to-risk chain (MarketData -> AlgoExecution -> Execution -> TradeBooking -> Position -> Risk, the compile-time wired StaticPipeline) for the products assigned to it. Everything in the chain runs on the shard's thread, so the services keep their single-threaded design and need no locks or strands.
+ (2) ShardMap partitions products either by hash of the identifier, or by ranges of product indices (contiguous, balanced blocks of the registry). The shard of every registered product is precomputed into a flat array, so routing a record is an identifier lookup and an array read.
+ (3) ShardRouter stands in front of the market data and trade connectors. It reads a feed (text or binary journal, see replay.hpp), and posts every record to the inbox of its product's shard: an AsyncListener ring whose consumer thread is pinned to the shard's core. Shards rebuild books and trades from the records exactly as the connectors do. A book is 2 * depth consecutive lines of one product, so it reaches one shard, in order, even with another feed routed at the same time.
+ (4) Shards share nothing on the trading path. Consumers that span products merge shard outputs: historical data listeners are multi-producer rings, so every shard publishes into the same listener, and bucketed risk is the sum over shards of each shard's buckets (a product contributes only on its own shard).
+ (5) Per-shard state that the unsharded chain keeps globally (the algo's alternating side, the round robin of booking books) advances per shard. With one shard, results are those of the unsharded chain.
+ */
+
+#ifndef sharding_hpp
+#define sharding_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include "async_listener.hpp"
+#include "bond_services.hpp"
+#include "feed_records.hpp"
+#include "product_registry.hpp"
+#include "replay.hpp"
+
+using namespace std;
+
+// How products are assigned to shards
+enum ShardPartition { HASH_PARTITION, RANGE_PARTITION };
+
+/**
+ * Settings of a sharded deployment.
+ */
+struct ShardConfig
+{
+    // Number of shards (0 for one per hardware thread); never more than there are products
+    unsigned shards = 0;
+
+    // Range partitioning keeps the shards balanced when the products are known up front, as they are here
+    ShardPartition partition = RANGE_PARTITION;
+
+    // Whether shard i is pinned to core first_core + i (modulo the number of cores)
+    bool pin_threads = true;
+    unsigned first_core = 0;
+
+    // Ring of each shard's inbox (the overflow policy must stay WAIT_FOR_ROOM: records cannot be dropped)
+    AsyncListenerConfig inbox;
+
+    // Where the router reads feeds: parsing text happens on the router thread, journals only need copying
+    ReplaySource feed_source = TEXT_REPLAY;
+};
+
+// A feed record on its way to a shard
+typedef variant<MarketDataFeedRecord, TradeFeedRecord> ShardRecord;
+
+/**
+ * Assignment of products to shards.
+ * Type T is the product type.
+ */
+template <typename T>
+class ShardMap
+{
+public:
+    // Partition the products registered so far
+    ShardMap(unsigned shard_count, ShardPartition partition);
+
+    // Shard of a product
+    unsigned GetShard(ProductIndex index) const;
+
+    // Shard of a product identifier; throws if the product is not registered
+    unsigned GetShard(string_view product_id) const;
+
+    // Indices of the products of a shard
+    vector<ProductIndex> GetProducts(unsigned shard) const;
+
+    unsigned GetShardCount() const;
+    ShardPartition GetPartition() const;
+
+private:
+    unsigned shard_count_;
+    ShardPartition partition_;
+    vector<unsigned> shards_;          // Indexed by product index
+};
+
+/**
+ * One shard: a tick-to-risk chain fed through its own inbox and thread.
+ * Type T is the product type.
+ */
+template <typename T>
+class Shard final : public ServiceListener<ShardRecord>
+{
+public:
+    typedef StaticPipeline<T> PipelineType;
+
+    // Core is where the shard's thread is pinned (-1 for none)
+    Shard(unsigned index, int core, const AsyncListenerConfig& inbox_config);
+
+    Shard(const Shard&) = delete;
+    Shard& operator = (const Shard&) = delete;
+
+    // Queue a record for the shard's thread (any thread may post)
+    void Post(const ShardRecord& record);
+
+    // Block until every record posted so far has been processed
+    void Drain();
+
+    // Get the services of the shard. Touch them from other threads only before posting, or after a drain.
+    PipelineType& GetPipeline();
+
+    unsigned GetIndex() const;
+    int GetCore() const;
+
+    // Number of books and trades injected into the chain
+    uint64_t GetBookCount() const;
+    uint64_t GetTradeCount() const;
+
+    // Get the inbox, for its high water mark and the utilization of the shard's thread
+    const AsyncListener<ShardRecord>& GetInbox() const;
+
+    // MARK: SERVICELISTENER CLASS OVERRIDE BELOW
+    // Records arrive here on the shard's thread
+    virtual void ProcessAdd(ShardRecord& record) override;
+
+    // Does nothing
+    virtual void ProcessRemove(ShardRecord& record) override;
+
+    // Does nothing
+    virtual void ProcessUpdate(ShardRecord& record) override;
+    // MARK: SERVICELISTENER CLASS OVERRIDE ABOVE
+
+private:
+    // As MarketDataConnector: rebuild the book in place, publish it once all its orders are in
+    void Apply(const MarketDataFeedRecord& record);
+
+    // As TradeBookingConnector
+    void Apply(const TradeFeedRecord& record);
+
+    unsigned index_;
+    int core_;
+    PipelineType pipeline_;
+    OrderBook<T>* book_;
+    unsigned order_count_;
+    uint64_t book_count_;
+    uint64_t trade_count_;
+
+    // Last, so that it is flushed and its thread joined before the pipeline goes away
+    AsyncListener<ShardRecord> inbox_;
+};
+
+/**
+ * Dispatches feed records to the shard of their product, and merges what spans shards.
+ * Type T is the product type.
+ */
+template <typename T>
+class ShardRouter
+{
+public:
+    explicit ShardRouter(ShardConfig config = ShardConfig());
+
+    ShardRouter(const ShardRouter&) = delete;
+    ShardRouter& operator = (const ShardRouter&) = delete;
+
+    // Route a whole feed, from the text file or its journal as configured; returns the number of records.
+    // Different feeds may be routed from different threads at the same time.
+    uint64_t RouteMarketData(const string& path = "marketdata.txt");
+    uint64_t RouteTrades(const string& path = "trades.txt");
+
+    // Route one record
+    void Route(const MarketDataFeedRecord& record);
+    void Route(const TradeFeedRecord& record);
+
+    // Block until every shard has processed what was routed to it
+    void Drain();
+
+    unsigned GetShardCount() const;
+    Shard<T>& GetShard(unsigned shard);
+    const ShardMap<T>& GetShardMap() const;
+
+    // Call f on every shard, in shard order
+    template <typename F>
+    void ForEachShard(F&& f);
+
+    // Bucketed risk merged over the shards (after a drain)
+    PV01< BucketedSector<T> > GetBucketedRisk(const BucketedSector<T>& sector);
+
+    // Books, trades, products and core of every shard (after a drain)
+    void PrintSummary(ostream& out) const;
+
+private:
+    template <typename R>
+    uint64_t RouteFeed(const string& path, uint32_t record_type);
+
+    ShardConfig config_;
+    ShardMap<T> map_;
+    vector<unique_ptr<Shard<T>>> shards_;
+};
+
+template <typename T>
+ShardMap<T>::ShardMap(unsigned shard_count, ShardPartition partition) : shard_count_(shard_count), partition_(partition)
+{
+    if (shard_count_ == 0) {
+        throw invalid_argument("ShardMap: shard count must be positive");
+    }
+    const ProductRegistry<T>& registry = ProductRegistry<T>::Instance();
+    size_t product_count = registry.Size();
+    shards_.resize(product_count);
+    for (size_t i = 0; i < product_count; i++) {
+        if (partition_ == HASH_PARTITION) {
+            shards_[i] = unsigned(hash<string_view>()(registry.Get(ProductIndex(i)).GetProductId()) % shard_count_);
+        } else {
+            shards_[i] = unsigned(i * shard_count_ / product_count);
+        }
+    }
+}
+
+template <typename T>
+unsigned ShardMap<T>::GetShard(ProductIndex index) const
+{
+    // Products registered after the map was built are dealt round robin
+    return (index < shards_.size()) ? shards_[index] : unsigned(index % shard_count_);
+}
+
+template <typename T>
+unsigned ShardMap<T>::GetShard(string_view product_id) const
+{
+    return GetShard(ProductRegistry<T>::Instance().GetIndex(product_id));
+}
+
+template <typename T>
+vector<ProductIndex> ShardMap<T>::GetProducts(unsigned shard) const
+{
+    vector<ProductIndex> products;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        if (shards_[i] == shard) {
+            products.push_back(ProductIndex(i));
+        }
+    }
+    return products;
+}
+
+template <typename T>
+unsigned ShardMap<T>::GetShardCount() const
+{
+    return shard_count_;
+}
+
+template <typename T>
+ShardPartition ShardMap<T>::GetPartition() const
+{
+    return partition_;
+}
+
+template <typename T>
+Shard<T>::Shard(unsigned index, int core, const AsyncListenerConfig& inbox_config) :
+  index_(index), core_(core), book_(nullptr), order_count_(0), book_count_(0), trade_count_(0),
+  inbox_(this, [&] { AsyncListenerConfig config = inbox_config; config.core = core; config.name = "shard" + to_string(index); return config; }()) {}
+
+template <typename T>
+void Shard<T>::Post(const ShardRecord& record)
+{
+    ShardRecord copy = record;
+    inbox_.ProcessAdd(copy);
+}
+
+template <typename T>
+void Shard<T>::Drain()
+{
+    inbox_.Flush();
+}
+
+template <typename T>
+typename Shard<T>::PipelineType& Shard<T>::GetPipeline()
+{
+    return pipeline_;
+}
+
+template <typename T>
+unsigned Shard<T>::GetIndex() const
+{
+    return index_;
+}
+
+template <typename T>
+int Shard<T>::GetCore() const
+{
+    return core_;
+}
+
+template <typename T>
+uint64_t Shard<T>::GetBookCount() const
+{
+    return book_count_;
+}
+
+template <typename T>
+uint64_t Shard<T>::GetTradeCount() const
+{
+    return trade_count_;
+}
+
+template <typename T>
+const AsyncListener<ShardRecord>& Shard<T>::GetInbox() const
+{
+    return inbox_;
+}
+
+template <typename T>
+void Shard<T>::ProcessAdd(ShardRecord& record)
+{
+    visit([this](const auto& feed_record) { Apply(feed_record); }, record);
+}
+
+template <typename T>
+void Shard<T>::ProcessRemove(ShardRecord& record) {}
+
+template <typename T>
+void Shard<T>::ProcessUpdate(ShardRecord& record) {}
+
+template <typename T>
+void Shard<T>::Apply(const MarketDataFeedRecord& record)
+{
+    auto& market_data_service = pipeline_.market_data_service;
+    unsigned read_lines = unsigned(market_data_service.GetBookDepth()) << 1;
+
+    // A new snapshot starts: rebuild the stored book in place
+    if (order_count_ == 0) {
+        book_ = &market_data_service.GetBook(FetchBond(JournalFieldView(record.product_id)));
+        book_->Clear();
+        LATENCY_STAMP(*book_);
+    }
+    book_->AddOrder(Order(PriceTick(record.price), record.quantity, PricingSide(record.side)));
+
+    order_count_++;
+    if (order_count_ == read_lines) {
+        order_count_ = 0;
+        book_count_++;
+        market_data_service.OnMessage(*book_);
+    }
+}
+
+template <typename T>
+void Shard<T>::Apply(const TradeFeedRecord& record)
+{
+    Trade<T> trade(FetchBond(JournalFieldView(record.product_id)), string(JournalFieldView(record.trade_id)), PriceTick(record.price),
+                   string(JournalFieldView(record.book)), record.quantity, Side(record.side));
+    LATENCY_STAMP(trade);
+    trade_count_++;
+    pipeline_.trade_booking_service.OnMessage(trade);
+}
+
+template <typename T>
+ShardRouter<T>::ShardRouter(ShardConfig config) :
+  config_(config),
+  map_([&] {
+      unsigned shards = (config.shards > 0) ? config.shards : max(1u, thread::hardware_concurrency());
+      size_t products = max<size_t>(1, ProductRegistry<T>::Instance().Size());
+      return unsigned(min<size_t>(shards, products));
+  }(), config.partition)
+{
+    if (config_.inbox.overflow_policy != WAIT_FOR_ROOM) {
+        throw invalid_argument("ShardRouter: shard inboxes must not drop records");
+    }
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    for (unsigned i = 0; i < map_.GetShardCount(); i++) {
+        int core = config_.pin_threads ? int((config_.first_core + i) % cores) : -1;
+        shards_.push_back(make_unique<Shard<T>>(i, core, config_.inbox));
+    }
+}
+
+template <typename T>
+uint64_t ShardRouter<T>::RouteMarketData(const string& path)
+{
+    return RouteFeed<MarketDataFeedRecord>(path, MARKET_DATA_FEED_RECORD);
+}
+
+template <typename T>
+uint64_t ShardRouter<T>::RouteTrades(const string& path)
+{
+    return RouteFeed<TradeFeedRecord>(path, TRADE_FEED_RECORD);
+}
+
+template <typename T>
+template <typename R>
+uint64_t ShardRouter<T>::RouteFeed(const string& path, uint32_t record_type)
+{
+    ReplayOptions options;
+    options.source = config_.feed_source;
+    FeedSource<R> feed(path, record_type, options);
+
+    R record;
+    int64_t timestamp;
+    uint64_t count = 0;
+    while (feed.Next(record, timestamp)) {
+        Route(record);
+        count++;
+    }
+    return count;
+}
+
+template <typename T>
+void ShardRouter<T>::Route(const MarketDataFeedRecord& record)
+{
+    shards_[map_.GetShard(JournalFieldView(record.product_id))]->Post(record);
+}
+
+template <typename T>
+void ShardRouter<T>::Route(const TradeFeedRecord& record)
+{
+    shards_[map_.GetShard(JournalFieldView(record.product_id))]->Post(record);
+}
+
+template <typename T>
+void ShardRouter<T>::Drain()
+{
+    for (auto& shard : shards_) {
+        shard->Drain();
+    }
+}
+
+template <typename T>
+unsigned ShardRouter<T>::GetShardCount() const
+{
+    return unsigned(shards_.size());
+}
+
+template <typename T>
+Shard<T>& ShardRouter<T>::GetShard(unsigned shard)
+{
+    return *shards_.at(shard);
+}
+
+template <typename T>
+const ShardMap<T>& ShardRouter<T>::GetShardMap() const
+{
+    return map_;
+}
+
+template <typename T>
+template <typename F>
+void ShardRouter<T>::ForEachShard(F&& f)
+{
+    for (auto& shard : shards_) {
+        f(*shard);
+    }
+}
+
+template <typename T>
+PV01<BucketedSector<T>> ShardRouter<T>::GetBucketedRisk(const BucketedSector<T>& sector)
+{
+    double pv01 = 0.;
+    long quantity = 1;  // Dummy, as RiskService::GetBucketedRisk
+    for (auto& shard : shards_) {
+        pv01 += shard->GetPipeline().risk_service.GetBucketedRisk(sector).GetPV01();
+    }
+    return PV01<BucketedSector<T>>(sector, pv01, quantity);
+}
+
+template <typename T>
+void ShardRouter<T>::PrintSummary(ostream& out) const
+{
+    const ProductRegistry<T>& registry = ProductRegistry<T>::Instance();
+    for (const auto& shard : shards_) {
+        out << "Shard " << shard->GetIndex();
+        if (shard->GetCore() >= 0) {
+            out << " (core " << shard->GetCore() << ")";
+        }
+        const AsyncListener<ShardRecord>& inbox = shard->GetInbox();
+        out << ": " << shard->GetBookCount() << " books, " << shard->GetTradeCount() << " trades, inbox high water mark " << inbox.GetHighWaterMark() << " of " << inbox.GetQueueStats().capacity
+            << ", utilization " << inbox.GetExecutorThread().GetStats().GetUtilization() * 100 << "%, products";
+        for (ProductIndex index : map_.GetProducts(shard->GetIndex())) {
+            out << " " << registry.Get(index).GetProductId();
+        }
+        out << endl;
+    }
+}
+
+#endif /* sharding_hpp */
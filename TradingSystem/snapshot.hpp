@@ -0,0 +1,676 @@
+/**
+ * snapshot.hpp
+ * Binary snapshots of the service state, tagged with the feed offsets they cover, for a warm restart
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) A snapshot holds what cannot be rebuilt from the tail of the feeds: the order books, positions, quantities at risk and open inquiries, plus the counters that pick the side of the next algo execution, the size of the next stream and the book of the next booking. Services that only keep the last record they forwarded (prices, executions, streams, trades) are rebuilt by the tail.
+ (2) The file is a header, the cursor of every feed (byte offset and line count), then one section per service: a count followed by fixed-layout records. Books and positions are a record followed by their levels or books, so nothing is truncated.
+ (3) SnapshotFeedRunner maps every feed file and hands the connectors chunks of it through LineReader, so a snapshot can be taken between chunks. Nothing runs concurrently with the feed thread then, so the state is consistent with the cursors. A market data chunk is a whole number of books, and a snapshot is skipped if a book is still incomplete.
+ (4) A snapshot is written to a temporary file and renamed over the previous one, so the file on disk is always the latest complete snapshot.
+ (5) On restart the snapshot is loaded into the services without notifying any listener, and every feed resumes from its offset. A snapshot whose feeds were generated from other parameters (see the feed .key files) is ignored.
+ (6) Records must have the same layout on the writing and reading machine, as for the journals.
+ */
+
+#ifndef snapshot_hpp
+#define snapshot_hpp
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.hpp"
+#include "feed_records.hpp"
+#include "line_reader.hpp"
+#include "product_registry.hpp"
+#include "utilities.hpp"
+#include "market_data_service.hpp"
+#include "algo_execution_service.hpp"
+#include "algo_streaming_service.hpp"
+#include "trade_booking_service.hpp"
+#include "position_service.hpp"
+#include "risk_service.hpp"
+#include "inquiry_service.hpp"
+
+using namespace std;
+
+// "TSSNAP01"
+constexpr uint64_t kSnapshotMagic = 0x313050414E535354ULL;
+constexpr uint32_t kSnapshotVersion = 1;
+
+// Width of feed path fields
+constexpr size_t kSnapshotPathSize = 64;
+
+struct SnapshotHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t feed_count;
+    uint64_t sequence;           // Feed lines applied when the snapshot was taken
+    int64_t timestamp;           // Nanoseconds since the epoch (wall clock)
+};
+
+// Where a feed stands
+struct SnapshotFeedRecord
+{
+    char path[kSnapshotPathSize];
+    uint64_t offset;             // Bytes applied from the start of the file
+    uint64_t lines;              // Lines applied
+    uint64_t key_hash;           // Hash of the feed's .key file (0 without one)
+};
+
+struct SnapshotCounterRecord
+{
+    int64_t algo_executions;
+    int64_t algo_streams;
+    int64_t bookings;
+};
+
+// An order book, followed by bid_count bid levels and offer_count offer levels
+struct SnapshotBookRecord
+{
+    char product_id[kFeedProductIdSize];
+    uint32_t bid_count;
+    uint32_t offer_count;
+};
+
+struct SnapshotLevelRecord
+{
+    int64_t price;               // Ticks
+    int64_t quantity;
+};
+
+// A position, followed by book_count books
+struct SnapshotPositionRecord
+{
+    char product_id[kFeedProductIdSize];
+    uint32_t book_count;
+    uint32_t padding;
+};
+
+struct SnapshotBookPositionRecord
+{
+    char book[kFeedIdSize];
+    int64_t position;
+};
+
+struct SnapshotPV01Record
+{
+    char product_id[kFeedProductIdSize];
+    int64_t quantity;
+};
+
+// Open inquiries are stored as inquiry feed records (see feed_records.hpp)
+
+/**
+ * Cursor of a feed file: how much of it the services have applied.
+ */
+struct FeedCursor
+{
+    string path;
+    uint64_t offset = 0;
+    uint64_t lines = 0;
+};
+
+/**
+ * Services saved into and restored from a snapshot. Services left null are skipped.
+ */
+template <typename T>
+struct SnapshotServices
+{
+    MarketDataService<T>* market_data = nullptr;
+    AlgoExecutionService<T>* algo_execution = nullptr;
+    AlgoStreamingService<T>* algo_streaming = nullptr;
+    TradeBookingService<T>* trade_booking = nullptr;
+    PositionService<T>* positions = nullptr;
+    RiskService<T>* risk = nullptr;
+    InquiryService<T>* inquiries = nullptr;
+};
+
+// Hash of the key file of a feed (0 if there is none), to tell whether a snapshot was taken over the same feed
+uint64_t GetFeedKeyHash(const string& path);
+
+// Write a snapshot of the services and feed cursors, replacing the file at path. Returns the size written.
+template <typename T>
+size_t SaveSnapshot(const string& path, const SnapshotServices<T>& services, const vector<FeedCursor>& feeds, uint64_t sequence);
+
+// Load a snapshot into the services and move the cursors of its feeds to where it was taken. Returns the sequence of the snapshot.
+// Throws if the file is malformed; returns nullopt (leaving everything untouched) if it was taken over other feeds.
+template <typename T>
+optional<uint64_t> LoadSnapshot(const string& path, const SnapshotServices<T>& services, vector<FeedCursor>& feeds);
+
+/**
+ * Read-only mapping of a whole file.
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator = (const MappedFile&) = delete;
+
+    const char* Data() const;
+    size_t Size() const;
+
+private:
+    const char* data_;
+    size_t size_;
+};
+
+struct SnapshotConfig
+{
+    string path = "state.snapshot";
+    uint64_t interval = 0;            // Feed lines between snapshots (0 to snapshot only when the feeds are done)
+    bool restore = false;             // Load the snapshot at path, if any, and process only the tail of the feeds
+};
+
+/**
+ * Runs feed files one after the other through their connectors, from their cursors, snapshotting the services as it goes.
+ * Type T is the product type.
+ */
+template <typename T>
+class SnapshotFeedRunner
+{
+public:
+    SnapshotFeedRunner(const SnapshotConfig& config, const SnapshotServices<T>& services);
+
+    // Add a feed. subscribe hands a chunk of the file to its connector. A chunk is a multiple of unit_lines lines,
+    // and at_boundary (if any) tells whether the connector is between units, i.e. whether a snapshot may be taken.
+    void AddFeed(const string& name, const string& path, function<void(LineReader&)> subscribe, unsigned unit_lines = 1, function<bool()> at_boundary = nullptr);
+
+    // Load the snapshot at the configured path, if restoring and there is one; returns whether it was loaded
+    bool Restore();
+
+    // Process the rest of every feed, snapshotting every interval lines and at the end
+    void Run();
+
+    // Feed lines applied so far (including those restored from the snapshot)
+    uint64_t GetSequence() const;
+
+    // Number of snapshots written
+    size_t GetSnapshotCount() const;
+
+private:
+    struct Feed
+    {
+        string name;
+        function<void(LineReader&)> subscribe;
+        unsigned unit_lines;
+        function<bool()> at_boundary;
+    };
+
+    // Write a snapshot, keeping its size and time for the log
+    void Save();
+
+    SnapshotConfig config_;
+    SnapshotServices<T> services_;
+    vector<Feed> feeds_;
+    vector<FeedCursor> cursors_;     // Same order as feeds_
+    uint64_t sequence_;
+    size_t snapshot_count_;
+    size_t last_snapshot_size_;
+    double total_snapshot_ms_;
+};
+
+/**
+ * Appends fixed-layout records to a buffer.
+ */
+class SnapshotWriter
+{
+public:
+    template <typename R>
+    void Write(const R& record);
+
+    const vector<char>& GetBuffer() const;
+
+private:
+    vector<char> buffer_;
+};
+
+/**
+ * Reads fixed-layout records back from a buffer; throws past its end.
+ */
+class SnapshotReader
+{
+public:
+    explicit SnapshotReader(const vector<char>& buffer);
+
+    template <typename R>
+    R Read();
+
+private:
+    const vector<char>& buffer_;
+    size_t position_;
+};
+
+template <typename R>
+void SnapshotWriter::Write(const R& record)
+{
+    static_assert(is_trivially_copyable_v<R>, "Snapshot records must be trivially copyable");
+    const char* bytes = reinterpret_cast<const char*>(&record);
+    buffer_.insert(buffer_.end(), bytes, bytes + sizeof(R));
+}
+
+const vector<char>& SnapshotWriter::GetBuffer() const
+{
+    return buffer_;
+}
+
+SnapshotReader::SnapshotReader(const vector<char>& buffer) : buffer_(buffer), position_(0) {}
+
+template <typename R>
+R SnapshotReader::Read()
+{
+    static_assert(is_trivially_copyable_v<R>, "Snapshot records must be trivially copyable");
+    if (buffer_.size() - position_ < sizeof(R)) {
+        throw runtime_error("SnapshotReader: truncated snapshot");
+    }
+    R record;
+    memcpy(&record, buffer_.data() + position_, sizeof(R));
+    position_ += sizeof(R);
+    return record;
+}
+
+uint64_t GetFeedKeyHash(const string& path)
+{
+    ifstream key_file(path + ".key", ios::binary);
+    if (!key_file) {
+        return 0;
+    }
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (istreambuf_iterator<char> it(key_file), end; it != end; ++it) {
+        hash = (hash ^ static_cast<unsigned char>(*it)) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+template <typename T>
+size_t SaveSnapshot(const string& path, const SnapshotServices<T>& services, const vector<FeedCursor>& feeds, uint64_t sequence)
+{
+    const ProductRegistry<T>& registry = ProductRegistry<T>::Instance();
+    size_t product_count = registry.Size();
+    SnapshotWriter writer;
+
+    writer.Write(SnapshotHeader{kSnapshotMagic, kSnapshotVersion, uint32_t(feeds.size()), sequence, GetJournalTimestamp()});
+    for (const FeedCursor& cursor : feeds) {
+        SnapshotFeedRecord record{};
+        CopyJournalFieldExact(record.path, cursor.path);
+        record.offset = cursor.offset;
+        record.lines = cursor.lines;
+        record.key_hash = GetFeedKeyHash(cursor.path);
+        writer.Write(record);
+    }
+
+    SnapshotCounterRecord counters{};
+    if (services.algo_execution) {
+        counters.algo_executions = services.algo_execution->GetExecutionCount();
+    }
+    if (services.algo_streaming) {
+        counters.algo_streams = services.algo_streaming->GetStreamCount();
+    }
+    if (services.trade_booking) {
+        counters.bookings = services.trade_booking->GetInListener()->GetBookingCount();
+    }
+    writer.Write(counters);
+
+    // Each section is its count, then its records
+    vector<const OrderBook<T>*> books;
+    for (ProductIndex index = 0; services.market_data && index < product_count; index++) {
+        if (const OrderBook<T>* book = services.market_data->FindBook(index)) {
+            books.push_back(book);
+        }
+    }
+    writer.Write(uint64_t(books.size()));
+    for (const OrderBook<T>* book : books) {
+        SnapshotBookRecord record{};
+        CopyJournalFieldExact(record.product_id, book->GetProduct().GetProductId());
+        record.bid_count = uint32_t(book->GetBidStack().size());
+        record.offer_count = uint32_t(book->GetOfferStack().size());
+        writer.Write(record);
+        for (const auto* stack : {&book->GetBidStack(), &book->GetOfferStack()}) {
+            for (const Order& order : *stack) {
+                writer.Write(SnapshotLevelRecord{order.GetPrice().GetTicks(), order.GetQuantity()});
+            }
+        }
+    }
+
+    vector<const Position<T>*> positions;
+    for (ProductIndex index = 0; services.positions && index < product_count; index++) {
+        if (const Position<T>* position = services.positions->FindPosition(index)) {
+            positions.push_back(position);
+        }
+    }
+    writer.Write(uint64_t(positions.size()));
+    vector<SnapshotBookPositionRecord> book_positions;
+    for (const Position<T>* position : positions) {
+        book_positions.clear();
+        position->ForEachBook([&book_positions](const string& book, long quantity) {
+            SnapshotBookPositionRecord record{};
+            CopyJournalFieldExact(record.book, book);
+            record.position = quantity;
+            book_positions.push_back(record);
+        });
+        SnapshotPositionRecord record{};
+        CopyJournalFieldExact(record.product_id, position->GetProduct().GetProductId());
+        record.book_count = uint32_t(book_positions.size());
+        writer.Write(record);
+        for (const auto& book_position : book_positions) {
+            writer.Write(book_position);
+        }
+    }
+
+    vector<SnapshotPV01Record> pv01s;
+    for (ProductIndex index = 0; services.risk && index < product_count; index++) {
+        if (const PV01<T>* pv01 = services.risk->FindPV01(index)) {
+            SnapshotPV01Record record{};
+            CopyJournalFieldExact(record.product_id, pv01->GetProduct().GetProductId());
+            record.quantity = pv01->GetQuantity();
+            pv01s.push_back(record);
+        }
+    }
+    writer.Write(uint64_t(pv01s.size()));
+    for (const auto& record : pv01s) {
+        writer.Write(record);
+    }
+
+    vector<InquiryFeedRecord> inquiries;
+    if (services.inquiries) {
+        services.inquiries->ForEachOpenInquiry([&inquiries](const Inquiry<T>& inquiry) {
+            InquiryFeedRecord record{};
+            CopyJournalFieldExact(record.inquiry_id, inquiry.GetInquiryId());
+            CopyJournalFieldExact(record.product_id, inquiry.GetProduct().GetProductId());
+            record.quantity = inquiry.GetQuantity();
+            record.price = inquiry.GetPrice().GetTicks();
+            record.side = inquiry.GetSide();
+            record.state = inquiry.GetState();
+            inquiries.push_back(record);
+        });
+    }
+    writer.Write(uint64_t(inquiries.size()));
+    for (const auto& record : inquiries) {
+        writer.Write(record);
+    }
+
+    // Replace the previous snapshot only once this one is complete
+    string temporary_path = path + ".tmp";
+    {
+        ofstream out(temporary_path, ios::binary | ios::trunc);
+        const vector<char>& buffer = writer.GetBuffer();
+        out.write(buffer.data(), buffer.size());
+        if (!out.flush()) {
+            throw runtime_error("SaveSnapshot: cannot write " + temporary_path);
+        }
+    }
+    filesystem::rename(temporary_path, path);
+    return writer.GetBuffer().size();
+}
+
+template <typename T>
+optional<uint64_t> LoadSnapshot(const string& path, const SnapshotServices<T>& services, vector<FeedCursor>& feeds)
+{
+    ifstream in(path, ios::binary);
+    if (!in) {
+        throw runtime_error("LoadSnapshot: cannot open " + path);
+    }
+    vector<char> buffer((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    SnapshotReader reader(buffer);
+
+    SnapshotHeader header = reader.Read<SnapshotHeader>();
+    if (header.magic != kSnapshotMagic || header.version != kSnapshotVersion) {
+        throw runtime_error("LoadSnapshot: " + path + " is not a snapshot of this version");
+    }
+
+    // Check every feed before touching any service
+    vector<pair<FeedCursor*, SnapshotFeedRecord>> restored_feeds;
+    for (uint32_t i = 0; i < header.feed_count; i++) {
+        SnapshotFeedRecord record = reader.Read<SnapshotFeedRecord>();
+        string_view feed_path = JournalFieldView(record.path);
+        for (FeedCursor& cursor : feeds) {
+            if (cursor.path != feed_path) {
+                continue;
+            }
+            std::error_code size_error;
+            uintmax_t size = filesystem::file_size(cursor.path, size_error);
+            if (record.key_hash != GetFeedKeyHash(cursor.path) || size_error || record.offset > size) {
+                return nullopt;
+            }
+            restored_feeds.emplace_back(&cursor, record);
+        }
+    }
+
+    SnapshotCounterRecord counters = reader.Read<SnapshotCounterRecord>();
+    if (services.algo_execution) {
+        services.algo_execution->SetExecutionCount(counters.algo_executions);
+    }
+    if (services.algo_streaming) {
+        services.algo_streaming->SetStreamCount(counters.algo_streams);
+    }
+    if (services.trade_booking) {
+        services.trade_booking->GetInListener()->SetBookingCount(counters.bookings);
+    }
+
+    const ProductRegistry<T>& registry = ProductRegistry<T>::Instance();
+    uint64_t book_count = reader.Read<uint64_t>();
+    for (uint64_t i = 0; i < book_count; i++) {
+        SnapshotBookRecord record = reader.Read<SnapshotBookRecord>();
+        const T& product = registry.Get(JournalFieldView(record.product_id));
+        OrderBook<T>* book = services.market_data ? &services.market_data->GetBook(product) : nullptr;
+        if (book) {
+            book->Clear();
+        }
+        for (uint32_t level = 0; level < record.bid_count + record.offer_count; level++) {
+            SnapshotLevelRecord order = reader.Read<SnapshotLevelRecord>();
+            if (book) {
+                book->AddOrder(Order(PriceTick(order.price), order.quantity, level < record.bid_count ? BID : OFFER));
+            }
+        }
+    }
+
+    uint64_t position_count = reader.Read<uint64_t>();
+    for (uint64_t i = 0; i < position_count; i++) {
+        SnapshotPositionRecord record = reader.Read<SnapshotPositionRecord>();
+        Position<T> position(registry.Get(JournalFieldView(record.product_id)));
+        for (uint32_t j = 0; j < record.book_count; j++) {
+            SnapshotBookPositionRecord book_position = reader.Read<SnapshotBookPositionRecord>();
+            string book(JournalFieldView(book_position.book));
+            position.AddPosition(book, book_position.position, BUY);
+        }
+        if (services.positions) {
+            services.positions->OnMessage(position);
+        }
+    }
+
+    uint64_t pv01_count = reader.Read<uint64_t>();
+    for (uint64_t i = 0; i < pv01_count; i++) {
+        SnapshotPV01Record record = reader.Read<SnapshotPV01Record>();
+        if (services.risk) {
+            services.risk->RestorePV01(PV01<T>(registry.Get(JournalFieldView(record.product_id)), 0., record.quantity));
+        }
+    }
+
+    uint64_t inquiry_count = reader.Read<uint64_t>();
+    for (uint64_t i = 0; i < inquiry_count; i++) {
+        InquiryFeedRecord record = reader.Read<InquiryFeedRecord>();
+        Inquiry<T> inquiry(string(JournalFieldView(record.inquiry_id)), registry.Get(JournalFieldView(record.product_id)), Side(record.side), record.quantity, PriceTick(record.price), InquiryState(record.state));
+        if (services.inquiries) {
+            services.inquiries->RestoreInquiry(inquiry);
+        }
+    }
+
+    for (auto& [cursor, record] : restored_feeds) {
+        cursor->offset = record.offset;
+        cursor->lines = record.lines;
+    }
+    return header.sequence;
+}
+
+MappedFile::MappedFile(const string& path) : data_(nullptr), size_(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("MappedFile: cannot open " + path);
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        throw runtime_error("MappedFile: cannot stat " + path);
+    }
+    size_ = size_t(file_stat.st_size);
+    if (size_ > 0) {
+        void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw runtime_error("MappedFile: cannot map " + path);
+        }
+        data_ = static_cast<const char*>(mapping);
+        madvise(mapping, size_, MADV_SEQUENTIAL);
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+const char* MappedFile::Data() const
+{
+    return data_;
+}
+
+size_t MappedFile::Size() const
+{
+    return size_;
+}
+
+template <typename T>
+SnapshotFeedRunner<T>::SnapshotFeedRunner(const SnapshotConfig& config, const SnapshotServices<T>& services) :
+  config_(config), services_(services), sequence_(0), snapshot_count_(0), last_snapshot_size_(0), total_snapshot_ms_(0.) {}
+
+template <typename T>
+void SnapshotFeedRunner<T>::AddFeed(const string& name, const string& path, function<void(LineReader&)> subscribe, unsigned unit_lines, function<bool()> at_boundary)
+{
+    feeds_.push_back(Feed{name, move(subscribe), max(unit_lines, 1u), move(at_boundary)});
+    FeedCursor cursor;
+    cursor.path = path;
+    cursors_.push_back(cursor);
+}
+
+template <typename T>
+bool SnapshotFeedRunner<T>::Restore()
+{
+    if (!config_.restore || !filesystem::exists(config_.path)) {
+        return false;
+    }
+    auto start = chrono::steady_clock::now();
+    optional<uint64_t> sequence = LoadSnapshot(config_.path, services_, cursors_);
+    if (!sequence) {
+        cout << GetTimestamp() << " Snapshot " << config_.path << " Was Taken Over Other Feeds, Ignored." << endl;
+        return false;
+    }
+    sequence_ = *sequence;
+    double elapsed_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << GetTimestamp() << " Snapshot Restored: " << sequence_ << " Feed Lines in " << elapsed_ms << " ms." << endl;
+    return true;
+}
+
+template <typename T>
+void SnapshotFeedRunner<T>::Run()
+{
+    for (size_t i = 0; i < feeds_.size(); i++) {
+        Feed& feed = feeds_[i];
+        FeedCursor& cursor = cursors_[i];
+        MappedFile file(cursor.path);
+        if (cursor.offset > file.Size()) {
+            throw runtime_error("SnapshotFeedRunner: " + cursor.path + " is shorter than its cursor");
+        }
+        if (cursor.offset == file.Size() && cursor.lines > 0) {
+            // Fully applied before the snapshot
+            continue;
+        }
+
+        cout << GetTimestamp() << " " << feed.name << " Processing" << (cursor.lines > 0 ? " From Line " + to_string(cursor.lines) : "") << "..." << endl;
+        uint64_t chunk_lines = (config_.interval + feed.unit_lines - 1) / feed.unit_lines * feed.unit_lines;
+        const char* begin = file.Data() + cursor.offset;
+        const char* end = file.Data() + file.Size();
+        while (begin < end) {
+            // The chunk ends after chunk_lines newlines (or at the end of the file)
+            const char* chunk_end = end;
+            uint64_t lines = 0;
+            if (chunk_lines > 0) {
+                const char* scan = begin;
+                while (lines < chunk_lines && scan < end) {
+                    const char* newline = static_cast<const char*>(memchr(scan, '\n', end - scan));
+                    scan = (newline == nullptr) ? end : newline + 1;
+                    lines++;
+                }
+                chunk_end = scan;
+            } else {
+                for (const char* scan = begin; scan < end; lines++) {
+                    const char* newline = static_cast<const char*>(memchr(scan, '\n', end - scan));
+                    scan = (newline == nullptr) ? end : newline + 1;
+                }
+            }
+
+            LineReader reader(begin, chunk_end);
+            feed.subscribe(reader);
+            cursor.offset += chunk_end - begin;
+            cursor.lines += lines;
+            sequence_ += lines;
+            begin = chunk_end;
+
+            if (chunk_lines > 0 && begin < end && (!feed.at_boundary || feed.at_boundary())) {
+                Save();
+            }
+        }
+        cout << GetTimestamp() << " " << feed.name << " Processed." << endl;
+    }
+    Save();
+    cout << GetTimestamp() << " Snapshots Saved: " << snapshot_count_ << " (the last at " << sequence_ << " Feed Lines, " << last_snapshot_size_ << " Bytes), " << total_snapshot_ms_ << " ms in total." << endl;
+}
+
+template <typename T>
+void SnapshotFeedRunner<T>::Save()
+{
+    auto start = chrono::steady_clock::now();
+    last_snapshot_size_ = SaveSnapshot(config_.path, services_, cursors_, sequence_);
+    snapshot_count_++;
+    total_snapshot_ms_ += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+template <typename T>
+uint64_t SnapshotFeedRunner<T>::GetSequence() const
+{
+    return sequence_;
+}
+
+template <typename T>
+size_t SnapshotFeedRunner<T>::GetSnapshotCount() const
+{
+    return snapshot_count_;
+}
+
+#endif /* snapshot_hpp */
@@ -89,7 +89,7 @@ public:
     virtual void Publish(V &data) = 0;
     
     // Subscribe data from the Connector
-    virtual void Subscribe(ifstream& data) = 0;
+    virtual void Subscribe(istream& data) = 0;
 
 };
 
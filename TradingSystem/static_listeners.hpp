@@ -0,0 +1,67 @@
+/**
+ * static_listeners.hpp
+ * Compile-time listener list, for wiring a fixed service graph without virtual dispatch
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) StaticListeners<V, Ls...> holds pointers to listeners of known concrete types. Notifying it expands to direct calls on each of them, so with `final` listener classes the compiler sees through the hop and can inline the next service.
+ (2) The services on the tick-to-trade chain (MarketData -> AlgoExecution -> Execution -> TradeBooking -> Position -> Risk) take the list as an extra template parameter, defaulting to an empty list. Their listeners are templated on the service they drive, so a chain of concrete types can be spelled out bottom-up (see StaticPipeline in bond_services.hpp).
+ (3) Static listeners are notified first, then the dynamic ones added with AddListener, which keeps working as before.
+ */
+
+#ifndef static_listeners_hpp
+#define static_listeners_hpp
+
+#include <tuple>
+
+using namespace std;
+
+/**
+ * A fixed list of listeners of concrete types Ls, all listening to events of type V.
+ */
+template <typename V, typename... Ls>
+class StaticListeners
+{
+public:
+    StaticListeners() = default;
+
+    // Set the listeners (nullptr leaves a listener unbound)
+    void Bind(Ls*... listeners);
+
+    // Notify every bound listener
+    void ProcessAdd(V& data);
+    void ProcessRemove(V& data);
+    void ProcessUpdate(V& data);
+
+private:
+    tuple<Ls*...> listeners_{};
+};
+
+template <typename V, typename... Ls>
+void StaticListeners<V, Ls...>::Bind(Ls*... listeners)
+{
+    listeners_ = tuple<Ls*...>(listeners...);
+}
+
+template <typename V, typename... Ls>
+void StaticListeners<V, Ls...>::ProcessAdd(V& data)
+{
+    apply([&data](auto*... listeners) { ((listeners != nullptr ? listeners->ProcessAdd(data) : void()), ...); }, listeners_);
+}
+
+template <typename V, typename... Ls>
+void StaticListeners<V, Ls...>::ProcessRemove(V& data)
+{
+    apply([&data](auto*... listeners) { ((listeners != nullptr ? listeners->ProcessRemove(data) : void()), ...); }, listeners_);
+}
+
+template <typename V, typename... Ls>
+void StaticListeners<V, Ls...>::ProcessUpdate(V& data)
+{
+    apply([&data](auto*... listeners) { ((listeners != nullptr ? listeners->ProcessUpdate(data) : void()), ...); }, listeners_);
+}
+
+#endif /* static_listeners_hpp */
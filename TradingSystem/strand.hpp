@@ -0,0 +1,123 @@
+/**
+ * strand.hpp
+ * Serializes work posted from several threads onto one worker thread
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) A Strand owns a FIFO task queue and a single worker thread. Everything posted to the same strand runs one task at a time, in the order it was posted, so a service driven through a strand needs no locking of its own.
+ (2) Services where several feeds meet (e.g. TradeBookingService, fed by its file connector and by ExecutionService) post their entry points to a strand. Services owned by a single feed thread are called directly as before.
+ (3) Drain blocks until every task posted so far has run, which is how a feed thread hands off at the end of a run.
+ */
+
+#ifndef strand_hpp
+#define strand_hpp
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+/**
+ * FIFO task queue executed by one worker thread.
+ */
+class Strand
+{
+public:
+    Strand();
+
+    // Runs the remaining tasks before joining the worker
+    ~Strand();
+
+    Strand(const Strand&) = delete;
+    Strand& operator = (const Strand&) = delete;
+
+    // Queue a task
+    void Post(function<void()> task);
+
+    // Block until every task posted so far has run
+    void Drain();
+
+    // Whether the caller is the strand's worker thread
+    bool RunningInThisThread() const;
+
+private:
+    // Worker loop
+    void Run();
+
+    deque<function<void()>> tasks_;
+    bool busy_;
+    bool stopping_;
+
+    mutable mutex mutex_;
+    condition_variable task_cv_;
+    condition_variable idle_cv_;
+    thread thread_;
+};
+
+Strand::Strand() : busy_(false), stopping_(false)
+{
+    thread_ = thread(&Strand::Run, this);
+}
+
+Strand::~Strand()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    task_cv_.notify_one();
+    thread_.join();
+}
+
+void Strand::Post(function<void()> task)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    task_cv_.notify_one();
+}
+
+void Strand::Drain()
+{
+    unique_lock<mutex> lock(mutex_);
+    idle_cv_.wait(lock, [this] { return tasks_.empty() && !busy_; });
+}
+
+bool Strand::RunningInThisThread() const
+{
+    return this_thread::get_id() == thread_.get_id();
+}
+
+void Strand::Run()
+{
+    unique_lock<mutex> lock(mutex_);
+    while (true) {
+        task_cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+            // Stopping and nothing left to run
+            break;
+        }
+
+        function<void()> task = std::move(tasks_.front());
+        tasks_.pop_front();
+        busy_ = true;
+
+        lock.unlock();
+        task();
+        lock.lock();
+
+        busy_ = false;
+        if (tasks_.empty()) {
+            idle_cv_.notify_all();
+        }
+    }
+}
+
+#endif /* strand_hpp */
@@ -10,6 +10,7 @@
 #include "soa.hpp"
 #include "algo_streaming_service.hpp"
 #include <unordered_map>
+#include "product_registry.hpp"
 #include <string>
 
 template<typename T>
@@ -23,8 +24,9 @@ class AlgoStreamingToStreamingListener;
 template<typename T>
 class StreamingService : public Service<string,PriceStream <T> > {
 private:
-    unordered_map<string, PriceStream<T>> price_streams_;
+    ProductStore<PriceStream<T>> price_streams_;     // Indexed by product index
     ServiceListener<AlgoStream<T>>* in_listener_;
+    Connector<PriceStream<T>>* out_connector_;
 
 public:
     
@@ -52,6 +54,9 @@ public:
     // Publish two-way prices
     void PublishPrice(PriceStream<T>& priceStream);
 
+    // Also publish through a connector, e.g. to a venue (nullptr for none)
+    void SetConnector(Connector<PriceStream<T>>* connector);
+
 };
 
 template<typename T>
@@ -76,7 +81,7 @@ public:
 };
 
 template<typename T>
-StreamingService<T>::StreamingService() {
+StreamingService<T>::StreamingService() : price_streams_(ProductRegistry<T>::Instance().Size()), out_connector_(nullptr) {
     in_listener_ = new AlgoStreamingToStreamingListener<T>(this);
 }
 
@@ -87,14 +92,14 @@ StreamingService<T>::~StreamingService() {
 
 template <typename T>
 PriceStream<T>& StreamingService<T>::GetData(string product_id) {
-    return price_streams_[product_id];
+    return price_streams_[ProductRegistry<T>::Instance().GetIndex(product_id)];
 }
 
 template <typename T>
 void StreamingService<T>::OnMessage(PriceStream<T>& data) {
-    string product_id = data.GetProduct().GetProductId();
+    ProductIndex index = ProductRegistry<T>::Instance().Resolve(data.GetProduct());
     
-    price_streams_.insert_or_assign(product_id, data);
+    price_streams_.InsertOrAssign(index, data);
     
 //    // Also notify listeners
 //    for (auto& listener : Service<string, Price<T>>::listeners_) {
@@ -122,6 +127,14 @@ void StreamingService<T>::PublishPrice(PriceStream<T> &price_stream) {
     for (auto& listener : this->GetListeners()) {
         listener->ProcessAdd(price_stream);
     }
+    if (out_connector_ != nullptr) {
+        out_connector_->Publish(price_stream);
+    }
+}
+
+template <typename T>
+void StreamingService<T>::SetConnector(Connector<PriceStream<T>>* connector) {
+    out_connector_ = connector;
 }
 
 template<typename T>
@@ -129,9 +142,9 @@ AlgoStreamingToStreamingListener<T>::AlgoStreamingToStreamingListener(StreamingS
 
 template<typename T>
 void AlgoStreamingToStreamingListener<T>::ProcessAdd(AlgoStream<T>& data) {
-    PriceStream<T>* price_stream = data.GetPriceStream();
-    service_->OnMessage(*price_stream);
-    service_->PublishPrice(*price_stream);
+    PriceStream<T>& price_stream = data.GetPriceStream();
+    service_->OnMessage(price_stream);
+    service_->PublishPrice(price_stream);
 }
 
 template<typename T>
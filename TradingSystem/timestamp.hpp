@@ -0,0 +1,87 @@
+/**
+ * timestamp.hpp
+ * Cheap wall-clock timestamps for persisted records, and monotonic stamps for the hot path
+ *
+ * @author Mingsen Wang
+ */
+
+/*
+ Design:
+ (1) A wall-clock timestamp is "YYYY-MM-DD HH:MM:SS.mmm". The "YYYY-MM-DD HH:MM:SS" prefix only changes once per second, so each thread caches it and re-runs localtime_r/strftime only when the second changes. Otherwise a timestamp is one clock read, a copy of the prefix and three digits.
+ (2) WriteTimestamp formats into a caller buffer of kTimestampSize bytes, with no allocation. GetTimestamp wraps it for callers that want a string.
+ (3) The hot path should not format wall-clock time at all: it takes GetMonotonicNanoseconds (steady clock), and formatting is left to the persistence edge (historical data, GUI).
+ */
+
+#ifndef timestamp_hpp
+#define timestamp_hpp
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+using namespace std;
+
+// Length of "YYYY-MM-DD HH:MM:SS.mmm" (no terminating NUL is written)
+constexpr size_t kTimestampSize = 23;
+
+// Write the wall-clock time of a time point into buffer; returns the number of characters written
+size_t WriteTimestamp(char* buffer, chrono::system_clock::time_point time_point);
+
+// Write the current wall-clock time into buffer; returns the number of characters written
+size_t WriteTimestamp(char* buffer);
+
+// Current steady clock time in nanoseconds, for stamping on the hot path
+uint64_t GetMonotonicNanoseconds();
+
+// Current steady clock time in milliseconds
+long GetMonotonicMilliseconds();
+
+size_t WriteTimestamp(char* buffer, chrono::system_clock::time_point time_point)
+{
+    constexpr size_t kPrefixSize = kTimestampSize - 4;
+
+    // Formatted "YYYY-MM-DD HH:MM:SS" of the last second seen by this thread
+    struct PrefixCache
+    {
+        time_t second = -1;
+        char prefix[kPrefixSize + 1];
+    };
+    static thread_local PrefixCache cache;
+
+    auto second_point = chrono::floor<chrono::seconds>(time_point);
+    time_t second = chrono::system_clock::to_time_t(second_point);
+    if (second != cache.second) {
+        tm local_time;
+        localtime_r(&second, &local_time);   // localtime shares a static buffer across threads
+        strftime(cache.prefix, sizeof(cache.prefix), "%F %T", &local_time);
+        cache.second = second;
+    }
+
+    long millisecond = long(chrono::duration_cast<chrono::milliseconds>(time_point - second_point).count());
+    memcpy(buffer, cache.prefix, kPrefixSize);
+    buffer[kPrefixSize] = '.';
+    buffer[kPrefixSize + 1] = char('0' + millisecond / 100);
+    buffer[kPrefixSize + 2] = char('0' + millisecond / 10 % 10);
+    buffer[kPrefixSize + 3] = char('0' + millisecond % 10);
+    return kTimestampSize;
+}
+
+size_t WriteTimestamp(char* buffer)
+{
+    return WriteTimestamp(buffer, chrono::system_clock::now());
+}
+
+uint64_t GetMonotonicNanoseconds()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long GetMonotonicMilliseconds()
+{
+    return long(chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+#endif /* timestamp_hpp */
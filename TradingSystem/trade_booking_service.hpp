@@ -11,7 +11,13 @@
 #include <vector>
 #include <unordered_map>
 #include "soa.hpp"
+#include "product_registry.hpp"
+#include "book_registry.hpp"
+#include "static_listeners.hpp"
+#include "latency.hpp"
 #include "execution_service.hpp"
+#include "line_reader.hpp"
+#include "strand.hpp"
 
 // Trade sides
 enum Side { BUY, SELL };
@@ -21,14 +27,14 @@ enum Side { BUY, SELL };
  * Type T is the product type.
  */
 template<typename T>
-class Trade
+class Trade : public LatencyTagged
 {
 
 public:
 
     Trade() = default;
     // ctor for a trade
-    Trade(const T &_product, string _tradeId, double _price, string _book, long _quantity, Side _side);
+    Trade(const T &_product, string _tradeId, PriceTick _price, string _book, long _quantity, Side _side);
 
     // Get the product
     const T& GetProduct() const;
@@ -37,10 +43,13 @@ public:
     const string& GetTradeId() const;
 
     // Get the mid price
-    double GetPrice() const;
+    PriceTick GetPrice() const;
 
     // Get the book
     const string& GetBook() const;
+    
+    // Get the index of the book in BookRegistry
+    BookIndex GetBookIndex() const;
 
     // Get the quantity
     long GetQuantity() const;
@@ -49,32 +58,47 @@ public:
     Side GetSide() const;
 
 private:
-    T product;
+    ProductRef<T> product;     // Registered instance, shared by every copy of the event
     string tradeId;
-    double price;
+    PriceTick price;
     string book;
+    BookIndex bookIndex = kInvalidBookIndex;
     long quantity;
     Side side;
 
 };
 
-template <typename T>
+template <typename T, typename Static = StaticListeners<Trade<T>>>
+class TradeBookingService;
+template <typename T, typename S = TradeBookingService<T>>
 class TradeBookingConnector;
-template <typename T>
+template <typename T, typename S = TradeBookingService<T>>
 class ExecutionToTradeBookingListener;
 
 /**
  * Trade Booking Service to book trades to a particular book.
  * Keyed on trade id.
+ * Fed by both the trade file and ExecutionService; with a strand set, both are serialized onto it.
  * Type T is the product type.
  */
-template<typename T>
-class TradeBookingService : public Service<string,Trade <T> >
+template <typename T, typename Static>
+class TradeBookingService final : public Service<string,Trade <T> >
 {
+public:
+    // Concrete types of the objects attached to this service, for static wiring
+    typedef TradeBookingConnector<T, TradeBookingService> ConnectorType;
+    typedef ExecutionToTradeBookingListener<T, TradeBookingService> InListener;
+    
 private:
     unordered_map<string, Trade<T>> trades_;
-    TradeBookingConnector<T>* out_connector_;
-    ExecutionToTradeBookingListener<T>* in_listener_;
+    ConnectorType* out_connector_;
+    InListener* in_listener_;
+    Static static_listeners_;
+    Strand* strand_;
+    
+    // Entry points, run on the strand if there is one
+    void ProcessMessage(Trade<T>& data);
+    void ProcessBooking(Trade<T>& trade);
     
 public:
     // Constructor and destructor
@@ -96,45 +120,54 @@ public:
     virtual const vector<ServiceListener<Trade<T>>*>& GetListeners() const override;
     // MARK: SERVICE CLASS OVERRIDE ABOVE
     
-    ExecutionToTradeBookingListener<T>* GetInListener();
+    InListener* GetInListener();
+    
+    // Get the listeners wired at compile time (notified ahead of the dynamic listeners)
+    Static& GetStaticListeners();
     
-    TradeBookingConnector<T>* GetConnector();
+    ConnectorType* GetConnector();
     
     // Book the trade
     void BookTrade(Trade<T> &trade);
+    
+    // Serialize OnMessage and BookTrade through a strand, so that several feed threads can drive the service (nullptr to call through directly)
+    void SetStrand(Strand* strand);
 };
 
-template<typename T>
-class TradeBookingConnector : public Connector<Trade<T>>
+template <typename T, typename S>
+class TradeBookingConnector final : public Connector<Trade<T>>
 {
 
 private:
 
-    TradeBookingService<T>* service;
+    S* service;
 
 public:
 
     // Connector and Destructor
-    TradeBookingConnector(TradeBookingService<T>* _service);
+    TradeBookingConnector(S* _service);
     ~TradeBookingConnector() = default;
 
     // Publish data to the Connector
     virtual void Publish(Trade<T>& data) override;
 
     // Subscribe data from the Connector
-    virtual void Subscribe(ifstream& data) override;
+    virtual void Subscribe(istream& data) override;
+
+    // Subscribe the lines of a reader, e.g. over a network receive buffer (see network_connectors.hpp)
+    void Subscribe(LineReader& reader);
 
 };
 
-template <typename T>
-class ExecutionToTradeBookingListener : public ServiceListener<ExecutionOrder<T>> {
+template <typename T, typename S>
+class ExecutionToTradeBookingListener final : public ServiceListener<ExecutionOrder<T>> {
 private:
-    TradeBookingService<T>* service_;
+    S* service_;
     long count_;
     
 public:
     // Connector and Destructor
-    ExecutionToTradeBookingListener(TradeBookingService<T>* _service);
+    ExecutionToTradeBookingListener(S* _service);
     ~ExecutionToTradeBookingListener() = default;
 
     // MARK: SERVICELISTENER CLASS OVERRIDE BELOW
@@ -147,15 +180,20 @@ public:
     // Listener callback to process an update event to the Service
     virtual void ProcessUpdate(ExecutionOrder<T> &data) override;
     // MARK: SERVICELISTENER CLASS OVERRIDE ABOVE
+    
+    // Number of executions booked so far, which picks the book of the next one (e.g. to snapshot and restore it)
+    long GetBookingCount() const;
+    void SetBookingCount(long count);
 };
 
 template<typename T>
-Trade<T>::Trade(const T &_product, string _tradeId, double _price, string _book, long _quantity, Side _side) :
+Trade<T>::Trade(const T &_product, string _tradeId, PriceTick _price, string _book, long _quantity, Side _side) :
   product(_product)
 {
     tradeId = _tradeId;
     price = _price;
     book = _book;
+    bookIndex = BookRegistry::Instance().Intern(book);
     quantity = _quantity;
     side = _side;
 }
@@ -163,7 +201,7 @@ Trade<T>::Trade(const T &_product, string _tradeId, double _price, string _book,
 template<typename T>
 const T& Trade<T>::GetProduct() const
 {
-    return product;
+    return *product;
 }
 
 template<typename T>
@@ -173,7 +211,7 @@ const string& Trade<T>::GetTradeId() const
 }
 
 template<typename T>
-double Trade<T>::GetPrice() const
+PriceTick Trade<T>::GetPrice() const
 {
     return price;
 }
@@ -184,6 +222,12 @@ const string& Trade<T>::GetBook() const
     return book;
 }
 
+template<typename T>
+BookIndex Trade<T>::GetBookIndex() const
+{
+    return bookIndex;
+}
+
 template<typename T>
 long Trade<T>::GetQuantity() const
 {
@@ -196,114 +240,156 @@ Side Trade<T>::GetSide() const
     return side;
 }
 
-template <typename T>
-TradeBookingService<T>::TradeBookingService() {
-    out_connector_ = new TradeBookingConnector<T>(this);
-    in_listener_ = new ExecutionToTradeBookingListener<T>(this);
+template <typename T, typename Static>
+TradeBookingService<T, Static>::TradeBookingService() : strand_(nullptr) {
+    out_connector_ = new ConnectorType(this);
+    in_listener_ = new InListener(this);
 }
 
-template <typename T>
-TradeBookingService<T>::~TradeBookingService() {
+template <typename T, typename Static>
+TradeBookingService<T, Static>::~TradeBookingService() {
     delete in_listener_;
     delete out_connector_;
 }
 
-template <typename T>
-Trade<T>& TradeBookingService<T>::GetData(string product_id) {
+template <typename T, typename Static>
+Trade<T>& TradeBookingService<T, Static>::GetData(string product_id) {
     return trades_.at(product_id);
 }
 
-template <typename T>
-void TradeBookingService<T>::OnMessage(Trade<T>& data) {
-    string trade_id = data.GetTradeId();
+template <typename T, typename Static>
+void TradeBookingService<T, Static>::OnMessage(Trade<T>& data) {
+    if (strand_ != nullptr && !strand_->RunningInThisThread()) {
+        // Hand a copy over to the strand; the caller's trade does not outlive this call
+        strand_->Post([this, trade = data]() mutable { ProcessMessage(trade); });
+    } else {
+        ProcessMessage(data);
+    }
+}
+
+template <typename T, typename Static>
+void TradeBookingService<T, Static>::ProcessMessage(Trade<T>& data) {
+    const string& trade_id = data.GetTradeId();
     
     trades_.insert_or_assign(trade_id, data);
 //    trades_[trade_id] = data;
     
     // Also notify listeners
+    static_listeners_.ProcessAdd(data);
     for (auto& listener : Service<string, Trade<T>>::listeners_) {
         listener->ProcessAdd(data);
     }
 }
 
-template <typename T>
-void TradeBookingService<T>::AddListener(ServiceListener<Trade<T>>* listener) {
+template <typename T, typename Static>
+void TradeBookingService<T, Static>::AddListener(ServiceListener<Trade<T>>* listener) {
     this->Service<string, Trade<T>>::AddListener(listener);
 }
 
-template <typename T>
-const vector<ServiceListener<Trade<T>>*>& TradeBookingService<T>::GetListeners() const {
+template <typename T, typename Static>
+const vector<ServiceListener<Trade<T>>*>& TradeBookingService<T, Static>::GetListeners() const {
     return this->Service<string, Trade<T>>::GetListeners();
 }
 
-template <typename T>
-ExecutionToTradeBookingListener<T>* TradeBookingService<T>::GetInListener() {
+template <typename T, typename Static>
+typename TradeBookingService<T, Static>::InListener* TradeBookingService<T, Static>::GetInListener() {
     return in_listener_;
 }
 
-template <typename T>
-TradeBookingConnector<T>* TradeBookingService<T>::GetConnector() {
+template <typename T, typename Static>
+Static& TradeBookingService<T, Static>::GetStaticListeners() {
+    return static_listeners_;
+}
+
+template <typename T, typename Static>
+typename TradeBookingService<T, Static>::ConnectorType* TradeBookingService<T, Static>::GetConnector() {
     return out_connector_;
 }
 
-template <typename T>
-void TradeBookingService<T>::BookTrade(Trade<T> &trade) {
+template <typename T, typename Static>
+void TradeBookingService<T, Static>::SetStrand(Strand* strand) {
+    strand_ = strand;
+}
+
+template <typename T, typename Static>
+void TradeBookingService<T, Static>::BookTrade(Trade<T> &trade) {
+    if (strand_ != nullptr && !strand_->RunningInThisThread()) {
+        strand_->Post([this, trade = trade]() mutable { ProcessBooking(trade); });
+    } else {
+        ProcessBooking(trade);
+    }
+}
+
+template <typename T, typename Static>
+void TradeBookingService<T, Static>::ProcessBooking(Trade<T> &trade) {
+    LATENCY_RECORD(BOOK_TRADE, trade);
+    static_listeners_.ProcessAdd(trade);
     for (auto& listener : Service<string, Trade<T>>::listeners_) {
         listener->ProcessAdd(trade);
     }
 }
 
-template <typename T>
-TradeBookingConnector<T>::TradeBookingConnector(TradeBookingService<T>* _service) {
+template <typename T, typename S>
+TradeBookingConnector<T, S>::TradeBookingConnector(S* _service) {
     service = _service;
 }
 
-template <typename T>
-void TradeBookingConnector<T>::Publish(Trade<T>& data) {
+template <typename T, typename S>
+void TradeBookingConnector<T, S>::Publish(Trade<T>& data) {
     // Does nothing. The connector is subscribe only.
 }
 
-template <typename T>
-void TradeBookingConnector<T>::Subscribe(ifstream& data) {
-    string line;
-    while (getline(data, line)) {
-        // Separate line with delimiter ','
-        stringstream line_stream(line);
-        string line_entry;
-        vector<string> line_entries;
-        while (getline(line_stream, line_entry, ',')) {
-            line_entries.push_back(line_entry);
-        }
-        
+template <typename T, typename S>
+void TradeBookingConnector<T, S>::Subscribe(istream& data) {
+    LineReader reader(data);
+    Subscribe(reader);
+}
+
+template <typename T, typename S>
+void TradeBookingConnector<T, S>::Subscribe(LineReader& reader) {
+    LineFields line_entries;
+    while (reader.ReadFields(line_entries)) {
+        line_entries.RequireFields(6, "TradeBookingConnector");
         // Parse data into Trade
-        string product_id = line_entries[0];
-        string trade_id = line_entries[1];
-        double price = ConvertPrice(line_entries[2]);
-        string book = line_entries[3];
-        long quantity = stol(line_entries[4]);
+        string_view product_id = line_entries[0];
+        string trade_id(line_entries[1]);
+        PriceTick price = ConvertPrice(line_entries[2]);
+        string book(line_entries[3]);
+        long quantity = ParseNumber<long>(line_entries[4]);
         Side side = (line_entries[5] == "BUY") ? BUY : SELL;
         
-        T product = FetchBond(product_id);
+        const T& product = FetchBond(product_id);
         Trade<T> trade(product, trade_id, price, book, quantity, side);
+        LATENCY_STAMP(trade);
         
         // Notify connected service
         service->OnMessage(trade);
     }
 }
 
-template <typename T>
-ExecutionToTradeBookingListener<T>::ExecutionToTradeBookingListener(TradeBookingService<T>* service) : service_(service), count_(0) {}
+template <typename T, typename S>
+ExecutionToTradeBookingListener<T, S>::ExecutionToTradeBookingListener(S* service) : service_(service), count_(0) {}
+
+template <typename T, typename S>
+long ExecutionToTradeBookingListener<T, S>::GetBookingCount() const {
+    return count_;
+}
+
+template <typename T, typename S>
+void ExecutionToTradeBookingListener<T, S>::SetBookingCount(long count) {
+    count_ = count;
+}
 
-template <typename T>
-void ExecutionToTradeBookingListener<T>::ProcessAdd(ExecutionOrder<T>& data) {
+template <typename T, typename S>
+void ExecutionToTradeBookingListener<T, S>::ProcessAdd(ExecutionOrder<T>& data) {
     
     count_++;
     
     // Get data from execution order
-    T product = data.GetProduct();
+    const T& product = data.GetProduct();
     PricingSide pricing_side = data.GetPricingSide();
-    string order_id = data.GetOrderId();
-    double price = data.GetPrice();
+    const string& order_id = data.GetOrderId();
+    PriceTick price = data.GetPrice();
     long visible_quantity = data.GetVisibleQuantity();
     long hidden_quantity = data.GetHiddenQuantity();
 
@@ -327,16 +413,17 @@ void ExecutionToTradeBookingListener<T>::ProcessAdd(ExecutionOrder<T>& data) {
     long quantity = visible_quantity + hidden_quantity;
 
     Trade<T> trade(product, order_id, price, book, quantity, side);
+    LATENCY_CARRY(trade, data);
     
     // Request connected service to book the trade
     service_->OnMessage(trade);
     service_->BookTrade(trade);
 }
 
-template <typename T>
-void ExecutionToTradeBookingListener<T>::ProcessRemove(ExecutionOrder<T>& data) {}
+template <typename T, typename S>
+void ExecutionToTradeBookingListener<T, S>::ProcessRemove(ExecutionOrder<T>& data) {}
 
-template <typename T>
-void ExecutionToTradeBookingListener<T>::ProcessUpdate(ExecutionOrder<T>& data) {}
+template <typename T, typename S>
+void ExecutionToTradeBookingListener<T, S>::ProcessUpdate(ExecutionOrder<T>& data) {}
 
 #endif
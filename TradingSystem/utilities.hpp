@@ -11,8 +11,14 @@
 #include <iostream>
 
 #include <string>
+#include <string_view>
 
 #include "products.hpp"
+#include "product_registry.hpp"
+#include "book_registry.hpp"
+#include "line_reader.hpp"
+#include "price_tick.hpp"
+#include "timestamp.hpp"
 #include <utility>
 #include <map>
 #include "boost/date_time/gregorian/gregorian.hpp"
@@ -25,51 +31,17 @@
 using namespace std;
 using namespace boost::gregorian;
 
-// Convert numeric price to bond notation
-float ConvertPrice(const string& str_price) {
-    // "100-xyz" -> 100 + xy / 32 + z / 256
-    auto delimiter_pos = str_price.find('-');
-    
-    // Integer
-    float res = stoi(str_price.substr(0, delimiter_pos));
-    
-    // xy
-    res += stoi(str_price.substr(delimiter_pos + 1, 2)) / 32.;
-    
-    // z
-    char last_char = str_price[delimiter_pos + 3];
-    if (last_char == '+') {
-        res += 1. / 64.;
-    } else {
-        res += (last_char - '0') / 256.;  // int('0') == 48
-    }
-    return res;
+// Convert bond notation to ticks
+// Parsed in place, so fields from LineReader can be passed without copying
+PriceTick ConvertPrice(string_view str_price) {
+    // "100-xyz" -> 100 * 256 + xy * 8 + z
+    return ParsePrice(str_price);
 }
 
-string ConvertPrice(float f_price) {
-    int integer = int(f_price);
-    string res = to_string(integer) + '-';
-    
-    f_price -= integer;
-    f_price *= 32.;
-    integer = int(f_price);
-    if (integer < 10) {
-        // Pad with 0 if only one digit
-        res += '0';
-    }
-    
-    res += to_string(integer);
-    
-    f_price -= integer;
-    f_price *= 8.;
-    integer = int(f_price);
-    if (integer == 4.) {
-        res += '+';
-    } else {
-        res += to_string(integer);
-    }
-    
-    return res;
+// Convert ticks to bond notation
+string ConvertPrice(PriceTick price) {
+    char buffer[kMaxPriceTextSize];
+    return string(buffer, FormatPrice(buffer, price));
 }
 
 
@@ -84,7 +56,8 @@ map<int, pair<string, date>> kBondMapMaturity({
     {30, {"912810TL2", {2052, Nov, 15}}}
 });
 
-map<string, pair<int, date>> kBondMapCusip({
+// Transparent comparator so that cusips can be looked up from string_view fields
+map<string, pair<int, date>, less<>> kBondMapCusip({
     {"91282CFX4", {2, {2024, Nov, 30}}},
     {"91282CFW6", {3, {2025, Nov, 15}}},
     {"91282CFZ9", {5, {2027, Nov, 30}}},
@@ -111,48 +84,47 @@ string FetchCusip(int maturity) {
     return kBondMapMaturity[maturity].first;
 }
 
-Bond FetchBond(int maturity) {
-    return Bond(kBondMapMaturity[maturity].first, CUSIP, "US" + to_string(maturity) + "Y", 0., kBondMapMaturity[maturity].second);
+// Intern every bond, in maturity order
+const ProductRegistry<Bond>& RegisterBonds() {
+    ProductRegistry<Bond>& registry = ProductRegistry<Bond>::Instance();
+    for (const auto& [maturity, cusip_date] : kBondMapMaturity) {
+        registry.Register(Bond(cusip_date.first, CUSIP, "US" + to_string(maturity) + "Y", 0., cusip_date.second));
+    }
+    return registry;
+}
+
+// Registered at startup, before any service stores are sized
+const ProductRegistry<Bond>& kBondRegistry = RegisterBonds();
+
+// Intern the trading books, in the order positions list them
+const BookRegistry& RegisterBooks() {
+    BookRegistry& registry = BookRegistry::Instance();
+    for (string_view book : { "TRSY1", "TRSY2", "TRSY3" }) {
+        registry.Intern(book);
+    }
+    return registry;
+}
+
+const BookRegistry& kBookRegistry = RegisterBooks();
+
+const Bond& FetchBond(int maturity) {
+    return kBondRegistry.Get(string_view(kBondMapMaturity.at(maturity).first));
 }
 
-Bond FetchBond(const string& cusip) {
-    return Bond(cusip, CUSIP, "US" + to_string(kBondMapCusip[cusip].first) + "Y", 0., kBondMapCusip[cusip].second);
+// Throws out_of_range for an unknown cusip
+const Bond& FetchBond(string_view cusip) {
+    return kBondRegistry.Get(cusip);
 }
 
+// Current wall-clock time as "YYYY-MM-DD HH:MM:SS.mmm"
+// Records written in bulk should use WriteTimestamp with their own buffer instead
 string GetTimestamp() {
-    // Get current time
-    auto current_time = chrono::system_clock::now();
-    
-    // Get millisecond as string
-    auto sec = chrono::time_point_cast<chrono::seconds>(current_time);
-    auto millisec = chrono::duration_cast<chrono::milliseconds>(current_time - sec);
-    auto millisec_count = millisec.count();
-    string millisec_string = to_string(millisec_count);
-    
-    // Forcing three digits of millisecond
-    if (millisec_count < 10) {
-        millisec_string = "00" + millisec_string;
-    } else if (millisec_count < 100) {
-        millisec_string = "0" + millisec_string;
-    }
-    
-    time_t curr_time_t = chrono::system_clock::to_time_t(current_time);
-    string second_string(24, 0);
-    strftime(second_string.data(), 24, "%F %T", localtime(&curr_time_t));
-    
-    return second_string + '.' + millisec_string;
+    char buffer[kTimestampSize];
+    return string(buffer, WriteTimestamp(buffer));
 }
 
 double GetPV01Value(const string& cusip) {
     return kPV01Map[cusip];
 }
 
-long GetMillisecond() {
-    auto time_point = chrono::system_clock::now();
-    auto sec = chrono::time_point_cast<chrono::seconds>(time_point);
-    auto millisec = chrono::duration_cast<chrono::milliseconds>(time_point - sec);
-    long millisec_count = millisec.count();
-    return millisec_count;
-}
-
 #endif /* utilities_hpp */